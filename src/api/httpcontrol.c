@@ -567,8 +567,6 @@ static const struct {
 static int
 hc_serve_file(http_connection_t *hc, const char *file, const char *contenttype)
 {
-  htsbuf_queue_t out;
-
   if(contenttype == NULL) {
     const char *pfx = strrchr(file, '.');
     if(pfx != NULL) {
@@ -583,14 +581,7 @@ hc_serve_file(http_connection_t *hc, const char *file, const char *contenttype)
     }
   }
 
-  buf_t *b = fa_load(file, NULL);
-  if(b == NULL)
-    return 404;
-
-  htsbuf_queue_init(&out, 0);
-  htsbuf_append(&out, b->b_ptr, b->b_size);
-  buf_release(b);
-  return http_send_reply(hc, 0, contenttype, NULL, NULL, 0, &out);
+  return http_send_file(hc, file, contenttype);
 }
 
 
@@ -21,6 +21,7 @@
 
 #include "fileaccess/http_client.h"
 #include "htsmsg/htsmsg_xml.h"
+#include "misc/xmlsax.h"
 
 #include "soap.h"
 
@@ -65,6 +66,29 @@ soap_encode_args(htsbuf_queue_t *xml, htsmsg_t *args)
 }
 
 
+/**
+ *
+ */
+static void
+soap_prepare(htsbuf_queue_t *post, char *action, size_t actionlen,
+             const char *service, int version, const char *method,
+             htsmsg_t *in)
+{
+  htsbuf_queue_init(post, 0);
+
+  htsbuf_qprintf(post,
+		 "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+		 "<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+		 "<s:Body><ns0:%s xmlns:ns0=\"urn:schemas-upnp-org:service:%s:%d\">", method, service, version);
+
+  soap_encode_args(post, in);
+  htsbuf_qprintf(post, "</ns0:%s></s:Body></s:Envelope>", method);
+
+  snprintf(action, actionlen, "\"urn:schemas-upnp-org:service:%s:%d#%s\"",
+	   service, version, method);
+}
+
+
 /**
  *
  */
@@ -78,18 +102,7 @@ soap_exec(const char *uri, const char *service, int version, const char *method,
   buf_t *result;
   char tmp[100];
 
-  htsbuf_queue_init(&post, 0);
-
-  htsbuf_qprintf(&post,
-		 "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-		 "<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
-		 "<s:Body><ns0:%s xmlns:ns0=\"urn:schemas-upnp-org:service:%s:%d\">", method, service, version);
-
-  soap_encode_args(&post, in);
-  htsbuf_qprintf(&post, "</ns0:%s></s:Body></s:Envelope>", method);
-
-  snprintf(tmp, sizeof(tmp),"\"urn:schemas-upnp-org:service:%s:%d#%s\"",
-	   service, version, method);
+  soap_prepare(&post, tmp, sizeof(tmp), service, version, method, in);
 
   r = http_req(uri,
                HTTP_RESULT_PTR(&result),
@@ -125,3 +138,136 @@ soap_exec(const char *uri, const char *service, int version, const char *method,
   htsmsg_release(out);
   return 0;
 }
+
+
+/**
+ *
+ */
+typedef struct soap_stream {
+  xml_sax_t *ss_sax;
+  soap_arg_cb_t *ss_cb;
+  void *ss_opaque;
+
+  int ss_depth;
+  int ss_parse_error;
+  int ss_got_response;
+  int ss_in_response;
+  char ss_response[100];
+  char ss_arg[64];
+} soap_stream_t;
+
+
+/**
+ * Envelope -> Body -> methodResponse -> argument
+ */
+static void
+soap_stream_start(void *opaque, const char *name, const char **attrs)
+{
+  soap_stream_t *ss = opaque;
+
+  ss->ss_depth++;
+  if(ss->ss_depth == 3 && !strcmp(name, ss->ss_response))
+    ss->ss_in_response = ss->ss_got_response = 1;
+  else if(ss->ss_depth == 4 && ss->ss_in_response)
+    snprintf(ss->ss_arg, sizeof(ss->ss_arg), "%s", name);
+}
+
+
+/**
+ *
+ */
+static void
+soap_stream_end(void *opaque, const char *name)
+{
+  soap_stream_t *ss = opaque;
+
+  if(ss->ss_depth == 4 && ss->ss_arg[0]) {
+    ss->ss_cb(ss->ss_opaque, ss->ss_arg, NULL, 0);
+    ss->ss_arg[0] = 0;
+  } else if(ss->ss_depth == 3) {
+    ss->ss_in_response = 0;
+  }
+  ss->ss_depth--;
+}
+
+
+/**
+ *
+ */
+static void
+soap_stream_cdata(void *opaque, const char *str, size_t len)
+{
+  soap_stream_t *ss = opaque;
+
+  if(ss->ss_depth == 4 && ss->ss_arg[0])
+    ss->ss_cb(ss->ss_opaque, ss->ss_arg, str, len);
+}
+
+
+static const xml_sax_callbacks_t soap_stream_callbacks = {
+  .xsc_start = soap_stream_start,
+  .xsc_end   = soap_stream_end,
+  .xsc_cdata = soap_stream_cdata,
+};
+
+
+/**
+ *
+ */
+static int
+soap_stream_data(void *opaque, const void *data, size_t size)
+{
+  soap_stream_t *ss = opaque;
+
+  if(size == 0)
+    return 0;
+
+  if(xml_sax_feed(ss->ss_sax, data, size)) {
+    ss->ss_parse_error = 1;
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Like soap_exec() but the response is parsed as it's received and
+ * output arguments are passed to the callback instead of being
+ * collected in a htsmsg
+ */
+int
+soap_exec_stream(const char *uri, const char *service, int version,
+                 const char *method, htsmsg_t *in,
+                 soap_arg_cb_t *cb, void *opaque,
+                 char *errbuf, size_t errlen)
+{
+  int r;
+  htsbuf_queue_t post;
+  char tmp[100];
+  soap_stream_t ss = {0};
+
+  soap_prepare(&post, tmp, sizeof(tmp), service, version, method, in);
+
+  ss.ss_cb = cb;
+  ss.ss_opaque = opaque;
+  snprintf(ss.ss_response, sizeof(ss.ss_response), "%sResponse", method);
+  ss.ss_sax = xml_sax_create(&soap_stream_callbacks, &ss);
+
+  r = http_req(uri,
+               HTTP_DATA_CALLBACK(soap_stream_data, &ss),
+               HTTP_ERRBUF(errbuf, errlen),
+               HTTP_POSTDATA(&post, "text/xml; charset=\"utf-8\""),
+               HTTP_REQUEST_HEADER("SOAPACTION", tmp),
+               NULL);
+
+  if(r == 0 || ss.ss_parse_error)
+    r = xml_sax_finish(ss.ss_sax, errbuf, errlen);
+
+  if(r == 0 && !ss.ss_got_response) {
+    snprintf(errbuf, errlen, "Malformed SOAP response, no %s", ss.ss_response);
+    r = -1;
+  }
+
+  xml_sax_destroy(ss.ss_sax);
+  return r ? -1 : 0;
+}
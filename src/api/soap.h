@@ -31,4 +31,17 @@ int soap_exec(const char *uri, const char *service, int version,
 	      const char *method, htsmsg_t *in, htsmsg_t **out,
 	      char *errbuf, size_t errlen);
 
+/**
+ * Invoked with decoded output argument data as it arrives. Large
+ * arguments may be split over multiple calls. A final call with
+ * data == NULL marks the end of the argument
+ */
+typedef void (soap_arg_cb_t)(void *opaque, const char *name,
+                             const char *data, size_t len);
+
+int soap_exec_stream(const char *uri, const char *service, int version,
+                     const char *method, htsmsg_t *in,
+                     soap_arg_cb_t *cb, void *opaque,
+                     char *errbuf, size_t errlen);
+
 #endif // SOAP_H__
@@ -254,8 +254,8 @@ tmdb_configure(void)
       goto done;
     }
 
-    htsmsg_t *doc = htsmsg_json_deserialize2(buf_cstr(result),
-                                             errbuf, sizeof(errbuf));
+    htsmsg_t *doc = htsmsg_json_deserialize_ro(buf_cstr(result),
+                                               errbuf, sizeof(errbuf));
     buf_release(result);
 
     if(doc == NULL) {
@@ -312,8 +312,8 @@ tmdb_load_movie_cast(const char *lookup_id)
   }
   http_headers_free(&response_headers);
 
-  htsmsg_t *doc = htsmsg_json_deserialize2(buf_cstr(result),
-                                           errbuf, sizeof(errbuf));
+  htsmsg_t *doc = htsmsg_json_deserialize_ro(buf_cstr(result),
+                                             errbuf, sizeof(errbuf));
   if(doc == NULL) {
     TRACE(TRACE_ERROR, "TMDB", "Got bad JSON from %s -- %s", url, errbuf);
   }
@@ -427,8 +427,8 @@ tmdb_load_movie_info(void *db, const char *item_url, const char *lookup_id,
   }
   http_headers_free(&response_headers);
 
-  htsmsg_t *doc = htsmsg_json_deserialize2(buf_cstr(result),
-                                           errbuf, sizeof(errbuf));
+  htsmsg_t *doc = htsmsg_json_deserialize_ro(buf_cstr(result),
+                                             errbuf, sizeof(errbuf));
   buf_release(result);
   if(doc == NULL) {
     TRACE(TRACE_ERROR, "TMDB", "Got bad JSON from %s -- %s", url, errbuf);
@@ -572,8 +572,8 @@ tmdb_query_by_title_and_year0(void *db, const char *item_url,
   }
   http_headers_free(&response_headers);
 
-  htsmsg_t *doc = htsmsg_json_deserialize2(buf_cstr(result),
-                                           errbuf, sizeof(errbuf));
+  htsmsg_t *doc = htsmsg_json_deserialize_ro(buf_cstr(result),
+                                             errbuf, sizeof(errbuf));
   buf_release(result);
   if(doc == NULL) {
     TRACE(TRACE_ERROR, "TMDB", "Got bad JSON from %s -- %s", url, errbuf);
@@ -34,6 +34,12 @@ atomic_inc(atomic_t *a)
   __sync_add_and_fetch(&a->v, 1);
 }
 
+static inline void
+atomic_add(atomic_t *a, int v)
+{
+  __sync_add_and_fetch(&a->v, v);
+}
+
 static inline int __attribute__((warn_unused_result))
 atomic_add_and_fetch(atomic_t *a, int v)
 {
@@ -52,12 +58,40 @@ atomic_get(const atomic_t *a)
   return (*(volatile int *)&(a)->v);
 }
 
+static inline int
+atomic_inc_not_zero(atomic_t *a)
+{
+  int v;
+  do {
+    v = atomic_get(a);
+    if(v == 0)
+      return 0;
+  } while(!__sync_bool_compare_and_swap(&a->v, v, v + 1));
+  return 1;
+}
+
 static inline void
 atomic_set(atomic_t *a, int v)
 {
   a->v = v;
 }
 
+static inline int
+atomic_ptr_cas(void **p, void *ov, void *nv)
+{
+  return __sync_bool_compare_and_swap(p, ov, nv);
+}
+
+static inline void *
+atomic_ptr_xchg(void **p, void *nv)
+{
+  void *ov;
+  do {
+    ov = *(void * volatile *)p;
+  } while(!__sync_bool_compare_and_swap(p, ov, nv));
+  return ov;
+}
+
 #elif defined(_MSC_VER)
 
 #include <Windows.h>
@@ -73,6 +107,12 @@ atomic_inc(atomic_t *a)
   InterlockedIncrement(&a->v);
 }
 
+static __inline void
+atomic_add(atomic_t *a, int v)
+{
+  InterlockedAdd(&a->v, v);
+}
+
 static __inline int
 atomic_add_and_fetch(atomic_t *a, int v)
 {
@@ -91,12 +131,36 @@ atomic_get(const atomic_t *a)
   return (*(volatile int *)&(a)->v);
 }
 
+static __inline int
+atomic_inc_not_zero(atomic_t *a)
+{
+  long v;
+  do {
+    v = a->v;
+    if(v == 0)
+      return 0;
+  } while(InterlockedCompareExchange(&a->v, v + 1, v) != v);
+  return 1;
+}
+
 static __inline void
 atomic_set(atomic_t *a, int v)
 {
   a->v = v;
 }
 
+static __inline int
+atomic_ptr_cas(void **p, void *ov, void *nv)
+{
+  return InterlockedCompareExchangePointer(p, nv, ov) == ov;
+}
+
+static __inline void *
+atomic_ptr_xchg(void **p, void *nv)
+{
+  return InterlockedExchangePointer(p, nv);
+}
+
 #else
 #error Missing atomic ops
 #endif
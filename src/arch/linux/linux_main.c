@@ -17,6 +17,8 @@
  *  This program is also available under a commercial proprietary license.
  *  For more information, contact andreas@lonelycoder.com
  */
+#include <stdio.h>
+
 #include <X11/Xlib.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtk.h>
@@ -57,6 +59,7 @@ gdk_release(void)
 static int running;
 extern const linux_ui_t ui_glw, ui_gu;
 static const linux_ui_t *ui_wanted = &ui_glw, *ui_current;
+static int gtk_available;
 
 
 /**
@@ -77,10 +80,15 @@ arch_stop_req(void)
 static void
 switch_ui(void)
 {
-  if(ui_current == &ui_glw)
+  if(ui_current == &ui_glw) {
+    if(!gtk_available) {
+      TRACE(TRACE_ERROR, "UI", "GTK UI not available, no display");
+      return;
+    }
     ui_wanted = &ui_gu;
-  else
+  } else {
     ui_wanted = &ui_glw;
+  }
 }
 
 
@@ -154,10 +162,21 @@ main(int argc, char **argv)
 
   gdk_threads_init();
   gdk_threads_enter();
+#if ENABLE_GLW_FRONTEND_HEADLESS
+  // Headless GLW does not need a display, only the GTK UI does
+  gtk_available = gtk_init_check(&argc, &argv);
+#else
   gtk_init(&argc, &argv);
+  gtk_available = 1;
+#endif
 
   parse_opts(argc, argv);
 
+  if(gconf.ui && !strcmp(gconf.ui, "gu") && !gtk_available) {
+    fprintf(stderr, "Unable to start GTK UI, cannot open display\n");
+    exit(1);
+  }
+
   linux_init();
 
   main_init();
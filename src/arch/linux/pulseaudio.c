@@ -22,10 +22,6 @@
 #include <assert.h>
 #include <math.h>
 
-#if defined(__x86_64)
-#include <xmmintrin.h>
-#endif
-
 #include "main.h"
 #include "audio2/audio.h"
 #include "media/media.h"
@@ -454,23 +450,10 @@ pulseaudio_audio_deliver(audio_decoder_t *ad, int samples,
     uint8_t *data[8] = {0};
     data[0] = (uint8_t *)buf;
     assert(rsamples <= samples);
-    avresample_read(ad->ad_avr, data, rsamples);
+    audio_read(ad, data, rsamples);
 
-    float *x = (float *)buf;
-    int i = 0;
     float s = audio_master_mute ? 0 : audio_master_volume * ad->ad_vol_scale;
-    int floats = samples * d->ss.channels;
-
-#if defined(__x86_64)
-    const __m128 scalar = _mm_set1_ps(s);
-    __m128 *v = (__m128 *)buf;
-    int vecs = floats / 4;
-    for(; i < vecs; i++)
-      v[i] = _mm_mul_ps(v[i], scalar);
-    i *= 4;
-#endif
-    for(; i < floats; i++)
-      x[i] *= s;
+    audio_gain_flt((float *)buf, samples * d->ss.channels, s);
   }
 
   if(pts != AV_NOPTS_VALUE) {
@@ -29,6 +29,7 @@
 #include "htsmsg/htsmsg_store.h"
 #include "settings.h"
 #include "misc/minmax.h"
+#include "misc/evtrace.h"
 
 #include <libavutil/avutil.h>
 #include <libavcodec/avcodec.h>
@@ -214,10 +215,17 @@ audio_decoder_destroy(struct audio_decoder *ad)
   mq_flush(ad->ad_mp, &ad->ad_mp->mp_audio, 1);
   av_frame_free(&ad->ad_frame);
 
+  if(ad->ad_convert_samples > 0 && ad->ad_in_sample_rate > 0)
+    TRACE(TRACE_DEBUG, "Audio",
+          "Conversion used %"PRId64"µs CPU per second of audio",
+          ad->ad_convert_time * ad->ad_in_sample_rate /
+          ad->ad_convert_samples);
+
   if(ad->ad_avr != NULL) {
     avresample_close(ad->ad_avr);
     avresample_free(&ad->ad_avr);
   }
+  audio_fastpath_release(ad);
 
   audio_cleanup_spdif_muxer(ad);
   free(ad);
@@ -368,6 +376,8 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
   if(mb->mb_skip || mb->mb_stream != mq->mq_stream)
     return 0;
 
+  EVTRACE_SCOPE("media", "audio decode");
+
   media_discontinuity_debug(&ad->ad_debug_discont,
                             mb->mb_dts,
                             mb->mb_pts,
@@ -512,7 +522,9 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
 
     int od = 0, id = 0;
 
-    if(ad->ad_avr != NULL) {
+    if(ad->ad_fastpath) {
+      od = audio_available(ad) * 1000000LL / ad->ad_out_sample_rate;
+    } else if(ad->ad_avr != NULL) {
       od = avresample_available(ad->ad_avr) *
         1000000LL / ad->ad_out_sample_rate;
       id = avresample_get_delay(ad->ad_avr) *
@@ -550,6 +562,33 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
 
     ac->ac_reconfig(ad);
 
+    char buf1[128];
+    char buf2[128];
+
+    av_get_channel_layout_string(buf1, sizeof(buf1),
+                                 -1, ad->ad_in_channel_layout);
+    av_get_channel_layout_string(buf2, sizeof(buf2),
+                                 -1, ad->ad_out_channel_layout);
+
+    const int fastpath = audio_fastpath_setup(ad);
+
+    TRACE(TRACE_DEBUG, "Audio",
+          "Converting from [%s %dHz %s] to [%s %dHz %s]%s",
+          buf1, ad->ad_in_sample_rate,
+          av_get_sample_fmt_name(ad->ad_in_sample_format),
+          buf2, ad->ad_out_sample_rate,
+          av_get_sample_fmt_name(ad->ad_out_sample_format),
+          fastpath ? " using fast path" : "");
+
+    if(fastpath) {
+      // No resampler needed
+      if(ad->ad_avr != NULL) {
+        avresample_close(ad->ad_avr);
+        avresample_free(&ad->ad_avr);
+      }
+      goto configured;
+    }
+
     if(ad->ad_avr == NULL)
       ad->ad_avr = avresample_alloc_context();
     else
@@ -569,26 +608,12 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
     av_opt_set_int(ad->ad_avr, "out_channel_layout",
                    ad->ad_out_channel_layout, 0);
 
-    char buf1[128];
-    char buf2[128];
-
-    av_get_channel_layout_string(buf1, sizeof(buf1),
-                                 -1, ad->ad_in_channel_layout);
-    av_get_channel_layout_string(buf2, sizeof(buf2),
-                                 -1, ad->ad_out_channel_layout);
-
-    TRACE(TRACE_DEBUG, "Audio",
-          "Converting from [%s %dHz %s] to [%s %dHz %s]",
-          buf1, ad->ad_in_sample_rate,
-          av_get_sample_fmt_name(ad->ad_in_sample_format),
-          buf2, ad->ad_out_sample_rate,
-          av_get_sample_fmt_name(ad->ad_out_sample_format));
-
     if(avresample_open(ad->ad_avr)) {
       TRACE(TRACE_ERROR, "Audio", "Unable to open resampler");
       avresample_free(&ad->ad_avr);
     }
 
+  configured:
     prop_set(mp->mp_prop_ctrl, "canAdjustVolume", PROP_SET_INT, 1);
 
     if(ac->ac_set_volume != NULL)
@@ -598,13 +623,22 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
   ad->ad_estimated_duration =
     1000000LL * frame->nb_samples / frame->sample_rate;
 
-  if(ad->ad_avr != NULL) {
+  const int64_t ts = arch_get_ts();
+
+  if(ad->ad_fastpath) {
+    audio_fastpath_convert(ad, frame);
+  } else if(ad->ad_avr != NULL) {
     avresample_convert(ad->ad_avr, NULL, 0, 0,
                        frame->data, frame->linesize[0],
                        frame->nb_samples);
   } else {
     usleep(ad->ad_estimated_duration);
   }
+
+  if(ad->ad_fastpath || ad->ad_avr != NULL) {
+    ad->ad_convert_time += arch_get_ts() - ts;
+    ad->ad_convert_samples += frame->nb_samples;
+  }
 #if CONFIG_GLW_REC
   glw_rec_audio_send(ad, frame, PTS_UNSET);
 #endif
@@ -638,10 +672,12 @@ audio_decode_thread(void *aux)
 
     int avail;
 
+    mq_ring_drain(mp, mq);
+
     if(ad->ad_spdif_muxer != NULL) {
       avail = ad->ad_spdif_frame_size;
     } else {
-      avail = ad->ad_avr != NULL ? avresample_available(ad->ad_avr) : 0;
+      avail = audio_available(ad);
     }
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
@@ -765,10 +801,8 @@ audio_decode_thread(void *aux)
 	  mp->mp_seek_audio_done(mp);
 	ad->ad_discontinuity = 1;
 
-	if(ad->ad_avr != NULL) {
-	  avresample_read(ad->ad_avr, NULL, avresample_available(ad->ad_avr));
-	  assert(avresample_available(ad->ad_avr) == 0);
-	}
+	audio_read(ad, NULL, audio_available(ad));
+	assert(audio_available(ad) == 0);
 	break;
 
       case MB_CTRL_EXIT:
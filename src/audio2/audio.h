@@ -97,6 +97,22 @@ typedef struct audio_decoder {
 
   AVAudioResampleContext *ad_avr;
 
+  /**
+   * Conversion fast path (bypassing ad_avr), see audio_convert.c
+   */
+  int ad_fastpath;
+  int ad_fp_channels;  // Input channels (1, 2 or 6)
+  int ad_fp_bpf;       // Output bytes per frame
+  uint8_t *ad_fp_buf;  // Output FIFO
+  int ad_fp_size;      // Size of FIFO (in frames)
+  int ad_fp_rdptr;
+  int ad_fp_wrptr;
+  float *ad_fp_scratch;
+  int ad_fp_scratch_size;
+
+  int64_t ad_convert_time;    // Time spent converting (µs)
+  int64_t ad_convert_samples; // Samples converted
+
   void *ad_mux_buffer;
   
   struct AVFormatContext *ad_spdif_muxer;
@@ -129,3 +145,15 @@ audio_class_t *audio_driver_init(struct prop *asettings);
 
 void audio_test_init(struct prop *asettings);
 
+int audio_available(audio_decoder_t *ad);
+
+int audio_read(audio_decoder_t *ad, uint8_t **planes, int samples);
+
+int audio_fastpath_setup(audio_decoder_t *ad);
+
+void audio_fastpath_convert(audio_decoder_t *ad, const struct AVFrame *f);
+
+void audio_fastpath_release(audio_decoder_t *ad);
+
+void audio_gain_flt(float *data, int count, float gain);
+
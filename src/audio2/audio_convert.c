@@ -0,0 +1,438 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "main.h"
+#include "audio.h"
+#include "misc/minmax.h"
+
+#include <libavutil/frame.h>
+#include <libavutil/channel_layout.h>
+
+/**
+ * Audio conversion fast path
+ *
+ * When the sample rate is not changed and the output is interleaved
+ * stereo (S16 or FLT) we convert decoded frames directly into an
+ * output FIFO instead of running them through libavresample.
+ * Output drivers don't need to care, they use audio_available()
+ * and audio_read() for both paths.
+ */
+
+
+/**
+ *
+ */
+void
+audio_gain_flt(float *data, int count, float gain)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 g = _mm_set1_ps(gain);
+  for(; i + 4 <= count; i += 4)
+    _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), g));
+#elif defined(__ARM_NEON__)
+  for(; i + 4 <= count; i += 4)
+    vst1q_f32(data + i, vmulq_n_f32(vld1q_f32(data + i), gain));
+#endif
+
+  for(; i < count; i++)
+    data[i] *= gain;
+}
+
+
+/**
+ * Float to S16 with saturation. All variants truncate towards zero
+ * so output doesn't depend on which one we run
+ */
+static void
+flt_to_s16(int16_t *dst, const float *src, int count)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  for(; i + 8 <= count; i += 8) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+    __m128 y = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+    __m128i a = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(x, hi), lo));
+    __m128i b = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(y, hi), lo));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+  }
+#elif defined(__ARM_NEON__)
+  for(; i + 4 <= count; i += 4) {
+    int32x4_t v = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32767.0f));
+    vst1_s16(dst + i, vqmovn_s32(v));
+  }
+#endif
+
+  for(; i < count; i++) {
+    float x = src[i] * 32767.0f;
+    if(x > 32767.0f)
+      x = 32767.0f;
+    else if(x < -32768.0f)
+      x = -32768.0f;
+    dst[i] = x;
+  }
+}
+
+
+/**
+ * S16 to float
+ */
+static void
+s16_to_flt(float *dst, const int16_t *src, int count)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+  for(; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    // Sign extend via unpack into upper half and arithmetic shift
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+#elif defined(__ARM_NEON__)
+  for(; i + 4 <= count; i += 4) {
+    float32x4_t v = vcvtq_f32_s32(vmovl_s16(vld1_s16(src + i)));
+    vst1q_f32(dst + i, vmulq_n_f32(v, 1.0f / 32768.0f));
+  }
+#endif
+
+  for(; i < count; i++)
+    dst[i] = src[i] * (1.0f / 32768.0f);
+}
+
+
+/**
+ * 5.1 (planar float) to interleaved stereo downmix
+ *
+ * Center and surround are mixed in at -3dB, LFE is dropped.
+ * Result is normalized so a full scale input can't clip
+ */
+#define DMX_NORM (1.0f / (1.0f + 0.7071f + 0.7071f))
+#define DMX_SIDE (0.7071f * DMX_NORM)
+
+static void
+downmix_51_fltp(float *dst, const float *fl, const float *fr,
+                const float *fc, const float *sl, const float *sr, int n)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 norm = _mm_set1_ps(DMX_NORM);
+  const __m128 side = _mm_set1_ps(DMX_SIDE);
+  for(; i + 4 <= n; i += 4) {
+    __m128 c = _mm_mul_ps(_mm_loadu_ps(fc + i), side);
+    __m128 l = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(fl + i), norm),
+                          _mm_mul_ps(_mm_loadu_ps(sl + i), side));
+    __m128 r = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(fr + i), norm),
+                          _mm_mul_ps(_mm_loadu_ps(sr + i), side));
+    l = _mm_add_ps(l, c);
+    r = _mm_add_ps(r, c);
+    _mm_storeu_ps(dst + i * 2,     _mm_unpacklo_ps(l, r));
+    _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+  }
+#elif defined(__ARM_NEON__)
+  for(; i + 4 <= n; i += 4) {
+    float32x4_t c = vmulq_n_f32(vld1q_f32(fc + i), DMX_SIDE);
+    float32x4x2_t lr;
+    lr.val[0] = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(fl + i), DMX_NORM),
+                            vld1q_f32(sl + i), DMX_SIDE);
+    lr.val[1] = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(fr + i), DMX_NORM),
+                            vld1q_f32(sr + i), DMX_SIDE);
+    lr.val[0] = vaddq_f32(lr.val[0], c);
+    lr.val[1] = vaddq_f32(lr.val[1], c);
+    vst2q_f32(dst + i * 2, lr);
+  }
+#endif
+
+  for(; i < n; i++) {
+    float c = fc[i] * DMX_SIDE;
+    dst[i * 2 + 0] = fl[i] * DMX_NORM + sl[i] * DMX_SIDE + c;
+    dst[i * 2 + 1] = fr[i] * DMX_NORM + sr[i] * DMX_SIDE + c;
+  }
+}
+
+
+/**
+ * Convert frame to interleaved float stereo
+ */
+static void
+frame_to_flt_stereo(float *dst, const AVFrame *f, int channels)
+{
+  const int n = f->nb_samples;
+  int i;
+
+  switch(f->format) {
+  case AV_SAMPLE_FMT_FLT:
+    if(channels == 2) {
+      memcpy(dst, f->data[0], n * 2 * sizeof(float));
+    } else {
+      const float *s = (const float *)f->data[0];
+      if(channels == 1) {
+        for(i = 0; i < n; i++)
+          dst[i * 2] = dst[i * 2 + 1] = s[i];
+      } else {
+        for(i = 0; i < n; i++, s += 6) {
+          float c = s[2] * DMX_SIDE;
+          dst[i * 2 + 0] = s[0] * DMX_NORM + s[4] * DMX_SIDE + c;
+          dst[i * 2 + 1] = s[1] * DMX_NORM + s[5] * DMX_SIDE + c;
+        }
+      }
+    }
+    break;
+
+  case AV_SAMPLE_FMT_FLTP:
+    if(channels == 6) {
+      const float **p = (const float **)f->extended_data;
+      downmix_51_fltp(dst, p[0], p[1], p[2], p[4], p[5], n);
+    } else {
+      const float *l = (const float *)f->extended_data[0];
+      const float *r = (const float *)f->extended_data[channels - 1];
+      for(i = 0; i < n; i++) {
+        dst[i * 2 + 0] = l[i];
+        dst[i * 2 + 1] = r[i];
+      }
+    }
+    break;
+
+  case AV_SAMPLE_FMT_S16:
+    if(channels == 2) {
+      s16_to_flt(dst, (const int16_t *)f->data[0], n * 2);
+    } else {
+      const int16_t *s = (const int16_t *)f->data[0];
+      for(i = 0; i < n; i++)
+        dst[i * 2] = dst[i * 2 + 1] = s[i] * (1.0f / 32768.0f);
+    }
+    break;
+
+  case AV_SAMPLE_FMT_S16P:
+    {
+      const int16_t *l = (const int16_t *)f->extended_data[0];
+      const int16_t *r = (const int16_t *)f->extended_data[channels - 1];
+      for(i = 0; i < n; i++) {
+        dst[i * 2 + 0] = l[i] * (1.0f / 32768.0f);
+        dst[i * 2 + 1] = r[i] * (1.0f / 32768.0f);
+      }
+    }
+    break;
+  }
+}
+
+
+/**
+ * Convert frame to interleaved S16 stereo
+ */
+static void
+frame_to_s16_stereo(audio_decoder_t *ad, int16_t *dst, const AVFrame *f,
+                    int channels)
+{
+  const int n = f->nb_samples;
+  int i;
+
+  if(f->format == AV_SAMPLE_FMT_S16 && channels == 2) {
+    memcpy(dst, f->data[0], n * 2 * sizeof(int16_t));
+    return;
+  }
+
+  if(f->format == AV_SAMPLE_FMT_S16 && channels == 1) {
+    const int16_t *s = (const int16_t *)f->data[0];
+    for(i = 0; i < n; i++)
+      dst[i * 2] = dst[i * 2 + 1] = s[i];
+    return;
+  }
+
+  if(f->format == AV_SAMPLE_FMT_S16P) {
+    const int16_t *l = (const int16_t *)f->extended_data[0];
+    const int16_t *r = (const int16_t *)f->extended_data[channels - 1];
+    for(i = 0; i < n; i++) {
+      dst[i * 2 + 0] = l[i];
+      dst[i * 2 + 1] = r[i];
+    }
+    return;
+  }
+
+  // Float input, go via scratch buffer
+
+  if(ad->ad_fp_scratch_size < n) {
+    free(ad->ad_fp_scratch);
+    ad->ad_fp_scratch = malloc(n * 2 * sizeof(float));
+    ad->ad_fp_scratch_size = n;
+  }
+  frame_to_flt_stereo(ad->ad_fp_scratch, f, channels);
+  flt_to_s16(dst, ad->ad_fp_scratch, n * 2);
+}
+
+
+/**
+ * Check if fast path can be used for current in/out configuration.
+ * Returns 1 if so
+ */
+int
+audio_fastpath_setup(audio_decoder_t *ad)
+{
+  int channels;
+
+  ad->ad_fp_rdptr = 0;
+  ad->ad_fp_wrptr = 0;
+  ad->ad_fastpath = 0;
+
+  if(ad->ad_in_sample_rate != ad->ad_out_sample_rate ||
+     ad->ad_out_channel_layout != AV_CH_LAYOUT_STEREO)
+    return 0;
+
+  if(ad->ad_out_sample_format != AV_SAMPLE_FMT_S16 &&
+     ad->ad_out_sample_format != AV_SAMPLE_FMT_FLT)
+    return 0;
+
+  switch(ad->ad_in_channel_layout) {
+  case AV_CH_LAYOUT_MONO:
+    channels = 1;
+    break;
+  case AV_CH_LAYOUT_STEREO:
+    channels = 2;
+    break;
+  case AV_CH_LAYOUT_5POINT1:
+  case AV_CH_LAYOUT_5POINT1_BACK:
+    // Downmix is only done for float input
+    if(ad->ad_in_sample_format != AV_SAMPLE_FMT_FLT &&
+       ad->ad_in_sample_format != AV_SAMPLE_FMT_FLTP)
+      return 0;
+    channels = 6;
+    break;
+  default:
+    return 0;
+  }
+
+  switch(ad->ad_in_sample_format) {
+  case AV_SAMPLE_FMT_S16:
+  case AV_SAMPLE_FMT_S16P:
+  case AV_SAMPLE_FMT_FLT:
+  case AV_SAMPLE_FMT_FLTP:
+    break;
+  default:
+    return 0;
+  }
+
+  ad->ad_fp_channels = channels;
+  ad->ad_fp_bpf = 2 * av_get_bytes_per_sample(ad->ad_out_sample_format);
+  ad->ad_fastpath = 1;
+  return 1;
+}
+
+
+/**
+ * Convert a decoded frame and append it to the output FIFO
+ */
+void
+audio_fastpath_convert(audio_decoder_t *ad, const AVFrame *f)
+{
+  const int n = f->nb_samples;
+  const int bpf = ad->ad_fp_bpf;
+
+  if(ad->ad_fp_wrptr + n > ad->ad_fp_size) {
+    // Move pending samples to start of buffer
+    int avail = ad->ad_fp_wrptr - ad->ad_fp_rdptr;
+    memmove(ad->ad_fp_buf, ad->ad_fp_buf + ad->ad_fp_rdptr * bpf,
+            avail * bpf);
+    ad->ad_fp_rdptr = 0;
+    ad->ad_fp_wrptr = avail;
+
+    if(avail + n > ad->ad_fp_size) {
+      ad->ad_fp_size = MAX(avail + n, ad->ad_tile_size * 4);
+      ad->ad_fp_buf = realloc(ad->ad_fp_buf, ad->ad_fp_size * bpf);
+    }
+  }
+
+  void *dst = ad->ad_fp_buf + ad->ad_fp_wrptr * bpf;
+
+  if(ad->ad_out_sample_format == AV_SAMPLE_FMT_S16)
+    frame_to_s16_stereo(ad, dst, f, ad->ad_fp_channels);
+  else
+    frame_to_flt_stereo(dst, f, ad->ad_fp_channels);
+
+  ad->ad_fp_wrptr += n;
+}
+
+
+/**
+ *
+ */
+void
+audio_fastpath_release(audio_decoder_t *ad)
+{
+  free(ad->ad_fp_buf);
+  ad->ad_fp_buf = NULL;
+  ad->ad_fp_size = 0;
+  free(ad->ad_fp_scratch);
+  ad->ad_fp_scratch = NULL;
+  ad->ad_fp_scratch_size = 0;
+}
+
+
+/**
+ * Number of output samples ready to be read
+ */
+int
+audio_available(audio_decoder_t *ad)
+{
+  if(ad->ad_fastpath)
+    return ad->ad_fp_wrptr - ad->ad_fp_rdptr;
+
+  return ad->ad_avr != NULL ? avresample_available(ad->ad_avr) : 0;
+}
+
+
+/**
+ * Read output samples, if planes is NULL samples are discarded
+ */
+int
+audio_read(audio_decoder_t *ad, uint8_t **planes, int samples)
+{
+  if(!ad->ad_fastpath)
+    return ad->ad_avr != NULL ?
+      avresample_read(ad->ad_avr, planes, samples) : 0;
+
+  samples = MIN(samples, ad->ad_fp_wrptr - ad->ad_fp_rdptr);
+
+  if(planes != NULL)
+    memcpy(planes[0], ad->ad_fp_buf + ad->ad_fp_rdptr * ad->ad_fp_bpf,
+           samples * ad->ad_fp_bpf);
+
+  ad->ad_fp_rdptr += samples;
+
+  if(ad->ad_fp_rdptr == ad->ad_fp_wrptr)
+    ad->ad_fp_rdptr = ad->ad_fp_wrptr = 0;
+
+  return samples;
+}
@@ -32,6 +32,7 @@
 #include "notifications.h"
 #include "image/image.h"
 #include "image/pixmap.h"
+#include "image/pixcache.h"
 #include "htsmsg/htsmsg_json.h"
 #include "media/media.h"
 #include "misc/minmax.h"
@@ -337,6 +338,21 @@ backend_imageloader(rstr_t *url0, const image_meta_t *im0,
 
   im.im_margin = MAX(im.im_shadow * 2, im.im_margin);
 
+  const int use_pixcache = pixcache_usable(url, &im);
+
+  if(use_pixcache && cache_control != BYPASS_CACHE) {
+    int is_expired = 0;
+    img = pixcache_get(url, &im,
+                       ONLY_CACHED(cache_control) ? &is_expired : NULL);
+    if(img != NULL) {
+      if(ONLY_CACHED(cache_control))
+        *cache_control = is_expired;
+      if(m)
+        htsmsg_release(m);
+      return img;
+    }
+  }
+
   hts_mutex_lock(&imageloader_mutex);
 
   loading_image_t *li;
@@ -416,7 +432,12 @@ backend_imageloader(rstr_t *url0, const image_meta_t *im0,
       li->li_image = image_retain(img);
 
     if(!im.im_no_decoding) {
+      int64_t ts = arch_get_ts();
       img = image_decode(img, &im, errbuf, errlen);
+
+      // pixcache_put() skips originals that are stale or uncacheable
+      if(img != NULL && use_pixcache)
+        pixcache_put(url, &im, img, arch_get_ts() - ts);
     }
 
   }
@@ -19,6 +19,7 @@
  */
 #include <string.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "navigator.h"
 #include "backend/backend.h"
@@ -40,6 +41,10 @@
 
 #define HLS_CORRUPTION_MEASURE_PERIOD (60 * 1000000)
 
+// Half-life (in seconds) of the throughput averages
+#define HLS_BW_FAST_HALFLIFE 2.0
+#define HLS_BW_SLOW_HALFLIFE 10.0
+
 /**
  * Relevant docs:
  *
@@ -157,6 +162,7 @@ segment_destroy(hls_segment_t *hs)
 
   if(hs->hs_fh != NULL)
     fa_close(hs->hs_fh);
+  buf_release(hs->hs_buf);
 
   TAILQ_REMOVE(&hs->hs_variant->hv_segments, hs, hs_link);
   free(hs->hs_url);
@@ -341,6 +347,7 @@ hls_bad_variant(hls_variant_t *hv, hls_error_t err)
 
   hls_variant_close(hv);
   usleep(100000);
+  hd->hd_pending = NULL;
   hd->hd_req = hls_demuxer_select_variant(hd, now, 0);
   hd->hd_last_switch = now;
 }
@@ -590,6 +597,37 @@ check_audio_only(hls_demuxer_t *hd)
 
 
 
+/**
+ * Feed a throughput measurement (bps) into the estimator.
+ *
+ * We keep a fast and a slow moving average weighted by the time since
+ * the previous sample and use the lower of the two. That way a drop in
+ * bandwidth is picked up quickly while a short burst of speed does
+ * not make us step up prematurely.
+ */
+static void
+hls_bw_sample(hls_demuxer_t *hd, int64_t bw)
+{
+  int64_t now = arch_get_ts();
+  bw = MIN(100000000, bw);
+
+  if(hd->hd_bw == 0) {
+    hd->hd_bw_fast = bw;
+    hd->hd_bw_slow = bw;
+  } else {
+    double t = (now - hd->hd_bw_last_sample) / 1000000.0;
+    double af = 1.0 - pow(0.5, t / HLS_BW_FAST_HALFLIFE);
+    double as = 1.0 - pow(0.5, t / HLS_BW_SLOW_HALFLIFE);
+    hd->hd_bw_fast += af * (bw - hd->hd_bw_fast);
+    hd->hd_bw_slow += as * (bw - hd->hd_bw_slow);
+  }
+
+  hd->hd_bw = MAX(1, MIN(hd->hd_bw_fast, hd->hd_bw_slow));
+  hd->hd_bw_last_sample = now;
+  hd->hd_bw_updated = 1;
+}
+
+
 /**
  *
  */
@@ -610,33 +648,43 @@ hls_segment_open(hls_segment_t *hs)
   foe.foe_open_timeout = 3000;
   foe.foe_cancellable = hd->hd_cancellable;
 
-  int flags = FA_BUFFERED_BIG | FA_STREAMING;
+  assert(hs->hs_buf == NULL);
+  hs->hs_buf = hls_prefetch_claim(hd, hs);
+
+  if(hs->hs_buf != NULL) {
 
-  if(hs->hs_byte_offset != -1)
-    flags &= ~FA_STREAMING;
-  
-  fh = fa_open_ex(hs->hs_url, errbuf, sizeof(errbuf), flags, &foe);
+    fh = memfile_make(buf_data(hs->hs_buf), buf_len(hs->hs_buf));
 
-  if(fh == NULL) {
+  } else {
 
-    if(cancellable_is_cancelled(hd->hd_cancellable))
-      return HLS_ERROR_SEGMENT_NOT_FOUND;
+    int flags = FA_BUFFERED_BIG | FA_STREAMING;
 
-    usleep(500000);
-    if(foe.foe_protocol_error == 404) {
-      return HLS_ERROR_SEGMENT_NOT_FOUND;
-    } else if(foe.foe_protocol_error == 403) {
-      hs->hs_permanent_error = 1;
-      return HLS_ERROR_SEGMENT_ACCESS_DENIED;
-    } else {
-      return HLS_ERROR_SEGMENT_BROKEN;
+    if(hs->hs_byte_offset != -1)
+      flags &= ~FA_STREAMING;
+
+    fh = fa_open_ex(hs->hs_url, errbuf, sizeof(errbuf), flags, &foe);
+
+    if(fh == NULL) {
+
+      if(cancellable_is_cancelled(hd->hd_cancellable))
+        return HLS_ERROR_SEGMENT_NOT_FOUND;
+
+      usleep(500000);
+      if(foe.foe_protocol_error == 404) {
+        return HLS_ERROR_SEGMENT_NOT_FOUND;
+      } else if(foe.foe_protocol_error == 403) {
+        hs->hs_permanent_error = 1;
+        return HLS_ERROR_SEGMENT_ACCESS_DENIED;
+      } else {
+        return HLS_ERROR_SEGMENT_BROKEN;
+      }
     }
-  }
 
-  fa_set_read_timeout(fh, 3000);
+    fa_set_read_timeout(fh, 3000);
 
-  if(hs->hs_byte_size != -1 && hs->hs_byte_offset != -1)
-    fh = fa_slice_open(fh, hs->hs_byte_offset, hs->hs_byte_size);
+    if(hs->hs_byte_size != -1 && hs->hs_byte_offset != -1)
+      fh = fa_slice_open(fh, hs->hs_byte_offset, hs->hs_byte_size);
+  }
 
   hs->hs_size = fa_fsize(fh);
 
@@ -653,6 +701,8 @@ hls_segment_open(hls_segment_t *hs)
 	TRACE(TRACE_ERROR, "HLS", "Unable to load key file %s",
 	      rstr_get(hs->hs_key_url));
 	fa_close(fh);
+        buf_release(hs->hs_buf);
+        hs->hs_buf = NULL;
         return HLS_ERROR_SEGMENT_BAD_KEY;
       }
       rstr_set(&hv->hv_key_url, hs->hs_key_url);
@@ -661,8 +711,9 @@ hls_segment_open(hls_segment_t *hs)
     fh = fa_aescbc_open(fh, hs->hs_iv, buf_c8(hv->hv_key));
   }
   hs->hs_fh = fh;
-  HLS_TRACE(h, "Opened %s (sequence %d) ranges:[%d + %d] OK",
-            hs->hs_url, hs->hs_seq, hs->hs_byte_offset, hs->hs_byte_size);
+  HLS_TRACE(h, "Opened %s (sequence %d) ranges:[%d + %d] OK%s",
+            hs->hs_url, hs->hs_seq, hs->hs_byte_offset, hs->hs_byte_size,
+            hs->hs_buf != NULL ? " (prefetched)" : "");
   return 0;
 }
 
@@ -679,44 +730,27 @@ hls_segment_close(hls_segment_t *hs)
   hls_demuxer_t *hd = hs->hs_variant->hv_demuxer;
   hls_t *h = hd->hd_hls;
 
-  if(hs->hs_blocked_counter == h->h_blocked) {
+  // Prefetched segments are measured by the prefetcher itself
+  if(hs->hs_buf == NULL && hs->hs_blocked_counter == h->h_blocked) {
     int64_t ts = arch_get_ts() - hs->hs_open_time;
     if(ts > 1000) {
       int64_t bw = 8000000LL * hs->hs_size / ts;
-      bw = MIN(100000000, bw);
-
-
-      int low_buffer = h->h_mp->mp_buffer_delay < 5000000;
-      const char *delta;
-      if(hd->hd_bw == 0) {
-        hd->hd_bw = bw;
-        delta = "Initial";
-      } else if(bw < hd->hd_bw) {
-        delta = "Decrease";
-        if(low_buffer)
-          hd->hd_bw = (hd->hd_bw + bw) / 2;
-        else
-          hd->hd_bw = (hd->hd_bw * 7 + bw) / 8;
-      } else {
-        delta = "Increase";
-        hd->hd_bw = (hd->hd_bw + bw) / 2;
-      }
+      hls_bw_sample(hd, bw);
       HLS_TRACE(h, "Estimated bandwidth updated %d bps "
-                "(most recent segment %d bps) "
-                "buffer: %ds (%s) delta: %s\n",
+                "(most recent segment %d bps) buffer: %ds",
                 hd->hd_bw, (int)bw,
-                (int)(h->h_mp->mp_buffer_delay / 1000000),
-                low_buffer ? "Low" : "OK",
-                delta);
-      hd->hd_bw_updated = 1;
+                (int)(h->h_mp->mp_buffer_delay / 1000000));
     }
   }
 
   fa_close(hs->hs_fh);
   hs->hs_fh = NULL;
+  buf_release(hs->hs_buf);
+  hs->hs_buf = NULL;
 }
 
 
+
 /**
  *
  */
@@ -1096,6 +1130,23 @@ hls_demuxer_select_variant(hls_demuxer_t *hd, int64_t now, int bw)
 
 
 
+/**
+ * Bandwidth we are willing to spend given the current buffer level.
+ * With little buffered a too optimistic choice means rebuffering so
+ * leave a wide margin, with a deep buffer we can get closer to the
+ * estimate.
+ */
+static int
+hls_usable_bw(const hls_demuxer_t *hd, int64_t buffer_delay)
+{
+  if(buffer_delay < 5000000)
+    return hd->hd_bw / 10 * 7;
+  if(buffer_delay < 15000000)
+    return hd->hd_bw / 20 * 17;
+  return hd->hd_bw;
+}
+
+
 /**
  *
  */
@@ -1104,6 +1155,25 @@ hls_check_bw_switch(hls_demuxer_t *hd)
 {
   hls_t *h = hd->hd_hls;
   media_pipe_t *mp = h->h_mp;
+  int64_t bytes, duration;
+
+  if(hls_prefetch_throughput(hd, &bytes, &duration)) {
+    int64_t bw = 8000000LL * bytes / duration;
+    hls_bw_sample(hd, bw);
+    HLS_TRACE(h, "Estimated bandwidth updated %d bps "
+              "(prefetch %d bps over %dms) buffer: %ds",
+              hd->hd_bw, (int)bw, (int)(duration / 1000),
+              (int)(mp->mp_buffer_delay / 1000000));
+  }
+
+  if(hd->hd_pending != NULL && !hls_prefetch_pending(hd)) {
+    HLS_TRACE(h, "%s: Prefetched segments consumed, switching to %s",
+              hd->hd_type, hd->hd_pending->hv_name);
+    hd->hd_req = hd->hd_pending;
+    hd->hd_pending = NULL;
+    hls_free_mbp(mp, &hd->hd_mb);
+    return;
+  }
 
   if(hd->hd_bw_updated == 0)
     return;
@@ -1118,7 +1188,12 @@ hls_check_bw_switch(hls_demuxer_t *hd)
     return;
 
   hd->hd_bw_updated = 0;
-  hls_variant_t *hv = hls_demuxer_select_variant(hd, now, hd->hd_bw);
+  hls_variant_t *hv =
+    hls_demuxer_select_variant(hd, now,
+                               hls_usable_bw(hd, mp->mp_buffer_delay));
+
+  if(hv == hd->hd_current)
+    hd->hd_pending = NULL;
 
   if(hv == NULL || hv == hd->hd_current)
     return;
@@ -1134,6 +1209,18 @@ hls_check_bw_switch(hls_demuxer_t *hd)
 
 
   hd->hd_last_switch = now;
+
+  /*
+   * Unless we're about to run dry, play out what has already been
+   * downloaded for the current variant before switching
+   */
+  if((hv->hv_bitrate > hd->hd_current->hv_bitrate ||
+      mp->mp_buffer_delay >= 5000000) && hls_prefetch_pending(hd)) {
+    hd->hd_pending = hv;
+    return;
+  }
+
+  hd->hd_pending = NULL;
   hd->hd_req = hv;
 
   hls_free_mbp(mp, &hd->hd_mb);
@@ -2144,6 +2231,7 @@ hls_demuxer_init(hls_demuxer_t *hd, hls_t *h, const char *type)
   hd->hd_seek_to_segment = PTS_UNSET;
   hd->hd_last_dts = PTS_UNSET;
   hd->hd_cancellable = cancellable_create();
+  hls_prefetch_init(hd);
 }
 
 
@@ -2153,6 +2241,7 @@ hls_demuxer_init(hls_demuxer_t *hd, hls_t *h, const char *type)
 static void
 hls_demuxer_close(media_pipe_t *mp, hls_demuxer_t *hd)
 {
+  hls_prefetch_stop(hd);
   variants_destroy(&hd->hd_variants);
   if(hd->hd_audio_codec != NULL)
     media_codec_deref(hd->hd_audio_codec);
@@ -81,6 +81,7 @@ typedef struct hls_segment {
   char hs_mark;
 
   fa_handle_t *hs_fh;
+  buf_t *hs_buf;  // Backing memory when served from the prefetcher
 
   int64_t hs_open_time;
   int hs_blocked_counter;
@@ -174,6 +175,38 @@ typedef struct hls_variant {
 } hls_variant_t;
 
 
+/**
+ * A segment being downloaded ahead of the demuxer
+ */
+typedef struct hls_prefetch {
+  TAILQ_ENTRY(hls_prefetch) hp_link;
+
+  // NULL once the job is orphaned (worker will free it when done)
+  struct hls_variant *hp_variant;
+  int hp_seq;
+
+  char *hp_url;
+  int hp_byte_offset;
+  int hp_byte_size;
+
+  enum {
+    HP_QUEUED,
+    HP_RUNNING,
+    HP_DONE,
+    HP_FAILED,
+  } hp_state;
+
+  int hp_reserved;  // Bytes accounted against the memory budget
+  buf_t *hp_buf;
+  cancellable_t *hp_cancellable;
+
+} hls_prefetch_t;
+
+TAILQ_HEAD(hls_prefetch_queue, hls_prefetch);
+
+#define HLS_PREFETCH_MAX_THREADS 4
+
+
 /**
  *
  */
@@ -183,9 +216,13 @@ typedef struct hls_demuxer {
 
   hls_variant_t *hd_current;
   hls_variant_t *hd_req;
+  hls_variant_t *hd_pending; // Switch to once prefetched segments are used
 
   int hd_bw;
   int hd_bw_updated;
+  double hd_bw_fast;
+  double hd_bw_slow;
+  int64_t hd_bw_last_sample;
   int64_t hd_download_counter_reset_at;
   int64_t hd_download_counter;
   int64_t hd_download_counter2;
@@ -219,6 +256,24 @@ typedef struct hls_demuxer {
 
   int64_t hd_last_dts;
 
+  /**
+   * Segment prefetcher, everything below is protected by
+   * hd_prefetch_mutex
+   */
+  hts_mutex_t hd_prefetch_mutex;
+  hts_cond_t hd_prefetch_cond;
+  struct hls_prefetch_queue hd_prefetches;
+  hts_thread_t hd_prefetch_threads[HLS_PREFETCH_MAX_THREADS];
+  int hd_prefetch_nthreads;
+  int hd_prefetch_run;
+  int64_t hd_prefetch_reserved;
+
+  // Aggregate throughput over the time any download was running
+  int hd_prefetch_active;
+  int64_t hd_prefetch_mark;
+  int64_t hd_prefetch_busy;
+  int64_t hd_prefetch_bytes;
+
 } hls_demuxer_t;
 
 LIST_HEAD(hls_discontinuity_segment_list, hls_discontinuity_segment);
@@ -298,6 +353,21 @@ hls_segment_t *hv_find_segment_by_seq(hls_variant_t *hv, int seq);
 
 void hls_bad_variant(hls_variant_t *hv, hls_error_t err);
 
+// Segment prefetcher
+
+void hls_prefetch_init(hls_demuxer_t *hd);
+
+void hls_prefetch_stop(hls_demuxer_t *hd);
+
+void hls_prefetch_schedule(hls_demuxer_t *hd, hls_segment_t *hs);
+
+buf_t *hls_prefetch_claim(hls_demuxer_t *hd, const hls_segment_t *hs);
+
+int hls_prefetch_pending(hls_demuxer_t *hd);
+
+int hls_prefetch_throughput(hls_demuxer_t *hd, int64_t *bytes,
+                            int64_t *duration);
+
 // TS demuxer
 
 media_buf_t *hls_ts_demuxer_read(hls_demuxer_t *hd);
@@ -0,0 +1,420 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "media/media.h"
+#include "fileaccess/fileaccess.h"
+#include "backend/backend.h"
+#include "video/video_settings.h"
+#include "misc/cancellable.h"
+#include "misc/minmax.h"
+
+#include "hls.h"
+
+/**
+ * Segment prefetcher
+ *
+ * A small pool of worker threads per demuxer downloads the segments
+ * following the one currently being demuxed into memory. The demuxer
+ * claims the buffer when it gets to the segment and reads it through
+ * a memfile handle. Download throughput is measured over the time any
+ * worker is busy so parallel downloads are not counted as slow links.
+ */
+
+#define HLS_PREFETCH_CHUNK (64 * 1024)
+
+
+/**
+ *
+ */
+static void
+hp_destroy(hls_prefetch_t *hp)
+{
+  buf_release(hp->hp_buf);
+  cancellable_release(hp->hp_cancellable);
+  free(hp->hp_url);
+  free(hp);
+}
+
+
+/**
+ * Detach a job from the demuxer. A running job is cancelled and freed
+ * by its worker once it returns, anything else is freed right away.
+ */
+static void
+hp_orphan(hls_demuxer_t *hd, hls_prefetch_t *hp)
+{
+  TAILQ_REMOVE(&hd->hd_prefetches, hp, hp_link);
+  hd->hd_prefetch_reserved -= hp->hp_reserved;
+  hp->hp_variant = NULL;
+
+  if(hp->hp_state == HP_RUNNING)
+    cancellable_cancel(hp->hp_cancellable);
+  else
+    hp_destroy(hp);
+}
+
+
+/**
+ * Must be called before and after each download with the mutex held
+ */
+static void
+hp_busy_update(hls_demuxer_t *hd, int delta)
+{
+  int64_t now = arch_get_ts();
+  if(hd->hd_prefetch_active > 0)
+    hd->hd_prefetch_busy += now - hd->hd_prefetch_mark;
+  hd->hd_prefetch_mark = now;
+  hd->hd_prefetch_active += delta;
+}
+
+
+/**
+ *
+ */
+static buf_t *
+hp_download(hls_demuxer_t *hd, hls_prefetch_t *hp)
+{
+  fa_open_extra_t foe = {0};
+  char errbuf[256];
+
+  foe.foe_open_timeout = 3000;
+  foe.foe_cancellable = hp->hp_cancellable;
+
+  int flags = hp->hp_byte_offset == -1 ? FA_STREAMING : 0;
+
+  fa_handle_t *fh = fa_open_ex(hp->hp_url, errbuf, sizeof(errbuf),
+                               flags, &foe);
+  if(fh == NULL)
+    return NULL;
+
+  fa_set_read_timeout(fh, 3000);
+
+  if(hp->hp_byte_size != -1 && hp->hp_byte_offset != -1)
+    fh = fa_slice_open(fh, hp->hp_byte_offset, hp->hp_byte_size);
+
+  int64_t size = fa_fsize(fh);
+  size_t cap = size > 0 ? size : 1024 * 1024;
+  size_t len = 0;
+  uint8_t *mem = malloc(cap);
+
+  while(mem != NULL) {
+    if(size > 0 && len == size)
+      break;
+
+    if(len == cap) {
+      cap *= 2;
+      uint8_t *n = realloc(mem, cap);
+      if(n == NULL) {
+        free(mem);
+        mem = NULL;
+        break;
+      }
+      mem = n;
+    }
+
+    int r = fa_read(fh, mem + len, MIN(cap - len, HLS_PREFETCH_CHUNK));
+
+    if(r < 0 || cancellable_is_cancelled(hp->hp_cancellable)) {
+      free(mem);
+      mem = NULL;
+      break;
+    }
+    if(r == 0)
+      break;
+    len += r;
+
+    hts_mutex_lock(&hd->hd_prefetch_mutex);
+    hd->hd_prefetch_bytes += r;
+    hts_mutex_unlock(&hd->hd_prefetch_mutex);
+  }
+
+  fa_close(fh);
+
+  if(mem == NULL)
+    return NULL;
+
+  // Don't keep slack around, hd_prefetch_bytes only counts len
+  if(len > 0 && len < cap) {
+    uint8_t *n = realloc(mem, len);
+    if(n != NULL)
+      mem = n;
+  }
+  return buf_create_from_malloced(len, mem);
+}
+
+
+/**
+ *
+ */
+static void *
+hls_prefetch_thread(void *aux)
+{
+  hls_demuxer_t *hd = aux;
+  hls_prefetch_t *hp;
+
+  hts_mutex_lock(&hd->hd_prefetch_mutex);
+
+  while(hd->hd_prefetch_run) {
+
+    TAILQ_FOREACH(hp, &hd->hd_prefetches, hp_link)
+      if(hp->hp_state == HP_QUEUED)
+        break;
+
+    if(hp == NULL) {
+      hts_cond_wait(&hd->hd_prefetch_cond, &hd->hd_prefetch_mutex);
+      continue;
+    }
+
+    hp->hp_state = HP_RUNNING;
+    hp_busy_update(hd, 1);
+    hts_mutex_unlock(&hd->hd_prefetch_mutex);
+
+    buf_t *b = hp_download(hd, hp);
+
+    hts_mutex_lock(&hd->hd_prefetch_mutex);
+    hp_busy_update(hd, -1);
+
+    if(hp->hp_variant == NULL) {
+      buf_release(b);
+      hp_destroy(hp);
+      continue;
+    }
+
+    if(b != NULL) {
+      hd->hd_prefetch_reserved += buf_len(b) - hp->hp_reserved;
+      hp->hp_reserved = buf_len(b);
+      hp->hp_buf = b;
+      hp->hp_state = HP_DONE;
+    } else {
+      hp->hp_state = HP_FAILED;
+    }
+    HLS_TRACE(hd->hd_hls, "%s: Prefetch of sequence %d %s",
+              hd->hd_type, hp->hp_seq, b != NULL ? "completed" : "failed");
+    hts_cond_broadcast(&hd->hd_prefetch_cond);
+  }
+
+  hts_mutex_unlock(&hd->hd_prefetch_mutex);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+void
+hls_prefetch_init(hls_demuxer_t *hd)
+{
+  hts_mutex_init(&hd->hd_prefetch_mutex);
+  hts_cond_init(&hd->hd_prefetch_cond, &hd->hd_prefetch_mutex);
+  TAILQ_INIT(&hd->hd_prefetches);
+  hd->hd_prefetch_run = 1;
+}
+
+
+/**
+ *
+ */
+void
+hls_prefetch_stop(hls_demuxer_t *hd)
+{
+  hls_prefetch_t *hp;
+
+  hts_mutex_lock(&hd->hd_prefetch_mutex);
+  hd->hd_prefetch_run = 0;
+  while((hp = TAILQ_FIRST(&hd->hd_prefetches)) != NULL)
+    hp_orphan(hd, hp);
+  hts_cond_broadcast(&hd->hd_prefetch_cond);
+  hts_mutex_unlock(&hd->hd_prefetch_mutex);
+
+  for(int i = 0; i < hd->hd_prefetch_nthreads; i++)
+    hts_thread_join(&hd->hd_prefetch_threads[i]);
+  hd->hd_prefetch_nthreads = 0;
+
+  hts_cond_destroy(&hd->hd_prefetch_cond);
+  hts_mutex_destroy(&hd->hd_prefetch_mutex);
+}
+
+
+/**
+ * Queue downloads for the segments following hs in its variant.
+ * Jobs belonging to other variants or to segments at or before hs
+ * are dropped since the demuxer will never ask for them.
+ */
+void
+hls_prefetch_schedule(hls_demuxer_t *hd, hls_segment_t *hs)
+{
+  hls_variant_t *hv = hs->hs_variant;
+  hls_prefetch_t *hp, *next;
+  const int count = MIN(video_settings.hls_prefetch_segments,
+                        HLS_PREFETCH_MAX_THREADS);
+  const int64_t budget = video_settings.hls_prefetch_memory * 1024LL * 1024;
+
+  hts_mutex_lock(&hd->hd_prefetch_mutex);
+
+  for(hp = TAILQ_FIRST(&hd->hd_prefetches); hp != NULL; hp = next) {
+    next = TAILQ_NEXT(hp, hp_link);
+    if(hp->hp_variant != hv || hp->hp_seq <= hs->hs_seq)
+      hp_orphan(hd, hp);
+  }
+
+  while(hd->hd_prefetch_nthreads < count) {
+    hts_thread_create_joinable("hlsprefetch",
+                               &hd->hd_prefetch_threads[hd->hd_prefetch_nthreads],
+                               hls_prefetch_thread, hd,
+                               THREAD_PRIO_DEMUXER);
+    hd->hd_prefetch_nthreads++;
+  }
+
+  /*
+   * Don't queue more when a variant switch is waiting for us to
+   * drain, or when the buffer is so low that parallel downloads
+   * would only slow down the segment we need next
+   */
+  const int depth = hd->hd_pending != NULL ||
+    hd->hd_hls->h_mp->mp_buffer_delay < 5000000 ? 0 : count;
+
+  hls_segment_t *x = hs;
+  for(int i = 0; i < depth; i++) {
+    x = TAILQ_NEXT(x, hs_link);
+    if(x == NULL)
+      break;
+
+    if(x->hs_permanent_error)
+      continue;
+
+    TAILQ_FOREACH(hp, &hd->hd_prefetches, hp_link)
+      if(hp->hp_seq == x->hs_seq)
+        break;
+    if(hp != NULL)
+      continue;
+
+    int64_t estimate = 1024 * 1024;
+    if(x->hs_byte_size != -1)
+      estimate = x->hs_byte_size;
+    else if(hv->hv_bitrate > 0)
+      estimate = x->hs_duration * hv->hv_bitrate / 8000000;
+
+    if(hd->hd_prefetch_reserved + estimate > budget)
+      break;
+
+    hp = calloc(1, sizeof(hls_prefetch_t));
+    hp->hp_variant = hv;
+    hp->hp_seq = x->hs_seq;
+    hp->hp_url = strdup(x->hs_url);
+    hp->hp_byte_offset = x->hs_byte_offset;
+    hp->hp_byte_size = x->hs_byte_size;
+    hp->hp_reserved = estimate;
+    hp->hp_cancellable = cancellable_create();
+    hp->hp_state = HP_QUEUED;
+    hd->hd_prefetch_reserved += estimate;
+    TAILQ_INSERT_TAIL(&hd->hd_prefetches, hp, hp_link);
+    hts_cond_broadcast(&hd->hd_prefetch_cond);
+  }
+
+  hts_mutex_unlock(&hd->hd_prefetch_mutex);
+}
+
+
+/**
+ * Return the downloaded contents of hs if the prefetcher has it.
+ * Waits for a download in progress. Returns NULL if the segment was
+ * never scheduled or the download failed, the caller will then open
+ * it directly (which also takes care of error reporting)
+ */
+buf_t *
+hls_prefetch_claim(hls_demuxer_t *hd, const hls_segment_t *hs)
+{
+  hls_prefetch_t *hp;
+  buf_t *b = NULL;
+
+  hts_mutex_lock(&hd->hd_prefetch_mutex);
+
+  while(1) {
+    TAILQ_FOREACH(hp, &hd->hd_prefetches, hp_link)
+      if(hp->hp_variant == hs->hs_variant && hp->hp_seq == hs->hs_seq)
+        break;
+
+    if(hp == NULL)
+      break;
+
+    if(hp->hp_state == HP_DONE) {
+      b = hp->hp_buf;
+      hp->hp_buf = NULL;
+      hp_orphan(hd, hp);
+      break;
+    }
+
+    if(hp->hp_state == HP_FAILED) {
+      hp_orphan(hd, hp);
+      break;
+    }
+
+    if(cancellable_is_cancelled(hd->hd_cancellable))
+      break;
+
+    hts_cond_wait_timeout(&hd->hd_prefetch_cond, &hd->hd_prefetch_mutex, 250);
+  }
+
+  hts_mutex_unlock(&hd->hd_prefetch_mutex);
+  return b;
+}
+
+
+/**
+ * Returns non-zero if there are prefetched or in-flight segments
+ * that the demuxer has not yet claimed
+ */
+int
+hls_prefetch_pending(hls_demuxer_t *hd)
+{
+  hts_mutex_lock(&hd->hd_prefetch_mutex);
+  int r = TAILQ_FIRST(&hd->hd_prefetches) != NULL;
+  hts_mutex_unlock(&hd->hd_prefetch_mutex);
+  return r;
+}
+
+
+/**
+ * Fetch the aggregate download throughput since last call. Bytes are
+ * counted as they arrive so this can be sampled while downloads are
+ * still running. Returns 0 if not enough has been measured yet.
+ */
+int
+hls_prefetch_throughput(hls_demuxer_t *hd, int64_t *bytes, int64_t *duration)
+{
+  int rval = 0;
+  hts_mutex_lock(&hd->hd_prefetch_mutex);
+
+  if(hd->hd_prefetch_active > 0)
+    hp_busy_update(hd, 0);
+
+  if(hd->hd_prefetch_busy >= 250000 && hd->hd_prefetch_bytes > 0) {
+    *bytes = hd->hd_prefetch_bytes;
+    *duration = hd->hd_prefetch_busy;
+    hd->hd_prefetch_bytes = 0;
+    hd->hd_prefetch_busy = 0;
+    rval = 1;
+  }
+  hts_mutex_unlock(&hd->hd_prefetch_mutex);
+  return rval;
+}
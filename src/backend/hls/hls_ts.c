@@ -1178,6 +1178,7 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
         }
         hv->hv_current_seg = hs;
         td->td_mux_mode = TD_MUX_MODE_UNSET;
+        hls_prefetch_schedule(hd, hs);
         break;
       }
     }
@@ -96,6 +96,9 @@ typedef struct htsp_connection {
   LIST_ENTRY(htsp_connection) hc_global_link;
   tcpcon_t *hc_tc;
 
+  buf_t *hc_rxbuf;
+  size_t hc_rxbuf_size;
+
   uint8_t hc_challenge[32];
 
   int hc_is_async;
@@ -193,10 +196,21 @@ static void htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m);
 
 static htsmsg_t *htsp_reqreply(htsp_connection_t *hc, htsmsg_t *m);
 
+static int htsp_mux_input_raw(htsp_connection_t *hc,
+                              const uint8_t *buf, size_t len);
 
+#define HTSP_RXBUF_MIN_SIZE (64 * 1024)
 
-static htsmsg_t *
-htsp_recv(htsp_connection_t *hc)
+/**
+ * Read one message from the server into the connection's receive
+ * buffer.
+ *
+ * The buffer is kept across calls and only replaced when it's too
+ * small or when a deserialized message still holds on to it (binary
+ * fields point straight into the buffer)
+ */
+static buf_t *
+htsp_read(htsp_connection_t *hc)
 {
   tcpcon_t *tc = hc->hc_tc;
   uint8_t len[4];
@@ -209,20 +223,40 @@ htsp_recv(htsp_connection_t *hc)
   if(l > 16 * 1024 * 1024)
     return NULL;
 
-  buf_t *buf = buf_create(l);
+  buf_t *b = hc->hc_rxbuf;
 
-  if(buf == NULL)
-    return NULL;
+  if(b != NULL &&
+     (atomic_get(&b->b_refcount) != 1 || hc->hc_rxbuf_size < l)) {
+    buf_release(b);
+    b = NULL;
+  }
 
-  htsmsg_t *m;
-  if(tcp_read_data(tc, buf_str(buf), l, NULL, NULL) < 0) {
-    m = NULL;
-  } else {
-    m = htsmsg_binary_deserialize(buf);
+  if(b == NULL) {
+    b = buf_create(MAX(l, HTSP_RXBUF_MIN_SIZE));
+    if(b == NULL) {
+      hc->hc_rxbuf = NULL;
+      return NULL;
+    }
+    hc->hc_rxbuf_size = buf_len(b);
   }
 
-  buf_release(buf);
-  return m;
+  hc->hc_rxbuf = b;
+  b->b_size = l;
+
+  if(tcp_read_data(tc, b->b_ptr, l, NULL, NULL) < 0)
+    return NULL;
+  return b;
+}
+
+
+/**
+ *
+ */
+static htsmsg_t *
+htsp_recv(htsp_connection_t *hc)
+{
+  buf_t *b = htsp_read(hc);
+  return b != NULL ? htsmsg_binary_deserialize(b) : NULL;
 }
 
 
@@ -1173,8 +1207,15 @@ htsp_thread(void *aux)
     hc->hc_is_async = 1;
 
     while(1) {
+      buf_t *b = htsp_read(hc);
+      if(b == NULL)
+        break;
+
+      // Packets are decoded in place without building a htsmsg
+      if(htsp_mux_input_raw(hc, buf_c8(b), buf_len(b)))
+        continue;
 
-      if((m = htsp_recv(hc)) == NULL)
+      if((m = htsmsg_binary_deserialize(b)) == NULL)
 	break;
 
       if(htsp_msg_dispatch(hc, m))
@@ -2165,14 +2206,10 @@ be_htsp_playvideo(const char *url, media_pipe_t *mp,
  * Leaves 'hc_subscription_mutex' locked if we successfully find a subscription
  */
 static htsp_subscription_t *
-htsp_find_subscription_by_msg(htsp_connection_t *hc, htsmsg_t *m)
+htsp_find_subscription(htsp_connection_t *hc, uint32_t sid)
 {
-  uint32_t sid;
   htsp_subscription_t *hs;
 
-  if(htsmsg_get_u32(m, "subscriptionId", &sid))
-    return NULL;
-
   hts_mutex_lock(&hc->hc_subscription_mutex);
   LIST_FOREACH(hs, &hc->hc_subscriptions, hs_link)
     if(hs->hs_sid == sid)
@@ -2183,26 +2220,47 @@ htsp_find_subscription_by_msg(htsp_connection_t *hc, htsmsg_t *m)
 }
 
 
+/**
+ *
+ */
+static htsp_subscription_t *
+htsp_find_subscription_by_msg(htsp_connection_t *hc, htsmsg_t *m)
+{
+  uint32_t sid;
+
+  if(htsmsg_get_u32(m, "subscriptionId", &sid))
+    return NULL;
+  return htsp_find_subscription(hc, sid);
+}
+
+
+/**
+ * The parts of a muxpkt message we care about
+ */
+typedef struct htsp_muxpkt {
+  uint32_t hmp_sid;
+  uint32_t hmp_stream;
+  uint32_t hmp_duration;
+  int64_t hmp_pts;
+  int64_t hmp_dts;
+  const void *hmp_payload;
+  size_t hmp_payload_len;
+} htsp_muxpkt_t;
+
+
 /**
  * Transport input
  */
 static void
-htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
+htsp_mux_packet(htsp_connection_t *hc, const htsp_muxpkt_t *hmp)
 {
   htsp_subscription_t *hs;
   htsp_subscription_stream_t *hss;
-  uint32_t stream;
+  const uint32_t stream = hmp->hmp_stream;
   media_pipe_t *mp;
-  const void *bin;
-  size_t binlen;
   media_buf_t *mb;
-  int64_t timeshift;
 
-  if(htsmsg_get_u32(m, "stream", &stream)  ||
-     htsmsg_get_bin(m, "payload", &bin, &binlen))
-    return;
-
-  if((hs = htsp_find_subscription_by_msg(hc, m)) == NULL)
+  if((hs = htsp_find_subscription(hc, hmp->hmp_sid)) == NULL)
     return;
 
   mp = hs->hs_mp;
@@ -2216,32 +2274,19 @@ htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
 
     if(hss != NULL) {
 
-      mb = media_buf_alloc_unlocked(mp, binlen);
+      mb = media_buf_alloc_unlocked(mp, hmp->hmp_payload_len);
       mb->mb_data_type = hss->hss_data_type;
       mb->mb_stream = hss->hss_index;
-
-      uint32_t u32;
-
-      if(htsmsg_get_u32(m, "duration", &u32))
-	mb->mb_duration = 0;
-      else
-        mb->mb_duration = u32;
-
-      if(htsmsg_get_s64(m, "dts", &mb->mb_dts))
-	mb->mb_dts = PTS_UNSET;
-
-      if(htsmsg_get_s64(m, "pts", &mb->mb_pts))
-	mb->mb_pts = PTS_UNSET;
-
-      if(htsmsg_get_s64(m, "timeshift", &timeshift))
-	timeshift = 0;
+      mb->mb_duration = hmp->hmp_duration;
+      mb->mb_dts = hmp->hmp_dts;
+      mb->mb_pts = hmp->hmp_pts;
 
       if(hss->hss_cw != NULL)
 	mb->mb_cw = media_codec_ref(hss->hss_cw);
 
-      memcpy(mb->mb_data, bin, binlen);
+      memcpy(mb->mb_data, hmp->hmp_payload, hmp->hmp_payload_len);
 
-      mb->mb_size = binlen;
+      mb->mb_size = hmp->hmp_payload_len;
 
       if(mb->mb_data_type == MB_SUBTITLE)
 	mb->mb_font_context = 0;
@@ -2256,6 +2301,137 @@ htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
 }
 
 
+/**
+ * Transport input from a deserialized message
+ */
+static void
+htsp_mux_input(htsp_connection_t *hc, htsmsg_t *m)
+{
+  htsp_muxpkt_t hmp;
+
+  if(htsmsg_get_u32(m, "subscriptionId", &hmp.hmp_sid) ||
+     htsmsg_get_u32(m, "stream", &hmp.hmp_stream)  ||
+     htsmsg_get_bin(m, "payload", &hmp.hmp_payload, &hmp.hmp_payload_len))
+    return;
+
+  if(htsmsg_get_u32(m, "duration", &hmp.hmp_duration))
+    hmp.hmp_duration = 0;
+
+  if(htsmsg_get_s64(m, "dts", &hmp.hmp_dts))
+    hmp.hmp_dts = PTS_UNSET;
+
+  if(htsmsg_get_s64(m, "pts", &hmp.hmp_pts))
+    hmp.hmp_pts = PTS_UNSET;
+
+  htsp_mux_packet(hc, &hmp);
+}
+
+
+/**
+ *
+ */
+static int
+htsp_field_is(const uint8_t *name, unsigned int namelen, const char *str)
+{
+  return strlen(str) == namelen && !memcmp(name, str, namelen);
+}
+
+
+/**
+ * Transport input straight from the receive buffer.
+ *
+ * Walks the top level fields of the serialized message without
+ * allocating anything. Returns 1 if the message was a muxpkt and has
+ * been taken care of, 0 if it should go through the regular
+ * deserializer instead (including anything we don't fully understand)
+ */
+static int
+htsp_mux_input_raw(htsp_connection_t *hc, const uint8_t *buf, size_t len)
+{
+  htsp_muxpkt_t hmp = {
+    .hmp_dts = PTS_UNSET,
+    .hmp_pts = PTS_UNSET,
+  };
+  int is_muxpkt = 0, have_sid = 0, have_stream = 0;
+
+  while(len > 5) {
+    const unsigned int type    = buf[0];
+    const unsigned int namelen = buf[1];
+    const unsigned int datalen = (buf[2] << 24) | (buf[3] << 16) |
+                                 (buf[4] << 8)  | buf[5];
+    buf += 6;
+    len -= 6;
+
+    if(len < namelen + datalen)
+      return 0;
+
+    const uint8_t *name = buf;
+    const uint8_t *data = buf + namelen;
+
+    buf += namelen + datalen;
+    len -= namelen + datalen;
+
+    switch(type) {
+    case HMF_STR:
+      if(htsp_field_is(name, namelen, "method")) {
+        if(datalen != 6 || memcmp(data, "muxpkt", 6))
+          return 0;
+        is_muxpkt = 1;
+      }
+      break;
+
+    case HMF_BIN:
+      if(htsp_field_is(name, namelen, "payload")) {
+        hmp.hmp_payload = data;
+        hmp.hmp_payload_len = datalen;
+      }
+      break;
+
+    case HMF_S64:
+      if(datalen > 8)
+        return 0;
+
+      uint64_t u64 = 0;
+      for(int i = datalen - 1; i >= 0; i--)
+        u64 = (u64 << 8) | data[i];
+      int64_t s64 = u64;
+
+      if(htsp_field_is(name, namelen, "pts")) {
+        hmp.hmp_pts = s64;
+      } else if(htsp_field_is(name, namelen, "dts")) {
+        hmp.hmp_dts = s64;
+      } else if(htsp_field_is(name, namelen, "duration")) {
+        hmp.hmp_duration = s64 < 0 || s64 > 0xffffffffLL ? 0 : s64;
+      } else if(htsp_field_is(name, namelen, "stream")) {
+        if(s64 < 0 || s64 > 0xffffffffLL)
+          return 0;
+        hmp.hmp_stream = s64;
+        have_stream = 1;
+      } else if(htsp_field_is(name, namelen, "subscriptionId")) {
+        if(s64 < 0 || s64 > 0xffffffffLL)
+          return 0;
+        hmp.hmp_sid = s64;
+        have_sid = 1;
+      }
+      break;
+
+    case HMF_MAP:
+    case HMF_LIST:
+      break;
+
+    default:
+      return 0;
+    }
+  }
+
+  if(!is_muxpkt || !have_sid || !have_stream || hmp.hmp_payload == NULL)
+    return 0;
+
+  htsp_mux_packet(hc, &hmp);
+  return 1;
+}
+
+
 /**
  *
  */
@@ -2389,6 +2565,7 @@ htsp_subscriptionStart(htsp_connection_t *hc, htsmsg_t *m)
 
       htsmsg_get_u32(sub, "width", &mcp.width);
       htsmsg_get_u32(sub, "height", &mcp.height);
+      mcp.low_latency = 1;
 
       /**
        * Try to create the codec
@@ -28,6 +28,8 @@ buf_t *blobcache_get(const char *key, const char *stash, int pad,
 int blobcache_get_meta(const char *key, const char *stash,
 		       char **etag, time_t *mtime);
 
+time_t blobcache_get_expiry(const char *key, const char *stash);
+
 int blobcache_put(const char *key, const char *stash, buf_t *buf,
 		  int maxage, const char *etag, time_t mtime,
                   int flags);
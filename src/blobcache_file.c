@@ -650,6 +650,32 @@ blobcache_get_meta(const char *key, const char *stash,
 }
 
 
+/**
+ * Returns when the item expires, 0 if it's not in the cache
+ */
+time_t
+blobcache_get_expiry(const char *key, const char *stash)
+{
+  uint64_t dk = digest_key(key, stash);
+  blobcache_item_t *p;
+  time_t r = 0;
+
+  hts_mutex_lock(&cache_lock);
+
+  if(bcstate != BLOBCACHE_STOPPING) {
+    for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link) {
+      if(p->bi_key_hash == dk) {
+        r = p->bi_expiry;
+        break;
+      }
+    }
+  }
+
+  hts_mutex_unlock(&cache_lock);
+  return r;
+}
+
+
 /**
  * Assume we're locked
  */
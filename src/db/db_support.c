@@ -24,9 +24,32 @@
 #include "main.h"
 #include "fileaccess/fileaccess.h"
 #include "misc/minmax.h"
+#include "misc/callout.h"
+#include "task.h"
 
 #include "db_support.h"
 
+/**
+ * Cache of prepared statements, keyed on connection and SQL text.
+ * Buckets are hashed on connection only so db_close() and
+ * db_release_cached() can find all statements for a connection
+ */
+typedef struct db_stmt_cache_entry {
+  LIST_ENTRY(db_stmt_cache_entry) dsce_link;
+  sqlite3 *dsce_db;
+  const char *dsce_sql;
+  sqlite3_stmt *dsce_stmt;
+  int dsce_inuse;
+} db_stmt_cache_entry_t;
+
+#define DB_STMT_CACHE_HASH 31
+
+static LIST_HEAD(, db_stmt_cache_entry) db_stmt_cache[DB_STMT_CACHE_HASH];
+static hts_mutex_t db_stmt_cache_mutex;
+
+#define db_stmt_cache_bucket(db) \
+  (&db_stmt_cache[((uintptr_t)(db) >> 4) % DB_STMT_CACHE_HASH])
+
 
 typedef struct unlock_notify {
   int fired;
@@ -110,6 +133,92 @@ db_preparex(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
   return rc;
 }
 
+/**
+ * Like db_prepare() but keep the statement around for next time.
+ * zSql is compared by pointer so it must be a constant.
+ * Statement must be returned with db_release_cached()
+ */
+int
+db_prepare_cachedx(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
+                   const char *file, int line)
+{
+  db_stmt_cache_entry_t *dsce;
+  int rc;
+
+  hts_mutex_lock(&db_stmt_cache_mutex);
+  LIST_FOREACH(dsce, db_stmt_cache_bucket(db), dsce_link) {
+    if(dsce->dsce_db == db && dsce->dsce_sql == zSql && !dsce->dsce_inuse) {
+      dsce->dsce_inuse = 1;
+      *ppStmt = dsce->dsce_stmt;
+      hts_mutex_unlock(&db_stmt_cache_mutex);
+      return SQLITE_OK;
+    }
+  }
+  hts_mutex_unlock(&db_stmt_cache_mutex);
+
+  rc = db_preparex(db, ppStmt, zSql, file, line);
+  if(rc != SQLITE_OK)
+    return rc;
+
+  dsce = malloc(sizeof(db_stmt_cache_entry_t));
+  dsce->dsce_db = db;
+  dsce->dsce_sql = zSql;
+  dsce->dsce_stmt = *ppStmt;
+  dsce->dsce_inuse = 1;
+
+  hts_mutex_lock(&db_stmt_cache_mutex);
+  LIST_INSERT_HEAD(db_stmt_cache_bucket(db), dsce, dsce_link);
+  hts_mutex_unlock(&db_stmt_cache_mutex);
+  return SQLITE_OK;
+}
+
+
+/**
+ *
+ */
+void
+db_release_cached(sqlite3_stmt *stmt)
+{
+  db_stmt_cache_entry_t *dsce;
+  sqlite3 *db = sqlite3_db_handle(stmt);
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  hts_mutex_lock(&db_stmt_cache_mutex);
+  LIST_FOREACH(dsce, db_stmt_cache_bucket(db), dsce_link) {
+    if(dsce->dsce_stmt == stmt) {
+      dsce->dsce_inuse = 0;
+      break;
+    }
+  }
+  hts_mutex_unlock(&db_stmt_cache_mutex);
+  assert(dsce != NULL);
+}
+
+
+/**
+ * Close connection, finalizing all cached statements first
+ */
+void
+db_close(sqlite3 *db)
+{
+  db_stmt_cache_entry_t *dsce, *next;
+
+  hts_mutex_lock(&db_stmt_cache_mutex);
+  for(dsce = LIST_FIRST(db_stmt_cache_bucket(db)); dsce != NULL; dsce = next) {
+    next = LIST_NEXT(dsce, dsce_link);
+    if(dsce->dsce_db != db)
+      continue;
+    LIST_REMOVE(dsce, dsce_link);
+    sqlite3_finalize(dsce->dsce_stmt);
+    free(dsce);
+  }
+  hts_mutex_unlock(&db_stmt_cache_mutex);
+  sqlite3_close(db);
+}
+
+
 /**
  *
  */
@@ -461,7 +570,7 @@ db_pool_put(db_pool_t *dp, sqlite3 *db)
     TRACE(TRACE_ERROR, "DB",
 	  "%s: db handle returned to pool while in transaction, closing handle",
 	  dp->dp_path);
-    sqlite3_close(db);
+    db_close(db);
     return;
   }
 
@@ -475,7 +584,7 @@ db_pool_put(db_pool_t *dp, sqlite3 *db)
   }
 
   hts_mutex_unlock(&dp->dp_mutex);
-  sqlite3_close(db);
+  db_close(db);
 }
 
 
@@ -493,7 +602,7 @@ db_pool_close(db_pool_t *dp)
   dp->dp_closed = 1;
   for(i = 0; i < dp->dp_size; i++)
     if(dp->dp_pool[i] != NULL)
-      sqlite3_close(dp->dp_pool[i]);
+      db_close(dp->dp_pool[i]);
   hts_mutex_unlock(&dp->dp_mutex);
 }
 
@@ -508,6 +617,16 @@ db_rstr(sqlite3_stmt *stmt, int col)
 }
 
 
+/**
+ * For columns with lots of repetition (artist, album, codec, ...)
+ */
+rstr_t *
+db_rstr_intern(sqlite3_stmt *stmt, int col)
+{
+  return rstr_intern((const char *)sqlite3_column_text(stmt, col));
+}
+
+
 /**
  *
  */
@@ -675,6 +794,358 @@ static struct sqlite3_mutex_methods sqlite_mutexes = {
 
 
 
+/**
+ * Write-behind queue
+ */
+#define DB_WB_HASH 127
+
+TAILQ_HEAD(db_wb_entry_queue, db_wb_entry);
+
+struct db_wb {
+  const db_wb_class_t *dw_class;
+  db_pool_t *dw_pool;
+  int64_t dw_delay;   // µs
+  int dw_max_entries;
+
+  hts_mutex_t dw_mutex;
+  hts_mutex_t dw_flush_mutex;  // Serializes flushes
+
+  struct db_wb_entry_queue dw_pending;
+  int dw_num_pending;
+
+  // Holds both pending and in-flight entries, newest first
+  LIST_HEAD(, db_wb_entry) dw_hash[DB_WB_HASH];
+
+  callout_t dw_timer;
+  int dw_task_pending;
+  int dw_closed;
+
+  // Statistics
+  int dw_enqueued;
+  int dw_merged;
+  int dw_written;
+  int dw_failed;
+  int dw_transactions;
+  int64_t dw_flush_time;
+};
+
+
+/**
+ *
+ */
+db_wb_t *
+db_wb_create(const db_wb_class_t *dwc, db_pool_t *pool,
+             int delay_ms, int max_entries)
+{
+  db_wb_t *dw = calloc(1, sizeof(db_wb_t));
+  dw->dw_class = dwc;
+  dw->dw_pool = pool;
+  dw->dw_delay = delay_ms * 1000LL;
+  dw->dw_max_entries = max_entries;
+  hts_mutex_init(&dw->dw_mutex);
+  hts_mutex_init(&dw->dw_flush_mutex);
+  TAILQ_INIT(&dw->dw_pending);
+  return dw;
+}
+
+
+/**
+ *
+ */
+static void
+db_wb_entry_destroy(db_wb_t *dw, db_wb_entry_t *dwe)
+{
+  free(dwe->dwe_key);
+  dw->dw_class->dwc_destroy(dwe);
+}
+
+
+/**
+ *
+ */
+static void
+db_wb_flush_task(void *aux)
+{
+  db_wb_t *dw = aux;
+  hts_mutex_lock(&dw->dw_mutex);
+  dw->dw_task_pending = 0;
+  hts_mutex_unlock(&dw->dw_mutex);
+  db_wb_flush(dw);
+}
+
+
+/**
+ * Must be called with dw_mutex held
+ */
+static void
+db_wb_schedule(db_wb_t *dw)
+{
+  if(dw->dw_task_pending)
+    return;
+  dw->dw_task_pending = 1;
+  task_run(db_wb_flush_task, dw);
+}
+
+
+/**
+ *
+ */
+static void
+db_wb_timer(callout_t *c, void *aux)
+{
+  db_wb_t *dw = aux;
+  hts_mutex_lock(&dw->dw_mutex);
+  db_wb_schedule(dw);
+  hts_mutex_unlock(&dw->dw_mutex);
+}
+
+
+/**
+ * Must be called with dw_mutex held
+ */
+db_wb_entry_t *
+db_wb_find(db_wb_t *dw, const char *key)
+{
+  db_wb_entry_t *dwe;
+
+  if(dw == NULL)
+    return NULL;
+
+  LIST_FOREACH(dwe, &dw->dw_hash[mystrhash(key) % DB_WB_HASH], dwe_hash_link)
+    if(!strcmp(dwe->dwe_key, key))
+      return dwe;
+  return NULL;
+}
+
+
+/**
+ * Queue an entry for writing. The queue takes ownership of both the
+ * entry and the (malloc'ed) key. A pending entry with the same key is
+ * replaced
+ */
+void
+db_wb_enqueue(db_wb_t *dw, db_wb_entry_t *dwe, char *key)
+{
+  int flush_now = 0;
+  dwe->dwe_key = key;
+  dwe->dwe_inflight = 0;
+  dwe->dwe_failed = 0;
+
+  hts_mutex_lock(&dw->dw_mutex);
+
+  db_wb_entry_t *old = db_wb_find(dw, key);
+  if(old != NULL && !old->dwe_inflight) {
+    LIST_REMOVE(old, dwe_hash_link);
+    TAILQ_REMOVE(&dw->dw_pending, old, dwe_link);
+    dw->dw_num_pending--;
+    dw->dw_merged++;
+    db_wb_entry_destroy(dw, old);
+  }
+
+  LIST_INSERT_HEAD(&dw->dw_hash[mystrhash(key) % DB_WB_HASH], dwe,
+                   dwe_hash_link);
+  TAILQ_INSERT_TAIL(&dw->dw_pending, dwe, dwe_link);
+  dw->dw_num_pending++;
+  dw->dw_enqueued++;
+
+  if(dw->dw_closed)
+    flush_now = 1;
+  else if(dw->dw_num_pending >= dw->dw_max_entries)
+    db_wb_schedule(dw);
+  else if(!callout_isarmed(&dw->dw_timer))
+    callout_arm_hires(&dw->dw_timer, db_wb_timer, dw, dw->dw_delay);
+
+  hts_mutex_unlock(&dw->dw_mutex);
+
+  if(flush_now)
+    db_wb_flush(dw);
+}
+
+
+/**
+ * Drop a pending write
+ */
+void
+db_wb_cancel(db_wb_t *dw, const char *key)
+{
+  if(dw == NULL)
+    return;
+
+  hts_mutex_lock(&dw->dw_mutex);
+  db_wb_entry_t *dwe = db_wb_find(dw, key);
+  if(dwe != NULL && !dwe->dwe_inflight) {
+    LIST_REMOVE(dwe, dwe_hash_link);
+    TAILQ_REMOVE(&dw->dw_pending, dwe, dwe_link);
+    dw->dw_num_pending--;
+    db_wb_entry_destroy(dw, dwe);
+  }
+  hts_mutex_unlock(&dw->dw_mutex);
+}
+
+
+/**
+ *
+ */
+void
+db_wb_lock(db_wb_t *dw)
+{
+  if(dw != NULL)
+    hts_mutex_lock(&dw->dw_mutex);
+}
+
+
+/**
+ *
+ */
+void
+db_wb_unlock(db_wb_t *dw)
+{
+  if(dw != NULL)
+    hts_mutex_unlock(&dw->dw_mutex);
+}
+
+
+/**
+ * Write all pending entries in one transaction.
+ *
+ * Entries stay visible to db_wb_find() while being written so readers
+ * never observe a state older than the database. An entry failing
+ * with anything but a deadlock is dropped and the transaction is
+ * restarted without it. If the transaction itself can't be done the
+ * whole batch is dropped, all drops are traced and counted in dw_failed
+ */
+void
+db_wb_flush(db_wb_t *dw)
+{
+  struct db_wb_entry_queue q;
+  db_wb_entry_t *dwe;
+  sqlite3 *db;
+  const char *err;
+  int rc, num = 0;
+
+  if(dw == NULL)
+    return;
+
+  hts_mutex_lock(&dw->dw_flush_mutex);
+  hts_mutex_lock(&dw->dw_mutex);
+
+  callout_disarm(&dw->dw_timer);
+  TAILQ_INIT(&q);
+  while((dwe = TAILQ_FIRST(&dw->dw_pending)) != NULL) {
+    TAILQ_REMOVE(&dw->dw_pending, dwe, dwe_link);
+    TAILQ_INSERT_TAIL(&q, dwe, dwe_link);
+    dwe->dwe_inflight = 1;
+    num++;
+  }
+  dw->dw_num_pending = 0;
+  hts_mutex_unlock(&dw->dw_mutex);
+
+  if(num == 0) {
+    hts_mutex_unlock(&dw->dw_flush_mutex);
+    return;
+  }
+
+  int64_t ts = arch_get_ts();
+
+  db = db_pool_get(dw->dw_pool);
+  if(db == NULL) {
+    err = "No database connection";
+    goto fail;
+  }
+
+ again:
+  if(db_begin(db)) {
+    err = "Unable to begin transaction";
+    goto fail;
+  }
+
+  TAILQ_FOREACH(dwe, &q, dwe_link) {
+    if(dwe->dwe_failed)
+      continue;
+
+    rc = dw->dw_class->dwc_write(db, dwe);
+    if(rc == SQLITE_LOCKED) {
+      db_rollback_deadlock(db);
+      goto again;
+    }
+    if(rc != SQLITE_OK) {
+      TRACE(TRACE_ERROR, "DB", "%s: Write of %s failed, error %d",
+            dw->dw_class->dwc_name, dwe->dwe_key, rc);
+      dwe->dwe_failed = 1;
+      dw->dw_failed++;
+      db_rollback(db);
+      goto again;
+    }
+  }
+
+  if(db_commit(db)) {
+    db_rollback(db);
+    err = "Commit failed";
+    goto fail;
+  }
+
+  dw->dw_transactions++;
+  TAILQ_FOREACH(dwe, &q, dwe_link)
+    if(!dwe->dwe_failed)
+      dw->dw_written++;
+  goto done;
+
+ fail:
+  num = 0;
+  TAILQ_FOREACH(dwe, &q, dwe_link) {
+    if(!dwe->dwe_failed) {
+      dwe->dwe_failed = 1;
+      num++;
+    }
+  }
+  dw->dw_failed += num;
+  TRACE(TRACE_ERROR, "DB", "%s: %s, %d writes dropped",
+        dw->dw_class->dwc_name, err, num);
+
+ done:
+  if(db != NULL)
+    db_pool_put(dw->dw_pool, db);
+
+  dw->dw_flush_time += arch_get_ts() - ts;
+
+  hts_mutex_lock(&dw->dw_mutex);
+  while((dwe = TAILQ_FIRST(&q)) != NULL) {
+    TAILQ_REMOVE(&q, dwe, dwe_link);
+    LIST_REMOVE(dwe, dwe_hash_link);
+    db_wb_entry_destroy(dw, dwe);
+  }
+  hts_mutex_unlock(&dw->dw_mutex);
+
+  hts_mutex_unlock(&dw->dw_flush_mutex);
+}
+
+
+/**
+ * Flush and stop deferring writes. Must be called before the
+ * database pool is closed. The queue itself is never freed as
+ * flush tasks may still be in flight
+ */
+void
+db_wb_close(db_wb_t *dw)
+{
+  if(dw == NULL)
+    return;
+
+  hts_mutex_lock(&dw->dw_mutex);
+  dw->dw_closed = 1;
+  hts_mutex_unlock(&dw->dw_mutex);
+
+  db_wb_flush(dw);
+
+  TRACE(TRACE_DEBUG, "DB",
+        "%s: %d writes queued, %d merged, %d written in %d transactions "
+        "(%d failed), %d ms spent writing",
+        dw->dw_class->dwc_name, dw->dw_enqueued, dw->dw_merged,
+        dw->dw_written, dw->dw_transactions, dw->dw_failed,
+        (int)(dw->dw_flush_time / 1000));
+}
+
+
 static void
 db_log(void *aux, int code, const char *str)
 {
@@ -726,6 +1197,7 @@ db_init(void)
   sqlite3_config(SQLITE_CONFIG_LOG, &db_log, NULL);
 
   sqlite3_initialize();
+  hts_mutex_init(&db_stmt_cache_mutex);
 #ifdef PS3
   sqlite3_soft_heap_limit(10000000);
 #endif
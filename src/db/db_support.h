@@ -20,6 +20,7 @@
 #pragma once
 #include <sqlite3.h>
 #include "misc/rstr.h"
+#include "misc/queue.h"
 
 int db_one_statement(sqlite3 *db, const char *sql, const char *src);
 
@@ -45,6 +46,16 @@ int db_preparex(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
 
 #define db_prepare(db, stmt, sql) db_preparex(db, stmt, sql, __FILE__, __LINE__)
 
+int db_prepare_cachedx(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
+                       const char *file, int line);
+
+#define db_prepare_cached(db, stmt, sql) \
+  db_prepare_cachedx(db, stmt, sql, __FILE__, __LINE__)
+
+void db_release_cached(sqlite3_stmt *stmt);
+
+void db_close(sqlite3 *db);
+
 #define db_begin(db)    db_begin0(db, __FUNCTION__)
 #define db_commit(db)   db_commit0(db, __FUNCTION__)
 #define db_rollback(db) db_rollback0(db, __FUNCTION__)
@@ -70,6 +81,55 @@ void db_pool_close(db_pool_t *dp);
 
 rstr_t *db_rstr(sqlite3_stmt *stmt, int col);
 
+rstr_t *db_rstr_intern(sqlite3_stmt *stmt, int col);
+
+/**
+ * Write-behind queue. Writes are collected and committed in a single
+ * transaction when the oldest one has waited for the configured delay
+ * or when too many are pending. Queueing a write with the same key as
+ * a pending one replaces it. Plain SQL queries don't see pending
+ * writes, readers must use db_wb_find() or flush first
+ */
+typedef struct db_wb db_wb_t;
+
+typedef struct db_wb_entry {
+  TAILQ_ENTRY(db_wb_entry) dwe_link;
+  LIST_ENTRY(db_wb_entry) dwe_hash_link;
+  char *dwe_key;
+  char dwe_inflight;
+  char dwe_failed;
+} db_wb_entry_t;
+
+typedef struct db_wb_class {
+  const char *dwc_name;
+
+  /**
+   * Called within a transaction. Return SQLITE_LOCKED to restart the
+   * transaction, any other error drops the entry
+   */
+  int (*dwc_write)(sqlite3 *db, db_wb_entry_t *dwe);
+
+  void (*dwc_destroy)(db_wb_entry_t *dwe);
+} db_wb_class_t;
+
+db_wb_t *db_wb_create(const db_wb_class_t *dwc, db_pool_t *pool,
+                      int delay_ms, int max_entries);
+
+void db_wb_enqueue(db_wb_t *dw, db_wb_entry_t *dwe, char *key);
+
+void db_wb_cancel(db_wb_t *dw, const char *key);
+
+void db_wb_lock(db_wb_t *dw);
+
+void db_wb_unlock(db_wb_t *dw);
+
+db_wb_entry_t *db_wb_find(db_wb_t *dw, const char *key);
+
+void db_wb_flush(db_wb_t *dw);
+
+void db_wb_close(db_wb_t *dw);
+
+
 int db_posint(sqlite3_stmt *stmt, int col);
 
 static __inline void db_bind_rstr(sqlite3_stmt *stmt, int col, rstr_t *rstr)
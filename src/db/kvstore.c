@@ -28,19 +28,16 @@
 #include "main.h"
 #include "prop/prop_i.h"
 #include "kvstore.h"
-#include "misc/callout.h"
 #include "misc/bytestream.h"
+#include "misc/str.h"
 #include "fileaccess/fileaccess.h"
 
 #if CONFIG_KVSTORE
 
 #include "db/db_support.h"
 
-LIST_HEAD(kvstore_write_list, kvstore_write);
-
-
 typedef struct kvstore_write {
-  LIST_ENTRY(kvstore_write) kw_link;
+  db_wb_entry_t kw_entry; // Must be first
   char *kw_url;
   int kw_domain;
   char *kw_key;
@@ -58,9 +55,11 @@ typedef struct kvstore_write {
 
 
 static db_pool_t *kvstore_pool;
-static struct kvstore_write_list deferred_writes;
-static callout_t deferred_callout;
-static hts_mutex_t deferred_mutex;
+static db_wb_t *kvstore_wb;
+
+// Writes are deferred this long to be merged with others
+#define KVSTORE_WB_DELAY_MS    1000
+#define KVSTORE_WB_MAX_PENDING 256
 
 
 static const char *domain_to_name[] = {
@@ -76,6 +75,7 @@ static const char *domain_to_name[] = {
 void
 kvstore_fini(void)
 {
+  db_wb_close(kvstore_wb);
   db_pool_close(kvstore_pool);
 }
 
@@ -100,6 +100,8 @@ kvstore_close(void *db)
 }
 
 
+static const db_wb_class_t kvstore_wb_class;
+
 /**
  *
  */
@@ -109,8 +111,6 @@ kvstore_init(void)
   sqlite3 *db;
   char buf[256];
 
-  hts_mutex_init(&deferred_mutex);
-
   snprintf(buf, sizeof(buf), "%s/kvstore", gconf.persistent_path);
   fa_makedir(buf);
   snprintf(buf, sizeof(buf), "%s/kvstore/kvstore.db", gconf.persistent_path);
@@ -130,6 +130,9 @@ kvstore_init(void)
 
   if(r)
     kvstore_pool = NULL; // Disable
+  else
+    kvstore_wb = db_wb_create(&kvstore_wb_class, kvstore_pool,
+                              KVSTORE_WB_DELAY_MS, KVSTORE_WB_MAX_PENDING);
 }
 
 
@@ -521,17 +524,23 @@ kv_url_opt_get(void *db, const char *url, int domain, const char *key)
 /**
  *
  */
+static char *
+deferred_key(const char *url, int domain, const char *key)
+{
+  return fmtstr("%d\n%s\n%s", domain, key, url);
+}
+
+
+/**
+ * Must be called with kvstore_wb locked
+ */
 static kvstore_write_t *
 deferred_get(const char *url, int domain, const char *key)
 {
-  kvstore_write_t *kw;
-  LIST_FOREACH(kw, &deferred_writes, kw_link) {
-    if(!strcmp(kw->kw_url, url) &&
-       !strcmp(kw->kw_key, key) &&
-       kw->kw_domain == domain)
-      return kw;
-  }
-  return NULL;
+  char *k = deferred_key(url, domain, key);
+  kvstore_write_t *kw = (kvstore_write_t *)db_wb_find(kvstore_wb, k);
+  free(k);
+  return kw;
 }
 
 
@@ -562,7 +571,7 @@ kv_url_opt_get_rstr(const char *url, int domain, const char *key)
   if(url == NULL)
     return NULL;
 
-  hts_mutex_lock(&deferred_mutex);
+  db_wb_lock(kvstore_wb);
   kvstore_write_t *kw = deferred_get(url, domain, key);
   if(kw != NULL) {
     rstr_t *r;
@@ -584,10 +593,10 @@ kv_url_opt_get_rstr(const char *url, int domain, const char *key)
     default:
       r = NULL;
     }
-    hts_mutex_unlock(&deferred_mutex);
+    db_wb_unlock(kvstore_wb);
     return r;
   }
-  hts_mutex_unlock(&deferred_mutex);
+  db_wb_unlock(kvstore_wb);
 
   void *data;
   size_t size;
@@ -632,7 +641,7 @@ kv_url_opt_get_int(const char *url, int domain, const char *key, int def)
   if(url == NULL)
     return def;
 
-  hts_mutex_lock(&deferred_mutex);
+  db_wb_lock(kvstore_wb);
   kvstore_write_t *kw = deferred_get(url, domain, key);
   if(kw != NULL) {
     int r;
@@ -653,10 +662,10 @@ kv_url_opt_get_int(const char *url, int domain, const char *key, int def)
       r = def;
       break;
     }
-    hts_mutex_unlock(&deferred_mutex);
+    db_wb_unlock(kvstore_wb);
     return r;
   }
-  hts_mutex_unlock(&deferred_mutex);
+  db_wb_unlock(kvstore_wb);
 
 
   void *data;
@@ -702,7 +711,7 @@ kv_url_opt_get_int64(const char *url, int domain, const char *key, int64_t def)
   if(url == NULL)
     return def;
 
-  hts_mutex_lock(&deferred_mutex);
+  db_wb_lock(kvstore_wb);
   kvstore_write_t *kw = deferred_get(url, domain, key);
   if(kw != NULL) {
     int64_t r;
@@ -723,10 +732,10 @@ kv_url_opt_get_int64(const char *url, int domain, const char *key, int64_t def)
       r = def;
       break;
     }
-    hts_mutex_unlock(&deferred_mutex);
+    db_wb_unlock(kvstore_wb);
     return r;
   }
-  hts_mutex_unlock(&deferred_mutex);
+  db_wb_unlock(kvstore_wb);
 
   void *data;
   size_t size;
@@ -913,92 +922,60 @@ kv_write_xattr(const kvstore_write_t *kw)
 /**
  *
  */
-void
-kvstore_deferred_flush(void)
+static int
+kv_wb_write(sqlite3 *db, db_wb_entry_t *dwe)
 {
-  kvstore_write_t *kw;
-  void *db;
-  int rc;
+  const kvstore_write_t *kw = (const kvstore_write_t *)dwe;
   uint64_t id = 0;
-  const char *current_url;
-
-  db = kvstore_get();
-  if(db == NULL)
-    return;
-
-  hts_mutex_lock(&deferred_mutex);
-
- again:
-  if(db_begin(db))
-    goto err;
-
-  current_url = NULL;
-
-  LIST_FOREACH(kw, &deferred_writes, kw_link) {
+  int rc;
 
-    if(gconf.fa_kvstore_as_xattr) {
-      if(!kv_write_xattr(kw))
-        continue;
-    }
+  if(gconf.fa_kvstore_as_xattr) {
+    if(!kv_write_xattr(kw))
+      return SQLITE_OK;
+  }
 
 #ifdef STOS
-    if(kw->kw_unimportant)
-      continue;
+  if(kw->kw_unimportant)
+    return SQLITE_OK;
 #endif
 
-    if(current_url == NULL || strcmp(kw->kw_url, current_url)) {
-
-      rc = get_url(db, kw->kw_url, &id);
-      if(rc == SQLITE_LOCKED) {
-        db_rollback_deadlock(db);
-        goto again;
-      }
-
-      if(rc != SQLITE_OK) {
-        db_rollback(db);
-        goto err;
-      }
-      current_url = kw->kw_url;
-    }
-
-    rc = kv_write_db(db, kw, id);
-    if(rc == SQLITE_LOCKED) {
-      db_rollback_deadlock(db);
-      goto again;
-    }
-    if(rc != SQLITE_OK) {
-      db_rollback(db);
-      goto err;
-    }
-  }
-
-  db_commit(db);
+  rc = get_url(db, kw->kw_url, &id);
+  if(rc != SQLITE_OK)
+    return rc;
 
- err:
+  return kv_write_db(db, kw, id);
+}
 
-  while((kw = LIST_FIRST(&deferred_writes)) != NULL) {
-    LIST_REMOVE(kw, kw_link);
-    free(kw->kw_url);
-    free(kw->kw_key);
-    if(kw->kw_type == KVSTORE_SET_STRING)
-      free(kw->kw_string);
-    free(kw);
-  }
 
+/**
+ *
+ */
+static void
+kv_wb_destroy(db_wb_entry_t *dwe)
+{
+  kvstore_write_t *kw = (kvstore_write_t *)dwe;
+  free(kw->kw_url);
+  free(kw->kw_key);
+  if(kw->kw_type == KVSTORE_SET_STRING)
+    free(kw->kw_string);
+  free(kw);
+}
 
-  hts_mutex_unlock(&deferred_mutex);
-  kvstore_close(db);
 
-}
+static const db_wb_class_t kvstore_wb_class = {
+  .dwc_name    = "kvstore",
+  .dwc_write   = kv_wb_write,
+  .dwc_destroy = kv_wb_destroy,
+};
 
 
 /**
  *
  */
-static void
-deferred_callout_fire(struct callout *c, void *opaque)
+void
+kvstore_deferred_flush(void)
 {
-  kvstore_deferred_flush();
+  db_wb_flush(kvstore_wb);
 }
 
 
@@ -1011,24 +988,16 @@ kv_url_opt_set(const char *url, int domain, const char *key,
 {
   va_list ap;
   const char *str;
-  va_start(ap, type);
-
-  hts_mutex_lock(&deferred_mutex);
 
-  kvstore_write_t *kw = deferred_get(url, domain, key);
-
-  if(kw == NULL) {
-    kw = malloc(sizeof(kvstore_write_t));
-    kw->kw_url    = strdup(url);
-    kw->kw_key    = strdup(key);
-    kw->kw_domain = domain;
-    LIST_INSERT_HEAD(&deferred_writes, kw, kw_link);
-  } else {
-    if(kw->kw_type == KVSTORE_SET_STRING)
-      free(kw->kw_string);
-  }
+  if(kvstore_wb == NULL)
+    return;
 
+  va_start(ap, type);
 
+  kvstore_write_t *kw = malloc(sizeof(kvstore_write_t));
+  kw->kw_url    = strdup(url);
+  kw->kw_key    = strdup(key);
+  kw->kw_domain = domain;
   kw->kw_type = type & 0xff;
   kw->kw_unimportant = type & KVSTORE_UNIMPORTANT;
 
@@ -1053,11 +1022,10 @@ kv_url_opt_set(const char *url, int domain, const char *key,
   default:
     break;
   }
-
-  hts_mutex_unlock(&deferred_mutex);
-
-  callout_arm(&deferred_callout, deferred_callout_fire, NULL, 1);
   va_end(ap);
+
+  // Replaces any pending write of the same key
+  db_wb_enqueue(kvstore_wb, &kw->kw_entry, deferred_key(url, domain, key));
 }
 
 #else
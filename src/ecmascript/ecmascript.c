@@ -610,6 +610,8 @@ es_context_create(const char *id, int flags, const char *url,
   hts_mutex_init(&ec->ec_mutex);
   atomic_set(&ec->ec_refcount, 1);
 
+  TAILQ_INIT(&ec->ec_http_pending);
+
   ec->ec_prop_unload_destroy = prop_vec_create(16);
 
   ec->ec_prop_dispatch_group = prop_dispatch_group_create();
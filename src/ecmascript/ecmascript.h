@@ -38,6 +38,7 @@ struct buf;
 
 LIST_HEAD(es_resource_list, es_resource);
 LIST_HEAD(es_context_list, es_context);
+TAILQ_HEAD(es_http_request_queue, es_http_request);
 
 #define ECMASCRIPT_MAX_NATIVE_CLASSES 16
 
@@ -110,6 +111,10 @@ typedef struct es_context {
 
   int ec_rooted_objects;
 
+  // Asynchronous HTTP requests waiting for a free slot (see es_io.c)
+  struct es_http_request_queue ec_http_pending;
+  int ec_http_inflight;
+
 } es_context_t;
 
 
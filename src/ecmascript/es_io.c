@@ -35,12 +35,25 @@
 
 extern ecmascript_native_class_t es_native_htsmsg;
 
+/**
+ * Max number of concurrent asynchronous HTTP requests per plugin.
+ * Additional requests are queued in the context and started as
+ * earlier requests complete
+ */
+#define ES_HTTP_MAX_INFLIGHT 4
+
 /**
  *
  */
 typedef struct es_http_request {
   es_resource_t super;
 
+  TAILQ_ENTRY(es_http_request) ehr_link;
+  char ehr_queued;    // On ec_http_pending
+  char ehr_running;   // Executing on a task thread
+  char ehr_streaming; // Body is delivered thru rooted 'onData' callback
+  char ehr_ondata;    // Root key for 'onData', only the address is used
+
   char *ehr_url;
   struct http_header_list ehr_request_headers;
   struct http_header_list ehr_response_headers;
@@ -91,8 +104,20 @@ static void
 es_http_request_destroy(es_resource_t *eres)
 {
   es_http_request_t *ehr = (es_http_request_t *)eres;
-  ehr_cleanup(ehr);
-  es_root_unregister(eres->er_ctx->ec_duk, eres);
+  es_context_t *ec = eres->er_ctx;
+
+  if(ehr->ehr_queued) {
+    TAILQ_REMOVE(&ec->ec_http_pending, ehr, ehr_link);
+    ehr->ehr_queued = 0;
+  }
+
+  // If request is still executing, ehr_task() will cleanup when done
+  if(!ehr->ehr_running)
+    ehr_cleanup(ehr);
+
+  if(ehr->ehr_streaming)
+    es_root_unregister(ec->ec_duk, &ehr->ehr_ondata);
+  es_root_unregister(ec->ec_duk, eres);
   es_resource_unlink(&ehr->super);
 }
 
@@ -154,13 +179,52 @@ disable_cache_on_http_headers(struct http_header_list *list)
 }
 
 
+/**
+ * Deliver a chunk of response body to the 'onData' callback.
+ * Called on the task thread executing the request
+ */
+static int
+ehr_data_cb(void *opaque, const void *data, size_t size)
+{
+  es_http_request_t *ehr = opaque;
+  es_context_t *ec = ehr->super.er_ctx;
+  int rval;
+
+  if(size == 0)
+    return 0; // End of body is signalled via the completion callback
+
+  duk_context *ctx = es_context_begin(ec);
+
+  if(ehr->super.er_zombie) {
+    rval = 1;
+  } else {
+    es_push_root(ctx, &ehr->ehr_ondata);
+
+    void *ptr = duk_push_fixed_buffer(ctx, size);
+    memcpy(ptr, data, size);
+
+    if(duk_pcall(ctx, 1)) {
+      es_dump_err(ctx);
+      rval = 1;
+    } else {
+      // Returning false from onData aborts the transfer
+      rval = duk_is_boolean(ctx, -1) && !duk_get_boolean(ctx, -1);
+    }
+    duk_pop(ctx);
+  }
+
+  es_context_end(ec, 0, ctx);
+  return rval;
+}
+
+
 /**
  *
  */
 static void
 es_http_do_request(es_http_request_t *ehr)
 {
-  if(ehr->ehr_cache &&
+  if(ehr->ehr_cache && !ehr->ehr_streaming &&
      (ehr->ehr_method == NULL || !strcmp(ehr->ehr_method, "GET")) &&
      ehr->ehr_headreq == 0 &&
      ehr->ehr_postdata == NULL) {
@@ -189,7 +253,10 @@ es_http_do_request(es_http_request_t *ehr)
     ehr->ehr_error =
       http_req(ehr->ehr_url,
                HTTP_ARGLIST(ehr->ehr_httpargs),
-               HTTP_RESULT_PTR(ehr->ehr_headreq ? NULL : &ehr->ehr_result),
+               HTTP_RESULT_PTR(ehr->ehr_headreq || ehr->ehr_streaming ?
+                               NULL : &ehr->ehr_result),
+               HTTP_DATA_CALLBACK(ehr->ehr_streaming ? ehr_data_cb : NULL,
+                                  ehr),
                HTTP_ERRBUF(ehr->ehr_errbuf, sizeof(ehr->ehr_errbuf)),
                HTTP_POSTDATA(ehr->ehr_postdata, ehr->ehr_postcontenttype),
                HTTP_FLAGS(ehr->ehr_flags),
@@ -246,6 +313,8 @@ es_http_push_result(duk_context *ctx, es_http_request_t *ehr)
 
 
 
+static void ehr_start(es_context_t *ec, es_http_request_t *ehr);
+
 /**
  *
  */
@@ -259,26 +328,57 @@ ehr_task(void *aux)
   es_context_t *ec = ehr->super.er_ctx;
   duk_context *ctx = es_context_begin(ec);
 
-  es_push_root(ctx, ehr);
+  ehr->ehr_running = 0;
+
+  if(!ehr->super.er_zombie) {
+    es_push_root(ctx, ehr);
+
+    if(ehr->ehr_error == 0 ||
+       (ehr->ehr_flags & FA_CONTENT_ON_ERROR && ehr->ehr_http_status)) {
+      duk_push_boolean(ctx, 0);
+      es_http_push_result(ctx, ehr);
+    } else {
+      duk_push_string(ctx, ehr->ehr_errbuf);
+      duk_push_undefined(ctx);
+    }
+
+    int rc = duk_pcall(ctx, 2);
+    if(rc)
+      es_dump_err(ctx);
 
-  if(ehr->ehr_error == 0 ||
-     (ehr->ehr_flags & FA_CONTENT_ON_ERROR && ehr->ehr_http_status)) {
-    duk_push_boolean(ctx, 0);
-    es_http_push_result(ctx, ehr);
+    duk_pop(ctx);
+
+    es_resource_destroy(&ehr->super);
   } else {
-    duk_push_string(ctx, ehr->ehr_errbuf);
-    duk_push_undefined(ctx);
+    // Destroyed while we were running, cleanup was deferred to us
+    ehr_cleanup(ehr);
   }
 
-  int rc = duk_pcall(ctx, 2);
-  if(rc)
-    es_dump_err(ctx);
-
-  duk_pop(ctx);
+  ec->ec_http_inflight--;
 
-  es_resource_destroy(&ehr->super);
+  // Kick next queued request (if any)
+  es_http_request_t *next = TAILQ_FIRST(&ec->ec_http_pending);
+  if(next != NULL && ec->ec_http_inflight < ES_HTTP_MAX_INFLIGHT) {
+    TAILQ_REMOVE(&ec->ec_http_pending, next, ehr_link);
+    next->ehr_queued = 0;
+    ehr_start(ec, next);
+  }
 
   es_context_end(ec, 1, ctx);
+  es_resource_release(&ehr->super);
+}
+
+
+/**
+ * Must be called with context locked
+ */
+static void
+ehr_start(es_context_t *ec, es_http_request_t *ehr)
+{
+  ec->ec_http_inflight++;
+  ehr->ehr_running = 1;
+  es_resource_retain(&ehr->super);
+  task_run(ehr_task, ehr);
 }
 
 
@@ -418,7 +518,24 @@ es_http_req(duk_context *ctx)
     // Async mode
     es_resource_link(&ehr->super, ec, 1);
     es_root_register(ctx, 2, ehr);
-    task_run(ehr_task, ehr);
+
+    /**
+     * If an 'onData' callback is given the response body is streamed
+     * to it in chunks as it arrives instead of being buffered
+     */
+    duk_get_prop_string(ctx, 1, "onData");
+    if(duk_is_function(ctx, -1)) {
+      es_root_register(ctx, -1, &ehr->ehr_ondata);
+      ehr->ehr_streaming = 1;
+    }
+    duk_pop(ctx);
+
+    if(ec->ec_http_inflight < ES_HTTP_MAX_INFLIGHT) {
+      ehr_start(ec, ehr);
+    } else {
+      TAILQ_INSERT_TAIL(&ec->ec_http_pending, ehr, ehr_link);
+      ehr->ehr_queued = 1;
+    }
     return 0;
   }
 
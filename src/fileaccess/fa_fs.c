@@ -862,6 +862,17 @@ fs_ftruncate(fa_handle_t *fh0, uint64_t newsize)
 }
 
 
+/**
+ * Used for sendfile() and friends
+ */
+static int
+fs_native_fd(fa_handle_t *fh0)
+{
+  fs_handle_t *fh = (fs_handle_t *)fh0;
+  return fh->part_count == 1 ? fh->parts[0].fd : -1;
+}
+
+
 fa_protocol_t fa_protocol_fs = {
   .fap_name = "file",
   .fap_scan = fs_scandir,
@@ -894,6 +905,7 @@ fa_protocol_t fa_protocol_fs = {
 
   .fap_fsinfo = fs_fsinfo,
   .fap_ftruncate = fs_ftruncate,
+  .fap_native_fd = fs_native_fd,
 
 };
 
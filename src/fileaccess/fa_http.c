@@ -43,6 +43,7 @@
 #include "misc/callout.h"
 #include "misc/average.h"
 #include "misc/minmax.h"
+#include "misc/evtrace.h"
 
 #include "usage.h"
 
@@ -64,6 +65,11 @@ static struct http_request_inspector_list http_request_inspectors;
  */
 #define STREAMING_LIMIT 128000
 
+/**
+ * Size of temporary buffers used when receiving content
+ */
+#define HTTP_TMP_SIZE 16384
+
 
 
 static int http_tokenize(char *buf, char **vec, int vecsize, int delimiter);
@@ -452,8 +458,9 @@ http_connection_park(http_connection_t *hc, int dbg, int max_age,
 
   hts_mutex_lock(&http_connections_mutex);
 
-  callout_arm_managed(&hc->hc_callout, http_connection_ka_expired,
-                      hc, max_age * 1000000LL, http_connection_lockmgr);
+  callout_arm_flags(&hc->hc_callout, http_connection_ka_expired,
+                    hc, max_age * 1000000LL, http_connection_lockmgr,
+                    CALLOUT_SLACK | CALLOUT_WORKER);
 
   TAILQ_REMOVE(&http_active_connections, hc, hc_link);
   hts_cond_broadcast(&http_connections_cond);
@@ -1118,6 +1125,73 @@ http_read_content(http_file_t *hf)
 }
 
 
+/**
+ * Like http_read_content() but pass the body to the callback in pieces
+ * as it arrives. If the callback returns non-zero no more data is
+ * delivered, but the body is still read to keep the connection usable
+ */
+static int
+http_stream_content(http_file_t *hf, http_data_cb_t *cb, void *opaque)
+{
+  int csize, len, stopped = 0;
+  int64_t s;
+  char chunkheader[100];
+  http_connection_t *hc = hf->hf_connection;
+  char *buf = malloc(HTTP_TMP_SIZE);
+
+  if(buf == NULL)
+    return -1;
+
+  if(hf->hf_chunked_transfer) {
+
+    while(1) {
+      if(tcp_read_line(hc->hc_tc, chunkheader, sizeof(chunkheader)) < 0)
+	break;
+
+      csize = strtol(chunkheader, NULL, 16);
+
+      for(len = 0; len < csize; len += s) {
+        s = MIN(csize - len, HTTP_TMP_SIZE);
+	if(tcp_read_data(hc->hc_tc, buf, s, NULL, 0))
+	  goto bad;
+        if(!stopped)
+          stopped = cb(opaque, buf, s);
+      }
+
+      if(tcp_read_data(hc->hc_tc, chunkheader, 2, NULL, 0))
+	break;
+
+      if(csize == 0) {
+	hf->hf_rsize = 0;
+        free(buf);
+        if(!stopped)
+          cb(opaque, NULL, 0);
+        return 0;
+      }
+    }
+  bad:
+    free(buf);
+    hf->hf_chunked_transfer = 0;
+    return -1;
+  }
+
+  for(s = hf->hf_rsize; s > 0; s -= len) {
+    len = MIN(s, HTTP_TMP_SIZE);
+    if(tcp_read_data(hc->hc_tc, buf, len, NULL, 0)) {
+      free(buf);
+      return -1;
+    }
+    if(!stopped)
+      stopped = cb(opaque, buf, len);
+  }
+  free(buf);
+  hf->hf_rsize = 0;
+  if(!stopped)
+    cb(opaque, NULL, 0);
+  return 0;
+}
+
+
 /**
  *
  */
@@ -1250,6 +1324,7 @@ http_read_response(http_file_t *hf, struct http_header_list *headers)
   int code = -1;
   int64_t i64;
   http_connection_t *hc = hf->hf_connection;
+  EVTRACE_SCOPE("http", "response");
 
   http_headers_free(headers);
 
@@ -2096,6 +2171,7 @@ static int
 http_read(fa_handle_t *handle, void *buf, const size_t size)
 {
   http_file_t *hf = (http_file_t *)handle;
+  EVTRACE_SCOPE("http", "read");
 
   if(hf->hf_stats_speed == NULL)
     return http_read_i(hf, buf, size);
@@ -2438,149 +2514,203 @@ static fa_protocol_t fa_protocol_https = {
 FAP_REGISTER(https);
 
 /**
- * Parse WEBDAV PROPFIND results
+ * WEBDAV PROPFIND results are parsed while they are received
  */
-static int
-parse_propfind(http_file_t *hf, htsmsg_t *xml, fa_dir_t *fd,
-	       char *errbuf, size_t errlen)
+typedef struct propfind {
+  http_file_t *pf_hf;
+  fa_dir_t *pf_fd;
+  htsmsg_xml_stream_t *pf_hxs;
+  int pf_responses;
+  int pf_found;
+
+  char *pf_rpath;
+  char *pf_path;
+  char *pf_fname;
+  char *pf_ehref; // Escaped href
+} propfind_t;
+
+
+/**
+ * Parse a single DAV:response
+ */
+static void
+propfind_response(void *opaque, const char *name, htsmsg_t *c)
 {
-  htsmsg_t *m, *c;
-  htsmsg_field_t *f;
+  propfind_t *pf = opaque;
+  http_file_t *hf = pf->pf_hf;
   const char *href, *d, *q;
-  int isdir, i, r;
-  char *rpath = malloc(URL_MAX);
-  char *path  = malloc(URL_MAX);
-  char *fname = malloc(URL_MAX);
-  char *ehref = malloc(URL_MAX); // Escaped href
+  char *path = pf->pf_path;
+  char *fname = pf->pf_fname;
+  int isdir, i;
   fa_dir_entry_t *fde;
 
-  // We need to compare paths and to do so, we must deescape the
-  // possible URL encoding. Do the searched-for path once
-  snprintf(rpath, URL_MAX, "%s", hf->hf_path);
-  url_deescape(rpath);
+  const char *root = htsmsg_xml_stream_root(pf->pf_hxs);
+  if(root == NULL || strcmp(root, "multistatus"))
+    return;
 
-  if((m = htsmsg_get_map(xml, "multistatus")) == NULL) {
-    snprintf(errbuf, errlen, "WEBDAV: DAV:multistatus not found in XML");
-    goto err;
-  }
+  pf->pf_responses++;
 
-  HTSMSG_FOREACH(f, m) {
-    if(strcmp(f->hmf_name, "response"))
-      continue;
-    if((c = htsmsg_get_map_by_field(f)) == NULL)
-      continue;
+  if(pf->pf_found)
+    return;
 
-    /* Some DAV servers seams to send an empty href tag for root path "/" */
-    href = htsmsg_get_str(c, "href") ?: "/";
+  /* Some DAV servers seams to send an empty href tag for root path "/" */
+  href = htsmsg_get_str(c, "href") ?: "/";
 
-    // Get rid of http://hostname (lighttpd includes those)
-    if((q = strstr(href, "://")) != NULL)
-      href = strchr(q + strlen("://"), '/') ?: "/";
+  // Get rid of http://hostname (lighttpd includes those)
+  if((q = strstr(href, "://")) != NULL)
+    href = strchr(q + strlen("://"), '/') ?: "/";
 
-    snprintf(ehref, URL_MAX, "%s", href);
-    url_deescape(ehref);
+  snprintf(pf->pf_ehref, URL_MAX, "%s", href);
+  url_deescape(pf->pf_ehref);
 
-    if((c = htsmsg_get_map_multi(c, "propstat", "prop", NULL)) == NULL)
-      continue;
+  if((c = htsmsg_get_map_multi(c, "propstat", "prop", NULL)) == NULL)
+    return;
 
-    htsmsg_t *tr = htsmsg_get_map(c, "resourcetype");
-    isdir = tr != NULL ? !!htsmsg_field_find(tr, "collection") : 0;
-
-    if(fd != NULL) {
-
-      if(strcmp(rpath, ehref)) {
-	http_connection_t *hc = hf->hf_connection;
-
-        if(!hc->hc_ssl && hc->hc_port == 80)
-          snprintf(path, URL_MAX, "webdav://%s%s",
-                   hc->hc_hostname, href);
-        else if(hc->hc_ssl && hc->hc_port == 443)
-          snprintf(path, URL_MAX, "webdavs://%s%s",
-                   hc->hc_hostname, href);
-        else
-          snprintf(path, URL_MAX, "%s://%s:%d%s",
-                   hc->hc_ssl ? "webdavs" : "webdav", hc->hc_hostname,
-		   hc->hc_port, href);
-
-	if((q = strrchr(path, '/')) != NULL) {
-	  q++;
-
-	  if(*q == 0) {
-	    /* We have a trailing slash, can't piggy back filename
-	       on path (we want to keep the trailing '/' in the URL
-	       since some webdav servers require it and will force us
-	       to 301/redirect if we don't come back with it */
-	    q--;
-	    while(q != path && q[-1] != '/')
-	      q--;
-
-	    for(i = 0; i < URL_MAX - 1 && q[i] != '/'; i++)
-	      fname[i] = q[i];
-	    fname[i] = 0;
-
-	  } else {
-	    snprintf(fname, URL_MAX, "%s", q);
-	  }
-	  url_deescape(fname);
-	  
-	  fde = fa_dir_add(fd, path, fname, 
-			   isdir ? CONTENT_DIR : CONTENT_FILE);
+  htsmsg_t *tr = htsmsg_get_map(c, "resourcetype");
+  isdir = tr != NULL ? !!htsmsg_field_find(tr, "collection") : 0;
 
-	  if(fde != NULL) {
+  if(pf->pf_fd != NULL) {
 
-	    fde->fde_statdone = 1;
+    if(strcmp(pf->pf_rpath, pf->pf_ehref)) {
+      http_connection_t *hc = hf->hf_connection;
 
-	    if(!isdir) {
-	      
-	      if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
-		fde->fde_stat.fs_size = strtoll(d, NULL, 10);
-	      else
-		fde->fde_statdone = 0;
-	    }
+      if(!hc->hc_ssl && hc->hc_port == 80)
+        snprintf(path, URL_MAX, "webdav://%s%s",
+                 hc->hc_hostname, href);
+      else if(hc->hc_ssl && hc->hc_port == 443)
+        snprintf(path, URL_MAX, "webdavs://%s%s",
+                 hc->hc_hostname, href);
+      else
+        snprintf(path, URL_MAX, "%s://%s:%d%s",
+                 hc->hc_ssl ? "webdavs" : "webdav", hc->hc_hostname,
+                 hc->hc_port, href);
+
+      if((q = strrchr(path, '/')) != NULL) {
+        q++;
+
+        if(*q == 0) {
+          /* We have a trailing slash, can't piggy back filename
+             on path (we want to keep the trailing '/' in the URL
+             since some webdav servers require it and will force us
+             to 301/redirect if we don't come back with it */
+          q--;
+          while(q != path && q[-1] != '/')
+            q--;
+
+          for(i = 0; i < URL_MAX - 1 && q[i] != '/'; i++)
+            fname[i] = q[i];
+          fname[i] = 0;
+
+        } else {
+          snprintf(fname, URL_MAX, "%s", q);
+        }
+        url_deescape(fname);
 
-	    if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
-	      http_ctime(&fde->fde_stat.fs_mtime, d);
-	  }
-	}
-      }
-    } else {
-      /* single entry stat(2) */
+        fde = fa_dir_add(pf->pf_fd, path, fname,
+                         isdir ? CONTENT_DIR : CONTENT_FILE);
 
-      snprintf(fname, URL_MAX, "%s", href);
-      url_deescape(fname);
+        if(fde != NULL) {
 
-      if(!strcmp(rpath, fname)) {
-	/* This is the path we asked for */
+          fde->fde_statdone = 1;
 
-	hf->hf_isdir = isdir;
+          if(!isdir) {
 
-	if(!isdir) {
-	  if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
-	    hf->hf_filesize = strtoll(d, NULL, 10);
+            if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
+              fde->fde_stat.fs_size = strtoll(d, NULL, 10);
+            else
+              fde->fde_statdone = 0;
+          }
+
+          if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
+            http_ctime(&fde->fde_stat.fs_mtime, d);
         }
-        hf->hf_mtime = 0;
-        if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
-          http_ctime(&hf->hf_mtime, d);
-	goto ok;
-      } 
+      }
+    }
+  } else {
+    /* single entry stat(2) */
+
+    snprintf(fname, URL_MAX, "%s", href);
+    url_deescape(fname);
+
+    if(!strcmp(pf->pf_rpath, fname)) {
+      /* This is the path we asked for */
+
+      hf->hf_isdir = isdir;
+
+      if(!isdir) {
+        if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
+          hf->hf_filesize = strtoll(d, NULL, 10);
+      }
+      hf->hf_mtime = 0;
+      if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
+        http_ctime(&hf->hf_mtime, d);
+      pf->pf_found = 1;
     }
   }
+}
 
-  if(fd == NULL) {
-    /* We should have returned earlier, server did not include the file 
-       we asked for in its reply. The server is probably broken. 
-       (It should respond with a 404 or something) */
+
+/**
+ *
+ */
+static int
+propfind_data(void *opaque, const void *data, size_t size)
+{
+  return size ? htsmsg_xml_stream_feed(opaque, data, size) : 0;
+}
+
+
+/**
+ * Receive and parse WEBDAV PROPFIND results
+ */
+static int
+parse_propfind(http_file_t *hf, fa_dir_t *fd, char *errbuf, size_t errlen)
+{
+  static const char *elements[] = {"response", NULL};
+  propfind_t pf = {0};
+  htsmsg_xml_stream_t *hxs;
+  char err0[128];
+  int r = -1;
+
+  pf.pf_hf = hf;
+  pf.pf_fd = fd;
+  pf.pf_rpath = malloc(URL_MAX);
+  pf.pf_path  = malloc(URL_MAX);
+  pf.pf_fname = malloc(URL_MAX);
+  pf.pf_ehref = malloc(URL_MAX);
+
+  // We need to compare paths and to do so, we must deescape the
+  // possible URL encoding. Do the searched-for path once
+  snprintf(pf.pf_rpath, URL_MAX, "%s", hf->hf_path);
+  url_deescape(pf.pf_rpath);
+
+  hxs = htsmsg_xml_stream_create(elements, propfind_response, &pf);
+  pf.pf_hxs = hxs;
+
+  if(http_stream_content(hf, propfind_data, hxs)) {
+    snprintf(errbuf, errlen, "Connection lost");
+  } else if(htsmsg_xml_stream_finish(hxs, err0, sizeof(err0))) {
+    snprintf(errbuf, errlen,
+             "WEBDAV/PROPFIND: XML parsing failed:\n%s", err0);
+  } else if(htsmsg_xml_stream_root(hxs) == NULL ||
+            strcmp(htsmsg_xml_stream_root(hxs), "multistatus")) {
+    snprintf(errbuf, errlen, "WEBDAV: DAV:multistatus not found in XML");
+  } else if(pf.pf_responses == 0) {
+    snprintf(errbuf, errlen, "WEBDAV: DAV:response not found in XML");
+  } else if(fd == NULL && !pf.pf_found) {
+    /* Server did not include the file we asked for in its reply.
+       The server is probably broken. (It should respond with a 404
+       or something) */
     snprintf(errbuf, errlen, "WEBDAV: File not found in XML reply");
-  err:
-    r = -1;
   } else {
-  ok:
     r = 0;
   }
-  free(rpath);
-  free(path);
-  free(fname);
-  free(ehref);
+
+  htsmsg_xml_stream_destroy(hxs);
+  free(pf.pf_rpath);
+  free(pf.pf_path);
+  free(pf.pf_fname);
+  free(pf.pf_ehref);
   return r;
 }
 
@@ -2592,12 +2722,9 @@ static int
 dav_propfind(http_file_t *hf, fa_dir_t *fd, char *errbuf, size_t errlen,
 	     int *non_interactive)
 {
-  int code, retval;
+  int code;
   htsbuf_queue_t q;
-  buf_t *buf;
-  htsmsg_t *xml;
   int redircount = 0;
-  char err0[128];
   int i;
   struct http_header_list headers, cookies;
 
@@ -2646,20 +2773,7 @@ dav_propfind(http_file_t *hf, fa_dir_t *fd, char *errbuf, size_t errlen,
     switch(code) {
       
     case 207: /* 207 Multi-part */
-      if((buf = http_read_content(hf)) == NULL) {
-	snprintf(errbuf, errlen, "Connection lost");
-	return -1;
-      }
-
-      xml = htsmsg_xml_deserialize_buf(buf, err0, sizeof(err0));
-      if(xml == NULL) {
-	snprintf(errbuf, errlen,
-		 "WEBDAV/PROPFIND: XML parsing failed:\n%s", err0);
-	return -1;
-      }
-      retval = parse_propfind(hf, xml, fd, errbuf, errlen);
-      htsmsg_release(xml);
-      return retval;
+      return parse_propfind(hf, fd, errbuf, errlen);
 
     case 301:
     case 302:
@@ -2784,9 +2898,6 @@ static fa_protocol_t fa_protocol_webdavs = {
 FAP_REGISTER(webdavs);
 
 
-#define HTTP_TMP_SIZE 16384
-
-
 
 /**
  *
@@ -2841,6 +2952,9 @@ struct http_req_aux {
   buf_t *result;
 
   int *http_code_ptr;
+
+  http_data_cb_t *data_cb;
+  void *data_opaque;
 };
 
 /**
@@ -2889,6 +3003,21 @@ cleanup_buf(struct http_req_aux *hra)
 }
 
 
+/**
+ *
+ */
+static int
+append_callback(http_file_t *hf, struct http_req_aux *hra,
+                const void *data, int size)
+{
+  if(hra->data_cb(hra->data_opaque, data, size)) {
+    snprintf(hra->errbuf, hra->errlen, "Aborted by receiver");
+    return -1;
+  }
+  return 0;
+}
+
+
 /**
  *
  */
@@ -2927,7 +3056,8 @@ append_gzip(http_file_t *hf, struct http_req_aux *hra,
       if(zr == Z_STREAM_END)
         return hra->decoded_data(hf, hra, NULL, 0);
 
-      if(hra->decoded_data(hf, hra, tmp, sizeof(tmp) - z->avail_out))
+      if(z->avail_out != sizeof(tmp) &&
+         hra->decoded_data(hf, hra, tmp, sizeof(tmp) - z->avail_out))
         return -1;
     }
   }
@@ -2944,6 +3074,9 @@ append_gzip(http_file_t *hf, struct http_req_aux *hra,
       snprintf(hra->errbuf, hra->errlen, "zlib error %d", zr);
       return -1;
     }
+    // Don't pass empty output on, size == 0 means EOF downstream
+    if(z->avail_out == sizeof(tmp))
+      continue;
     if(hra->decoded_data(hf, hra, tmp, sizeof(tmp) - z->avail_out))
       return -1;
   }
@@ -3258,7 +3391,8 @@ http_req_do(http_req_aux_t *hra)
       inflateEnd(&hra->zstream);
   } else {
     HF_TRACE(hf, "No data transfered");
-    r = 0;
+    // Streaming receivers still expect the end of body call
+    r = hra->data_cb != NULL ? append_callback(hf, hra, NULL, 0) : 0;
   }
  cleanup:
   free(hra->tmpbuf);
@@ -3448,6 +3582,16 @@ http_reqv(const char *url, va_list ap,
       hra->want_result = 1;
       break;
 
+    case HTTP_TAG_DATA_CALLBACK:
+      hra->data_cb = va_arg(ap, http_data_cb_t *);
+      hra->data_opaque = va_arg(ap, void *);
+      if(hra->data_cb == NULL)
+        break;
+      assert(hra->want_result == 0);
+      hra->decoded_data = append_callback;
+      hra->want_result = 1;
+      break;
+
     case HTTP_TAG_ERRBUF:
       hra->errbuf = va_arg(ap, char *);
       hra->errlen = va_arg(ap, size_t);
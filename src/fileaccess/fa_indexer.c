@@ -26,8 +26,10 @@
 #include "db/db_support.h"
 #include "fa_indexer.h"
 #include "fa_probe.h"
+#include "fa_pathindex.h"
 #include "fileaccess.h"
 #include "htsmsg/htsmsg_store.h"
+#include "misc/minmax.h"
 
 #define INDEXER_TRACE(x, ...) do {                                   \
     if(gconf.enable_indexer_debug)                                   \
@@ -36,46 +38,195 @@
 
 extern int media_buffer_hungry;
 
+#define INDEXER_DIR_BATCH   16  // Max directories listed per pass
+#define INDEXER_MAX_WORKERS 4
+
+static prop_t *indexer_prop_active;
+static prop_t *indexer_prop_directories;
+static prop_t *indexer_prop_items;
+static prop_t *indexer_prop_queued;
+static prop_t *indexer_prop_rate;
+
+
+/**
+ * The indexer works in passes. Each pass lists a batch of directories
+ * in parallel, then probes all new and modified items in parallel and
+ * finally writes the result to the metadb in a single transaction.
+ */
+typedef struct indexer_job {
+  TAILQ_ENTRY(indexer_job) ij_link;
+  void (*ij_run)(struct indexer_job *ij);
+} indexer_job_t;
+
+TAILQ_HEAD(indexer_job_queue, indexer_job);
+TAILQ_HEAD(indexer_item_queue, indexer_item);
+TAILQ_HEAD(indexer_dir_queue, indexer_dir);
+TAILQ_HEAD(item_queue, item);
+
+typedef struct item {
+  TAILQ_ENTRY(item) link;
+  char *url;
+} item_t;
+
+
+typedef struct indexer_dir {
+  indexer_job_t id_job;
+  TAILQ_ENTRY(indexer_dir) id_link;
+  char *id_url;
+  time_t id_mtime;
+  int id_err;
+  struct indexer_item_queue id_items;  // New or modified items
+  struct item_queue id_removed;        // Exist in db but not in filesystem
+} indexer_dir_t;
+
+
+typedef struct indexer_item {
+  indexer_job_t ii_job;
+  TAILQ_ENTRY(indexer_item) ii_link;
+  indexer_dir_t *ii_dir;
+  rstr_t *ii_url;
+  rstr_t *ii_filename;
+  int ii_type;
+  time_t ii_mtime;
+  metadata_t *ii_md;
+  metadata_index_status_t ii_index_status;
+} indexer_item_t;
+
+
+static hts_mutex_t ij_mutex;
+static hts_cond_t ij_work_cond;
+static hts_cond_t ij_done_cond;
+static struct indexer_job_queue ij_queue;
+static int ij_pending;
+
+
+/**
+ *
+ */
 static void
-update_item(void *db, const fa_dir_entry_t *fsentry, const char *parent,
-            time_t parent_mtime)
+indexer_job_enqueue(indexer_job_t *ij)
 {
-  metadata_t *md;
-  metadata_index_status_t index_status = INDEX_STATUS_ANALYZED;
+  hts_mutex_lock(&ij_mutex);
+  TAILQ_INSERT_TAIL(&ij_queue, ij, ij_link);
+  ij_pending++;
+  hts_cond_signal(&ij_work_cond);
+  hts_mutex_unlock(&ij_mutex);
+}
 
-  if(content_dirish(fsentry->fde_type)) {
-    md = fa_probe_dir(rstr_get(fsentry->fde_url));
 
-    if(md->md_contenttype == CONTENT_DIR) {
-      // Regular dirs need further scanning
-      index_status = INDEX_STATUS_UNSET;
+/**
+ * Wait for all enqueued jobs to complete
+ */
+static void
+indexer_job_wait(void)
+{
+  hts_mutex_lock(&ij_mutex);
+  while(ij_pending > 0) {
+    hts_cond_wait(&ij_done_cond, &ij_mutex);
+    prop_set_int(indexer_prop_queued, ij_pending);
+  }
+  hts_mutex_unlock(&ij_mutex);
+}
+
+
+/**
+ *
+ */
+static void *
+indexer_worker_thread(void *aux)
+{
+  indexer_job_t *ij;
+
+  hts_mutex_lock(&ij_mutex);
+  while(1) {
+    if((ij = TAILQ_FIRST(&ij_queue)) == NULL) {
+      hts_cond_wait(&ij_work_cond, &ij_mutex);
+      continue;
     }
+    TAILQ_REMOVE(&ij_queue, ij, ij_link);
+    hts_mutex_unlock(&ij_mutex);
 
-  } else {
-    md = fa_probe_metadata(rstr_get(fsentry->fde_url), NULL, 0,
-                           rstr_get(fsentry->fde_filename), NULL);
+    // Don't compete with playback for I/O
+    while(media_buffer_hungry)
+      sleep(1);
+
+    ij->ij_run(ij);
+
+    hts_mutex_lock(&ij_mutex);
+    ij_pending--;
+    hts_cond_signal(&ij_done_cond);
   }
-  if(md == NULL)
-    return;
+  return NULL;
+}
+
 
-  metadb_metadata_write(db, rstr_get(fsentry->fde_url),
-                        fsentry->fde_stat.fs_mtime,
-                        md, parent, parent_mtime,
-                        index_status);
-  metadata_destroy(md);
+/**
+ *
+ */
+static void
+indexer_item_add(indexer_dir_t *id, const fa_dir_entry_t *fde)
+{
+  indexer_item_t *ii = calloc(1, sizeof(indexer_item_t));
+  ii->ii_dir = id;
+  ii->ii_url = rstr_dup(fde->fde_url);
+  ii->ii_filename = rstr_dup(fde->fde_filename);
+  ii->ii_type = fde->fde_type;
+  ii->ii_mtime = fde->fde_stat.fs_mtime;
+  TAILQ_INSERT_TAIL(&id->id_items, ii, ii_link);
 }
 
 
+/**
+ * Runs in worker thread
+ */
+static void
+probe_item(indexer_job_t *ij)
+{
+  indexer_item_t *ii = (indexer_item_t *)ij;
+
+  ii->ii_index_status = INDEX_STATUS_ANALYZED;
+
+  if(content_dirish(ii->ii_type)) {
+    ii->ii_md = fa_probe_dir(rstr_get(ii->ii_url));
 
-static int
-rescan_directory(const char *url, char *errbuf, size_t errlen, void *db,
-                 time_t fs_mtime)
+    if(ii->ii_md != NULL && ii->ii_md->md_contenttype == CONTENT_DIR) {
+      // Regular dirs need further scanning
+      ii->ii_index_status = INDEX_STATUS_UNSET;
+    }
+
+  } else {
+    ii->ii_md = fa_probe_metadata(rstr_get(ii->ii_url), NULL, 0,
+                                  rstr_get(ii->ii_filename), NULL);
+  }
+}
+
+
+/**
+ * Runs in worker thread
+ */
+static void
+list_directory(indexer_job_t *ij)
 {
+  indexer_dir_t *id = (indexer_dir_t *)ij;
   fa_dir_entry_t *fsentry, *dbentry, *n;
+  fa_stat_t fs;
+  char errbuf[512];
 
-  fa_dir_t *fsdir = fa_scandir(url, errbuf, errlen);
-  if(fsdir == NULL)
-    return -1;
+  if(fa_stat_ex(id->id_url, &fs, errbuf, sizeof(errbuf), FA_NON_INTERACTIVE)) {
+    INDEXER_TRACE("Scanning %s failed -- %s", id->id_url, errbuf);
+    id->id_err = 1;
+    return;
+  }
+
+  INDEXER_TRACE("Scanning path %s", id->id_url);
+  id->id_mtime = fs.fs_mtime;
+
+  fa_dir_t *fsdir = fa_scandir(id->id_url, errbuf, sizeof(errbuf));
+  if(fsdir == NULL) {
+    INDEXER_TRACE("Scanning %s failed -- %s", id->id_url, errbuf);
+    id->id_err = 1;
+    return;
+  }
 
   RB_FOREACH(fsentry, &fsdir->fd_entries, fde_link) {
     fa_dir_entry_stat(fsentry);
@@ -85,7 +236,10 @@ rescan_directory(const char *url, char *errbuf, size_t errlen, void *db,
     }
   }
 
-  fa_dir_t *dbdir = metadb_metadata_scandir(db, url, NULL);
+  void *db = metadb_get();
+  fa_dir_t *dbdir = metadb_metadata_scandir(db, id->id_url, NULL);
+  metadb_close(db);
+
   if(dbdir == NULL)
     dbdir = fa_dir_alloc();
 
@@ -93,7 +247,7 @@ rescan_directory(const char *url, char *errbuf, size_t errlen, void *db,
     n = RB_NEXT(dbentry, fde_link);
 
     fsentry = fa_dir_find(fsdir, dbentry->fde_url);
-    if(fsentry->fde_type == CONTENT_UNKNOWN)
+    if(fsentry != NULL && fsentry->fde_type == CONTENT_UNKNOWN)
       fsentry = NULL;
 
     if(fsentry != NULL) {
@@ -106,13 +260,14 @@ rescan_directory(const char *url, char *errbuf, size_t errlen, void *db,
         // Ok, don't do anything
       } else {
         INDEXER_TRACE("Updating item %s", rstr_get(fsentry->fde_url));
-        update_item(db, fsentry, url, fs_mtime);
+        indexer_item_add(id, fsentry);
       }
       fa_dir_entry_free(fsdir, fsentry);
     } else {
-      // Exist in DB but not in filesystem
       INDEXER_TRACE("Removing item %s", rstr_get(dbentry->fde_url));
-      metadb_unparent_item(db, rstr_get(dbentry->fde_url));
+      item_t *i = malloc(sizeof(item_t));
+      i->url = strdup(rstr_get(dbentry->fde_url));
+      TAILQ_INSERT_TAIL(&id->id_removed, i, link);
     }
   }
 
@@ -120,60 +275,59 @@ rescan_directory(const char *url, char *errbuf, size_t errlen, void *db,
     if(fsentry->fde_type == CONTENT_UNKNOWN)
       continue;
     INDEXER_TRACE("New item %s", rstr_get(fsentry->fde_url));
-    update_item(db, fsentry, url, fs_mtime);
+    indexer_item_add(id, fsentry);
   }
 
   fa_dir_free(fsdir);
   fa_dir_free(dbdir);
-  return 0;
 }
 
 
 /**
  *
  */
-static void
-index_directory(const char *url)
+static int
+write_directory(void *db, const indexer_dir_t *id)
 {
-  fa_stat_t fs;
-  int err;
-  char errbuf[512];
-  void *db = metadb_get();
+  const indexer_item_t *ii;
+  const item_t *i;
+  sqlite3_stmt *stmt;
+  int rc;
 
-  if(!fa_stat_ex(url, &fs, errbuf, sizeof(errbuf), FA_NON_INTERACTIVE)) {
-    INDEXER_TRACE("Scanning path %s", url);
-    err = rescan_directory(url, errbuf, sizeof(errbuf), db, fs.fs_mtime);
-  } else {
-    INDEXER_TRACE("Scanning %s failed -- %s", url, errbuf);
-    err = 1;
+  TAILQ_FOREACH(ii, &id->id_items, ii_link) {
+    if(ii->ii_md == NULL)
+      continue;
+    rc = metadb_metadata_writex(db, rstr_get(ii->ii_url), ii->ii_mtime,
+                                ii->ii_md, id->id_url, id->id_mtime,
+                                ii->ii_index_status);
+    if(rc == METADATA_DEADLOCK)
+      return rc;
+  }
+
+  TAILQ_FOREACH(i, &id->id_removed, link) {
+    rc = metadb_unparent_itemx(db, i->url);
+    if(rc == METADATA_DEADLOCK)
+      return rc;
   }
-  sqlite3_stmt *stmt;
 
   // Update the index status for the scanned directory
-  int rc = db_prepare(db, &stmt,
-                      "UPDATE item "
-                      "SET indexstatus = ?2 "
-                      "WHERE url = ?1");
+  rc = db_prepare(db, &stmt,
+                  "UPDATE item "
+                  "SET indexstatus = ?2 "
+                  "WHERE url = ?1");
   if(!rc) {
-    sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 2, err ? INDEX_STATUS_ERROR : INDEX_STATUS_ANALYZED);
-    db_step(stmt);
+    sqlite3_bind_text(stmt, 1, id->id_url, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2,
+                     id->id_err ? INDEX_STATUS_ERROR : INDEX_STATUS_ANALYZED);
+    rc = db_step(stmt);
     sqlite3_finalize(stmt);
+    if(rc == SQLITE_LOCKED)
+      return METADATA_DEADLOCK;
   }
-  metadb_close(db);
+  return 0;
 }
 
 
-
-TAILQ_HEAD(item_queue, item);
-
-typedef struct item {
-  TAILQ_ENTRY(item) link;
-  char *url;
-} item_t;
-
-
-
 /**
  *
  */
@@ -189,6 +343,122 @@ free_items(struct item_queue *q)
 }
 
 
+/**
+ *
+ */
+static void
+indexer_dir_destroy(indexer_dir_t *id)
+{
+  indexer_item_t *ii;
+
+  while((ii = TAILQ_FIRST(&id->id_items)) != NULL) {
+    TAILQ_REMOVE(&id->id_items, ii, ii_link);
+    if(ii->ii_md != NULL)
+      metadata_destroy(ii->ii_md);
+    rstr_release(ii->ii_url);
+    rstr_release(ii->ii_filename);
+    free(ii);
+  }
+  free_items(&id->id_removed);
+  free(id->id_url);
+  free(id);
+}
+
+
+static int indexer_stats_dirs;
+static int indexer_stats_items;
+
+
+/**
+ * Index a batch of directories
+ */
+static void
+index_directories(struct item_queue *q)
+{
+  struct indexer_dir_queue dirs;
+  indexer_dir_t *id;
+  indexer_item_t *ii;
+  item_t *i;
+  int items = 0;
+
+  TAILQ_INIT(&dirs);
+
+  TAILQ_FOREACH(i, q, link) {
+    id = calloc(1, sizeof(indexer_dir_t));
+    id->id_url = strdup(i->url);
+    TAILQ_INIT(&id->id_items);
+    TAILQ_INIT(&id->id_removed);
+    TAILQ_INSERT_TAIL(&dirs, id, id_link);
+    id->id_job.ij_run = list_directory;
+    indexer_job_enqueue(&id->id_job);
+  }
+  indexer_job_wait();
+
+  TAILQ_FOREACH(id, &dirs, id_link) {
+    TAILQ_FOREACH(ii, &id->id_items, ii_link) {
+      ii->ii_job.ij_run = probe_item;
+      indexer_job_enqueue(&ii->ii_job);
+      items++;
+    }
+  }
+  prop_set_int(indexer_prop_queued, items);
+  indexer_job_wait();
+
+  void *db = metadb_get();
+  while(1) {
+    if(db_begin(db))
+      break;
+
+    int r = 0;
+    TAILQ_FOREACH(id, &dirs, id_link)
+      if((r = write_directory(db, id)) != 0)
+        break;
+
+    if(r == METADATA_DEADLOCK) {
+      db_rollback_deadlock(db);
+      continue;
+    }
+    db_commit(db);
+    break;
+  }
+  metadb_close(db);
+
+  TAILQ_FOREACH(id, &dirs, id_link) {
+    TAILQ_FOREACH(ii, &id->id_items, ii_link)
+      if(ii->ii_md != NULL)
+        fa_pathindex_add(rstr_get(ii->ii_url), ii->ii_md->md_contenttype);
+    TAILQ_FOREACH(i, &id->id_removed, link)
+      fa_pathindex_remove(i->url);
+  }
+  fa_pathindex_commit();
+
+  while((id = TAILQ_FIRST(&dirs)) != NULL) {
+    TAILQ_REMOVE(&dirs, id, id_link);
+    indexer_dir_destroy(id);
+    indexer_stats_dirs++;
+  }
+  indexer_stats_items += items;
+
+  prop_set_int(indexer_prop_directories, indexer_stats_dirs);
+  prop_set_int(indexer_prop_items, indexer_stats_items);
+}
+
+
+/**
+ *
+ */
+static void
+index_directory(const char *url)
+{
+  struct item_queue q;
+  item_t i = {.url = (char *)url};
+
+  TAILQ_INIT(&q);
+  TAILQ_INSERT_TAIL(&q, &i, link);
+  index_directories(&q);
+}
+
+
 /**
  *
  */
@@ -202,6 +472,7 @@ get_items(void *db, struct item_queue *q, const char *pfx, const char *query)
     return METADATA_PERMANENT_ERROR;
 
   sqlite3_bind_text(stmt, 1, pfx, -1, SQLITE_STATIC);
+  sqlite3_bind_int(stmt, 2, INDEXER_DIR_BATCH);
 
   while((rc = db_step(stmt)) == SQLITE_ROW) {
     item_t *i = malloc(sizeof(item_t));
@@ -218,7 +489,7 @@ get_items(void *db, struct item_queue *q, const char *pfx, const char *query)
  *
  */
 static int
-find_unprocessed_directory(const char *prefix)
+find_unprocessed_directories(const char *prefix)
 {
   char pfx[PATH_MAX];
   void *db = metadb_get();
@@ -234,18 +505,15 @@ find_unprocessed_directory(const char *prefix)
                     "WHERE url LIKE ?1 "
                     "AND contenttype = 1 "
                     "AND indexstatus = 0 "
-                    "LIMIT 1");
+                    "LIMIT ?2");
 
   metadb_close(db);
   if(r)
     return 0;
 
-  item_t *i;
-  r = 0;
-  TAILQ_FOREACH(i, &q, link) {
-    index_directory(i->url);
-    r = 1;
-  }
+  r = !TAILQ_EMPTY(&q);
+  if(r)
+    index_directories(&q);
   free_items(&q);
   return r;
 }
@@ -402,11 +670,18 @@ indexer_thread(void *aux)
 {
   indexer_root_t *ir;
   int did_something;
+  int64_t pass_start = 0;
 
   hts_mutex_lock(&indexer_mutex);
   while(1) {
   restart:
     did_something = 0;
+    if(pass_start == 0) {
+      pass_start = arch_get_ts();
+      indexer_stats_dirs = 0;
+      indexer_stats_items = 0;
+      prop_set_int(indexer_prop_active, 1);
+    }
     TAILQ_FOREACH(ir, &roots, ir_link) {
       ir->ir_refcount++;
 
@@ -422,7 +697,7 @@ indexer_thread(void *aux)
         index_directory(ir->ir_url);
         did_something = 1;
       } else {
-        did_something |= find_unprocessed_directory(ir->ir_url);
+        did_something |= find_unprocessed_directories(ir->ir_url);
       }
 
       hts_mutex_lock(&indexer_mutex);
@@ -436,8 +711,35 @@ indexer_thread(void *aux)
       if(!ir->ir_root_scanned)
         goto restart;
     }
-    if(!did_something)
-      hts_cond_wait(&indexer_cond, &indexer_mutex);
+    int64_t ts = arch_get_ts();
+    if(ts > pass_start) {
+      prop_set_float(indexer_prop_rate,
+                     indexer_stats_items * 1000000.0 / (ts - pass_start));
+    }
+
+    if(!did_something) {
+      if(indexer_stats_dirs > 1) {
+        TRACE(TRACE_INFO, "Indexer",
+              "Indexed %d items in %d directories in %d s (%.1f items/s)",
+              indexer_stats_items, indexer_stats_dirs,
+              (int)((ts - pass_start) / 1000000),
+              indexer_stats_items * 1000000.0 / MAX(ts - pass_start, 1));
+      }
+      prop_set_int(indexer_prop_active, 0);
+      pass_start = 0;
+
+      hts_mutex_unlock(&indexer_mutex);
+      fa_pathindex_maintain();
+      hts_mutex_lock(&indexer_mutex);
+
+      // Roots may have been added while we were unlocked
+      TAILQ_FOREACH(ir, &roots, ir_link)
+        if(!ir->ir_root_scanned)
+          break;
+
+      if(ir == NULL)
+        hts_cond_wait(&indexer_cond, &indexer_mutex);
+    }
   }
   return NULL;
 }
@@ -449,6 +751,8 @@ indexer_thread(void *aux)
 void
 fa_indexer_init(void)
 {
+  fa_pathindex_init();
+
   TAILQ_INIT(&roots);
   hts_mutex_init(&indexer_mutex);
   hts_cond_init(&indexer_cond, &indexer_mutex);
@@ -470,6 +774,23 @@ fa_indexer_init(void)
     htsmsg_release(m);
   }
 
+  prop_t *p = prop_create(prop_get_global(), "indexer");
+  indexer_prop_active      = prop_create(p, "active");
+  indexer_prop_directories = prop_create(p, "directories");
+  indexer_prop_items       = prop_create(p, "items");
+  indexer_prop_queued      = prop_create(p, "queued");
+  indexer_prop_rate        = prop_create(p, "itemsPerSecond");
+
+  TAILQ_INIT(&ij_queue);
+  hts_mutex_init(&ij_mutex);
+  hts_cond_init(&ij_work_cond, &ij_mutex);
+  hts_cond_init(&ij_done_cond, &ij_mutex);
+
+  int workers = MAX(2, MIN(gconf.concurrency, INDEXER_MAX_WORKERS));
+  for(int i = 0; i < workers; i++)
+    hts_thread_create_detached("indexer worker", indexer_worker_thread, NULL,
+                               THREAD_PRIO_METADATA_BG);
+
   hts_thread_create_detached("indexer", indexer_thread, NULL,
 			     THREAD_PRIO_METADATA_BG);
 }
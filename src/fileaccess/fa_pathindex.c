@@ -0,0 +1,1435 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#include <sys/mman.h>
+#define PI_USE_MMAP
+#endif
+
+#include "main.h"
+#include "backend/backend.h"
+#include "backend/search.h"
+#include "metadata/metadata.h"
+#include "db/db_support.h"
+#include "settings.h"
+#include "misc/minmax.h"
+#include "arch/atomic.h"
+#include "fileaccess.h"
+#include "fa_pathindex.h"
+
+/**
+ * The path index consists of a read-only base file that is memory
+ * mapped and a delta of updates done since the base was written. The
+ * delta is kept in memory and is appended to a journal so it survives
+ * restarts. Once the delta grows too large a new base is built.
+ *
+ * Base file layout (native byte order, the file is a local cache):
+ *
+ *   pi_header_t
+ *   pi_entry_t[num_entries]      One per item, files and directories
+ *   names                        File name of each entry
+ *   pi_trigram_t[num_trigrams]   Sorted on trigram
+ *   postings                     Varint delta coded sorted entry ids
+ *
+ * To keep the file compact each entry only stores its own file name
+ * and the id of its parent directory. Parents that are not indexed
+ * items themselves (typically the index roots) are stored as prefix
+ * entries holding the entire url and are not searchable.
+ *
+ * Trigrams are taken from the lower cased file name, so searching
+ * matches file names (same as 'locate -b'), not full paths.
+ */
+
+#define PI_MAGIC   0x4950564d
+#define PI_VERSION 1
+
+#define PI_NO_PARENT 0xffffffff
+#define PI_F_PREFIX  0x1
+
+#define PI_MAX_DEPTH 64
+
+#define PI_COMPACT_MIN 10000   // Minimum delta size before rebuilding base
+#define PI_SEARCH_LIMIT 500
+
+typedef struct pi_header {
+  uint32_t ph_magic;
+  uint32_t ph_version;
+  uint32_t ph_num_entries;
+  uint32_t ph_num_trigrams;
+  uint32_t ph_names_size;
+  uint32_t ph_postings_size;
+  uint32_t ph_off_entries;
+  uint32_t ph_off_names;
+  uint32_t ph_off_trigrams;
+  uint32_t ph_off_postings;
+} pi_header_t;
+
+typedef struct pi_entry {
+  uint32_t pe_parent;
+  uint32_t pe_name_off;
+  uint16_t pe_name_len;
+  uint8_t pe_type;
+  uint8_t pe_flags;
+} pi_entry_t;
+
+typedef struct pi_trigram {
+  uint32_t pt_trigram;
+  uint32_t pt_offset;
+  uint32_t pt_count;
+} pi_trigram_t;
+
+
+/**
+ * A loaded base file
+ */
+typedef struct pi_base {
+  atomic_t pb_refcount;
+  void *pb_data;
+  size_t pb_size;
+  int pb_mapped;
+  const pi_header_t *pb_hdr;
+  const pi_entry_t *pb_entries;
+  const char *pb_names;
+  const pi_trigram_t *pb_trigrams;
+  const uint8_t *pb_postings;
+} pi_base_t;
+
+
+/**
+ * An update not yet in the base file
+ */
+typedef struct pi_delta {
+  LIST_ENTRY(pi_delta) pd_hash_link;
+  TAILQ_ENTRY(pi_delta) pd_link;
+  char *pd_url;
+  int pd_type;
+  int pd_removed;
+  uint32_t pd_seq;
+} pi_delta_t;
+
+#define PI_DELTA_HASH 4096
+
+typedef struct pi_deltaset {
+  LIST_HEAD(, pi_delta) pds_hash[PI_DELTA_HASH];
+  TAILQ_HEAD(pi_delta_queue, pi_delta) pds_queue;
+  int pds_num;
+  int pds_tombstones;
+} pi_deltaset_t;
+
+
+typedef struct pi_hit {
+  int score;
+  int type;
+  uint32_t id;
+  char *url;
+} pi_hit_t;
+
+/**
+ * Best hits so far. Kept as a heap with the worst hit at the root
+ */
+typedef struct pi_hits {
+  pi_hit_t *ph_v;
+  int ph_num;
+  int ph_max;
+} pi_hits_t;
+
+
+static hts_mutex_t pi_mutex;
+static int pi_enabled;
+static pi_base_t *pi_base;
+static pi_deltaset_t pi_delta;
+static uint32_t pi_seq;
+static FILE *pi_journal;
+static int pi_search_enabled;
+
+static char pi_base_path[PATH_MAX];
+static char pi_journal_path[PATH_MAX];
+
+
+/**
+ *
+ */
+static __inline uint8_t
+pi_lower(uint8_t c)
+{
+  return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+
+/**
+ *
+ */
+static __inline uint32_t
+pi_trigram(const uint8_t *s)
+{
+  return pi_lower(s[0]) << 16 | pi_lower(s[1]) << 8 | pi_lower(s[2]);
+}
+
+
+/**
+ * Case insensitive search for lower cased needle, returns offset or -1
+ */
+static int
+pi_find(const char *hay, int haylen, const char *needle, int len)
+{
+  int i, j;
+  for(i = 0; i <= haylen - len; i++) {
+    for(j = 0; j < len; j++)
+      if(pi_lower(hay[i + j]) != (uint8_t)needle[j])
+        break;
+    if(j == len)
+      return i;
+  }
+  return -1;
+}
+
+
+/**
+ * Higher is better. Prefer short names and matches at word boundaries
+ */
+static int
+pi_score(const char *name, int namelen, int pos, int qlen)
+{
+  int score = 1000 - MIN(namelen, 255) * 2;
+  if(pos == 0)
+    score += 2000;
+  else if(!isalnum((uint8_t)name[pos - 1]))
+    score += 1000;
+
+  if(pos + qlen == namelen || name[pos + qlen] == '.')
+    score += 500;
+  return score;
+}
+
+#define pi_score_max(namelen) (3500 - MIN(namelen, 255) * 2)
+
+
+/**************************************************************************
+ * Delta
+ *************************************************************************/
+
+/**
+ *
+ */
+static void
+pi_deltaset_init(pi_deltaset_t *pds)
+{
+  memset(pds, 0, sizeof(pi_deltaset_t));
+  TAILQ_INIT(&pds->pds_queue);
+}
+
+
+/**
+ *
+ */
+static pi_delta_t *
+pi_delta_find(pi_deltaset_t *pds, const char *url)
+{
+  pi_delta_t *pd;
+  LIST_FOREACH(pd, &pds->pds_hash[mystrhash(url) % PI_DELTA_HASH],
+               pd_hash_link)
+    if(!strcmp(pd->pd_url, url))
+      return pd;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+pi_delta_set(pi_deltaset_t *pds, const char *url, int type, int removed,
+             uint32_t seq)
+{
+  pi_delta_t *pd = pi_delta_find(pds, url);
+
+  if(pd == NULL) {
+    pd = malloc(sizeof(pi_delta_t));
+    pd->pd_url = strdup(url);
+    pd->pd_removed = 0;
+    LIST_INSERT_HEAD(&pds->pds_hash[mystrhash(url) % PI_DELTA_HASH], pd,
+                     pd_hash_link);
+    pds->pds_num++;
+  } else {
+    TAILQ_REMOVE(&pds->pds_queue, pd, pd_link);
+  }
+  TAILQ_INSERT_TAIL(&pds->pds_queue, pd, pd_link);
+
+  pds->pds_tombstones += removed - pd->pd_removed;
+  pd->pd_removed = removed;
+  pd->pd_type = type;
+  pd->pd_seq = seq;
+}
+
+
+/**
+ *
+ */
+static void
+pi_delta_destroy(pi_deltaset_t *pds, pi_delta_t *pd)
+{
+  pds->pds_tombstones -= pd->pd_removed;
+  pds->pds_num--;
+  LIST_REMOVE(pd, pd_hash_link);
+  TAILQ_REMOVE(&pds->pds_queue, pd, pd_link);
+  free(pd->pd_url);
+  free(pd);
+}
+
+
+/**
+ *
+ */
+static void
+pi_deltaset_clear(pi_deltaset_t *pds)
+{
+  pi_delta_t *pd;
+  while((pd = TAILQ_FIRST(&pds->pds_queue)) != NULL)
+    pi_delta_destroy(pds, pd);
+}
+
+
+/**
+ * Returns true if a base entry with the given url is replaced or
+ * removed by the delta, either directly or by removal of a parent
+ */
+static int
+pi_delta_overrides(pi_deltaset_t *pds, const char *url)
+{
+  if(pds->pds_num == 0)
+    return 0;
+
+  if(pi_delta_find(pds, url) != NULL)
+    return 1;
+
+  if(pds->pds_tombstones == 0)
+    return 0;
+
+  char buf[PATH_MAX];
+  snprintf(buf, sizeof(buf), "%s", url);
+  char *proto = strstr(buf, "://");
+  char *s;
+
+  while((s = strrchr(buf, '/')) != NULL && (proto == NULL || s > proto + 2)) {
+    *s = 0;
+    pi_delta_t *pd = pi_delta_find(pds, buf);
+    if(pd != NULL && pd->pd_removed)
+      return 1;
+  }
+  return 0;
+}
+
+
+/**************************************************************************
+ * Base file
+ *************************************************************************/
+
+/**
+ *
+ */
+static void
+pi_base_release(pi_base_t *pb)
+{
+  if(pb == NULL || atomic_dec(&pb->pb_refcount))
+    return;
+#ifdef PI_USE_MMAP
+  if(pb->pb_mapped)
+    munmap(pb->pb_data, pb->pb_size);
+  else
+#endif
+    free(pb->pb_data);
+  free(pb);
+}
+
+
+/**
+ * Must be called with pi_mutex held
+ */
+static pi_base_t *
+pi_base_get(void)
+{
+  if(pi_base != NULL)
+    atomic_inc(&pi_base->pb_refcount);
+  return pi_base;
+}
+
+
+/**
+ *
+ */
+static pi_base_t *
+pi_base_open(const char *path)
+{
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if(fd == -1)
+    return NULL;
+
+  if(fstat(fd, &st) || st.st_size < sizeof(pi_header_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  pi_base_t *pb = calloc(1, sizeof(pi_base_t));
+  atomic_set(&pb->pb_refcount, 1);
+  pb->pb_size = st.st_size;
+
+#ifdef PI_USE_MMAP
+  pb->pb_data = mmap(NULL, pb->pb_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(pb->pb_data == MAP_FAILED) {
+    pb->pb_data = NULL;
+  } else {
+    pb->pb_mapped = 1;
+  }
+#endif
+
+  if(pb->pb_data == NULL) {
+    pb->pb_data = malloc(pb->pb_size);
+    if(pb->pb_data == NULL ||
+       read(fd, pb->pb_data, pb->pb_size) != pb->pb_size) {
+      close(fd);
+      free(pb->pb_data);
+      free(pb);
+      return NULL;
+    }
+  }
+  close(fd);
+
+  const pi_header_t *ph = pb->pb_data;
+  const uint64_t size = pb->pb_size;
+
+  if(ph->ph_magic != PI_MAGIC || ph->ph_version != PI_VERSION ||
+     ph->ph_off_entries +
+     (uint64_t)ph->ph_num_entries * sizeof(pi_entry_t) > size ||
+     ph->ph_off_names + (uint64_t)ph->ph_names_size > size ||
+     ph->ph_off_trigrams +
+     (uint64_t)ph->ph_num_trigrams * sizeof(pi_trigram_t) > size ||
+     ph->ph_off_postings + (uint64_t)ph->ph_postings_size > size ||
+     (ph->ph_off_entries | ph->ph_off_trigrams) & 3) {
+    TRACE(TRACE_ERROR, "pathindex", "%s: Invalid index file", path);
+    pi_base_release(pb);
+    return NULL;
+  }
+
+  const uint8_t *data = pb->pb_data;
+  pb->pb_hdr       = ph;
+  pb->pb_entries   = (const void *)(data + ph->ph_off_entries);
+  pb->pb_names     = (const void *)(data + ph->ph_off_names);
+  pb->pb_trigrams  = (const void *)(data + ph->ph_off_trigrams);
+  pb->pb_postings  = data + ph->ph_off_postings;
+  return pb;
+}
+
+
+/**
+ * Reconstruct url of entry, returns -1 if it does not fit or the
+ * file is corrupt
+ */
+static int
+pi_entry_url(const pi_base_t *pb, uint32_t id, char *buf, size_t size)
+{
+  uint32_t stack[PI_MAX_DEPTH];
+  int depth = 0;
+  size_t len = 0;
+
+  while(id != PI_NO_PARENT) {
+    if(depth == PI_MAX_DEPTH || id >= pb->pb_hdr->ph_num_entries)
+      return -1;
+    stack[depth++] = id;
+    id = pb->pb_entries[id].pe_parent;
+  }
+
+  while(depth > 0) {
+    const pi_entry_t *pe = &pb->pb_entries[stack[--depth]];
+    if(len + pe->pe_name_len + 2 > size ||
+       (uint64_t)pe->pe_name_off + pe->pe_name_len >
+       pb->pb_hdr->ph_names_size)
+      return -1;
+    memcpy(buf + len, pb->pb_names + pe->pe_name_off, pe->pe_name_len);
+    len += pe->pe_name_len;
+    if(depth > 0)
+      buf[len++] = '/';
+  }
+  buf[len] = 0;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static const pi_trigram_t *
+pi_trigram_find(const pi_base_t *pb, uint32_t trigram)
+{
+  const pi_trigram_t *t = pb->pb_trigrams;
+  int lo = 0, hi = pb->pb_hdr->ph_num_trigrams;
+
+  while(lo < hi) {
+    int mid = (lo + hi) / 2;
+    if(t[mid].pt_trigram < trigram)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo < pb->pb_hdr->ph_num_trigrams && t[lo].pt_trigram == trigram)
+    return &t[lo];
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static __inline const uint8_t *
+pi_varint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+  uint32_t r = 0;
+  int shift = 0;
+  while(p < end) {
+    r |= (*p & 0x7f) << shift;
+    if(!(*p++ & 0x80))
+      break;
+    shift += 7;
+  }
+  *v = r;
+  return p;
+}
+
+
+/**
+ *
+ */
+static int
+pi_hitcmp(const void *A, const void *B)
+{
+  const pi_hit_t *a = A, *b = B;
+  if(a->score != b->score)
+    return b->score - a->score;
+  return a->id < b->id ? -1 : a->id > b->id;
+}
+
+
+/**
+ *
+ */
+static void
+pi_hit_swap(pi_hit_t *a, pi_hit_t *b)
+{
+  pi_hit_t t = *a;
+  *a = *b;
+  *b = t;
+}
+
+
+/**
+ * Add hit unless we already have ph_max better ones
+ */
+static void
+pi_hit_add(pi_hits_t *ph, int score, int type, uint32_t id, char *url)
+{
+  pi_hit_t h = {score, type, id, url};
+  pi_hit_t *v = ph->ph_v;
+  int i, c;
+
+  if(ph->ph_num < ph->ph_max) {
+    i = ph->ph_num++;
+    v[i] = h;
+    while(i > 0 && pi_hitcmp(&v[(i - 1) / 2], &v[i]) < 0) {
+      pi_hit_swap(&v[(i - 1) / 2], &v[i]);
+      i = (i - 1) / 2;
+    }
+    return;
+  }
+
+  if(ph->ph_num == 0 || pi_hitcmp(&h, &v[0]) >= 0) {
+    free(url);
+    return;
+  }
+
+  free(v[0].url);
+  v[0] = h;
+  i = 0;
+  while((c = i * 2 + 1) < ph->ph_num) {
+    if(c + 1 < ph->ph_num && pi_hitcmp(&v[c + 1], &v[c]) > 0)
+      c++;
+    if(pi_hitcmp(&v[c], &v[i]) <= 0)
+      break;
+    pi_hit_swap(&v[c], &v[i]);
+    i = c;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+pi_test_entry(const pi_base_t *pb, uint32_t id, const char *q, int qlen,
+              pi_hits_t *ph)
+{
+  const pi_entry_t *pe = &pb->pb_entries[id];
+  if(pe->pe_flags & PI_F_PREFIX ||
+     (uint64_t)pe->pe_name_off + pe->pe_name_len >
+     pb->pb_hdr->ph_names_size)
+    return;
+
+  // Skip the match if even the best possible score would not make it
+  if(ph->ph_num == ph->ph_max && ph->ph_num > 0 &&
+     pi_score_max(pe->pe_name_len) <= ph->ph_v[0].score)
+    return;
+
+  const char *name = pb->pb_names + pe->pe_name_off;
+  int pos = pi_find(name, pe->pe_name_len, q, qlen);
+  if(pos >= 0)
+    pi_hit_add(ph, pi_score(name, pe->pe_name_len, pos, qlen),
+               pe->pe_type, id, NULL);
+}
+
+
+/**
+ * Find all entries in base matching the lower cased query
+ */
+static void
+pi_search_base(const pi_base_t *pb, const char *q, int qlen, pi_hits_t *ph)
+{
+  const int num_entries = pb->pb_hdr->ph_num_entries;
+  const pi_trigram_t *tv[256];
+  int i, j, k, num_tri = 0;
+
+  if(qlen < 3) {
+    // Too short for trigrams, scan everything
+    for(i = 0; i < num_entries; i++)
+      pi_test_entry(pb, i, q, qlen, ph);
+    return;
+  }
+
+  for(i = 0; i < qlen - 2; i++) {
+    const pi_trigram_t *t = pi_trigram_find(pb, pi_trigram((const uint8_t *)q + i));
+    if(t == NULL)
+      return; // Can't match anything
+    for(j = 0; j < num_tri; j++)
+      if(tv[j] == t)
+        break;
+    if(j == num_tri)
+      tv[num_tri++] = t;
+  }
+
+  // Start with the rarest trigram to keep the candidate set small
+  for(i = 1; i < num_tri; i++) {
+    const pi_trigram_t *t = tv[i];
+    for(j = i; j > 0 && tv[j - 1]->pt_count > t->pt_count; j--)
+      tv[j] = tv[j - 1];
+    tv[j] = t;
+  }
+
+  const uint8_t *pend = pb->pb_postings + pb->pb_hdr->ph_postings_size;
+  int num_cand = tv[0]->pt_count;
+  uint32_t *cand = malloc(num_cand * sizeof(uint32_t));
+  const uint8_t *p = pb->pb_postings + tv[0]->pt_offset;
+  uint32_t id = 0, d;
+
+  for(i = 0; i < num_cand; i++) {
+    p = pi_varint(p, pend, &d);
+    id += d;
+    cand[i] = id;
+  }
+
+  for(j = 1; j < num_tri && num_cand > 0; j++) {
+    const pi_trigram_t *t = tv[j];
+    p = pb->pb_postings + t->pt_offset;
+    id = 0;
+    k = 0;
+    int n = 0;
+    for(i = 0; i < t->pt_count && k < num_cand; i++) {
+      p = pi_varint(p, pend, &d);
+      id += d;
+      while(k < num_cand && cand[k] < id)
+        k++;
+      if(k < num_cand && cand[k] == id)
+        cand[n++] = cand[k++];
+    }
+    num_cand = n;
+  }
+
+  // Trigrams may match in the wrong order, so verify each candidate
+  for(i = 0; i < num_cand; i++)
+    if(cand[i] < num_entries)
+      pi_test_entry(pb, cand[i], q, qlen, ph);
+  free(cand);
+}
+
+
+/**
+ *
+ */
+int
+fa_pathindex_search(const char *query, int limit, fa_pathindex_hit_t **hitsp)
+{
+  char q[256];
+  int qlen, i, num;
+  char url[PATH_MAX];
+  pi_hits_t base = {}, hits = {};
+  pi_delta_t *pd;
+
+  *hitsp = NULL;
+  if(!pi_enabled)
+    return 0;
+
+  for(qlen = 0; query[qlen] && qlen < sizeof(q) - 1; qlen++)
+    q[qlen] = pi_lower(query[qlen]);
+  q[qlen] = 0;
+  if(qlen == 0)
+    return 0;
+
+  hts_mutex_lock(&pi_mutex);
+  pi_base_t *pb = pi_base_get();
+  // Some of the best hits in base might be replaced by the delta
+  base.ph_max = limit + pi_delta.pds_num;
+  hts_mutex_unlock(&pi_mutex);
+
+  if(pb != NULL) {
+    base.ph_v = malloc(base.ph_max * sizeof(pi_hit_t));
+    pi_search_base(pb, q, qlen, &base);
+  }
+
+  hits.ph_max = limit;
+  hits.ph_v = malloc(limit * sizeof(pi_hit_t));
+
+  hts_mutex_lock(&pi_mutex);
+
+  for(i = 0; i < base.ph_num; i++) {
+    if(pi_entry_url(pb, base.ph_v[i].id, url, sizeof(url)))
+      continue;
+    if(pi_delta_overrides(&pi_delta, url))
+      continue;
+    pi_hit_add(&hits, base.ph_v[i].score, base.ph_v[i].type,
+               base.ph_v[i].id, strdup(url));
+  }
+
+  TAILQ_FOREACH(pd, &pi_delta.pds_queue, pd_link) {
+    if(pd->pd_removed)
+      continue;
+    const char *name = strrchr(pd->pd_url, '/');
+    name = name ? name + 1 : pd->pd_url;
+    int len = strlen(name);
+    int pos = pi_find(name, len, q, qlen);
+    if(pos >= 0)
+      pi_hit_add(&hits, pi_score(name, len, pos, qlen),
+                 pd->pd_type, PI_NO_PARENT, strdup(pd->pd_url));
+  }
+  hts_mutex_unlock(&pi_mutex);
+
+  pi_base_release(pb);
+  free(base.ph_v);
+
+  num = hits.ph_num;
+  qsort(hits.ph_v, num, sizeof(pi_hit_t), pi_hitcmp);
+
+  fa_pathindex_hit_t *r = malloc(MAX(num, 1) * sizeof(fa_pathindex_hit_t));
+  for(i = 0; i < num; i++) {
+    r[i].url   = hits.ph_v[i].url;
+    r[i].type  = hits.ph_v[i].type;
+    r[i].score = hits.ph_v[i].score;
+  }
+  free(hits.ph_v);
+  *hitsp = r;
+  return num;
+}
+
+
+/**
+ *
+ */
+void
+fa_pathindex_hits_free(fa_pathindex_hit_t *hits, int num)
+{
+  int i;
+  for(i = 0; i < num; i++)
+    free(hits[i].url);
+  free(hits);
+}
+
+
+/**************************************************************************
+ * Building
+ *************************************************************************/
+
+typedef struct pi_src {
+  char *url;
+  int type;
+} pi_src_t;
+
+typedef struct pi_dir {
+  struct pi_dir *next;
+  const char *url;
+  int len;
+  uint32_t id;
+} pi_dir_t;
+
+#define PI_DIR_HASH 65536
+
+
+/**
+ *
+ */
+static unsigned int
+pi_dir_hash(const char *s, int len)
+{
+  unsigned int h = 2166136261u;
+  while(len--)
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+  return h % PI_DIR_HASH;
+}
+
+
+/**
+ *
+ */
+static int
+pi_srccmp(const void *A, const void *B)
+{
+  const pi_src_t *a = A, *b = B;
+  return strcmp(a->url, b->url);
+}
+
+
+/**
+ *
+ */
+static int
+pi_u64cmp(const void *A, const void *B)
+{
+  const uint64_t a = *(const uint64_t *)A, b = *(const uint64_t *)B;
+  return a < b ? -1 : a > b;
+}
+
+
+/**
+ *
+ */
+#define PI_GROW(ptr, num, cap, init) do {                  \
+    if((num) == (cap)) {                                   \
+      (cap) = MAX(init, (cap) * 2);                        \
+      (ptr) = realloc((ptr), (cap) * sizeof((ptr)[0]));    \
+    }                                                      \
+  } while(0)
+
+
+/**
+ *
+ */
+static uint32_t
+pi_add_name(char **names, uint32_t *size, uint32_t *cap,
+            const char *str, int len)
+{
+  uint32_t off = *size;
+  while(*size + len > *cap) {
+    *cap = MAX(65536, *cap * 2);
+    *names = realloc(*names, *cap);
+  }
+  memcpy(*names + off, str, len);
+  *size += len;
+  return off;
+}
+
+
+/**
+ * Write a new base file from the given items
+ */
+static int
+pi_build(const char *path, pi_src_t *src, int num_src)
+{
+  pi_dir_t **dirs = calloc(PI_DIR_HASH, sizeof(pi_dir_t *));
+  pi_dir_t *pdir;
+  pi_entry_t *entries = NULL;
+  uint32_t num_entries = 0, entries_cap = 0;
+  char *names = NULL;
+  uint32_t names_size = 0, names_cap = 0;
+  uint64_t *pairs = NULL;
+  uint32_t num_pairs = 0, pairs_cap = 0;
+  int i, rval = -1;
+
+  qsort(src, num_src, sizeof(pi_src_t), pi_srccmp);
+
+  for(i = 0; i < num_src; i++) {
+    const char *url = src[i].url;
+    const char *name = strrchr(url, '/');
+    int dirlen, namelen;
+    uint32_t parent;
+
+    if(i > 0 && !strcmp(url, src[i - 1].url))
+      continue;
+
+    if(name == NULL || name == url)
+      continue;
+    dirlen = name - url;
+    name++;
+    namelen = strlen(name);
+    if(namelen == 0 || namelen > 65535 || dirlen > 65535)
+      continue;
+
+    // Find parent, create prefix entry if it's not indexed itself
+    unsigned int h = pi_dir_hash(url, dirlen);
+    for(pdir = dirs[h]; pdir != NULL; pdir = pdir->next)
+      if(pdir->len == dirlen && !memcmp(pdir->url, url, dirlen))
+        break;
+
+    if(pdir == NULL) {
+      PI_GROW(entries, num_entries, entries_cap, 4096);
+      pi_entry_t *pe = &entries[num_entries];
+      pe->pe_parent = PI_NO_PARENT;
+      pe->pe_name_off = pi_add_name(&names, &names_size, &names_cap,
+                                    url, dirlen);
+      pe->pe_name_len = dirlen;
+      pe->pe_type = CONTENT_DIR;
+      pe->pe_flags = PI_F_PREFIX;
+
+      pdir = malloc(sizeof(pi_dir_t));
+      pdir->url = url;
+      pdir->len = dirlen;
+      pdir->id = num_entries++;
+      pdir->next = dirs[h];
+      dirs[h] = pdir;
+    }
+    parent = pdir->id;
+
+    PI_GROW(entries, num_entries, entries_cap, 4096);
+    pi_entry_t *pe = &entries[num_entries];
+    pe->pe_parent = parent;
+    pe->pe_name_off = pi_add_name(&names, &names_size, &names_cap,
+                                  name, namelen);
+    pe->pe_name_len = namelen;
+    pe->pe_type = src[i].type;
+    pe->pe_flags = 0;
+
+    if(src[i].type == CONTENT_DIR) {
+      h = pi_dir_hash(url, strlen(url));
+      pdir = malloc(sizeof(pi_dir_t));
+      pdir->url = url;
+      pdir->len = strlen(url);
+      pdir->id = num_entries;
+      pdir->next = dirs[h];
+      dirs[h] = pdir;
+    }
+
+    for(int j = 0; j < namelen - 2; j++) {
+      PI_GROW(pairs, num_pairs, pairs_cap, 65536);
+      pairs[num_pairs++] =
+        (uint64_t)pi_trigram((const uint8_t *)name + j) << 32 | num_entries;
+    }
+    num_entries++;
+  }
+
+  for(i = 0; i < PI_DIR_HASH; i++) {
+    while((pdir = dirs[i]) != NULL) {
+      dirs[i] = pdir->next;
+      free(pdir);
+    }
+  }
+  free(dirs);
+
+  qsort(pairs, num_pairs, sizeof(uint64_t), pi_u64cmp);
+
+  // Trigram table and postings
+  pi_trigram_t *trigrams = NULL;
+  uint32_t num_trigrams = 0, trigrams_cap = 0;
+  uint8_t *postings = malloc(num_pairs * 5 + 1);
+  uint32_t postings_size = 0;
+  uint32_t prev_id = 0;
+
+  for(i = 0; i < num_pairs; i++) {
+    uint32_t tri = pairs[i] >> 32;
+    uint32_t id = pairs[i];
+
+    if(i > 0 && pairs[i] == pairs[i - 1])
+      continue; // Same trigram twice in one name
+
+    if(num_trigrams == 0 || trigrams[num_trigrams - 1].pt_trigram != tri) {
+      PI_GROW(trigrams, num_trigrams, trigrams_cap, 4096);
+      trigrams[num_trigrams].pt_trigram = tri;
+      trigrams[num_trigrams].pt_offset = postings_size;
+      trigrams[num_trigrams].pt_count = 0;
+      num_trigrams++;
+      prev_id = 0;
+    }
+    trigrams[num_trigrams - 1].pt_count++;
+
+    uint32_t d = id - prev_id;
+    prev_id = id;
+    while(d >= 0x80) {
+      postings[postings_size++] = d | 0x80;
+      d >>= 7;
+    }
+    postings[postings_size++] = d;
+  }
+  free(pairs);
+
+  pi_header_t ph = {0};
+  ph.ph_magic         = PI_MAGIC;
+  ph.ph_version       = PI_VERSION;
+  ph.ph_num_entries   = num_entries;
+  ph.ph_num_trigrams  = num_trigrams;
+  ph.ph_names_size    = names_size;
+  ph.ph_postings_size = postings_size;
+  ph.ph_off_entries   = sizeof(pi_header_t);
+  ph.ph_off_names     = ph.ph_off_entries + num_entries * sizeof(pi_entry_t);
+  ph.ph_off_trigrams  = (ph.ph_off_names + names_size + 3) & ~3;
+  ph.ph_off_postings  = ph.ph_off_trigrams +
+    num_trigrams * sizeof(pi_trigram_t);
+
+  char tmp[PATH_MAX];
+  static const char pad[4];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *fp = fopen(tmp, "wb");
+  if(fp != NULL) {
+    if(fwrite(&ph, sizeof(ph), 1, fp) == 1 &&
+       fwrite(entries, sizeof(pi_entry_t), num_entries, fp) == num_entries &&
+       fwrite(names, 1, names_size, fp) == names_size &&
+       fwrite(pad, 1, ph.ph_off_trigrams - ph.ph_off_names - names_size, fp) ==
+       ph.ph_off_trigrams - ph.ph_off_names - names_size &&
+       fwrite(trigrams, sizeof(pi_trigram_t), num_trigrams, fp) ==
+       num_trigrams &&
+       fwrite(postings, 1, postings_size, fp) == postings_size) {
+      rval = 0;
+    }
+    if(fclose(fp))
+      rval = -1;
+    if(!rval && rename(tmp, path))
+      rval = -1;
+    if(rval)
+      unlink(tmp);
+  }
+
+  if(rval)
+    TRACE(TRACE_ERROR, "pathindex", "Unable to write %s", path);
+  else
+    TRACE(TRACE_DEBUG, "pathindex",
+          "Wrote %s: %d entries, %d trigrams, %d kB",
+          path, num_entries, num_trigrams,
+          (int)((ph.ph_off_postings + postings_size) / 1024));
+
+  free(entries);
+  free(names);
+  free(trigrams);
+  free(postings);
+  return rval;
+}
+
+
+/**
+ *
+ */
+static void
+pi_journal_write(const pi_delta_t *pd)
+{
+  if(pi_journal == NULL)
+    return;
+  if(pd->pd_removed)
+    fprintf(pi_journal, "-%s\n", pd->pd_url);
+  else
+    fprintf(pi_journal, "+%d %s\n", pd->pd_type, pd->pd_url);
+}
+
+
+/**
+ * Add all indexed items from metadb, used to populate a new index
+ */
+static void
+pi_load_metadb(pi_src_t **srcp, int *nump, int *capp)
+{
+  sqlite3_stmt *stmt;
+  void *db = metadb_get();
+  if(db == NULL)
+    return;
+
+  if(!db_prepare(db, &stmt,
+                 "SELECT url, contenttype FROM item "
+                 "WHERE parent IS NOT NULL")) {
+    while(db_step(stmt) == SQLITE_ROW) {
+      const char *url = (const char *)sqlite3_column_text(stmt, 0);
+      if(url == NULL)
+        continue;
+      PI_GROW(*srcp, *nump, *capp, 65536);
+      (*srcp)[*nump].url = strdup(url);
+      (*srcp)[*nump].type = sqlite3_column_int(stmt, 1);
+      (*nump)++;
+    }
+    sqlite3_finalize(stmt);
+  }
+  metadb_close(db);
+}
+
+
+/**
+ * Merge base and delta into a new base file
+ */
+static void
+pi_compact(int from_metadb)
+{
+  pi_deltaset_t snap;
+  pi_delta_t *pd, *next;
+  pi_src_t *src = NULL;
+  int num = 0, cap = 0, i;
+  char url[PATH_MAX];
+
+  int64_t ts = arch_get_ts();
+
+  pi_deltaset_init(&snap);
+
+  hts_mutex_lock(&pi_mutex);
+  pi_base_t *pb = pi_base_get();
+  uint32_t seq = pi_seq;
+  TAILQ_FOREACH(pd, &pi_delta.pds_queue, pd_link)
+    pi_delta_set(&snap, pd->pd_url, pd->pd_type, pd->pd_removed, pd->pd_seq);
+  hts_mutex_unlock(&pi_mutex);
+
+  if(from_metadb)
+    pi_load_metadb(&src, &num, &cap);
+
+  if(pb != NULL) {
+    for(i = 0; i < pb->pb_hdr->ph_num_entries; i++) {
+      if(pb->pb_entries[i].pe_flags & PI_F_PREFIX)
+        continue;
+      if(pi_entry_url(pb, i, url, sizeof(url)))
+        continue;
+      if(pi_delta_overrides(&snap, url))
+        continue;
+      PI_GROW(src, num, cap, 65536);
+      src[num].url = strdup(url);
+      src[num].type = pb->pb_entries[i].pe_type;
+      num++;
+    }
+  }
+  pi_base_release(pb);
+
+  TAILQ_FOREACH(pd, &snap.pds_queue, pd_link) {
+    if(pd->pd_removed)
+      continue;
+    PI_GROW(src, num, cap, 65536);
+    src[num].url = strdup(pd->pd_url);
+    src[num].type = pd->pd_type;
+    num++;
+  }
+  pi_deltaset_clear(&snap);
+
+  int r = pi_build(pi_base_path, src, num);
+
+  for(i = 0; i < num; i++)
+    free(src[i].url);
+  free(src);
+
+  if(r)
+    return;
+
+  pb = pi_base_open(pi_base_path);
+  if(pb == NULL)
+    return;
+
+  hts_mutex_lock(&pi_mutex);
+  pi_base_release(pi_base);
+  pi_base = pb;
+
+  // Drop everything that made it into the new base and rewrite journal
+  for(pd = TAILQ_FIRST(&pi_delta.pds_queue); pd != NULL; pd = next) {
+    next = TAILQ_NEXT(pd, pd_link);
+    if(pd->pd_seq <= seq)
+      pi_delta_destroy(&pi_delta, pd);
+  }
+
+  if(pi_journal != NULL)
+    fclose(pi_journal);
+  pi_journal = fopen(pi_journal_path, "w");
+  TAILQ_FOREACH(pd, &pi_delta.pds_queue, pd_link)
+    pi_journal_write(pd);
+  if(pi_journal != NULL)
+    fflush(pi_journal);
+
+  hts_mutex_unlock(&pi_mutex);
+
+  TRACE(TRACE_DEBUG, "pathindex", "Index rebuilt with %d items in %d ms",
+        num, (int)((arch_get_ts() - ts) / 1000));
+}
+
+
+/**
+ * Called by the indexer when idle
+ */
+void
+fa_pathindex_maintain(void)
+{
+  if(!pi_enabled)
+    return;
+
+  hts_mutex_lock(&pi_mutex);
+  int have_base = pi_base != NULL;
+  int threshold = MAX(PI_COMPACT_MIN,
+                      have_base ? pi_base->pb_hdr->ph_num_entries / 8 : 0);
+  int compact = !have_base || pi_delta.pds_num > threshold;
+  hts_mutex_unlock(&pi_mutex);
+
+  if(compact)
+    pi_compact(!have_base);
+}
+
+
+/**************************************************************************
+ * Updates
+ *************************************************************************/
+
+/**
+ *
+ */
+static void
+pi_update(const char *url, int type, int removed)
+{
+  if(!pi_enabled)
+    return;
+
+  hts_mutex_lock(&pi_mutex);
+  pi_delta_set(&pi_delta, url, type, removed, ++pi_seq);
+  pi_journal_write(TAILQ_LAST(&pi_delta.pds_queue, pi_delta_queue));
+  hts_mutex_unlock(&pi_mutex);
+}
+
+
+/**
+ *
+ */
+void
+fa_pathindex_add(const char *url, int type)
+{
+  pi_update(url, type, 0);
+}
+
+
+/**
+ *
+ */
+void
+fa_pathindex_remove(const char *url)
+{
+  pi_update(url, 0, 1);
+}
+
+
+/**
+ * Make journal persistent
+ */
+void
+fa_pathindex_commit(void)
+{
+  if(!pi_enabled)
+    return;
+  hts_mutex_lock(&pi_mutex);
+  if(pi_journal != NULL)
+    fflush(pi_journal);
+  hts_mutex_unlock(&pi_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+pi_journal_replay(void)
+{
+  char line[PATH_MAX + 32];
+  FILE *fp = fopen(pi_journal_path, "r");
+  if(fp == NULL)
+    return;
+
+  while(fgets(line, sizeof(line), fp) != NULL) {
+    char *nl = strchr(line, '\n');
+    if(nl == NULL)
+      break; // Truncated write
+    *nl = 0;
+
+    if(line[0] == '-') {
+      pi_delta_set(&pi_delta, line + 1, 0, 1, ++pi_seq);
+    } else if(line[0] == '+') {
+      char *url;
+      int type = strtol(line + 1, &url, 10);
+      if(*url == ' ')
+        pi_delta_set(&pi_delta, url + 1, type, 0, ++pi_seq);
+    }
+  }
+  fclose(fp);
+}
+
+
+/**
+ *
+ */
+void
+fa_pathindex_init(void)
+{
+  char path[PATH_MAX];
+
+  if(gconf.persistent_path == NULL)
+    return;
+
+  hts_mutex_init(&pi_mutex);
+  pi_deltaset_init(&pi_delta);
+
+  snprintf(path, sizeof(path), "%s/pathindex", gconf.persistent_path);
+  fa_makedir(path);
+  snprintf(pi_base_path, sizeof(pi_base_path), "%s/index.dat", path);
+  snprintf(pi_journal_path, sizeof(pi_journal_path), "%s/journal", path);
+
+  pi_base = pi_base_open(pi_base_path);
+  pi_journal_replay();
+  pi_journal = fopen(pi_journal_path, "a");
+  pi_enabled = 1;
+
+  TRACE(TRACE_DEBUG, "pathindex", "Loaded index with %d entries, %d updates",
+        pi_base ? pi_base->pb_hdr->ph_num_entries : 0, pi_delta.pds_num);
+}
+
+
+/**************************************************************************
+ * Search backend
+ *************************************************************************/
+
+typedef struct pi_search {
+  char *ps_query;
+  prop_t *ps_nodes;
+} pi_search_t;
+
+
+/**
+ *
+ */
+static void *
+pi_searcher(void *aux)
+{
+  pi_search_t *ps = aux;
+  fa_pathindex_hit_t *hits;
+  prop_t *nodes[4] = {}, *entries[4] = {};
+  static const char *titles[4] = {
+    "Local audio files", "Local video files",
+    "Local images", "Local folders"
+  };
+  char iconpath[PATH_MAX];
+  int i, t;
+
+  snprintf(iconpath, sizeof(iconpath), "%s/res/fileaccess/fs_icon.png",
+	   app_dataroot());
+
+  int num = fa_pathindex_search(ps->ps_query, PI_SEARCH_LIMIT, &hits);
+
+  for(i = 0; i < num; i++) {
+    switch(hits[i].type) {
+    case CONTENT_AUDIO: t = 0; break;
+    case CONTENT_VIDEO:
+    case CONTENT_DVD:   t = 1; break;
+    case CONTENT_IMAGE: t = 2; break;
+    case CONTENT_DIR:
+    case CONTENT_ALBUM: t = 3; break;
+    default:
+      continue;
+    }
+
+    if(nodes[t] == NULL)
+      if(search_class_create(ps->ps_nodes, &nodes[t], &entries[t],
+                             titles[t], iconpath))
+        break;
+
+    prop_add_int(entries[t], 1);
+
+    const char *name = strrchr(hits[i].url, '/');
+    prop_t *p = prop_create_root(NULL);
+    prop_set(p, "url", PROP_SET_STRING, hits[i].url);
+    prop_set(p, "type", PROP_SET_STRING, content2type(hits[i].type));
+    prop_set(prop_create(p, "metadata"), "title", PROP_SET_STRING,
+             name ? name + 1 : hits[i].url);
+
+    if(prop_set_parent(p, nodes[t])) {
+      prop_destroy(p);
+      break;
+    }
+  }
+
+  for(i = 0; i < 4; i++) {
+    prop_ref_dec(nodes[i]);
+    prop_ref_dec(entries[i]);
+  }
+
+  fa_pathindex_hits_free(hits, num);
+  prop_ref_dec(ps->ps_nodes);
+  free(ps->ps_query);
+  free(ps);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+pathindex_search(prop_t *model, const char *query, prop_t *loading)
+{
+  if(!pi_search_enabled || !pi_enabled)
+    return;
+
+  pi_search_t *ps = malloc(sizeof(pi_search_t));
+  ps->ps_query = strdup(query);
+  ps->ps_nodes = prop_ref_inc(prop_create(model, "nodes"));
+
+  hts_thread_create_detached("pathindex search", pi_searcher, ps,
+			     THREAD_PRIO_MODEL);
+}
+
+
+/**
+ *
+ */
+static int
+pathindex_init(void)
+{
+  prop_t *s = search_get_settings();
+
+  setting_create(SETTING_BOOL, s, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE(_p("Search in indexed files")),
+                 SETTING_VALUE(1),
+                 SETTING_WRITE_BOOL(&pi_search_enabled),
+                 SETTING_STORE("pathindex", "enable"),
+                 NULL);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static backend_t be_pathindex = {
+  .be_init = pathindex_init,
+  .be_search = pathindex_search,
+};
+
+BE_REGISTER(pathindex);
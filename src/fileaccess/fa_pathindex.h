@@ -0,0 +1,44 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+/**
+ * Trigram index over the file names of all indexed items
+ */
+typedef struct fa_pathindex_hit {
+  char *url;
+  int type;   // CONTENT_ type
+  int score;
+} fa_pathindex_hit_t;
+
+void fa_pathindex_init(void);
+
+void fa_pathindex_add(const char *url, int type);
+
+void fa_pathindex_remove(const char *url);
+
+void fa_pathindex_commit(void);
+
+void fa_pathindex_maintain(void);
+
+int fa_pathindex_search(const char *query, int limit,
+                        fa_pathindex_hit_t **hitsp);
+
+void fa_pathindex_hits_free(fa_pathindex_hit_t *hits, int num);
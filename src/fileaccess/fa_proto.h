@@ -240,6 +240,11 @@ typedef struct fa_protocol {
    */
   int (*fap_no_parking)(fa_handle_t *fh);
 
+  /**
+   * Return the OS file descriptor backing the handle, or -1
+   */
+  int (*fap_native_fd)(fa_handle_t *fh);
+
   /**
    * Check if a file URL should be redirected to something else
    */
@@ -193,8 +193,11 @@ deep_probe(fa_dir_entry_t *fde, scanner_t *s)
 
     prop_t *meta = prop_create_r(fde->fde_prop, "metadata");
 
-    if(!fde->fde_ignore_cache && !fa_dir_entry_stat(fde) &&
-       (fde->fde_md == NULL || !fde->fde_md->md_cache_status)) {
+    if(fde->fde_metadb_checked) {
+      // Already looked up by metadb_prefetch()
+      fde->fde_metadb_checked = 0;
+    } else if(!fde->fde_ignore_cache && !fa_dir_entry_stat(fde) &&
+              (fde->fde_md == NULL || !fde->fde_md->md_cache_status)) {
 
       if(fde->fde_md != NULL)
 	metadata_destroy(fde->fde_md);
@@ -250,10 +253,10 @@ deep_probe(fa_dir_entry_t *fde, scanner_t *s)
         SCAN_TRACE(s, "Storing item %s in DB parent:%s mtime:%d",
                    rstr_get(fde->fde_url), s->s_url,
                    (int)fde->fde_stat.fs_mtime);
-	metadb_metadata_write(getdb(s), rstr_get(fde->fde_url),
-			      fde->fde_stat.fs_mtime,
-			      fde->fde_md, s->s_url, s->s_mtime,
-                              is);
+	metadb_metadata_write_deferred(rstr_get(fde->fde_url),
+                                       fde->fde_stat.fs_mtime,
+                                       fde->fde_md, s->s_url, s->s_mtime,
+                                       is);
 	break;
       case METADATA_CACHE_STATUS_FULL:
 	// All set
@@ -295,6 +298,66 @@ tryplay(scanner_t *s)
 }
 
 
+/**
+ * Fetch cached metadata for all entries that are about to be deep
+ * probed with a single batched metadb query instead of one lookup
+ * per entry
+ */
+static void
+metadb_prefetch(scanner_t *s)
+{
+  fa_dir_entry_t *fde, **fdes;
+  const char **urls;
+  time_t *mtimes;
+  int i, num = 0;
+
+  fdes   = malloc(s->s_fd->fd_count * sizeof(fa_dir_entry_t *));
+  urls   = malloc(s->s_fd->fd_count * sizeof(const char *));
+  mtimes = malloc(s->s_fd->fd_count * sizeof(time_t));
+
+  RB_FOREACH(fde, &s->s_fd->fd_entries, fde_link) {
+
+    if(fde->fde_probestatus == FDE_PROBED_NONE) {
+      if(fde->fde_type == CONTENT_FILE)
+	fde->fde_type = contenttype_from_filename(rstr_get(fde->fde_filename));
+
+      fde->fde_probestatus = FDE_PROBED_FILENAME;
+    }
+
+    if(fde->fde_probestatus != FDE_PROBED_FILENAME ||
+       fde->fde_type == CONTENT_UNKNOWN || fde->fde_type == CONTENT_SHARE ||
+       fde->fde_ignore_cache ||
+       (fde->fde_md != NULL && fde->fde_md->md_cache_status) ||
+       fa_dir_entry_stat(fde))
+      continue;
+
+    fdes[num]   = fde;
+    urls[num]   = rstr_get(fde->fde_url);
+    mtimes[num] = fde->fde_stat.fs_mtime;
+    num++;
+  }
+
+  if(num > 0) {
+    metadb_batch_t *mb = metadb_batch_get(getdb(s), urls, mtimes, num);
+    if(mb != NULL) {
+      for(i = 0; i < num; i++) {
+        fde = fdes[i];
+        if(fde->fde_md != NULL)
+          metadata_destroy(fde->fde_md);
+        fde->fde_md = metadb_batch_metadata(mb, i);
+        fde->fde_metadb_checked = 1;
+      }
+      SCAN_TRACE(s, "Prefetched metadata for %d items", num);
+      metadb_batch_free(mb);
+    }
+  }
+
+  free(fdes);
+  free(urls);
+  free(mtimes);
+}
+
+
 /**
  *
  */
@@ -307,8 +370,10 @@ analyzer(scanner_t *s, int probe)
   if(s->s_fd->fd_count == 0)
     return;
   
-  if(probe)
+  if(probe) {
     tryplay(s);
+    metadb_prefetch(s);
+  }
 
   /* Scan all entries */
   RB_FOREACH(fde, &s->s_fd->fd_entries, fde_link) {
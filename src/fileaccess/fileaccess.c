@@ -384,6 +384,19 @@ fa_fsize(void *fh_)
 }
 
 
+/**
+ *
+ */
+int
+fa_native_fd(void *fh_)
+{
+  fa_handle_t *fh = fh_;
+  if(fh->fh_proto->fap_native_fd == NULL)
+    return -1;
+  return fh->fh_proto->fap_native_fd(fh);
+}
+
+
 /**
  *
  */
@@ -1484,6 +1497,16 @@ typedef struct loadarg {
 #define FA_LOAD_CACHE_STASH "fa-load"
 
 
+/**
+ * When the cached copy of an fa_load() URL expires, 0 if not cached
+ */
+time_t
+fa_load_cache_expiry(const char *url)
+{
+  return blobcache_get_expiry(url, FA_LOAD_CACHE_STASH);
+}
+
+
 /**
  *
  */
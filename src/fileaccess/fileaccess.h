@@ -92,6 +92,7 @@ typedef struct fa_dir_entry {
   char fde_ignore_cache;
   char fde_bound_to_metadb;
   char fde_marked;
+  char fde_metadb_checked; // fde_md is result of a batched metadb lookup
   struct fa_stat fde_stat;
 
 #if ENABLE_METADATA
@@ -211,6 +212,7 @@ int64_t fa_seek4(void *fh, int64_t pos, int whence, int lazy);
 #define fa_seek_lazy(fh, pos, whence) fa_seek4(fh, pos, whence, 1)
 
 int64_t fa_fsize(void *fh);
+int fa_native_fd(void *fh);
 int fa_ftruncate(void *fh, uint64_t newsize);
 
 int fa_stat_ex(const char *url, struct fa_stat *buf, char *errbuf,
@@ -334,6 +336,8 @@ buf_t *fa_load(const char *url, ...) attribute_null_sentinel;
 
 buf_t *fa_load_and_close(fa_handle_t *fh);
 
+time_t fa_load_cache_expiry(const char *url);
+
 int fa_parent(char *dst, size_t dstlen, const char *url)
   attribute_unused_result;
 
@@ -45,6 +45,7 @@ enum {
   HTTP_TAG_READ_TIMEOUT,
   HTTP_TAG_LOCATION,
   HTTP_TAG_RESPONSE_CODE,
+  HTTP_TAG_DATA_CALLBACK,
 };
 
 
@@ -67,6 +68,7 @@ enum {
 #define HTTP_READ_TIMEOUT(a)               HTTP_TAG_READ_TIMEOUT, a
 #define HTTP_LOCATION(a)                   HTTP_TAG_LOCATION, a
 #define HTTP_RESPONSE_CODE(a)              HTTP_TAG_RESPONSE_CODE, a
+#define HTTP_DATA_CALLBACK(a, b)           HTTP_TAG_DATA_CALLBACK, a, b
 
 /**
  * Tell HTTP client to create an internal buffer. To be used when
@@ -97,6 +99,13 @@ typedef struct http_request_inspection {
  */
 typedef struct http_req_aux http_req_aux_t;
 
+/**
+ * Callback for HTTP_DATA_CALLBACK(). Invoked with (decoded) body data
+ * as it arrives instead of buffering the full response. A final call
+ * with size == 0 signals end of body. Return non-zero to abort transfer
+ */
+typedef int (http_data_cb_t)(void *opaque, const void *data, size_t size);
+
 
 /**
  *
@@ -61,6 +61,7 @@
 
 LIST_HEAD(cifs_connection_list, cifs_connection);
 LIST_HEAD(nbt_req_list, nbt_req);
+TAILQ_HEAD(nbt_req_queue, nbt_req);
 LIST_HEAD(cifs_tree_list, cifs_tree);
 
 static struct cifs_connection_list cifs_connections;
@@ -68,6 +69,10 @@ static hts_mutex_t smb_global_mutex;
 
 #define NBT_TIMEOUT 30000
 
+#define SMB_READ_SIZE       57344  // 14 * 4096 is max according to spec
+#define SMB_LARGE_READ_SIZE 126976 // With CAP_LARGE_READX, 31 * 4096
+#define SMB_READ_WINDOW     8      // Max outstanding READ_ANDX per file
+
 /**
  *
  */
@@ -77,10 +82,10 @@ typedef struct nbt_req {
   void *nr_response;
   int nr_response_len;
   int nr_result;
-  LIST_ENTRY(nbt_req) nr_multi_link;
-  int nr_offset;
+  TAILQ_ENTRY(nbt_req) nr_file_link;
+  uint64_t nr_pos;      // File offset for READ_ANDX requests
   int nr_cnt;
-  int nr_last;
+  int nr_consumed;
   int nr_is_trans2;
   int nr_data_count;
 } nbt_req_t;
@@ -130,6 +135,7 @@ typedef struct cifs_connection {
   uint8_t cc_bpc;   // Bytes per characters 1 or 2
   uint8_t cc_ntsmb;
   uint8_t cc_security_mode;
+  uint8_t cc_large_readx;
 
   uint8_t cc_challenge_key[8];
   uint8_t cc_domain[64];
@@ -579,6 +585,9 @@ smb_neg_proto(cifs_connection_t *cc, char *errbuf, size_t errlen)
     return -1;
   }
 
+  cc->cc_large_readx =
+    !!(letoh_32(reply->capabilities) & SERVER_CAP_LARGE_READX);
+
   cc->cc_session_key = reply->session_key;
   cc->cc_security_mode = reply->security_mode;
 
@@ -989,8 +998,11 @@ smb_dispatch(void *aux)
   hts_mutex_lock(&smb_global_mutex);
 
   LIST_FOREACH(nr, &cc->cc_pending_nbt_requests, nr_link) {
+    if(nr->nr_result != -1)
+      continue; // Completed, response not yet picked up (read-ahead)
     nr->nr_result = 1;
     free(nr->nr_response);
+    nr->nr_response = NULL;
   }
 
   hts_cond_broadcast(&cc->cc_cond);
@@ -2236,6 +2248,15 @@ typedef struct smb_file {
   uint16_t sf_fid;
   uint64_t sf_pos;
   uint64_t sf_file_size;
+
+  /**
+   * Outstanding and completed READ_ANDX requests in file order.
+   * sf_req_end is the file offset following the last queued request
+   */
+  struct nbt_req_queue sf_reqs;
+  int sf_num_reqs;
+  uint64_t sf_req_end;
+  int sf_sequential;  // Number of back to back sequential reads
 } smb_file_t;
 
 
@@ -2301,6 +2322,7 @@ smb_open(fa_protocol_t *fap, const char *url, char *errbuf, size_t errlen,
 
   sf = calloc(1, sizeof(smb_file_t));
   sf->sf_ct = ct;  // transfer reference of 'sf' to smb_file_t
+  TAILQ_INIT(&sf->sf_reqs);
 
   resp = rbuf;
   sf->sf_fid = resp->fid;
@@ -2311,6 +2333,26 @@ smb_open(fa_protocol_t *fap, const char *url, char *errbuf, size_t errlen,
 }
 
 
+/**
+ * Drop all queued read requests. Replies that are still in flight
+ * will be discarded by smb_dispatch() as they no longer match.
+ */
+static void
+smb_read_flush(smb_file_t *sf)
+{
+  nbt_req_t *nr;
+
+  while((nr = TAILQ_FIRST(&sf->sf_reqs)) != NULL) {
+    TAILQ_REMOVE(&sf->sf_reqs, nr, nr_file_link);
+    LIST_REMOVE(nr, nr_link);
+    free(nr->nr_response);
+    free(nr);
+  }
+  sf->sf_num_reqs = 0;
+  sf->sf_req_end = sf->sf_pos;
+}
+
+
 /**
  * Close file
  */
@@ -2323,6 +2365,8 @@ smb_close(fa_handle_t *fh)
 
   hts_mutex_lock(&smb_global_mutex);
 
+  smb_read_flush(sf);
+
   req = alloca(sizeof(SMB_CLOSE_req_t));
   memset(req, 0, sizeof(SMB_CLOSE_req_t));
 
@@ -2338,19 +2382,62 @@ smb_close(fa_handle_t *fh)
 
 
 /**
- *
+ * Queue READ_ANDX requests until 'end' is covered or the window is full
+ */
+static void
+smb_read_issue(smb_file_t *sf, uint64_t end)
+{
+  cifs_tree_t *ct = sf->sf_ct;
+  cifs_connection_t *cc = ct->ct_cc;
+  SMB_READ_ANDX_req_t *req;
+  int chunk = cc->cc_large_readx ? SMB_LARGE_READ_SIZE : SMB_READ_SIZE;
+
+  // Leave room in the server's multiplex limit for other requests
+  int window = MAX(1, MIN(SMB_READ_WINDOW, cc->cc_max_mpx_count - 1));
+
+  req = alloca(sizeof(SMB_READ_ANDX_req_t));
+
+  while(sf->sf_req_end < end && sf->sf_num_reqs < window) {
+    int cnt = MIN(end - sf->sf_req_end, chunk);
+    uint64_t pos = sf->sf_req_end;
+
+    memset(req, 0, sizeof(SMB_READ_ANDX_req_t));
+    smbv1_init_header(cc, &req->hdr, SMB_READ_ANDX,
+                      SMB_FLAGS_CANONICAL_PATHNAMES, 0, ct->ct_tid, 1);
+
+    req->fid = sf->sf_fid;
+    req->offset_low = htole_32((uint32_t)pos);
+    req->offset_high = htole_32((uint32_t)(pos >> 32));
+    req->max_count_low = htole_16(cnt & 0xffff);
+    req->max_count_high = htole_32(cnt >> 16);
+    req->wordcount = 12;
+    req->andx_command = 0xff;
+
+    nbt_req_t *nr = nbt_async_req(cc, req, sizeof(SMB_READ_ANDX_req_t), 0,
+                                  "read");
+    nr->nr_pos = pos;
+    nr->nr_cnt = cnt;
+    TAILQ_INSERT_TAIL(&sf->sf_reqs, nr, nr_file_link);
+    sf->sf_num_reqs++;
+    sf->sf_req_end += cnt;
+  }
+}
+
+
+/**
+ * Reads are served from a window of pipelined READ_ANDX requests.
+ * Once the file is read sequentially the window is kept full ahead
+ * of the read position (read-ahead) so the next read does not have
+ * to wait a full round trip.
  */
 static int
 smb_read(fa_handle_t *fh, void *buf, size_t size)
 {
   smb_file_t *sf = (smb_file_t *)fh;
-  SMB_READ_ANDX_req_t *req;
   const SMB_READ_ANDX_resp_t *resp;
-  size_t cnt, rcnt;
-  size_t total = 0;
   cifs_tree_t *ct = sf->sf_ct;
-  nbt_req_t *nr = NULL;
-  struct nbt_req_list reqs;
+  nbt_req_t *nr;
+  size_t total = 0;
 
   if(sf->sf_pos >= sf->sf_file_size)
     return 0;
@@ -2361,96 +2448,89 @@ smb_read(fa_handle_t *fh, void *buf, size_t size)
   if(size == 0)
     return 0;
 
-  LIST_INIT(&reqs);
-
-  req = alloca(sizeof(SMB_READ_ANDX_req_t));
-  memset(req, 0, sizeof(SMB_READ_ANDX_req_t));
-
   hts_mutex_lock(&smb_global_mutex);
 
-  while(size > 0) {
-    cnt = MIN(size, 57344); // 14 * 4096 is max according to spec
-    smbv1_init_header(ct->ct_cc, &req->hdr, SMB_READ_ANDX,
-                      SMB_FLAGS_CANONICAL_PATHNAMES, 0, ct->ct_tid, 1);
+  nr = TAILQ_FIRST(&sf->sf_reqs);
+  if((nr != NULL ? nr->nr_pos + nr->nr_consumed : sf->sf_req_end) ==
+     sf->sf_pos) {
+    sf->sf_sequential++;
+  } else {
+    // Seek, or first read
+    smb_read_flush(sf);
+    sf->sf_sequential = 0;
+  }
 
-    req->fid = sf->sf_fid;
-    int64_t pos = sf->sf_pos + total;
-    req->offset_low = htole_32((uint32_t)pos);
-    req->offset_high = htole_32((uint32_t)(pos >> 32));
-    req->max_count_low = htole_16(cnt & 0xffff);
-    req->max_count_high = htole_32(cnt >> 16);
-    req->wordcount = 12;
-    req->andx_command = 0xff;
+  uint64_t end = sf->sf_sequential >= 2 ? sf->sf_file_size : sf->sf_pos + size;
 
-    nr = nbt_async_req(ct->ct_cc, req, sizeof(SMB_READ_ANDX_req_t), 0,
-                       "read");
-    LIST_INSERT_HEAD(&reqs, nr, nr_multi_link);
+  while(size > 0) {
 
-    nr->nr_offset = total;
-    nr->nr_cnt = cnt;
-    total += cnt;
-    size -= cnt;
-    nr->nr_last = 0;
-  }
-  nr->nr_last = 1;
+    smb_read_issue(sf, end);
 
-  while(1) {
-    LIST_FOREACH(nr, &reqs, nr_multi_link)
-      if(nr->nr_result == -1)
-	break;
+    nr = TAILQ_FIRST(&sf->sf_reqs);
+    assert(nr != NULL);
 
-    if(nr != NULL) {
+    while(nr->nr_result == -1) {
       if(hts_cond_wait_timeout(&ct->ct_cc->cc_cond, &smb_global_mutex,
                                NBT_TIMEOUT)) {
-	break;
+        TRACE(TRACE_ERROR, "SMB", "%s:%d read timeout (%d) on %p",
+              ct->ct_cc->cc_hostname, ct->ct_cc->cc_port, nr->nr_mid,
+              ct->ct_cc);
+        ct->ct_cc->cc_broken = 1;
+        goto fail;
       }
-    } else {
-      break;
     }
-  }
 
-  total = 0;
-  while((nr = LIST_FIRST(&reqs)) != NULL) {
     if(nr->nr_result)
       goto fail;
 
     resp = nr->nr_response;
-    uint32_t errcode = letoh_32(resp->hdr.errorcode);
-    if(errcode)
+    if(nr->nr_response_len < sizeof(SMB_READ_ANDX_resp_t) ||
+       letoh_32(resp->hdr.errorcode))
       goto fail;
 
-    LIST_REMOVE(nr, nr_link);
-    LIST_REMOVE(nr, nr_multi_link);
-
-    rcnt = letoh_16(resp->data_length_low);
+    int rcnt = letoh_16(resp->data_length_low);
     rcnt += letoh_32(resp->data_length_high) << 16;
-    memcpy(buf + nr->nr_offset,
-	   nr->nr_response + letoh_16(resp->data_offset), rcnt);
-    free(nr->nr_response);
+    int offset = letoh_16(resp->data_offset);
+
+    if(rcnt > nr->nr_cnt || offset + rcnt > nr->nr_response_len)
+      goto fail;
+
+    int copy = MIN(rcnt - nr->nr_consumed, size);
+    memcpy(buf + total, nr->nr_response + offset + nr->nr_consumed, copy);
+    nr->nr_consumed += copy;
+    sf->sf_pos += copy;
+    total += copy;
+    size -= copy;
+
+    if(nr->nr_consumed < rcnt)
+      continue;
 
-    sf->sf_pos += rcnt;
-    total += rcnt;
+    TAILQ_REMOVE(&sf->sf_reqs, nr, nr_file_link);
+    LIST_REMOVE(nr, nr_link);
+    sf->sf_num_reqs--;
+    free(nr->nr_response);
 
-    if(nr->nr_last && rcnt < nr->nr_cnt) {
+    if(rcnt < nr->nr_cnt) {
+      // Short read, file is probably truncated. Drop what's queued after
       free(nr);
+      smb_read_flush(sf);
       break;
     }
     free(nr);
   }
+
+  // Keep window full for next read
+  if(sf->sf_sequential >= 2)
+    smb_read_issue(sf, end);
+
   hts_mutex_unlock(&smb_global_mutex);
   return total;
 
  fail:
-
-  while((nr = LIST_FIRST(&reqs)) != NULL) {
-    LIST_REMOVE(nr, nr_link);
-    LIST_REMOVE(nr, nr_multi_link);
-    free(nr->nr_response);
-    free(nr);
-  }
+  smb_read_flush(sf);
+  sf->sf_sequential = 0;
   hts_mutex_unlock(&smb_global_mutex);
   return -1;
-
 }
 
 
@@ -72,6 +72,7 @@ typedef struct {
 
 #define SERVER_CAP_UNICODE 0x00000004
 #define SERVER_CAP_NT_SMBS 0x00000010
+#define SERVER_CAP_LARGE_READX 0x00004000
 
 #define SECURITY_SIGNATURES_REQUIRED	0x08
 #define SECURITY_SIGNATURES_ENABLED	0x04
@@ -28,13 +28,232 @@
 #include "htsmsg.h"
 
 #include "main.h"
+#include "misc/minmax.h"
+
+#define HTSMSG_INDEX_THRESHOLD 16 // Maps with more fields gets a hash index
+
+/**
+ *
+ */
+typedef struct htsmsg_arena_chunk {
+  struct htsmsg_arena_chunk *hac_next;
+  size_t hac_used;
+  size_t hac_size;
+  char hac_data[0];
+} htsmsg_arena_chunk_t;
+
+struct htsmsg_arena {
+  int ha_refcount;
+  size_t ha_chunk_size;
+  htsmsg_arena_chunk_t *ha_chunks;
+};
+
+
+/**
+ *
+ */
+htsmsg_arena_t *
+htsmsg_arena_create(size_t chunk_size)
+{
+  htsmsg_arena_t *ha = calloc(1, sizeof(htsmsg_arena_t));
+  ha->ha_refcount = 1;
+  ha->ha_chunk_size = chunk_size ?: 65536;
+  return ha;
+}
+
+
+/**
+ *
+ */
+void
+htsmsg_arena_release(htsmsg_arena_t *ha)
+{
+  htsmsg_arena_chunk_t *hac, *next;
+
+  ha->ha_refcount--;
+  if(ha->ha_refcount > 0)
+    return;
+
+  for(hac = ha->ha_chunks; hac != NULL; hac = next) {
+    next = hac->hac_next;
+    free(hac);
+  }
+  free(ha);
+}
+
+
+/**
+ *
+ */
+static void *
+htsmsg_arena_alloc(htsmsg_arena_t *ha, size_t size)
+{
+  htsmsg_arena_chunk_t *hac = ha->ha_chunks;
+
+  size = (size + 7) & ~7;
+
+  if(hac == NULL || hac->hac_used + size > hac->hac_size) {
+    size_t chunk_size = MAX(ha->ha_chunk_size, size);
+    hac = malloc(sizeof(htsmsg_arena_chunk_t) + chunk_size);
+    hac->hac_used = 0;
+    hac->hac_size = chunk_size;
+    hac->hac_next = ha->ha_chunks;
+    ha->ha_chunks = hac;
+  }
+
+  void *r = hac->hac_data + hac->hac_used;
+  hac->hac_used += size;
+  return r;
+}
+
+
+/**
+ *
+ */
+static char *
+htsmsg_strdup(htsmsg_t *msg, const char *str)
+{
+  if(msg->hm_arena == NULL)
+    return strdup(str);
+
+  size_t len = strlen(str) + 1;
+  char *r = htsmsg_arena_alloc(msg->hm_arena, len);
+  memcpy(r, str, len);
+  return r;
+}
+
+
+/**
+ *
+ */
+static unsigned int
+htsmsg_name_hash(const char *name)
+{
+  unsigned int h = 2166136261u;
+  while(*name)
+    h = (h ^ (uint8_t)*name++) * 16777619u;
+  return h;
+}
+
+
+/**
+ *
+ */
+static void
+htsmsg_index_clear(htsmsg_t *msg)
+{
+  free(msg->hm_index);
+  msg->hm_index = NULL;
+  msg->hm_index_size = 0;
+}
+
+
+/**
+ * Insert into open addressed hash. If a field with the same name
+ * already exists it's kept as lookups should return the first field
+ */
+static void
+htsmsg_index_insert(htsmsg_t *msg, htsmsg_field_t *f)
+{
+  htsmsg_field_t **index = msg->hm_index;
+  const unsigned int mask = msg->hm_index_size - 1;
+  unsigned int i = htsmsg_name_hash(f->hmf_name) & mask;
+
+  while(index[i] != NULL) {
+    if(!strcmp(index[i]->hmf_name, f->hmf_name)) {
+      msg->hm_index_dups = 1;
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  index[i] = f;
+}
+
+
+/**
+ * Remove field from index (backward shift deletion). If the field
+ * shadowed a later field with the same name, that one is indexed instead.
+ * Must be called before the field is unlinked
+ */
+static void
+htsmsg_index_remove(htsmsg_t *msg, htsmsg_field_t *f)
+{
+  htsmsg_field_t **index = msg->hm_index;
+  const unsigned int mask = msg->hm_index_size - 1;
+  unsigned int i, j, k;
+
+  if(f->hmf_name == NULL)
+    return;
+
+  i = htsmsg_name_hash(f->hmf_name) & mask;
+  while(index[i] != f) {
+    if(index[i] == NULL)
+      return; // A shadowed duplicate, not in index
+    i = (i + 1) & mask;
+  }
+
+  index[i] = NULL;
+  j = i;
+  while(1) {
+    j = (j + 1) & mask;
+    if(index[j] == NULL)
+      break;
+    k = htsmsg_name_hash(index[j]->hmf_name) & mask;
+    // Move entry back unless its home slot lies cyclically in (i, j]
+    if(i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+      index[i] = index[j];
+      index[j] = NULL;
+      i = j;
+    }
+  }
+
+  if(!msg->hm_index_dups)
+    return;
+
+  htsmsg_field_t *n = TAILQ_NEXT(f, hmf_link);
+  for(; n != NULL; n = TAILQ_NEXT(n, hmf_link)) {
+    if(n->hmf_name != NULL && !strcmp(n->hmf_name, f->hmf_name)) {
+      htsmsg_index_insert(msg, n);
+      break;
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+htsmsg_index_build(htsmsg_t *msg)
+{
+  htsmsg_field_t *f;
+  unsigned int size = 32;
+
+  while(size < msg->hm_num_fields * 2)
+    size *= 2;
+
+  htsmsg_index_clear(msg);
+  msg->hm_index = calloc(size, sizeof(htsmsg_field_t *));
+  msg->hm_index_size = size;
+  msg->hm_index_dups = 0;
+
+  TAILQ_FOREACH(f, &msg->hm_fields, hmf_link)
+    if(f->hmf_name != NULL)
+      htsmsg_index_insert(msg, f);
+}
+
+
 /**
  *
  */
 void
 htsmsg_field_destroy(htsmsg_t *msg, htsmsg_field_t *f)
 {
+  if(msg->hm_index != NULL)
+    htsmsg_index_remove(msg, f);
+
   TAILQ_REMOVE(&msg->hm_fields, f, hmf_link);
+  msg->hm_num_fields--;
 
   htsmsg_release(f->hmf_childs);
 
@@ -51,7 +270,8 @@ htsmsg_field_destroy(htsmsg_t *msg, htsmsg_field_t *f)
   if(f->hmf_flags & HMF_NAME_ALLOCED)
     free(f->hmf_name);
   rstr_release(f->hmf_namespace);
-  free(f);
+  if(msg->hm_arena == NULL)
+    free(f);
 }
 
 /**
@@ -60,10 +280,17 @@ htsmsg_field_destroy(htsmsg_t *msg, htsmsg_field_t *f)
 htsmsg_field_t *
 htsmsg_field_add(htsmsg_t *msg, const char *name, int type, int flags)
 {
-  htsmsg_field_t *f = malloc(sizeof(htsmsg_field_t));
+  htsmsg_field_t *f;
+
+  if(msg->hm_arena != NULL)
+    f = htsmsg_arena_alloc(msg->hm_arena, sizeof(htsmsg_field_t));
+  else
+    f = malloc(sizeof(htsmsg_field_t));
+
   f->hmf_childs = NULL;
   f->hmf_namespace = NULL;
   TAILQ_INSERT_TAIL(&msg->hm_fields, f, hmf_link);
+  msg->hm_num_fields++;
 
   if(msg->hm_islist) {
     assert(name == NULL);
@@ -71,13 +298,31 @@ htsmsg_field_add(htsmsg_t *msg, const char *name, int type, int flags)
     assert(name != NULL);
   }
 
-  if(flags & HMF_NAME_ALLOCED)
-    f->hmf_name = name ? strdup(name) : NULL;
-  else
+  if(flags & HMF_NAME_ALLOCED) {
+    if(name == NULL) {
+      f->hmf_name = NULL;
+    } else {
+      f->hmf_name = htsmsg_strdup(msg, name);
+    }
+    if(msg->hm_arena != NULL)
+      flags &= ~HMF_NAME_ALLOCED;
+  } else {
     f->hmf_name = (char *)name;
+  }
 
   f->hmf_type = type;
   f->hmf_flags = flags;
+
+  // The index is only ever modified here so lookups stay read-only
+  // and can be done concurrently on a message that's no longer changed
+  if(msg->hm_index != NULL) {
+    if(msg->hm_num_fields * 2 > msg->hm_index_size)
+      htsmsg_index_build(msg);
+    else
+      htsmsg_index_insert(msg, f);
+  } else if(!msg->hm_islist && msg->hm_num_fields > HTSMSG_INDEX_THRESHOLD) {
+    htsmsg_index_build(msg);
+  }
   return f;
 }
 
@@ -99,6 +344,18 @@ htsmsg_field_find(htsmsg_t *msg, const char *name)
     return NULL;
   }
 
+  if(msg->hm_index != NULL) {
+    const unsigned int mask = msg->hm_index_size - 1;
+    unsigned int i = htsmsg_name_hash(name) & mask;
+
+    while((f = msg->hm_index[i]) != NULL) {
+      if(!strcmp(f->hmf_name, name))
+        return f;
+      i = (i + 1) & mask;
+    }
+    return NULL;
+  }
+
   TAILQ_FOREACH(f, &msg->hm_fields, hmf_link) {
     if(f->hmf_name != NULL && !strcmp(f->hmf_name, name))
       return f;
@@ -149,6 +406,43 @@ htsmsg_create_list(void)
 }
 
 
+/**
+ *
+ */
+static htsmsg_t *
+htsmsg_create_in(htsmsg_arena_t *ha, int islist)
+{
+  htsmsg_t *msg = htsmsg_arena_alloc(ha, sizeof(htsmsg_t));
+  memset(msg, 0, sizeof(htsmsg_t));
+  msg->hm_refcount = 1;
+  TAILQ_INIT(&msg->hm_fields);
+  msg->hm_islist = islist;
+  msg->hm_arena = ha;
+  ha->ha_refcount++;
+  return msg;
+}
+
+
+/**
+ *
+ */
+htsmsg_t *
+htsmsg_create_map_in(htsmsg_arena_t *ha)
+{
+  return htsmsg_create_in(ha, 0);
+}
+
+
+/**
+ *
+ */
+htsmsg_t *
+htsmsg_create_list_in(htsmsg_arena_t *ha)
+{
+  return htsmsg_create_in(ha, 1);
+}
+
+
 /**
  *
  */
@@ -165,11 +459,17 @@ htsmsg_release(htsmsg_t *msg)
     return;
 
 
+  htsmsg_index_clear(msg);
+
   while((f = TAILQ_FIRST(&msg->hm_fields)) != NULL)
     htsmsg_field_destroy(msg, f);
 
   buf_release(msg->hm_backing_store);
-  free(msg);
+
+  if(msg->hm_arena != NULL)
+    htsmsg_arena_release(msg->hm_arena);
+  else
+    free(msg);
 }
 
 /**
@@ -252,9 +552,10 @@ htsmsg_add_dbl(htsmsg_t *msg, const char *name, double dbl)
 void
 htsmsg_add_str(htsmsg_t *msg, const char *name, const char *str)
 {
-  htsmsg_field_t *f = htsmsg_field_add(msg, name, HMF_STR, 
-				        HMF_ALLOCED | HMF_NAME_ALLOCED);
-  f->hmf_str = strdup(str);
+  htsmsg_field_t *f = htsmsg_field_add(msg, name, HMF_STR,
+                                       HMF_NAME_ALLOCED |
+                                       (msg->hm_arena ? 0 : HMF_ALLOCED));
+  f->hmf_str = htsmsg_strdup(msg, str);
 }
 
 /*
@@ -263,10 +564,15 @@ htsmsg_add_str(htsmsg_t *msg, const char *name, const char *str)
 void
 htsmsg_add_bin(htsmsg_t *msg, const char *name, const void *bin, size_t len)
 {
-  htsmsg_field_t *f = htsmsg_field_add(msg, name, HMF_BIN, 
-				       HMF_ALLOCED | HMF_NAME_ALLOCED);
+  htsmsg_field_t *f = htsmsg_field_add(msg, name, HMF_BIN,
+                                       HMF_NAME_ALLOCED |
+                                       (msg->hm_arena ? 0 : HMF_ALLOCED));
   void *v;
-  f->hmf_bin = v = malloc(len);
+  if(msg->hm_arena != NULL)
+    v = htsmsg_arena_alloc(msg->hm_arena, len);
+  else
+    v = malloc(len);
+  f->hmf_bin = v;
   f->hmf_binsize = len;
   memcpy(v, bin, len);
 }
@@ -721,9 +1027,5 @@ htsmsg_get_map_by_field_if_name(htsmsg_field_t *f, const char *name)
 int
 htsmsg_get_children(htsmsg_t *msg)
 {
-  htsmsg_field_t *f;
-  int cnt = 0;
-  TAILQ_FOREACH(f, &msg->hm_fields, hmf_link)
-    cnt++;
-  return cnt;
+  return msg->hm_num_fields;
 }
@@ -30,11 +30,22 @@
 
 TAILQ_HEAD(htsmsg_field_queue, htsmsg_field);
 
+struct htsmsg_arena;
+
 typedef struct htsmsg {
   struct htsmsg_field_queue hm_fields;
   buf_t *hm_backing_store;
   uint8_t hm_islist;
   int hm_refcount;
+  int hm_num_fields;
+
+  // Set if message, fields and strings are allocated from an arena
+  struct htsmsg_arena *hm_arena;
+
+  // Hash index for large maps, maintained by htsmsg_field_add()
+  struct htsmsg_field **hm_index;
+  unsigned int hm_index_size;
+  uint8_t hm_index_dups;  // Index has shadowed fields with same name
 } htsmsg_t;
 
 
@@ -98,6 +109,25 @@ htsmsg_t *htsmsg_create_map(void);
  */
 htsmsg_t *htsmsg_create_list(void);
 
+/**
+ * Arenas
+ *
+ * Messages created in an arena get the message itself, all fields,
+ * names and strings from the arena. Sub messages should be created in
+ * the same arena. Nothing is returned to the system until the last
+ * message in the arena is released, at which point all memory is freed
+ * at once. Intended for large parsed documents that are mostly read.
+ */
+typedef struct htsmsg_arena htsmsg_arena_t;
+
+htsmsg_arena_t *htsmsg_arena_create(size_t chunk_size);
+
+void htsmsg_arena_release(htsmsg_arena_t *ha);
+
+htsmsg_t *htsmsg_create_map_in(htsmsg_arena_t *ha);
+
+htsmsg_t *htsmsg_create_list_in(htsmsg_arena_t *ha);
+
 /**
  * Remove a given field from a msg
  */
@@ -113,6 +113,7 @@ htsmsg_binary_des0(htsmsg_t *msg, const uint8_t *buf, size_t len, buf_t *src)
     }
 
     TAILQ_INSERT_TAIL(&msg->hm_fields, f, hmf_link);
+    msg->hm_num_fields++;
     buf += datalen;
     len -= datalen;
   }
@@ -145,13 +145,13 @@ htsmsg_json_serialize_to_rstr(htsmsg_t *msg, const char *prefix)
 static void *
 create_map(void *opaque)
 {
-  return htsmsg_create_map();
+  return opaque ? htsmsg_create_map_in(opaque) : htsmsg_create_map();
 }
 
 static void *
 create_list(void *opaque)
 {
-  return htsmsg_create_list();
+  return opaque ? htsmsg_create_list_in(opaque) : htsmsg_create_list();
 }
 
 static void
@@ -169,8 +169,10 @@ add_obj(void *opaque, void *parent, const char *name, void *child)
 static void 
 add_string(void *opaque, void *parent, const char *name,  char *str)
 {
-  htsmsg_add_str(parent, name, str);
-  free(str);
+  // Take over the string instead of copying it
+  htsmsg_field_t *f = htsmsg_field_add(parent, name, HMF_STR,
+                                       HMF_ALLOCED | HMF_NAME_ALLOCED);
+  f->hmf_str = str;
 }
 
 static void 
@@ -229,3 +231,16 @@ htsmsg_json_deserialize2(const char *src, char *errbuf, size_t errlen)
 {
   return json_deserialize(src, &json_to_htsmsg, NULL, errbuf, errlen);
 }
+
+
+/**
+ * Parse into an arena, see htsmsg_arena_create()
+ */
+htsmsg_t *
+htsmsg_json_deserialize_ro(const char *src, char *errbuf, size_t errlen)
+{
+  htsmsg_arena_t *ha = htsmsg_arena_create(0);
+  htsmsg_t *m = json_deserialize(src, &json_to_htsmsg, ha, errbuf, errlen);
+  htsmsg_arena_release(ha); // Each message holds a reference
+  return m;
+}
@@ -31,6 +31,14 @@ htsmsg_t *htsmsg_json_deserialize(const char *src);
 htsmsg_t *htsmsg_json_deserialize2(const char *src,
                                    char *errbuf, size_t errlen);
 
+/**
+ * For large documents that are only read. The result is allocated
+ * from an arena so memory is not reclaimed until the whole document
+ * is released
+ */
+htsmsg_t *htsmsg_json_deserialize_ro(const char *src,
+                                     char *errbuf, size_t errlen);
+
 void htsmsg_json_serialize(htsmsg_t *msg, htsbuf_queue_t *hq, int pretty);
 
 char *htsmsg_json_serialize_to_str(htsmsg_t *msg, int pretty);
@@ -180,8 +180,9 @@ htsmsg_store_save(htsmsg_t *record, const char *key)
   lm->lm_msg = htsmsg_copy(record);
 
   lm->lm_dirty = 1;
-  callout_arm_managed(&lm->lm_timer, htsmsg_store_timer_cb, lm,
-                      SETTINGS_CACHE_DELAY, htsmsg_store_lockmgr);
+  callout_arm_flags(&lm->lm_timer, htsmsg_store_timer_cb, lm,
+                    SETTINGS_CACHE_DELAY, htsmsg_store_lockmgr,
+                    CALLOUT_SLACK | CALLOUT_WORKER);
 
   hts_mutex_unlock(&loaded_msg_mutex);
 }
@@ -221,8 +222,9 @@ htsmsg_store_obtain(const char *key, int create)
   LIST_INSERT_HEAD(&loaded_msgs, lm, lm_link);
   lm->lm_msg = r;
 
-  callout_arm_managed(&lm->lm_timer, htsmsg_store_timer_cb, lm,
-                      SETTINGS_CACHE_DELAY, htsmsg_store_lockmgr);
+  callout_arm_flags(&lm->lm_timer, htsmsg_store_timer_cb, lm,
+                    SETTINGS_CACHE_DELAY, htsmsg_store_lockmgr,
+                    CALLOUT_SLACK | CALLOUT_WORKER);
 
   return lm;
 }
@@ -303,8 +305,9 @@ htsmsg_store_set(const char *store, const char *key, int value_type, ...)
     abort();
   }
   lm->lm_dirty = 1;
-  callout_arm_managed(&lm->lm_timer, htsmsg_store_timer_cb, lm,
-                      SETTINGS_CACHE_DELAY, htsmsg_store_lockmgr);
+  callout_arm_flags(&lm->lm_timer, htsmsg_store_timer_cb, lm,
+                    SETTINGS_CACHE_DELAY, htsmsg_store_lockmgr,
+                    CALLOUT_SLACK | CALLOUT_WORKER);
   hts_mutex_unlock(&loaded_msg_mutex);
   va_end(ap);
 }
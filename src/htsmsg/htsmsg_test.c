@@ -0,0 +1,186 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "main.h"
+#include "htsmsg.h"
+#include "htsmsg_json.h"
+#include "htsmsg_xml.h"
+#include "htsbuf.h"
+#include "misc/minmax.h"
+
+void htsmsg_test(void);
+
+#define TEST_ITEMS  20000
+#define TEST_FIELDS 24
+#define TEST_ROUNDS 5
+
+#define TEST_DIDL_ITEMS 5000
+
+static int64_t test_first_item;
+static int test_items;
+
+/**
+ *
+ */
+static void
+test_didl_element(void *opaque, const char *name, htsmsg_t *element)
+{
+  if(test_items++ == 0)
+    test_first_item = arch_get_ts();
+  assert(htsmsg_get_str(element, "res") != NULL);
+}
+
+
+/**
+ * Time to first item for a large DIDL-Lite document, complete tree vs
+ * streaming parser (fed in 16kB pieces as if received from network)
+ */
+static void
+htsmsg_xml_test(void)
+{
+  static const char *elements[] = {"item", NULL};
+  htsbuf_queue_t hq;
+  htsmsg_field_t *f;
+  char errbuf[256];
+  int64_t ts;
+  int i;
+
+  htsbuf_queue_init(&hq, 0);
+  htsbuf_qprintf(&hq, "<?xml version=\"1.0\"?><DIDL-Lite "
+                 "xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+                 "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">");
+  for(i = 0; i < TEST_DIDL_ITEMS; i++)
+    htsbuf_qprintf(&hq,
+                   "<item id=\"64$%d\" parentID=\"64\" restricted=\"1\">"
+                   "<dc:title>Track &amp; number %d</dc:title>"
+                   "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+                   "<upnp:artist>Some artist</upnp:artist>"
+                   "<res duration=\"0:03:%02d.000\" protocolInfo=\"http-get:*:"
+                   "audio/mpeg:*\">http://127.0.0.1:8200/MediaItems/%d.mp3"
+                   "</res></item>", i, i, i % 60, i);
+  htsbuf_qprintf(&hq, "</DIDL-Lite>");
+  char *xml = htsbuf_to_string(&hq);
+  size_t len = strlen(xml);
+  htsbuf_queue_flush(&hq);
+
+  test_items = 0;
+  ts = arch_get_ts();
+  htsmsg_t *doc = htsmsg_xml_deserialize_cstr(xml, errbuf, sizeof(errbuf));
+  assert(doc != NULL);
+  HTSMSG_FOREACH(f, htsmsg_get_map(doc, "DIDL-Lite"))
+    test_didl_element(NULL, f->hmf_name, htsmsg_get_map_by_field(f));
+  printf("htsmsg: XML tree: first item after %d us, %d items in %d us\n",
+         (int)(test_first_item - ts), test_items, (int)(arch_get_ts() - ts));
+  htsmsg_release(doc);
+
+  test_items = 0;
+  ts = arch_get_ts();
+  htsmsg_xml_stream_t *hxs =
+    htsmsg_xml_stream_create(elements, test_didl_element, NULL);
+  for(i = 0; i < len; i += 16384)
+    htsmsg_xml_stream_feed(hxs, xml + i, MIN(len - i, 16384));
+  if(htsmsg_xml_stream_finish(hxs, errbuf, sizeof(errbuf)))
+    printf("htsmsg: XML stream failed: %s\n", errbuf);
+  printf("htsmsg: XML stream: first item after %d us, %d items in %d us\n",
+         (int)(test_first_item - ts), test_items, (int)(arch_get_ts() - ts));
+  htsmsg_xml_stream_destroy(hxs);
+
+  assert(test_items == TEST_DIDL_ITEMS);
+  free(xml);
+}
+
+
+/**
+ * Parse and query a multi-MB JSON document
+ */
+void
+htsmsg_test(void)
+{
+  htsbuf_queue_t hq;
+  htsmsg_field_t *f;
+  char name[32];
+  int64_t ts;
+  int i, j, found = 0;
+
+  htsmsg_t *list = htsmsg_create_list();
+  for(i = 0; i < TEST_ITEMS; i++) {
+    htsmsg_t *m = htsmsg_create_map();
+    for(j = 0; j < TEST_FIELDS; j++) {
+      snprintf(name, sizeof(name), "field_%d", j);
+      if(j & 1)
+        htsmsg_add_s32(m, name, i * j);
+      else
+        htsmsg_add_str(m, name, "Some string value of moderate length");
+    }
+    htsmsg_add_msg(list, NULL, m);
+  }
+  htsmsg_t *doc = htsmsg_create_map();
+  htsmsg_add_msg(doc, "results", list);
+
+  htsbuf_queue_init(&hq, 0);
+  htsmsg_json_serialize(doc, &hq, 0);
+  char *json = htsbuf_to_string(&hq);
+  htsbuf_queue_flush(&hq);
+  htsmsg_release(doc);
+
+  printf("htsmsg: JSON document is %zd bytes\n", strlen(json));
+
+  int64_t parse = 0, lookup = 0, release = 0;
+
+  for(int round = 0; round < TEST_ROUNDS; round++) {
+    ts = arch_get_ts();
+    doc = htsmsg_json_deserialize_ro(json, NULL, 0);
+    parse += arch_get_ts() - ts;
+    assert(doc != NULL);
+
+    list = htsmsg_get_list(doc, "results");
+    assert(list != NULL);
+    assert(htsmsg_get_children(list) == TEST_ITEMS);
+
+    found = 0;
+    ts = arch_get_ts();
+    for(j = TEST_FIELDS - 1; j >= 0; j--) {
+      snprintf(name, sizeof(name), "field_%d", j);
+      HTSMSG_FOREACH(f, list) {
+        htsmsg_t *m = htsmsg_get_map_by_field(f);
+        if(htsmsg_field_find(m, name) != NULL)
+          found++;
+      }
+    }
+    lookup += arch_get_ts() - ts;
+    assert(found == TEST_ITEMS * TEST_FIELDS);
+
+    ts = arch_get_ts();
+    htsmsg_release(doc);
+    release += arch_get_ts() - ts;
+  }
+
+  printf("htsmsg: Parse: %d ms\n", (int)(parse / TEST_ROUNDS / 1000));
+  printf("htsmsg: %d lookups: %d ms\n", found,
+         (int)(lookup / TEST_ROUNDS / 1000));
+  printf("htsmsg: Release: %d ms\n", (int)(release / TEST_ROUNDS / 1000));
+  free(json);
+
+  htsmsg_xml_test();
+}
@@ -54,6 +54,8 @@
 #include "htsmsg_xml.h"
 #include "htsbuf.h"
 #include "misc/str.h"
+#include "misc/xmlsax.h"
+#include "misc/minmax.h"
 
 TAILQ_HEAD(cdata_content_queue, cdata_content);
 
@@ -968,3 +970,216 @@ htsmsg_xml_deserialize_cstr(const char *str, char *errbuf, size_t errbufsize)
   return htsmsg_xml_deserialize_buf(b, errbuf, errbufsize);
 }
 
+
+
+/**
+ * Streaming deserializer
+ */
+#define HXS_MAX_DEPTH 32
+
+typedef struct hxs_level {
+  htsmsg_t *hl_msg;
+  htsmsg_field_t *hl_field;  // Field in parent, NULL for captured element
+  char *hl_text;
+  size_t hl_len;
+  size_t hl_size;
+} hxs_level_t;
+
+struct htsmsg_xml_stream {
+  xml_sax_t *hxs_sax;
+  const char **hxs_names;
+  htsmsg_xml_element_cb_t *hxs_cb;
+  void *hxs_opaque;
+
+  int hxs_depth;    // Depth inside captured element, 0 if not capturing
+  int hxs_skip;     // Levels beyond HXS_MAX_DEPTH
+  hxs_level_t hxs_levels[HXS_MAX_DEPTH];
+  char *hxs_root;   // Name of document element
+};
+
+
+/**
+ *
+ */
+static void
+hxs_start(void *opaque, const char *name, const char **attrs)
+{
+  htsmsg_xml_stream_t *hxs = opaque;
+  hxs_level_t *hl;
+  htsmsg_field_t *f = NULL;
+  const char **n;
+
+  if(hxs->hxs_root == NULL)
+    hxs->hxs_root = strdup(name);
+
+  if(hxs->hxs_depth == 0) {
+    for(n = hxs->hxs_names; *n != NULL; n++)
+      if(!strcmp(*n, name))
+        break;
+    if(*n == NULL)
+      return;
+
+  } else if(hxs->hxs_depth == HXS_MAX_DEPTH || hxs->hxs_skip) {
+    hxs->hxs_skip++;
+    return;
+
+  } else {
+    f = htsmsg_field_add(hxs->hxs_levels[hxs->hxs_depth - 1].hl_msg,
+                         name, HMF_MAP, HMF_NAME_ALLOCED);
+  }
+
+  hl = &hxs->hxs_levels[hxs->hxs_depth++];
+  hl->hl_msg = htsmsg_create_map();
+  hl->hl_field = f;
+  hl->hl_len = 0;
+
+  for(; *attrs != NULL; attrs += 2) {
+    f = htsmsg_field_add(hl->hl_msg, attrs[0], HMF_STR,
+                         HMF_XML_ATTRIBUTE | HMF_NAME_ALLOCED | HMF_ALLOCED);
+    f->hmf_str = strdup(attrs[1]);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+hxs_cdata(void *opaque, const char *str, size_t len)
+{
+  htsmsg_xml_stream_t *hxs = opaque;
+  hxs_level_t *hl;
+
+  if(hxs->hxs_depth == 0 || hxs->hxs_skip)
+    return;
+
+  hl = &hxs->hxs_levels[hxs->hxs_depth - 1];
+  if(hl->hl_len + len + 1 > hl->hl_size) {
+    hl->hl_size = MAX(hl->hl_len + len + 1, hl->hl_size * 2);
+    hl->hl_text = realloc(hl->hl_text, hl->hl_size);
+  }
+  memcpy(hl->hl_text + hl->hl_len, str, len);
+  hl->hl_len += len;
+}
+
+
+/**
+ *
+ */
+static void
+hxs_end(void *opaque, const char *name)
+{
+  htsmsg_xml_stream_t *hxs = opaque;
+  hxs_level_t *hl;
+  htsmsg_field_t *f;
+  int i;
+
+  if(hxs->hxs_skip) {
+    hxs->hxs_skip--;
+    return;
+  }
+
+  if(hxs->hxs_depth == 0)
+    return;
+
+  hl = &hxs->hxs_levels[--hxs->hxs_depth];
+  f = hl->hl_field;
+
+  if(f == NULL) {
+    hxs->hxs_cb(hxs->hxs_opaque, name, hl->hl_msg);
+    htsmsg_release(hl->hl_msg);
+    return;
+  }
+
+  for(i = 0; i < hl->hl_len; i++)
+    if(!is_xmlws(hl->hl_text[i]))
+      break;
+
+  if(i < hl->hl_len) {
+    f->hmf_str = malloc(hl->hl_len + 1);
+    memcpy(f->hmf_str, hl->hl_text, hl->hl_len);
+    f->hmf_str[hl->hl_len] = 0;
+    f->hmf_type = HMF_STR;
+    f->hmf_flags |= HMF_ALLOCED;
+  }
+
+  if(TAILQ_FIRST(&hl->hl_msg->hm_fields) != NULL) {
+    f->hmf_childs = hl->hl_msg;
+  } else {
+    htsmsg_release(hl->hl_msg);
+  }
+}
+
+
+static const xml_sax_callbacks_t hxs_callbacks = {
+  .xsc_start = hxs_start,
+  .xsc_end   = hxs_end,
+  .xsc_cdata = hxs_cdata,
+};
+
+
+/**
+ *
+ */
+htsmsg_xml_stream_t *
+htsmsg_xml_stream_create(const char **names, htsmsg_xml_element_cb_t *cb,
+                         void *opaque)
+{
+  htsmsg_xml_stream_t *hxs = calloc(1, sizeof(htsmsg_xml_stream_t));
+  hxs->hxs_names = names;
+  hxs->hxs_cb = cb;
+  hxs->hxs_opaque = opaque;
+  hxs->hxs_sax = xml_sax_create(&hxs_callbacks, hxs);
+  return hxs;
+}
+
+
+/**
+ *
+ */
+int
+htsmsg_xml_stream_feed(htsmsg_xml_stream_t *hxs, const void *data, size_t len)
+{
+  return xml_sax_feed(hxs->hxs_sax, data, len);
+}
+
+
+/**
+ *
+ */
+int
+htsmsg_xml_stream_finish(htsmsg_xml_stream_t *hxs, char *errbuf, size_t errlen)
+{
+  return xml_sax_finish(hxs->hxs_sax, errbuf, errlen);
+}
+
+
+/**
+ *
+ */
+const char *
+htsmsg_xml_stream_root(const htsmsg_xml_stream_t *hxs)
+{
+  return hxs->hxs_root;
+}
+
+
+/**
+ *
+ */
+void
+htsmsg_xml_stream_destroy(htsmsg_xml_stream_t *hxs)
+{
+  int i;
+
+  // Unfinished levels are not yet linked to their parents
+  for(i = 0; i < hxs->hxs_depth; i++)
+    htsmsg_release(hxs->hxs_levels[i].hl_msg);
+
+  for(i = 0; i < HXS_MAX_DEPTH; i++)
+    free(hxs->hxs_levels[i].hl_text);
+
+  xml_sax_destroy(hxs->hxs_sax);
+  free(hxs->hxs_root);
+  free(hxs);
+}
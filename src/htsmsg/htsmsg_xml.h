@@ -31,4 +31,38 @@ htsmsg_t *htsmsg_xml_deserialize_cstr(const char *str,
 
 htsmsg_t *htsmsg_xml_deserialize_buf(buf_t *b, char *errbuf, size_t errsize);
 
+
+/**
+ * Streaming deserializer
+ *
+ * Elements with any of the given names are assembled into a htsmsg
+ * (with the same layout as htsmsg_xml_deserialize_*() would produce
+ * for the element) and passed to the callback as soon as its end tag
+ * has been parsed. Everything outside those elements is discarded.
+ *
+ * Namespace prefixes are stripped and whitespace-only character
+ * data is ignored
+ */
+typedef struct htsmsg_xml_stream htsmsg_xml_stream_t;
+
+typedef void (htsmsg_xml_element_cb_t)(void *opaque, const char *name,
+                                       htsmsg_t *element);
+
+htsmsg_xml_stream_t *htsmsg_xml_stream_create(const char **names,
+                                              htsmsg_xml_element_cb_t *cb,
+                                              void *opaque);
+
+int htsmsg_xml_stream_feed(htsmsg_xml_stream_t *hxs,
+                           const void *data, size_t len);
+
+int htsmsg_xml_stream_finish(htsmsg_xml_stream_t *hxs,
+                             char *errbuf, size_t errlen);
+
+/**
+ * Name of the document element, NULL until its start tag is parsed
+ */
+const char *htsmsg_xml_stream_root(const htsmsg_xml_stream_t *hxs);
+
+void htsmsg_xml_stream_destroy(htsmsg_xml_stream_t *hxs);
+
 #endif /* HTSMSG_XML_H_ */
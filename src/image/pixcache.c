@@ -0,0 +1,263 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "main.h"
+#include "blobcache.h"
+#include "arch/atomic.h"
+#include "fileaccess/fileaccess.h"
+#include "misc/str.h"
+#include "misc/lz4.h"
+#include "misc/minmax.h"
+#include "image.h"
+#include "pixmap.h"
+#include "pixcache.h"
+
+#define PIXCACHE_STASH  "pixcache"
+#define PIXCACHE_MAGIC  0x50584332  // 'PXC2'
+
+// Don't bother with tiny images or huge ones (blobcache pressure)
+#define PIXCACHE_MIN_SIZE 4096
+#define PIXCACHE_MAX_SIZE (16 * 1024 * 1024)
+
+/**
+ * Native byte order, the cache is never shared between hosts
+ */
+typedef struct pixcache_hdr {
+  uint32_t ph_magic;
+  uint32_t ph_size;         // Uncompressed pixel data
+  uint32_t ph_decode_time;  // µs it took to produce the image originally
+
+  int32_t ph_linesize;
+  float ph_aspect;
+  float ph_intensity;
+  float ph_primary_color[3];
+
+  uint16_t ph_pm_width;
+  uint16_t ph_pm_height;
+  uint16_t ph_pm_margin;
+  uint16_t ph_pm_flags;
+
+  uint16_t ph_width;
+  uint16_t ph_height;
+  uint16_t ph_margin;
+  uint16_t ph_flags;
+
+  uint8_t ph_type;
+  uint8_t ph_color_planes;
+  uint8_t ph_origin_coded_type;
+  uint8_t ph_orientation;
+} pixcache_hdr_t;
+
+
+static atomic_t pixcache_hits;
+static atomic_t pixcache_misses;
+static atomic_t pixcache_saved_ms;
+
+
+/**
+ *
+ */
+static char *
+pixcache_key(const char *url, const image_meta_t *im)
+{
+  return fmtstr("%s\n%d:%d:%d:%d:%d:%d:%d:%d:%d:%d%d%d%d%d",
+                url, im->im_req_width, im->im_req_height,
+                im->im_max_width, im->im_max_height,
+                (int)(im->im_req_aspect * 1000),
+                im->im_corner_radius, im->im_corner_selection,
+                im->im_shadow, im->im_margin,
+                !!im->im_can_mono, !!im->im_32bit_swizzle,
+                !!im->im_want_thumb, !!im->im_intensity_analysis,
+                !!im->im_primary_color_analysis);
+}
+
+
+/**
+ * Local files are skipped, they can change under our feet and reading
+ * them is cheap anyway
+ */
+int
+pixcache_usable(const char *url, const image_meta_t *im)
+{
+  if(gconf.disable_image_pixcache || im->im_no_decoding)
+    return 0;
+
+  return !mystrbegins(url, "file://");
+}
+
+
+/**
+ *
+ */
+static void
+pixcache_trace(int hit, const char *url, int decode_time)
+{
+  if(!gconf.enable_image_debug)
+    return;
+
+  int hits = atomic_get(&pixcache_hits);
+  int misses = atomic_get(&pixcache_misses);
+
+  TRACE(TRACE_DEBUG, "pixcache",
+        "%s %s (%dms decode %s) -- "
+        "hit rate %d%% of %d lookups, %dms decode time avoided",
+        hit ? "Hit" : "Stored", url, decode_time / 1000,
+        hit ? "avoided" : "cost",
+        hits * 100 / MAX(1, hits + misses), hits + misses,
+        atomic_get(&pixcache_saved_ms));
+}
+
+
+/**
+ *
+ */
+image_t *
+pixcache_get(const char *url, const image_meta_t *im, int *is_expired)
+{
+  char *key = pixcache_key(url, im);
+  buf_t *b = blobcache_get(key, PIXCACHE_STASH, 0, is_expired, NULL, NULL);
+  free(key);
+
+  if(b == NULL) {
+    atomic_inc(&pixcache_misses);
+    return NULL;
+  }
+
+  const pixcache_hdr_t *ph = buf_data(b);
+  pixmap_t *pm = NULL;
+
+  if(buf_len(b) < sizeof(pixcache_hdr_t) || ph->ph_magic != PIXCACHE_MAGIC)
+    goto bad;
+
+  pm = pixmap_create(ph->ph_pm_width  - ph->ph_pm_margin * 2,
+                     ph->ph_pm_height - ph->ph_pm_margin * 2,
+                     ph->ph_type, ph->ph_pm_margin);
+  if(pm == NULL || pm->pm_linesize != ph->ph_linesize ||
+     pm->pm_linesize * pm->pm_height != ph->ph_size)
+    goto bad;
+
+  if(lz4_decompress(ph + 1, buf_len(b) - sizeof(pixcache_hdr_t),
+                    pm->pm_data, ph->ph_size))
+    goto bad;
+
+  pm->pm_aspect = ph->ph_aspect;
+  pm->pm_flags = ph->ph_pm_flags;
+  pm->pm_intensity = ph->ph_intensity;
+  memcpy(pm->pm_primary_color, ph->ph_primary_color,
+         sizeof(pm->pm_primary_color));
+
+  image_t *img = image_create_from_pixmap(pm);
+  pixmap_release(pm);
+
+  img->im_width  = ph->ph_width;
+  img->im_height = ph->ph_height;
+  img->im_margin = ph->ph_margin;
+  img->im_flags  = ph->ph_flags;
+  img->im_color_planes = ph->ph_color_planes;
+  img->im_origin_coded_type = ph->ph_origin_coded_type;
+  img->im_orientation = ph->ph_orientation;
+
+  atomic_inc(&pixcache_hits);
+  atomic_add(&pixcache_saved_ms, ph->ph_decode_time / 1000);
+  pixcache_trace(1, url, ph->ph_decode_time);
+  buf_release(b);
+  return img;
+
+ bad:
+  if(pm != NULL)
+    pixmap_release(pm);
+  buf_release(b);
+  atomic_inc(&pixcache_misses);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+void
+pixcache_put(const char *url, const image_meta_t *im, const image_t *img,
+             int decode_time)
+{
+  if(img->im_num_components != 1 ||
+     img->im_components[0].type != IMAGE_PIXMAP)
+    return;
+
+  const pixmap_t *pm = img->im_components[0].pm;
+  const size_t size = pm->pm_linesize * pm->pm_height;
+
+  if(pm->pm_data == NULL || size < PIXCACHE_MIN_SIZE ||
+     size > PIXCACHE_MAX_SIZE)
+    return;
+
+  // Expire together with the original. If it's not cached (no-store,
+  // no validators) or already stale we must not cache the result either
+  const time_t now = time(NULL);
+  const time_t expiry = fa_load_cache_expiry(url);
+  if(expiry <= now)
+    return;
+
+  buf_t *b = buf_create(sizeof(pixcache_hdr_t) + LZ4_COMPRESS_BOUND(size));
+  if(b == NULL)
+    return;
+
+  pixcache_hdr_t *ph = b->b_ptr;
+  memset(ph, 0, sizeof(pixcache_hdr_t));
+
+  ph->ph_magic = PIXCACHE_MAGIC;
+  ph->ph_size = size;
+  ph->ph_decode_time = decode_time;
+  ph->ph_linesize = pm->pm_linesize;
+  ph->ph_aspect = pm->pm_aspect;
+  ph->ph_intensity = pm->pm_intensity;
+  memcpy(ph->ph_primary_color, pm->pm_primary_color,
+         sizeof(ph->ph_primary_color));
+  ph->ph_pm_width  = pm->pm_width;
+  ph->ph_pm_height = pm->pm_height;
+  ph->ph_pm_margin = pm->pm_margin;
+  ph->ph_pm_flags  = pm->pm_flags;
+  ph->ph_width  = img->im_width;
+  ph->ph_height = img->im_height;
+  ph->ph_margin = img->im_margin;
+  ph->ph_flags  = img->im_flags;
+  ph->ph_type = pm->pm_type;
+  ph->ph_color_planes = img->im_color_planes;
+  ph->ph_origin_coded_type = img->im_origin_coded_type;
+  ph->ph_orientation = img->im_orientation;
+
+  size_t clen = lz4_compress(pm->pm_data, size, ph + 1,
+                             LZ4_COMPRESS_BOUND(size));
+  if(clen == 0) {
+    buf_release(b);
+    return;
+  }
+  b->b_size = sizeof(pixcache_hdr_t) + clen;
+
+  char *key = pixcache_key(url, im);
+  blobcache_put(key, PIXCACHE_STASH, b, MIN(expiry - now, INT32_MAX),
+                NULL, 0, 0);
+  free(key);
+  buf_release(b);
+
+  pixcache_trace(0, url, decode_time);
+}
@@ -0,0 +1,38 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+struct image;
+struct image_meta;
+
+/**
+ * Cache of decoded and post-processed images, stored LZ4 compressed
+ * in the blobcache. Keyed on URL and every image_meta parameter that
+ * affects the resulting pixmap. Entries expire when the original in
+ * the fa_load() cache does, images that aren't cached are not stored.
+ */
+
+int pixcache_usable(const char *url, const struct image_meta *im);
+
+struct image *pixcache_get(const char *url, const struct image_meta *im,
+                           int *is_expired);
+
+void pixcache_put(const char *url, const struct image_meta *im,
+                  const struct image *img, int decode_time);
@@ -320,6 +320,35 @@ libav_video_eof(media_codec_t *mc, video_decoder_t *vd,
 
 #include "misc/minmax.h"
 
+
+/**
+ * Update decode fps and zap latency stats after a frame has been
+ * produced by the decoder
+ */
+static void
+libav_video_stats(video_decoder_t *vd, media_queue_t *mq)
+{
+  int64_t now = arch_get_ts();
+
+  if(vd->vd_zap_start) {
+    prop_set_int(mq->mq_prop_zap_latency, (now - vd->vd_zap_start) / 1000);
+    vd->vd_zap_start = 0;
+  }
+
+  vd->vd_decoded_frames++;
+
+  if(vd->vd_decoded_frames_epoch == 0) {
+    vd->vd_decoded_frames_epoch = now;
+    vd->vd_decoded_frames = 0;
+  } else if(now - vd->vd_decoded_frames_epoch >= 1000000) {
+    prop_set_float(mq->mq_prop_decode_fps, vd->vd_decoded_frames * 1000000.0 /
+                   (now - vd->vd_decoded_frames_epoch));
+    vd->vd_decoded_frames_epoch = now;
+    vd->vd_decoded_frames = 0;
+  }
+}
+
+
 /**
  *
  */
@@ -344,6 +373,13 @@ libav_decode_video(struct media_codec *mc, struct video_decoder *vd,
    * If we are seeking, drop any non-reference frames
    */
   ctx->skip_frame = mb->mb_skip == 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+  if(vd->vd_zap_armed) {
+    // First packet after open or flush, measure time until first picture
+    vd->vd_zap_armed = 0;
+    vd->vd_zap_start = arch_get_ts();
+  }
+
   avgtime_start(&vd->vd_decode_time);
 
   avcodec_decode_video2(ctx, frame, &got_pic, &mb->mb_pkt);
@@ -356,6 +392,8 @@ libav_decode_video(struct media_codec *mc, struct video_decoder *vd,
   if(got_pic == 0)
     return;
 
+  libav_video_stats(vd, mq);
+
   const media_buf_meta_t *mbm = &vd->vd_reorder[frame->reordered_opaque];
   if(!mbm->mbm_skip)
     libav_deliver_frame(vd, mp, mq, ctx, frame, mbm, t, mc);
@@ -395,6 +433,116 @@ get_buffer2_wrapper(struct AVCodecContext *s, AVFrame *frame, int flags)
   return mc->get_buffer2(s, frame, flags);
 }
 
+/**
+ * Decoder threading policy
+ *
+ * Frame threading scales well but delays output by one frame per
+ * thread, which is noticeable when zapping and seeking. Slice
+ * threading adds no delay but only helps if the stream is encoded
+ * with multiple slices. Small pictures are not worth the thread
+ * overhead at all.
+ *
+ * The first matching rule wins. AV_CODEC_ID_NONE matches any codec
+ * and max_pixels == 0 matches any resolution.
+ */
+typedef struct libav_thread_policy {
+  int codec_id;
+  unsigned int max_pixels;
+  int thread_type;          // FF_THREAD_* mask
+  int max_threads;          // 0 = gconf.concurrency
+} libav_thread_policy_t;
+
+static const libav_thread_policy_t libav_thread_policies[] = {
+  // MPEG-1/2 decoders in libav only support slice threading
+  { AV_CODEC_ID_MPEG1VIDEO, 0,         FF_THREAD_SLICE, 0 },
+  { AV_CODEC_ID_MPEG2VIDEO, 0,         FF_THREAD_SLICE, 0 },
+
+  { AV_CODEC_ID_H264,       720 * 576, FF_THREAD_FRAME | FF_THREAD_SLICE, 2 },
+  { AV_CODEC_ID_HEVC,       720 * 576, FF_THREAD_FRAME | FF_THREAD_SLICE, 2 },
+
+  { AV_CODEC_ID_NONE,       352 * 288, FF_THREAD_SLICE, 1 },
+  { AV_CODEC_ID_NONE,       0,         FF_THREAD_FRAME | FF_THREAD_SLICE, 0 },
+};
+
+
+/**
+ *
+ */
+static void
+libav_set_threading(media_codec_t *cw, const AVCodec *codec,
+                    const media_codec_params_t *mcp)
+{
+  AVCodecContext *ctx = cw->ctx;
+  unsigned int pixels;
+  const libav_thread_policy_t *ltp = NULL;
+
+  if(codec->type != AVMEDIA_TYPE_VIDEO) {
+    ctx->thread_count = 1;
+    return;
+  }
+
+  // If we run with vdpau and h264 libav will crash when going
+  // back and forth between accelerated and non-accelerated mode
+  if(video_settings.vdpau && cw->codec_id == AV_CODEC_ID_H264) {
+    ctx->thread_count = 1;
+    return;
+  }
+
+  if(mcp != NULL && mcp->width && mcp->height)
+    pixels = mcp->width * mcp->height;
+  else
+    pixels = ctx->width * ctx->height;
+
+  for(int i = 0; i < ARRAYSIZE(libav_thread_policies); i++) {
+    ltp = &libav_thread_policies[i];
+    if(ltp->codec_id != AV_CODEC_ID_NONE && ltp->codec_id != cw->codec_id)
+      continue;
+    // Unknown resolution, don't let a low resolution rule match
+    if(ltp->max_pixels && (pixels == 0 || pixels > ltp->max_pixels))
+      continue;
+    break;
+  }
+
+  int thread_type = ltp->thread_type;
+  int thread_count = ltp->max_threads ?
+    MIN(ltp->max_threads, gconf.concurrency) : gconf.concurrency;
+
+  switch(video_settings.decoder_threading) {
+  case VIDEO_THREADING_FRAME:
+    thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    thread_count = gconf.concurrency;
+    break;
+  case VIDEO_THREADING_SLICE:
+    thread_type = FF_THREAD_SLICE;
+    break;
+  default:
+    break;
+  }
+
+  if(mcp != NULL && mcp->low_latency)
+    thread_type &= ~FF_THREAD_FRAME;
+
+  thread_type &= codec->capabilities & CODEC_CAP_FRAME_THREADS ?
+    ~0 : ~FF_THREAD_FRAME;
+  thread_type &= codec->capabilities & CODEC_CAP_SLICE_THREADS ?
+    ~0 : ~FF_THREAD_SLICE;
+
+  if(thread_type == 0)
+    thread_count = 1;
+
+  ctx->thread_type  = thread_type;
+  ctx->thread_count = MAX(thread_count, 1);
+
+  TRACE(TRACE_DEBUG, "libav",
+        "%s %u pixels: %d thread%s, %s%s%s",
+        codec->name, pixels, ctx->thread_count,
+        ctx->thread_count == 1 ? "" : "s",
+        thread_type & FF_THREAD_FRAME ? "frame " : "",
+        thread_type & FF_THREAD_SLICE ? "slice " : "",
+        mcp != NULL && mcp->low_latency ? "(low latency)" : "");
+}
+
+
 /**
  *
  */
@@ -423,15 +571,12 @@ media_codec_create_lavc(media_codec_t *cw, const media_codec_params_t *mcp,
   if(mcp && mcp->cheat_for_speed)
     cw->ctx->flags2 |= CODEC_FLAG2_FAST;
 
+  libav_set_threading(cw, codec, mcp);
+
   if(codec->type == AVMEDIA_TYPE_VIDEO) {
 
     cw->get_buffer2 = &avcodec_default_get_buffer2;
 
-    // If we run with vdpau and h264 libav will crash when going
-    // back and forth between accelerated and non-accelerated mode
-    if(!(video_settings.vdpau && cw->codec_id == AV_CODEC_ID_H264))
-      cw->ctx->thread_count = gconf.concurrency;
-
     cw->ctx->opaque = cw;
     cw->ctx->refcounted_frames = 1;
     cw->ctx->get_format = &libav_get_format;
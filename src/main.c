@@ -38,6 +38,7 @@
 #include "notifications.h"
 #include "sd/sd.h"
 #include "misc/callout.h"
+#include "misc/evtrace.h"
 #include "runcontrol.h"
 #include "service.h"
 #include "plugins.h"
@@ -364,6 +365,19 @@ main_init(void)
 
   prop_init_late();
 
+#if ENABLE_LZ4TEST
+  // Test binary, configure with --enable-lz4test
+  extern int lz4_test(void);
+  exit(lz4_test());
+#endif
+
+#if ENABLE_HTSMSGTEST
+  // Benchmark binary, configure with --enable-htsmsgtest
+  extern void htsmsg_test(void);
+  htsmsg_test();
+  exit(0);
+#endif
+
   /* Initialize settings */
   settings_init();
 
@@ -435,6 +449,12 @@ main_init(void)
   /* Initialize media subsystem */
   media_init();
 
+#if ENABLE_MEDIABUFTEST
+  // Benchmark binary, configure with --enable-mediabuftest
+  extern int media_buf_test(void);
+  exit(media_buf_test());
+#endif
+
   /* Service handling */
   service_init();
 
@@ -532,6 +552,11 @@ parse_opts(int argc, char **argv)
 	     "                       Intended for plugin development\n"
 	     "   -j <path>           Load javascript file\n"
 	     "   --skin <skin>     Select skin (for GLW ui)\n"
+	     "   --trace-events <path> Record event trace and write it to\n"
+	     "                       <path> on exit (Chrome trace format)\n"
+#if ENABLE_GLW_FRONTEND_HEADLESS
+	     "   --glw-bench <path> Replay GLW benchmark script and exit\n"
+#endif
 	     "\n"
 	     "  URL is any URL-type supported, "
 	     "e.g., \"file:///...\"\n"
@@ -631,6 +656,15 @@ parse_opts(int argc, char **argv)
       gconf.load_ecmascript = argv[1];
       argc -= 2; argv += 2;
       continue;
+    } else if(!strcmp(argv[0], "--trace-events") && argc > 1) {
+      gconf.evtrace_path = argv[1];
+      evtrace_set(1);
+      argc -= 2; argv += 2;
+      continue;
+    } else if(!strcmp(argv[0], "--glw-bench") && argc > 1) {
+      gconf.glw_bench_script = argv[1];
+      argc -= 2; argv += 2;
+      continue;
     } else if(!strcmp(argv[0], "--vmir-bitcode") && argc > 1) {
       gconf.load_np = argv[1];
       argc -= 2; argv += 2;
@@ -731,6 +765,9 @@ void
 app_flush_caches(void)
 {
   kvstore_deferred_flush();
+#if ENABLE_METADATA
+  metadb_metadata_flush();
+#endif
   htsmsg_store_flush();
 }
 
@@ -834,6 +871,8 @@ main_fini(void)
   kvstore_fini();
   notifications_fini();
   htsmsg_store_flush();
+  if(gconf.evtrace_path != NULL)
+    evtrace_write_file(gconf.evtrace_path);
   TRACE(TRACE_DEBUG, "core", APPNAMEUSER" terminated normally");
   trace_fini();
 }
@@ -235,6 +235,7 @@ typedef struct gconf {
   int enable_omnigrade;
   int enable_http_debug;
   int disable_http_reuse;
+  int disable_image_pixcache;
   int enable_experimental;
   int enable_indexer;
   int enable_detailed_avdiff;
@@ -275,6 +276,10 @@ typedef struct gconf {
 
   const char *load_np;
 
+  const char *evtrace_path;  // Write event trace here on exit
+
+  const char *glw_bench_script;
+
   const char *initial_url;
   const char *initial_view;
 
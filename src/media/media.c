@@ -409,6 +409,7 @@ mp_release(media_pipe_t *mp)
   hts_mutex_destroy(&mp->mp_overlay_mutex);
 
   pool_destroy(mp->mp_mb_pool);
+  media_buf_release_pools(mp);
 
   if(mp->mp_satisfied == 0)
     atomic_dec(&media_buffer_hungry);
@@ -430,6 +431,9 @@ void
 mp_bump_epoch(media_pipe_t *mp)
 {
   hts_mutex_lock(&mp->mp_mutex);
+  // Packets still in the rings belong to the current epoch
+  mq_ring_drain(mp, &mp->mp_video);
+  mq_ring_drain(mp, &mp->mp_audio);
   mp->mp_epoch++;
   hts_mutex_unlock(&mp->mp_mutex);
 }
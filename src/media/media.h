@@ -209,6 +209,13 @@ typedef struct media_pipe {
 
   pool_t *mp_mb_pool;
 
+  /*
+   * Recycled packet payload buffers, bucketed in quarter steps between
+   * powers of two, from 4kB to 1MB. See media_buf.c
+   */
+#define MP_PAYLOAD_POOLS 33
+  struct AVBufferPool *mp_payload_pools[MP_PAYLOAD_POOLS];
+
 
   unsigned int mp_buffer_current; // Bytes current queued (total for all queues)
   unsigned int mp_buffer_delay;   // Current delay of buffer in µs
@@ -542,7 +549,8 @@ mp_check_underrun(media_pipe_t *mp)
 {
   if(mp->mp_flags & MP_PRE_BUFFERING &&
      unlikely(TAILQ_FIRST(&mp->mp_video.mq_q_data) == NULL) &&
-     unlikely(TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL))
+     unlikely(TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL) &&
+     mq_ring_empty(&mp->mp_video) && mq_ring_empty(&mp->mp_audio))
     mp_underrun(mp);
 }
 
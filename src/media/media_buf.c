@@ -42,24 +42,117 @@ media_buf_dtor_avpacket(media_buf_t *mb)
 
 #define BUF_PAD 32
 
+#define MB_PAYLOAD_MIN_SHIFT 12 // Smallest payload pool holds 4kB buffers
+
+/**
+ * Size class for a payload of 'total' bytes. Classes are spaced a
+ * quarter of a power of two apart so at most 25% is wasted
+ */
+static int
+media_buf_payload_class(size_t total, size_t *sizep)
+{
+  int shift = MB_PAYLOAD_MIN_SHIFT;
+
+  if(total <= (size_t)1 << shift) {
+    *sizep = (size_t)1 << shift;
+    return 0;
+  }
+
+  while((size_t)2 << shift < total)
+    shift++;
+
+  const size_t step = (size_t)1 << (shift - 2);
+  const int sub = (total - ((size_t)1 << shift) + step - 1) / step;
+
+  *sizep = ((size_t)1 << shift) + sub * step;
+  return (shift - MB_PAYLOAD_MIN_SHIFT) * 4 + sub;
+}
+
+
+/**
+ * Allocate packet payload from the pipe's payload pools.
+ *
+ * A steady stream of packets will keep recycling the same buffers
+ * (they are returned to the pool when the last reference is dropped)
+ * instead of doing a malloc() + free() for each packet.
+ * Payloads larger than the biggest pool fall back to av_new_packet()
+ *
+ * Does not need mp_mutex, AVBufferPools are thread safe
+ */
+static int
+media_buf_new_payload(media_pipe_t *mp, AVPacket *pkt, size_t size)
+{
+  size_t poolsize;
+  const int idx = media_buf_payload_class(size + FF_INPUT_BUFFER_PADDING_SIZE,
+                                          &poolsize);
+  if(idx >= MP_PAYLOAD_POOLS)
+    return av_new_packet(pkt, size);
+
+  AVBufferPool *pool = *(AVBufferPool * volatile *)&mp->mp_payload_pools[idx];
+
+  if(pool == NULL) {
+    pool = av_buffer_pool_init(poolsize, NULL);
+    if(pool == NULL)
+      return av_new_packet(pkt, size);
+
+    if(!atomic_ptr_cas((void **)&mp->mp_payload_pools[idx], NULL, pool)) {
+      // Someone else created it
+      av_buffer_pool_uninit(&pool);
+      pool = mp->mp_payload_pools[idx];
+    }
+  }
+
+  av_init_packet(pkt);
+  pkt->buf = av_buffer_pool_get(pool);
+  if(pkt->buf == NULL)
+    return av_new_packet(pkt, size);
+
+  pkt->data = pkt->buf->data;
+  pkt->size = size;
+  memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+media_buf_init_payload(media_pipe_t *mp, media_buf_t *mb, size_t size)
+{
+  if(media_buf_new_payload(mp, &mb->mb_pkt, size)) {
+    // Callers expect a payload, same as av_new_packet() failing did
+    TRACE(TRACE_ERROR, "media", "Unable to allocate %zd byte packet", size);
+    abort();
+  }
+  mb->mb_dtor = media_buf_dtor_avpacket;
+}
+
+
+/**
+ *
+ */
 media_buf_t *
 media_buf_alloc_locked(media_pipe_t *mp, size_t size)
 {
   hts_mutex_assert(&mp->mp_mutex);
   media_buf_t *mb = pool_get(mp->mp_mb_pool);
-  av_new_packet(&mb->mb_pkt, size);
-  mb->mb_dtor = media_buf_dtor_avpacket;
+  media_buf_init_payload(mp, mb, size);
   return mb;
 }
 
 
+/**
+ * Only the header comes from mp_mb_pool, so keep the lock just for that
+ */
 media_buf_t *
 media_buf_alloc_unlocked(media_pipe_t *mp, size_t size)
 {
   media_buf_t *mb;
   hts_mutex_lock(&mp->mp_mutex);
-  mb = media_buf_alloc_locked(mp, size);
+  mb = pool_get(mp->mp_mb_pool);
   hts_mutex_unlock(&mp->mp_mutex);
+  media_buf_init_payload(mp, mb, size);
   return mb;
 }
 
@@ -116,6 +209,21 @@ media_buf_free_locked(media_pipe_t *mp, media_buf_t *mb)
 }
 
 
+/**
+ * Buffers still referenced elsewhere keep their pool alive until
+ * they are released
+ */
+void
+media_buf_release_pools(media_pipe_t *mp)
+{
+#if ENABLE_LIBAV
+  for(int i = 0; i < MP_PAYLOAD_POOLS; i++)
+    if(mp->mp_payload_pools[i] != NULL)
+      av_buffer_pool_uninit(&mp->mp_payload_pools[i]);
+#endif
+}
+
+
 /**
  *
  */
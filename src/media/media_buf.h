@@ -153,7 +153,13 @@ typedef struct media_buf {
 
 } media_buf_t;
 
-#define mb_buffered_size(mb) MAX((mb)->mb_size, 4096)
+/**
+ * Memory accounted for a queued packet. This is the size actually
+ * allocated for the payload when known, which is rounded up to the
+ * payload pool size class
+ */
+#define mb_buffered_size(mb) \
+  MAX((mb)->mb_pkt.buf ? (mb)->mb_pkt.buf->size : (mb)->mb_size, 4096)
 
 void copy_mbm_from_mb(media_buf_meta_t *mbm, const media_buf_t *mb);
 
@@ -170,3 +176,5 @@ media_buf_t *media_buf_from_avpkt_unlocked(struct media_pipe *mp,
                                            struct AVPacket *pkt);
 
 void media_buf_dtor_frame_info(media_buf_t *mb);
+
+void media_buf_release_pools(struct media_pipe *mp);
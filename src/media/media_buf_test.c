@@ -0,0 +1,169 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "media.h"
+
+/**
+ * Packet path benchmark
+ *
+ * A synthetic 100 Mbit/s stream of TS sized (7 * 188 byte) packets is
+ * pushed into the video queue of a media pipe with
+ * mb_enqueue_with_events(), the same way a demuxer does. A consumer
+ * thread dequeues the way the video decoder does and counts how often
+ * it had to wait on mq_avail. First run is paced to the stream rate,
+ * the second one is unpaced to find the ceiling.
+ *
+ * Fails if any packet is lost or delivered out of order
+ */
+
+int media_buf_test(void);
+
+#define MBT_BITRATE   100000000
+#define MBT_PKT_SIZE  (7 * 188)
+#define MBT_SECONDS   5
+
+typedef struct mbt {
+  media_pipe_t *mbt_mp;
+  int mbt_packets;
+  int mbt_wakeups;
+  int mbt_errors;
+} mbt_t;
+
+
+/**
+ *
+ */
+static void *
+mbt_consumer(void *aux)
+{
+  mbt_t *mbt = aux;
+  media_pipe_t *mp = mbt->mbt_mp;
+  media_queue_t *mq = &mp->mp_video;
+  media_buf_t *mb;
+
+  hts_mutex_lock(&mp->mp_mutex);
+
+  while(1) {
+    mq_ring_drain(mp, mq);
+
+    if((mb = TAILQ_FIRST(&mq->mq_q_ctrl)) != NULL) {
+      TAILQ_REMOVE(&mq->mq_q_ctrl, mb, mb_link);
+    } else if((mb = TAILQ_FIRST(&mq->mq_q_data)) != NULL) {
+      TAILQ_REMOVE(&mq->mq_q_data, mb, mb_link);
+    } else {
+      hts_cond_wait(&mq->mq_avail, &mp->mp_mutex);
+      mbt->mbt_wakeups++;
+      continue;
+    }
+
+    mq->mq_packets_current--;
+    mp->mp_buffer_current -= mb_buffered_size(mb);
+    hts_cond_signal(&mp->mp_backpressure);
+
+    if(mb->mb_data_type == MB_CTRL_EXIT) {
+      media_buf_free_locked(mp, mb);
+      break;
+    }
+
+    if(mb->mb_sequence != mbt->mbt_packets)
+      mbt->mbt_errors++;
+    mbt->mbt_packets++;
+    media_buf_free_locked(mp, mb);
+  }
+
+  hts_mutex_unlock(&mp->mp_mutex);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static int
+mbt_run(int paced)
+{
+  const int64_t interval = MBT_PKT_SIZE * 8 * 1000000LL / MBT_BITRATE;
+  mbt_t mbt = {0};
+  hts_thread_t tid;
+  int64_t ts, now;
+  int i, rval = 0;
+
+  media_pipe_t *mp = mbt.mbt_mp = mp_create("mbtest", 0);
+
+  hts_mutex_lock(&mp->mp_mutex);
+  mp->mp_max_realtime_delay = INT32_MAX;
+  hts_mutex_unlock(&mp->mp_mutex);
+
+  hts_thread_create_joinable("mbtest", &tid, mbt_consumer, &mbt,
+                             THREAD_PRIO_DEMUXER);
+
+  ts = arch_get_ts();
+
+  for(i = 0; ; i++) {
+    now = arch_get_ts();
+    if(now - ts >= MBT_SECONDS * 1000000LL)
+      break;
+
+    if(paced && ts + i * interval > now)
+      usleep(ts + i * interval - now);
+
+    media_buf_t *mb = media_buf_alloc_unlocked(mp, MBT_PKT_SIZE);
+    mb->mb_data_type = MB_VIDEO;
+    mb->mb_sequence = i;
+    mb->mb_pts = mb->mb_dts = PTS_UNSET;
+    memset(mb->mb_data, 0x47, MBT_PKT_SIZE);
+    mb_enqueue_with_events(mp, &mp->mp_video, mb);
+  }
+
+  // Control packets are dequeued first, so wait for the data like EOF does
+  mp_wait_for_empty_queues(mp);
+  mp_send_cmd(mp, &mp->mp_video, MB_CTRL_EXIT);
+  hts_thread_join(&tid);
+
+  now = arch_get_ts() - ts;
+  printf("media_buf: %s: %d packets/s (%.1f Mbit/s), %d wakeups/s\n",
+         paced ? "100 Mbit/s paced" : "unpaced",
+         (int)(mbt.mbt_packets * 1000000LL / now),
+         mbt.mbt_packets * (double)MBT_PKT_SIZE * 8 / now,
+         (int)(mbt.mbt_wakeups * 1000000LL / now));
+
+  if(mbt.mbt_packets != i || mbt.mbt_errors) {
+    printf("media_buf: %d packets sent, %d received, %d out of order\n",
+           i, mbt.mbt_packets, mbt.mbt_errors);
+    rval = 1;
+  }
+
+  mp_destroy(mp);
+  return rval;
+}
+
+
+/**
+ * Returns non-zero on failure
+ */
+int
+media_buf_test(void)
+{
+  return mbt_run(1) || mbt_run(0);
+}
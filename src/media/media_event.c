@@ -44,6 +44,9 @@ mp_seek_in_queues(media_pipe_t *mp, int64_t user_time)
   media_buf_t *abuf, *vbuf, *vk, *mb;
   int rval = 1;
 
+  mq_ring_drain(mp, &mp->mp_audio);
+  mq_ring_drain(mp, &mp->mp_video);
+
   TAILQ_FOREACH(abuf, &mp->mp_audio.mq_q_data, mb_link)
     if(abuf->mb_user_time != PTS_UNSET && abuf->mb_user_time >= user_time)
       break;
@@ -196,6 +199,9 @@ mp_event_dispatch(media_pipe_t *mp, event_t *e)
   if(mp->mp_handle_event == NULL ||
      !mp->mp_handle_event(mp, mp->mp_handle_event_opaque, e)) {
     TAILQ_INSERT_TAIL(&mp->mp_eq, e, e_link);
+    // Revoke lock-free credit so the demuxer picks up the event
+    atomic_set(&mp->mp_video.mq_ring_credit, 0);
+    atomic_set(&mp->mp_audio.mq_ring_credit, 0);
     hts_cond_signal(&mp->mp_backpressure);
   } else {
     event_release(e);
@@ -22,6 +22,24 @@
 #include "media.h"
 
 #include "misc/minmax.h"
+#include "misc/evtrace.h"
+
+/*
+ * Ring indexes and mq_ring_wake are sequentially consistent. The consumer
+ * stores mq_ring_wake and then loads mq_ring_head while the producer does
+ * it the other way around, so at least one of them sees the other's store
+ */
+#if defined(__ATOMIC_SEQ_CST)
+#define mq_ring_store(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define mq_ring_load(p)     __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#else
+#define mq_ring_store(p, v) do { __sync_synchronize(); *(p) = v; __sync_synchronize(); } while(0)
+#define mq_ring_load(p) ({ unsigned int v__ = *(volatile unsigned int *)(p); __sync_synchronize(); v__;})
+#endif
+
+// With data already queued, let this many packets collect before waking up
+#define MQ_RING_BATCH 16
+
 
 /**
  *
@@ -52,6 +70,7 @@ mq_flush_q(media_pipe_t *mp, media_queue_t *mq, struct media_buf_queue *q,
 static void
 mq_flush_locked(media_pipe_t *mp, media_queue_t *mq, int full)
 {
+  mq_ring_drain(mp, mq);
   mq->mq_last_deq_dts = PTS_UNSET;
   mq_flush_q(mp, mq, &mq->mq_q_data, full);
   mq_flush_q(mp, mq, &mq->mq_q_ctrl, full);
@@ -192,6 +211,127 @@ mp_enqueue_check_pre_buffering(media_pipe_t *mp)
 }
 
 
+/**
+ * Lock-free handoff of data packets from the demuxer to the decoder.
+ *
+ * mb_enqueue_with_events() normally has to check for pending events and
+ * buffer limits under mp_mutex. Instead, each time it has done so it
+ * hands out a credit of bytes that may be pushed into the queue's ring
+ * without locking (see mq_ring_grant()). Posting an event revokes the
+ * credit so the demuxer takes the locked path on its next packet.
+ *
+ * Whoever holds mp_mutex moves packets from the ring into mq_q_data
+ * using mq_ring_drain() before looking at the data queue. The consumer
+ * tells the producer, via mq_ring_wake, after how many pushed packets it
+ * wants mq_avail to be signalled.
+ *
+ * Returns 0 if the packet was not pushed and must take the locked path
+ */
+static int
+mq_ring_push(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
+{
+  if(mb->mb_data_type != MB_VIDEO && mb->mb_data_type != MB_AUDIO)
+    return 0;
+
+  if(__sync_lock_test_and_set(&mq->mq_ring_busy, 1))
+    return 0; // Another thread is pushing to this queue
+
+  const unsigned int head = mq->mq_ring_head;
+  int pushed = 0;
+
+  if(head - mq_ring_load(&mq->mq_ring_tail) < MQ_RING_SIZE &&
+     atomic_add_and_fetch(&mq->mq_ring_credit, -(int)mb_buffered_size(mb)) >= 0) {
+    mq->mq_ring[head & (MQ_RING_SIZE - 1)] = mb;
+    mq_ring_store(&mq->mq_ring_head, head + 1);
+    pushed = 1;
+  }
+
+  __sync_lock_release(&mq->mq_ring_busy);
+
+  if(!pushed)
+    return 0;
+
+  const unsigned int wake = mq_ring_load(&mq->mq_ring_wake);
+  if(wake && head + 1 - mq_ring_load(&mq->mq_ring_tail) >= wake &&
+     __sync_bool_compare_and_swap(&mq->mq_ring_wake, wake, 0)) {
+    hts_mutex_lock(&mp->mp_mutex);
+    hts_cond_signal(&mq->mq_avail);
+    hts_mutex_unlock(&mp->mp_mutex);
+  }
+  return 1;
+}
+
+
+/**
+ * Move packets pushed by mq_ring_push() to mq_q_data.
+ *
+ * Must be called with mp locked, before looking at mq_q_data
+ */
+void
+mq_ring_drain(media_pipe_t *mp, media_queue_t *mq)
+{
+  unsigned int tail = mq->mq_ring_tail;
+  int moved = 0;
+
+  while(1) {
+    const unsigned int head = mq_ring_load(&mq->mq_ring_head);
+
+    if(head == tail) {
+      /*
+       * Ask to be woken up on the next push, or after a few if we still
+       * have data to work on. Then look again since a push racing with
+       * this might not have seen the request
+       */
+      mq_ring_store(&mq->mq_ring_wake, mq->mq_no_data_interest ? 0 :
+                    TAILQ_FIRST(&mq->mq_q_data) != NULL ? MQ_RING_BATCH : 1);
+      if(mq_ring_load(&mq->mq_ring_head) == tail)
+        break;
+      continue;
+    }
+
+    while(tail != head) {
+      media_buf_t *mb = mq->mq_ring[tail & (MQ_RING_SIZE - 1)];
+      tail++;
+      TAILQ_INSERT_TAIL(&mq->mq_q_data, mb, mb_link);
+      mq->mq_packets_current++;
+      mb->mb_epoch = mp->mp_epoch;
+      mp->mp_buffer_current += mb_buffered_size(mb);
+      moved = 1;
+    }
+    mq_ring_store(&mq->mq_ring_tail, tail);
+  }
+
+  if(!moved)
+    return;
+
+  mq_update_stats(mp, mq, 0);
+
+  if(!mq->mq_no_data_interest)
+    hts_cond_signal(&mq->mq_avail);
+}
+
+
+/**
+ * Hand out credit for lock-free pushes, must be called with mp locked
+ * after checking for events.
+ *
+ * No credit while pre-buffering as we need to check if we should
+ * release the hold for each packet
+ */
+static void
+mq_ring_grant(media_pipe_t *mp, media_queue_t *mq)
+{
+  int credit = 0;
+
+  if(!(mp->mp_hold_flags & MP_HOLD_PRE_BUFFERING) &&
+     mp->mp_buffer_delay < mp->mp_max_realtime_delay &&
+     mp->mp_buffer_current < mp->mp_buffer_limit)
+    credit = mp->mp_buffer_limit - mp->mp_buffer_current;
+
+  atomic_set(&mq->mq_ring_credit, credit);
+}
+
+
 /**
  *
  */
@@ -200,7 +340,11 @@ mb_enqueue_with_events(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 {
   event_t *e = NULL;
 
+  if(mq_ring_push(mp, mq, mb))
+    return NULL;
+
   hts_mutex_lock(&mp->mp_mutex);
+  mq_ring_drain(mp, mq);
 #if 0
   printf("ENQ %s %d %d/%d %d/%d\n",
          mq == &mp->mp_video ? "video" : "audio",
@@ -245,6 +389,7 @@ mb_enqueue_with_events(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
     TAILQ_REMOVE(&mp->mp_eq, e, e_link);
   } else {
     mb_enq(mp, mq, mb);
+    mq_ring_grant(mp, mq);
   }
 
   hts_mutex_unlock(&mp->mp_mutex);
@@ -263,6 +408,7 @@ mb_enqueue_no_block(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb,
   assert(mb->mb_data_type < MB_CTRL);
 
   hts_mutex_lock(&mp->mp_mutex);
+  mq_ring_drain(mp, mq);
 
   mp_update_buffer_delay(mp);
   mp_enqueue_check_pre_buffering(mp);
@@ -318,6 +464,14 @@ mb_enqueue_always(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 void
 mq_update_stats(media_pipe_t *mp, media_queue_t *mq, int force)
 {
+  if(unlikely(evtrace_enabled)) {
+    evtrace_counter("media",
+                    mq == &mp->mp_video ? "video packets" :
+                    mq == &mp->mp_audio ? "audio packets" : "other packets",
+                    mq->mq_packets_current);
+    evtrace_counter("media", "buffered bytes", mp->mp_buffer_current);
+  }
+
   if(!force && --mp->mp_stats_update_limiter > 0)
     return;
   mp->mp_stats_update_limiter = 100;
@@ -378,6 +532,9 @@ mq_init(media_queue_t *mq, prop_t *p, hts_mutex_t *mutex, media_pipe_t *mp)
 
   mq->mq_prop_codec       = prop_create(p, "codec");
   mq->mq_prop_too_slow    = prop_create(p, "too_slow");
+
+  mq->mq_prop_decode_fps  = prop_create(p, "decode_fps");
+  mq->mq_prop_zap_latency = prop_create(p, "zap_latency");
 }
 
 
@@ -401,10 +558,17 @@ mp_wait_for_empty_queues(media_pipe_t *mp)
   hts_mutex_lock(&mp->mp_mutex);
 
   // Only wait for data queues to drain, aux (subtitles) might be stalled
-  while((e = TAILQ_FIRST(&mp->mp_eq)) == NULL &&
-	(TAILQ_FIRST(&mp->mp_audio.mq_q_data) != NULL ||
-         TAILQ_FIRST(&mp->mp_video.mq_q_data) != NULL))
+  while(1) {
+    mq_ring_drain(mp, &mp->mp_audio);
+    mq_ring_drain(mp, &mp->mp_video);
+
+    if((e = TAILQ_FIRST(&mp->mp_eq)) != NULL ||
+       (TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL &&
+        TAILQ_FIRST(&mp->mp_video.mq_q_data) == NULL))
+      break;
+
     hts_cond_wait(&mp->mp_backpressure, &mp->mp_mutex);
+  }
 
   if(e != NULL)
     TAILQ_REMOVE(&mp->mp_eq, e, e_link);
@@ -536,6 +700,8 @@ mb_enq(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
   } else if(mb->mb_data_type > MB_CTRL) {
     TAILQ_INSERT_TAIL(&mq->mq_q_ctrl, mb, mb_link);
   } else {
+    // Packets still in the ring go first
+    mq_ring_drain(mp, mq);
     TAILQ_INSERT_TAIL(&mq->mq_q_data, mb, mb_link);
     do_signal = !mq->mq_no_data_interest;
   }
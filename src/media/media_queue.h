@@ -70,6 +70,9 @@ typedef struct media_queue {
 
   prop_t *mq_prop_too_slow;
 
+  prop_t *mq_prop_decode_fps;
+  prop_t *mq_prop_zap_latency; // In ms
+
   struct media_pipe *mq_mp;
 
   // Copies to avoid updating codec user facing info too often
@@ -83,9 +86,31 @@ typedef struct media_queue {
 
   media_discontinuity_aux_t mq_demux_debug;
 
+  /*
+   * Data packets handed over by the demuxer without taking mp_mutex.
+   * See mq_ring_push() in media_queue.c
+   */
+#define MQ_RING_SIZE 64 // Must be a power of two
+  struct media_buf *mq_ring[MQ_RING_SIZE];
+  unsigned int mq_ring_head;  // Only written by the producer
+  unsigned int mq_ring_tail;  // Only written with mp_mutex held
+  int mq_ring_busy;           // A producer is pushing
+  unsigned int mq_ring_wake;  // Signal mq_avail when this many are pushed
+  atomic_t mq_ring_credit;    // Bytes that may be pushed without locking
+
 } media_queue_t;
 
 
+/**
+ * Return true if there are no packets waiting in the ring.
+ * Must be called with mp_mutex locked
+ */
+static inline int
+mq_ring_empty(const media_queue_t *mq)
+{
+  return *(volatile const unsigned int *)&mq->mq_ring_head == mq->mq_ring_tail;
+}
+
 
 void mp_send_cmd_locked(struct media_pipe *mp, media_queue_t *mq, int cmd);
 
@@ -130,4 +155,6 @@ void mq_destroy(media_queue_t *mq);
 
 void mq_update_stats(struct media_pipe *mp, media_queue_t *mq, int force);
 
+void mq_ring_drain(struct media_pipe *mp, media_queue_t *mq);
+
 void mp_update_buffer_delay(struct media_pipe *mp);
@@ -30,6 +30,20 @@
 #include "fileaccess/fa_indexer.h"
 #include "metadata_str.h"
 #include "misc/minmax.h"
+#include "prop/prop_vdir.h"
+
+/**
+ * Row kept in memory for library pages exposed through a prop_vdir
+ */
+typedef struct bmdb_row {
+  rstr_t *br_url;
+  rstr_t *br_type;
+  rstr_t *br_title;
+  rstr_t *br_artist;
+  int br_track;
+  int br_duration;
+} bmdb_row_t;
+
 
 /**
  *
@@ -39,6 +53,12 @@ typedef struct bmdb {
   library_query_t b_type;
   prop_t *b_nodes;
   prop_t *b_metadata;
+  prop_t *b_entries;
+
+  bmdb_row_t *b_rows;
+  int b_num_rows;
+  int b_rows_alloc;
+  int b_virtual;
 
 } bmdb_t;
 
@@ -112,13 +132,102 @@ get_percentage(const char *url)
 static void
 bmdb_destroy(bmdb_t *b)
 {
+  for(int i = 0; i < b->b_num_rows; i++) {
+    bmdb_row_t *br = &b->b_rows[i];
+    rstr_release(br->br_url);
+    rstr_release(br->br_type);
+    rstr_release(br->br_title);
+    rstr_release(br->br_artist);
+  }
+  free(b->b_rows);
   prop_ref_dec(b->b_nodes);
   prop_ref_dec(b->b_metadata);
+  prop_ref_dec(b->b_entries);
   free(b->b_query);
   free(b);
 }
 
 
+/**
+ *
+ */
+static void
+add_row(bmdb_t *b, const char *url, rstr_t *contenttype,
+        const char *title, int track, const char *artist, int duration)
+{
+  if(b->b_num_rows == b->b_rows_alloc) {
+    b->b_rows_alloc = MAX(256, b->b_rows_alloc * 2);
+    b->b_rows = realloc(b->b_rows, b->b_rows_alloc * sizeof(bmdb_row_t));
+  }
+  bmdb_row_t *br = &b->b_rows[b->b_num_rows++];
+  br->br_url      = rstr_alloc(url);
+  br->br_type     = rstr_dup(contenttype);
+  br->br_title    = rstr_alloc(title);
+  br->br_artist   = rstr_intern(artist);
+  br->br_track    = track;
+  br->br_duration = duration;
+}
+
+
+/**
+ *
+ */
+static void
+set_item_title(prop_t *metadata, const char *url, const char *title)
+{
+  if(title == NULL) {
+    char fname[512];
+    fa_url_get_last_component(fname, sizeof(fname), url);
+
+    rstr_t *ft = metadata_remove_postfix(fname);
+    prop_set(metadata, "title", PROP_SET_RSTRING, ft);
+    rstr_release(ft);
+  } else {
+    prop_set(metadata, "title", PROP_SET_STRING, title);
+  }
+}
+
+
+/**
+ * prop_vdir row callback. Stub rows only carry what's needed to show
+ * them in a list
+ */
+static void
+bmdb_row_fill(void *opaque, prop_t *c, unsigned int index, int flags)
+{
+  bmdb_t *b = opaque;
+  const bmdb_row_t *br = &b->b_rows[index];
+
+  prop_set(c, "type", PROP_SET_RSTRING, br->br_type);
+  prop_set(c, "url", PROP_SET_RSTRING, br->br_url);
+
+  prop_t *metadata = prop_create_r(c, "metadata");
+  set_item_title(metadata, rstr_get(br->br_url), rstr_get(br->br_title));
+
+  if(flags & PROP_VDIR_ROW_FULL) {
+    if(br->br_track)
+      prop_set(metadata, "track", PROP_SET_INT, br->br_track);
+
+    if(br->br_artist)
+      prop_set(metadata, "artist", PROP_SET_RSTRING, br->br_artist);
+
+    if(br->br_duration > 0)
+      prop_set(metadata, "duration", PROP_SET_INT, br->br_duration / 1000);
+  }
+  prop_ref_dec(metadata);
+}
+
+
+/**
+ *
+ */
+static void
+bmdb_vdir_release(void *opaque)
+{
+  bmdb_destroy(opaque);
+}
+
+
 /**
  *
  */
@@ -126,6 +235,11 @@ static void
 add_item(bmdb_t *b, const char *url, const char *parent, rstr_t *contenttype,
          const char *title, int track, const char *artist, int duration)
 {
+  if(b->b_virtual) {
+    add_row(b, url, contenttype, title, track, artist, duration);
+    return;
+  }
+
   prop_t *c = prop_create_r(b->b_nodes, url);
 
   prop_unmark(c);
@@ -144,17 +258,7 @@ add_item(bmdb_t *b, const char *url, const char *parent, rstr_t *contenttype,
   if(duration > 0)
     prop_set(metadata, "duration", PROP_SET_INT, duration / 1000);
 
-  if(title == NULL) {
-    char fname[512];
-    fa_url_get_last_component(fname, sizeof(fname), url);
-
-    rstr_t *ft = metadata_remove_postfix(fname);
-    prop_set(metadata, "title", PROP_SET_RSTRING, ft);
-    rstr_release(ft);
-  } else {
-    prop_set(metadata, "title", PROP_SET_STRING, title);
-  }
-
+  set_item_title(metadata, url, title);
 
 #if 0
   prop_t *options = prop_create(bi->bi_prop, "options");
@@ -193,7 +297,7 @@ video_query(bmdb_t *b, void *db)
   while((rc = db_step(stmt)) == SQLITE_ROW) {
     const char *url = (const char *)sqlite3_column_text(stmt, 0);
     const char *parent = (const char *)sqlite3_column_text(stmt, 1);
-    rstr_t *ct = rstr_alloc(content2type(sqlite3_column_int(stmt, 2)));
+    rstr_t *ct = rstr_intern(content2type(sqlite3_column_int(stmt, 2)));
     add_item(b, url, parent, ct, NULL, 0, NULL, 0);
     rstr_release(ct);
   }
@@ -417,7 +521,8 @@ artists_query(bmdb_t *b, void *db)
 static int
 bmdb_query_exec(void *db, bmdb_t *b)
 {
-  prop_mark_childs(b->b_nodes);
+  if(!b->b_virtual)
+    prop_mark_childs(b->b_nodes);
 
   switch(b->b_type) {
   case LIBRARY_QUERY_ALBUMS:
@@ -437,7 +542,8 @@ bmdb_query_exec(void *db, bmdb_t *b)
     break;
   }
 
-  prop_destroy_marked_childs(b->b_nodes);
+  if(!b->b_virtual)
+    prop_destroy_marked_childs(b->b_nodes);
   return 0;
 }
 
@@ -500,7 +606,11 @@ bmdb_thread(void *aux)
   void *db = metadb_get();
   bmdb_query_exec(db, b);
   metadb_close(db);
-  bmdb_destroy(b);
+
+  // Rows are materialized on demand, 'b' lives until nodes are destroyed
+  prop_vdir_create(b->b_nodes, b->b_entries, b->b_num_rows,
+                   bmdb_row_fill, bmdb_vdir_release, b,
+                   PROP_VDIR_AUTODESTROY);
   return NULL;
 }
 
@@ -516,6 +626,8 @@ bmdb_query_create(const char *query, int type, prop_t *model)
   prop_set(model, "type", PROP_SET_STRING, "directory");
   b->b_nodes = prop_create_r(model, "nodes");
   b->b_metadata = prop_create_r(model, "metadata");
+  b->b_entries = prop_create_r(model, "entries");
+  b->b_virtual = 1;
   b->b_type = type;
   b->b_query = strdup(query);
   return b;
@@ -128,6 +128,93 @@ metadata_destroy(metadata_t *md)
 }
 
 
+/**
+ *
+ */
+static void
+clone_persons(struct metadata_person_queue *dst,
+              const struct metadata_person_queue *src)
+{
+  const metadata_person_t *mp;
+
+  TAILQ_FOREACH(mp, src, mp_link) {
+    metadata_person_t *n = malloc(sizeof(metadata_person_t));
+    n->mp_name       = rstr_dup(mp->mp_name);
+    n->mp_character  = rstr_dup(mp->mp_character);
+    n->mp_department = rstr_dup(mp->mp_department);
+    n->mp_job        = rstr_dup(mp->mp_job);
+    n->mp_portrait   = rstr_dup(mp->mp_portrait);
+    TAILQ_INSERT_TAIL(dst, n, mp_link);
+  }
+}
+
+
+/**
+ *
+ */
+static rstr_vec_t *
+clone_vec(const rstr_vec_t *rv)
+{
+  rstr_vec_t *r = NULL;
+  int i;
+  if(rv != NULL)
+    for(i = 0; i < rv->size; i++)
+      rstr_vec_append(&r, rv->v[i]);
+  return r;
+}
+
+
+/**
+ * Deep copy of a metadata_t
+ */
+metadata_t *
+metadata_clone(const metadata_t *src)
+{
+  const metadata_stream_t *ms;
+  metadata_t *md = malloc(sizeof(metadata_t));
+
+  *md = *src;
+  TAILQ_INIT(&md->md_streams);
+  TAILQ_INIT(&md->md_cast);
+  TAILQ_INIT(&md->md_crew);
+
+  md->md_parent = src->md_parent ? metadata_clone(src->md_parent) : NULL;
+
+  md->md_title = rstr_dup(src->md_title);
+  md->md_album = rstr_dup(src->md_album);
+  md->md_artist = rstr_dup(src->md_artist);
+  md->md_format = rstr_dup(src->md_format);
+  md->md_genre = rstr_dup(src->md_genre);
+  md->md_description = rstr_dup(src->md_description);
+  md->md_tagline = rstr_dup(src->md_tagline);
+  md->md_imdb_id = rstr_dup(src->md_imdb_id);
+  md->md_manufacturer = rstr_dup(src->md_manufacturer);
+  md->md_equipment = rstr_dup(src->md_equipment);
+  md->md_ext_id = rstr_dup(src->md_ext_id);
+
+  md->md_icons        = clone_vec(src->md_icons);
+  md->md_backdrops    = clone_vec(src->md_backdrops);
+  md->md_wide_banners = clone_vec(src->md_wide_banners);
+  md->md_thumbs       = clone_vec(src->md_thumbs);
+
+  md->md_redirect = src->md_redirect ? strdup(src->md_redirect) : NULL;
+
+  TAILQ_FOREACH(ms, &src->md_streams, ms_link) {
+    metadata_stream_t *n = malloc(sizeof(metadata_stream_t));
+    *n = *ms;
+    n->ms_title = rstr_dup(ms->ms_title);
+    n->ms_info = rstr_dup(ms->ms_info);
+    n->ms_isolang = rstr_dup(ms->ms_isolang);
+    n->ms_codec = rstr_dup(ms->ms_codec);
+    TAILQ_INSERT_TAIL(&md->md_streams, n, ms_link);
+  }
+
+  clone_persons(&md->md_cast, &src->md_cast);
+  clone_persons(&md->md_crew, &src->md_crew);
+  return md;
+}
+
+
 /**
  *
  */
@@ -139,9 +226,9 @@ metadata_add_stream(metadata_t *md, const char *codec, int type,
 {
   metadata_stream_t *ms = malloc(sizeof(metadata_stream_t));
   ms->ms_title = rstr_alloc(title);
-  ms->ms_info = rstr_alloc(info);
-  ms->ms_isolang = rstr_alloc(isolang);
-  ms->ms_codec = rstr_alloc(codec);
+  ms->ms_info = rstr_intern(info);
+  ms->ms_isolang = rstr_intern(isolang);
+  ms->ms_codec = rstr_intern(codec);
   ms->ms_type = type;
   ms->ms_disposition = disposition;
   ms->ms_streamindex = streamindex;
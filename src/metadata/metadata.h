@@ -291,6 +291,8 @@ metadata_t *metadata_create(void);
 
 void metadata_destroy(metadata_t *md);
 
+metadata_t *metadata_clone(const metadata_t *md);
+
 void metadata_add_stream(metadata_t *md, const char *codec,
 			 int type, int streamindex,
 			 const char *title,
@@ -332,8 +334,83 @@ void metadb_metadata_write(void *db, const char *url, time_t mtime,
 			   time_t parent_mtime,
                            metadata_index_status_t indexstatus);
 
+/**
+ * Queue the write and commit it later together with other writes.
+ * Reads from metadb do not see queued writes, call
+ * metadb_metadata_flush() first if that matters
+ */
+void metadb_metadata_write_deferred(const char *url, time_t mtime,
+                                    const metadata_t *md, const char *parent,
+                                    time_t parent_mtime,
+                                    metadata_index_status_t indexstatus);
+
+void metadb_metadata_flush(void);
+
+/**
+ * Same as metadb_metadata_write() but must be called within a
+ * transaction. Returns METADATA_DEADLOCK if the caller should
+ * rollback and retry.
+ */
+int metadb_metadata_writex(void *db, const char *url, time_t mtime,
+                           const metadata_t *md, const char *parent,
+                           time_t parent_mtime,
+                           metadata_index_status_t indexstatus);
+
 metadata_t *metadb_metadata_get(void *db, const char *url, time_t mtime);
 
+/**
+ * Video stream as returned by metadb_batch_get()
+ */
+typedef struct metadb_batch_stream {
+  int mdbs_row;
+  int mdbs_type;
+  int mdbs_index;
+  int mdbs_disposition;
+  rstr_t *mdbs_codec;
+  rstr_t *mdbs_title;
+  rstr_t *mdbs_info;
+  rstr_t *mdbs_isolang;
+} metadb_batch_stream_t;
+
+/**
+ * Column packed result of metadb_batch_get(). Row i corresponds to
+ * url i of the request. Columns not relevant for a row's content type
+ * are zero / NULL
+ */
+typedef struct metadb_batch {
+  int mdb_count;
+
+  char *mdb_found;
+  char *mdb_parented;
+  int64_t *mdb_item_id;
+  int64_t *mdb_videoitem_id;
+  int *mdb_contenttype;
+  int *mdb_index_status;
+  int *mdb_duration;  // ms
+  int *mdb_track;
+  int *mdb_year;
+  int *mdb_time;
+  rstr_t **mdb_title;
+  rstr_t **mdb_album;
+  rstr_t **mdb_artist;
+  rstr_t **mdb_format;
+  rstr_t **mdb_manufacturer;
+  rstr_t **mdb_equipment;
+
+  // Sorted on row and stream index
+  int mdb_num_streams;
+  int mdb_streams_alloc;
+  metadb_batch_stream_t *mdb_streams;
+  int *mdb_stream_first;  // Index + 1 of row's first stream, 0 if none
+} metadb_batch_t;
+
+metadb_batch_t *metadb_batch_get(void *db, const char **urls,
+                                 const time_t *mtimes, int count);
+
+metadata_t *metadb_batch_metadata(const metadb_batch_t *mb, int row);
+
+void metadb_batch_free(metadb_batch_t *mb);
+
 struct fa_dir;
 struct fa_dir *metadb_metadata_scandir(void *db, const char *url,
 				       time_t *mtimep);
@@ -342,6 +419,13 @@ void metadb_parent_item(void *db, const char *url, const char *parent_url);
 
 void metadb_unparent_item(void *db, const char *url);
 
+/**
+ * Same as metadb_unparent_item() but must be called within a
+ * transaction. Returns METADATA_DEADLOCK if the caller should
+ * rollback and retry.
+ */
+int metadb_unparent_itemx(void *db, const char *url);
+
 int metadb_item_set_preferred_ds(void *opaque, const char *url, int ds_id);
 
 int metadb_item_get_preferred_ds(const char *url);
@@ -37,9 +37,19 @@
 #include "settings.h"
 #include "notifications.h"
 #include "metadata_sources.h"
+#include "misc/minmax.h"
+#include "misc/str.h"
 
 // If not set to true by metadb_init() no metadb actions will occur
 static db_pool_t *metadb_pool;
+static db_wb_t *metadb_wb;
+
+#define METADB_WB_DELAY_MS    2000
+#define METADB_WB_MAX_PENDING 128
+
+static const db_wb_class_t metadb_wb_class;
+
+static void metadb_batch_init(void);
 
 static int
 rc2metadatacode(int rc)
@@ -112,6 +122,8 @@ metadb_init(void)
 
   //  unlink(buf);
 
+  metadb_batch_init();
+
   metadb_pool = db_pool_create(buf, 2);
   db = metadb_get();
   if(db == NULL)
@@ -127,6 +139,9 @@ metadb_init(void)
   if(r) {
     metadb_pool = NULL; // Disable
   } else {
+    metadb_wb = db_wb_create(&metadb_wb_class, metadb_pool,
+                             METADB_WB_DELAY_MS, METADB_WB_MAX_PENDING);
+
     prop_t *dir = setting_get_dir("general:resets");
     settings_create_action(dir, _p("Clear all metadata"),
 			   items_clear, NULL, 0, NULL);
@@ -140,6 +155,7 @@ metadb_init(void)
 void
 metadb_fini(void)
 {
+  db_wb_close(metadb_wb);
   db_pool_close(metadb_pool);
 }
 
@@ -723,7 +739,7 @@ metadb_get_video_art(void *db, int64_t videoitem_id, int type)
   sqlite3_bind_int(sel, 2, type);
   rstr_vec_t *rv = NULL;
   while((rc = db_step(sel)) == SQLITE_ROW) {
-    rstr_t *r = db_rstr(sel, 0);
+    rstr_t *r = db_rstr_intern(sel, 0);
     rstr_vec_append(&rv, r);
     rstr_release(r);
   }
@@ -1165,7 +1181,7 @@ metadb_insert_imageitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
 /**
  *
  */
-static int
+int
 metadb_metadata_writex(void *db, const char *url, time_t mtime,
                        const metadata_t *md, const char *parent,
                        time_t parent_mtime,
@@ -1176,6 +1192,18 @@ metadb_metadata_writex(void *db, const char *url, time_t mtime,
   int rc;
   sqlite3_stmt *stmt;
 
+  switch(md->md_contenttype) {
+  case CONTENT_AUDIO:
+  case CONTENT_VIDEO:
+  case CONTENT_IMAGE:
+  case CONTENT_DIR:
+  case CONTENT_DVD:
+  case CONTENT_SHARE:
+    break;
+  default:
+    return 0;
+  }
+
   if(parent != NULL) {
     parent_id = db_item_get(db, parent, NULL);
     if(parent_id == METADATA_DEADLOCK)
@@ -1274,18 +1302,6 @@ metadb_metadata_write(void *db, const char *url, time_t mtime,
 		      time_t parent_mtime,
                       metadata_index_status_t indexstatus)
 {
-  switch(md->md_contenttype) {
-  case CONTENT_AUDIO:
-  case CONTENT_VIDEO:
-  case CONTENT_IMAGE:
-  case CONTENT_DIR:
-  case CONTENT_DVD:
-  case CONTENT_SHARE:
-    break;
-  default:
-    return;
-  }
-
   while(1) {
     if(db_begin(db))
       return;
@@ -1306,196 +1322,93 @@ metadb_metadata_write(void *db, const char *url, time_t mtime,
 }
 
 
-typedef struct get_cache {
-  int64_t gc_album_id;
-  rstr_t *gc_album_title;
-
-  int64_t gc_artist_id;
-  rstr_t *gc_artist_title;
-
-} get_cache_t;
-
-
 /**
- *
+ * Pending metadb_metadata_write_deferred()
  */
-static void
-get_cache_release(get_cache_t *gc)
-{
-  rstr_release(gc->gc_album_title);
-  rstr_release(gc->gc_artist_title);
-}
+typedef struct metadb_wb_entry {
+  db_wb_entry_t mwe_entry; // Must be first
+  char *mwe_url;
+  time_t mwe_mtime;
+  metadata_t *mwe_md;
+  char *mwe_parent;
+  time_t mwe_parent_mtime;
+  metadata_index_status_t mwe_indexstatus;
+} metadb_wb_entry_t;
 
 
 /**
  *
  */
 static int
-metadb_metadata_get_artist(sqlite3 *db, get_cache_t *gc, int64_t id)
+metadb_wb_write(sqlite3 *db, db_wb_entry_t *dwe)
 {
-  if(id < 1)
-    return METADATA_PERMANENT_ERROR;
-
-  if(id == gc->gc_artist_id)
-    return 0;
-
-  int rc;
-  sqlite3_stmt *sel;
-
-  rc = db_prepare(db, &sel,
-		  "SELECT title "
-		  "FROM artist "
-		  "WHERE id = ?1 AND ds_id=1"
-		  );
-
-  if(rc != SQLITE_OK)
-    return METADATA_PERMANENT_ERROR;
-
-  sqlite3_bind_int64(sel, 1, id);
-
-  rc = db_step(sel);
-
-  if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
-    return METADATA_PERMANENT_ERROR;
-  }
-
-  gc->gc_artist_id = id;
-
-  rstr_release(gc->gc_artist_title);
-  gc->gc_artist_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-  sqlite3_finalize(sel);
-  return 0;
+  const metadb_wb_entry_t *mwe = (const metadb_wb_entry_t *)dwe;
+
+  int r = metadb_metadata_writex(db, mwe->mwe_url, mwe->mwe_mtime,
+                                 mwe->mwe_md, mwe->mwe_parent,
+                                 mwe->mwe_parent_mtime, mwe->mwe_indexstatus);
+  if(r == METADATA_DEADLOCK)
+    return SQLITE_LOCKED;
+  return r ? SQLITE_ERROR : SQLITE_OK;
 }
 
 
 /**
  *
  */
-static int
-metadb_metadata_get_album(sqlite3 *db, get_cache_t *gc, int64_t id)
+static void
+metadb_wb_destroy(db_wb_entry_t *dwe)
 {
-  if(id < 1)
-    return METADATA_PERMANENT_ERROR;
-
-  if(id == gc->gc_album_id)
-    return 0;
-
-  int rc;
-  sqlite3_stmt *sel;
-
-  rc = db_prepare(db, &sel,
-		  "SELECT title "
-		  "FROM album "
-		  "WHERE id = ?1 AND ds_id=1");
+  metadb_wb_entry_t *mwe = (metadb_wb_entry_t *)dwe;
+  free(mwe->mwe_url);
+  free(mwe->mwe_parent);
+  metadata_destroy(mwe->mwe_md);
+  free(mwe);
+}
 
-  if(rc != SQLITE_OK)
-    return METADATA_PERMANENT_ERROR;
 
-  sqlite3_bind_int64(sel, 1, id);
-
-  rc = db_step(sel);
-
-  if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
-    return METADATA_PERMANENT_ERROR;
-  }
-
-  gc->gc_album_id = id;
-  rstr_release(gc->gc_album_title);
-  gc->gc_album_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-  sqlite3_finalize(sel);
-  return 0;
-}
+static const db_wb_class_t metadb_wb_class = {
+  .dwc_name    = "metadb",
+  .dwc_write   = metadb_wb_write,
+  .dwc_destroy = metadb_wb_destroy,
+};
 
 
 /**
- *
+ * Like metadb_metadata_write() but the write is queued and committed
+ * together with other writes. A later write of the same url replaces
+ * a pending one
  */
-static int
-metadb_metadata_get_audio(sqlite3 *db, metadata_t *md, int64_t item_id,
-			  get_cache_t *gc)
+void
+metadb_metadata_write_deferred(const char *url, time_t mtime,
+                               const metadata_t *md, const char *parent,
+                               time_t parent_mtime,
+                               metadata_index_status_t indexstatus)
 {
-  int rc;
-  sqlite3_stmt *sel;
-
-  rc = db_prepare(db, &sel,
-		  "SELECT title, album_id, artist_id, duration, track "
-		  "FROM audioitem "
-		  "WHERE item_id = ?1 AND ds_id = 1"
-		  );
-
-  if(rc != SQLITE_OK)
-    return METADATA_PERMANENT_ERROR;
-
-  sqlite3_bind_int64(sel, 1, item_id);
-
-  rc = db_step(sel);
-
-  if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
-    return METADATA_PERMANENT_ERROR;
-  }
-
-  md->md_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-
-  if(!metadb_metadata_get_album(db, gc, sqlite3_column_int64(sel, 1)))
-    md->md_album = rstr_dup(gc->gc_album_title);
-
-  if(!metadb_metadata_get_artist(db, gc, sqlite3_column_int64(sel, 2)))
-    md->md_artist = rstr_dup(gc->gc_artist_title);
-
-  md->md_duration = sqlite3_column_int(sel, 3) / 1000.0f;
-  md->md_track = sqlite3_column_int(sel, 4);
+  if(metadb_wb == NULL)
+    return;
 
-  sqlite3_finalize(sel);
-  return 0;
+  metadb_wb_entry_t *mwe = malloc(sizeof(metadb_wb_entry_t));
+  mwe->mwe_url          = strdup(url);
+  mwe->mwe_mtime        = mtime;
+  mwe->mwe_md           = metadata_clone(md);
+  mwe->mwe_parent       = parent ? strdup(parent) : NULL;
+  mwe->mwe_parent_mtime = parent_mtime;
+  mwe->mwe_indexstatus  = indexstatus;
+  db_wb_enqueue(metadb_wb, &mwe->mwe_entry, strdup(url));
 }
 
 
 /**
  *
  */
-static int64_t
-metadb_metadata_get_video(sqlite3 *db, metadata_t *md, int64_t item_id,
-			  int ds_id)
+void
+metadb_metadata_flush(void)
 {
-  int rc;
-  sqlite3_stmt *sel;
-
-  rc = db_prepare(db, &sel,
-		  "SELECT id, title, duration, format, year "
-		  "FROM videoitem "
-		  "WHERE item_id = ?1 "
-		  "AND ds_id = ?2"
-		  );
-
-  if(rc != SQLITE_OK)
-    return METADATA_PERMANENT_ERROR;
-
-  sqlite3_bind_int64(sel, 1, item_id);
-  sqlite3_bind_int(sel, 2, ds_id);
-
-  rc = db_step(sel);
-
-  if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
-    return METADATA_PERMANENT_ERROR;
-  }
-
-  int64_t id = sqlite3_column_int64(sel, 0);
-
-  md->md_title = rstr_alloc((void *)sqlite3_column_text(sel, 1));
-  md->md_duration = sqlite3_column_int(sel, 2) / 1000.0f;
-  md->md_format = rstr_alloc((void *)sqlite3_column_text(sel, 3));
-  md->md_year = sqlite3_column_int(sel, 4);
-
-  sqlite3_finalize(sel);
-  return id;
+  db_wb_flush(metadb_wb);
 }
 
 
-
 /**
  *
  */
@@ -2037,58 +1950,359 @@ metadb_get_videoinfo(void *db, const char *url,
 }
 
 
+/**
+ * Batched metadata lookup
+ *
+ * Items are fetched METADB_BATCH_CHUNK at a time with one statement
+ * per table using "IN (...)" lists. Unused slots in the list are bound
+ * to NULL which never matches, so SQL text is fixed and statements can
+ * be kept in the per-connection statement cache.
+ */
+#define METADB_BATCH_CHUNK 64
+
+typedef enum {
+  MB_SQL_ITEM,
+  MB_SQL_AUDIO,
+  MB_SQL_VIDEO,
+  MB_SQL_STREAM,
+  MB_SQL_IMAGE,
+  MB_SQL_num,
+} mb_sql_t;
+
+static const char *mb_sql_templates[MB_SQL_num] = {
+  [MB_SQL_ITEM] =
+  "SELECT id, url, contenttype, parent, mtime "
+  "FROM item "
+  "WHERE url IN (%s)",
+
+  [MB_SQL_AUDIO] =
+  "SELECT a.item_id, a.title, al.title, ar.title, a.duration, a.track "
+  "FROM audioitem AS a "
+  "LEFT JOIN album AS al ON al.id = a.album_id AND al.ds_id = 1 "
+  "LEFT JOIN artist AS ar ON ar.id = a.artist_id AND ar.ds_id = 1 "
+  "WHERE a.item_id IN (%s) AND a.ds_id = 1",
+
+  [MB_SQL_VIDEO] =
+  "SELECT item_id, id, title, duration, format, year "
+  "FROM videoitem "
+  "WHERE item_id IN (%s) AND ds_id = 1",
+
+  [MB_SQL_STREAM] =
+  "SELECT videoitem_id, streamindex, info, isolang, codec, "
+  "mediatype, disposition, title "
+  "FROM videostream "
+  "WHERE videoitem_id IN (%s) "
+  "ORDER BY videoitem_id, streamindex",
+
+  [MB_SQL_IMAGE] =
+  "SELECT item_id, original_time, manufacturer, equipment "
+  "FROM imageitem "
+  "WHERE item_id IN (%s)",
+};
+
+static char *mb_sql[MB_SQL_num];
+
+
+/**
+ *
+ */
+static void
+metadb_batch_init(void)
+{
+  char params[METADB_BATCH_CHUNK * 5];
+  int i, off = 0;
+
+  for(i = 0; i < METADB_BATCH_CHUNK; i++)
+    off += snprintf(params + off, sizeof(params) - off, "%s?%d",
+                    i ? "," : "", i + 1);
+
+  for(i = 0; i < MB_SQL_num; i++)
+    mb_sql[i] = fmtstr(mb_sql_templates[i], params);
+}
+
+
 /**
  *
  */
+static metadb_batch_t *
+metadb_batch_create(int count)
+{
+  metadb_batch_t *mb = calloc(1, sizeof(metadb_batch_t));
+  mb->mdb_count = count;
+  mb->mdb_found          = calloc(count, sizeof(char));
+  mb->mdb_parented       = calloc(count, sizeof(char));
+  mb->mdb_item_id        = calloc(count, sizeof(int64_t));
+  mb->mdb_videoitem_id   = calloc(count, sizeof(int64_t));
+  mb->mdb_contenttype    = calloc(count, sizeof(int));
+  mb->mdb_index_status   = calloc(count, sizeof(int));
+  mb->mdb_duration       = calloc(count, sizeof(int));
+  mb->mdb_track          = calloc(count, sizeof(int));
+  mb->mdb_year           = calloc(count, sizeof(int));
+  mb->mdb_time           = calloc(count, sizeof(int));
+  mb->mdb_title          = calloc(count, sizeof(rstr_t *));
+  mb->mdb_album          = calloc(count, sizeof(rstr_t *));
+  mb->mdb_artist         = calloc(count, sizeof(rstr_t *));
+  mb->mdb_format         = calloc(count, sizeof(rstr_t *));
+  mb->mdb_manufacturer   = calloc(count, sizeof(rstr_t *));
+  mb->mdb_equipment      = calloc(count, sizeof(rstr_t *));
+  mb->mdb_stream_first   = calloc(count, sizeof(int));
+  return mb;
+}
+
+
+/**
+ *
+ */
+void
+metadb_batch_free(metadb_batch_t *mb)
+{
+  int i;
+  if(mb == NULL)
+    return;
+
+  for(i = 0; i < mb->mdb_count; i++) {
+    rstr_release(mb->mdb_title[i]);
+    rstr_release(mb->mdb_album[i]);
+    rstr_release(mb->mdb_artist[i]);
+    rstr_release(mb->mdb_format[i]);
+    rstr_release(mb->mdb_manufacturer[i]);
+    rstr_release(mb->mdb_equipment[i]);
+  }
+
+  for(i = 0; i < mb->mdb_num_streams; i++) {
+    metadb_batch_stream_t *mbs = &mb->mdb_streams[i];
+    rstr_release(mbs->mdbs_codec);
+    rstr_release(mbs->mdbs_title);
+    rstr_release(mbs->mdbs_info);
+    rstr_release(mbs->mdbs_isolang);
+  }
+
+  free(mb->mdb_found);
+  free(mb->mdb_parented);
+  free(mb->mdb_item_id);
+  free(mb->mdb_videoitem_id);
+  free(mb->mdb_contenttype);
+  free(mb->mdb_index_status);
+  free(mb->mdb_duration);
+  free(mb->mdb_track);
+  free(mb->mdb_year);
+  free(mb->mdb_time);
+  free(mb->mdb_title);
+  free(mb->mdb_album);
+  free(mb->mdb_artist);
+  free(mb->mdb_format);
+  free(mb->mdb_manufacturer);
+  free(mb->mdb_equipment);
+  free(mb->mdb_streams);
+  free(mb->mdb_stream_first);
+  free(mb);
+}
+
+
+/**
+ * Bind ids of rows in chunk with given contenttype. Returns number
+ * of rows bound
+ */
 static int
-metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t videoitem_id)
+metadb_batch_bind(sqlite3_stmt *stmt, const int64_t *ids,
+                  const metadb_batch_t *mb, int first, int num,
+                  int contenttype)
 {
-  int rc;
+  int i, n = 0;
+  for(i = first; i < first + num; i++) {
+    if(!mb->mdb_found[i] || mb->mdb_contenttype[i] != contenttype)
+      continue;
+    sqlite3_bind_int64(stmt, ++n, ids[i]);
+  }
+  return n;
+}
+
+
+/**
+ *
+ */
+static void
+metadb_batch_add_stream(metadb_batch_t *mb, int row, sqlite3_stmt *sel)
+{
+  int type;
+  const char *str = (const char *)sqlite3_column_text(sel, 5);
+
+  if(str == NULL)
+    return;
+
+  if(!strcmp(str, "audio"))
+    type = MEDIA_TYPE_AUDIO;
+  else if(!strcmp(str, "video"))
+    type = MEDIA_TYPE_VIDEO;
+  else if(!strcmp(str, "subtitle"))
+    type = MEDIA_TYPE_SUBTITLE;
+  else
+    return;
+
+  if(mb->mdb_num_streams == mb->mdb_streams_alloc) {
+    mb->mdb_streams_alloc = MAX(16, mb->mdb_streams_alloc * 2);
+    mb->mdb_streams = realloc(mb->mdb_streams, mb->mdb_streams_alloc *
+                             sizeof(metadb_batch_stream_t));
+  }
+
+  metadb_batch_stream_t *mbs = &mb->mdb_streams[mb->mdb_num_streams++];
+  mbs->mdbs_row         = row;
+  mbs->mdbs_type        = type;
+  mbs->mdbs_index       = sqlite3_column_int(sel, 1);
+  mbs->mdbs_info        = db_rstr_intern(sel, 2);
+  mbs->mdbs_isolang     = db_rstr_intern(sel, 3);
+  mbs->mdbs_codec       = db_rstr_intern(sel, 4);
+  mbs->mdbs_disposition = sqlite3_column_int(sel, 6);
+  mbs->mdbs_title       = db_rstr(sel, 7);
+}
+
+
+/**
+ * Find row in chunk for a given item (or videoitem) id
+ */
+static int
+metadb_batch_find(const int64_t *ids, int first, int num, int64_t id,
+                  int from)
+{
+  int i;
+  for(i = MAX(from, first); i < first + num; i++)
+    if(ids[i] == id)
+      return i;
+  return -1;
+}
+
+
+/**
+ * Load per content type data for rows [first, first + num) which
+ * must have item id and content type set
+ */
+static int
+metadb_batch_load(sqlite3 *db, metadb_batch_t *mb, int first, int num)
+{
+  char hit[METADB_BATCH_CHUNK] = {0};
   sqlite3_stmt *sel;
-  int atrack = 0;
-  int strack = 0;
-  int vtrack = 0;
+  int i, row, rc;
 
-  rc = db_prepare(db, &sel,
-		  "SELECT streamindex, info, isolang, codec, "
-		  "mediatype, disposition, title "
-		  "FROM videostream "
-		  "WHERE videoitem_id = ?1 "
-		  "ORDER BY streamindex"
-		  );
+  assert(num <= METADB_BATCH_CHUNK);
 
-  if(rc != SQLITE_OK)
-    return METADATA_PERMANENT_ERROR;
+  // Audio
 
-  sqlite3_bind_int64(sel, 1, videoitem_id);
+  for(i = first; i < first + num; i++)
+    if(mb->mdb_found[i] && mb->mdb_contenttype[i] == CONTENT_AUDIO)
+      break;
 
-  while((rc = db_step(sel)) == SQLITE_ROW) {
-    int type;
-    int tn;
-    const char *str = (const char *)sqlite3_column_text(sel, 4);
-    if(!strcmp(str, "audio")) {
-      type = MEDIA_TYPE_AUDIO;
-      tn = ++atrack;
-    } else if(!strcmp(str, "video")) {
-      type = MEDIA_TYPE_VIDEO;
-      tn = ++vtrack;
-    } else if(!strcmp(str, "subtitle")) {
-      type = MEDIA_TYPE_SUBTITLE;
-      tn = ++strack;
-    } else {
+  if(i != first + num) {
+    if(db_prepare_cached(db, &sel, mb_sql[MB_SQL_AUDIO]) != SQLITE_OK)
+      return -1;
+
+    metadb_batch_bind(sel, mb->mdb_item_id, mb, first, num, CONTENT_AUDIO);
+
+    while((rc = db_step(sel)) == SQLITE_ROW) {
+      int64_t id = sqlite3_column_int64(sel, 0);
+      row = first - 1;
+      while((row = metadb_batch_find(mb->mdb_item_id, first, num, id,
+                                     row + 1)) != -1) {
+        hit[row - first] = 1;
+        mb->mdb_title[row]    = db_rstr(sel, 1);
+        mb->mdb_album[row]    = db_rstr_intern(sel, 2);
+        mb->mdb_artist[row]   = db_rstr_intern(sel, 3);
+        mb->mdb_duration[row] = sqlite3_column_int(sel, 4);
+        mb->mdb_track[row]    = sqlite3_column_int(sel, 5);
+      }
+    }
+    db_release_cached(sel);
+  }
+
+  // Video (and streams)
+
+  for(i = first; i < first + num; i++)
+    if(mb->mdb_found[i] && mb->mdb_contenttype[i] == CONTENT_VIDEO)
+      break;
+
+  if(i != first + num) {
+    if(db_prepare_cached(db, &sel, mb_sql[MB_SQL_VIDEO]) != SQLITE_OK)
+      return -1;
+
+    metadb_batch_bind(sel, mb->mdb_item_id, mb, first, num, CONTENT_VIDEO);
+
+    while((rc = db_step(sel)) == SQLITE_ROW) {
+      int64_t id = sqlite3_column_int64(sel, 0);
+      row = first - 1;
+      while((row = metadb_batch_find(mb->mdb_item_id, first, num, id,
+                                     row + 1)) != -1) {
+        hit[row - first] = 1;
+        mb->mdb_videoitem_id[row] = sqlite3_column_int64(sel, 1);
+        mb->mdb_title[row]        = db_rstr(sel, 2);
+        mb->mdb_duration[row]     = sqlite3_column_int(sel, 3);
+        mb->mdb_format[row]       = db_rstr_intern(sel, 4);
+        mb->mdb_year[row]         = sqlite3_column_int(sel, 5);
+      }
+    }
+    db_release_cached(sel);
+
+    if(db_prepare_cached(db, &sel, mb_sql[MB_SQL_STREAM]) != SQLITE_OK)
+      return -1;
+
+    metadb_batch_bind(sel, mb->mdb_videoitem_id, mb, first, num,
+                      CONTENT_VIDEO);
+
+    while((rc = db_step(sel)) == SQLITE_ROW) {
+      int64_t id = sqlite3_column_int64(sel, 0);
+      row = first - 1;
+      while((row = metadb_batch_find(mb->mdb_videoitem_id, first, num, id,
+                                     row + 1)) != -1)
+        metadb_batch_add_stream(mb, row, sel);
+    }
+    db_release_cached(sel);
+  }
+
+  // Images
+
+  for(i = first; i < first + num; i++)
+    if(mb->mdb_found[i] && mb->mdb_contenttype[i] == CONTENT_IMAGE)
+      break;
+
+  if(i != first + num) {
+    if(db_prepare_cached(db, &sel, mb_sql[MB_SQL_IMAGE]) != SQLITE_OK)
+      return -1;
+
+    metadb_batch_bind(sel, mb->mdb_item_id, mb, first, num, CONTENT_IMAGE);
+
+    while((rc = db_step(sel)) == SQLITE_ROW) {
+      int64_t id = sqlite3_column_int64(sel, 0);
+      row = first - 1;
+      while((row = metadb_batch_find(mb->mdb_item_id, first, num, id,
+                                     row + 1)) != -1) {
+        hit[row - first] = 1;
+        mb->mdb_time[row]         = sqlite3_column_int(sel, 1);
+        mb->mdb_manufacturer[row] = db_rstr(sel, 2);
+        mb->mdb_equipment[row]    = db_rstr(sel, 3);
+      }
+    }
+    db_release_cached(sel);
+  }
+
+  for(i = first; i < first + num; i++) {
+    if(!mb->mdb_found[i])
       continue;
+
+    switch(mb->mdb_contenttype[i]) {
+    case CONTENT_AUDIO:
+    case CONTENT_VIDEO:
+    case CONTENT_IMAGE:
+      mb->mdb_found[i] = hit[i - first];
+      break;
+
+    case CONTENT_DIR:
+    case CONTENT_SHARE:
+    case CONTENT_DVD:
+      break;
+
+    default:
+      mb->mdb_found[i] = 0;
+      break;
     }
-    metadata_add_stream(md, 
-			(const char *)sqlite3_column_text(sel, 3),
-			type,
-			sqlite3_column_int(sel, 0),
-			(const char *)sqlite3_column_text(sel, 6),
-			(const char *)sqlite3_column_text(sel, 1),
-			(const char *)sqlite3_column_text(sel, 2),
-			sqlite3_column_int(sel, 5),
-			tn, -1);
   }
-  sqlite3_finalize(sel);
   return 0;
 }
 
@@ -2097,81 +2311,165 @@ metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t videoitem_id)
  *
  */
 static int
-metadb_metadata_get_image(sqlite3 *db, metadata_t *md, int64_t item_id)
+metadb_batch_stream_cmp(const void *A, const void *B)
+{
+  const metadb_batch_stream_t *a = A;
+  const metadb_batch_stream_t *b = B;
+
+  if(a->mdbs_row != b->mdbs_row)
+    return a->mdbs_row - b->mdbs_row;
+  return a->mdbs_index - b->mdbs_index;
+}
+
+
+/**
+ * Streams are loaded in videoitem order, sort them per row and index
+ * the first stream of each row
+ */
+static void
+metadb_batch_index_streams(metadb_batch_t *mb)
+{
+  int i;
+
+  if(mb->mdb_num_streams == 0)
+    return;
+
+  qsort(mb->mdb_streams, mb->mdb_num_streams, sizeof(metadb_batch_stream_t),
+        metadb_batch_stream_cmp);
+
+  for(i = mb->mdb_num_streams - 1; i >= 0; i--)
+    mb->mdb_stream_first[mb->mdb_streams[i].mdbs_row] = i + 1;
+}
+
+
+/**
+ * Fetch metadata for a set of urls. If mtimes is non-NULL the item
+ * must have been stored with the same mtime for it to be found
+ */
+metadb_batch_t *
+metadb_batch_get(void *db, const char **urls, const time_t *mtimes, int count)
 {
-  int rc;
   sqlite3_stmt *sel;
+  int first, i, rc;
 
-  rc = db_prepare(db, &sel,
-		  "SELECT original_time, manufacturer, equipment "
-		  "FROM imageitem "
-		  "WHERE item_id = ?1"
-		  );
+  if(db_begin(db))
+    return NULL;
 
-  if(rc != SQLITE_OK)
-    return METADATA_PERMANENT_ERROR;
+  metadb_batch_t *mb = metadb_batch_create(count);
 
-  sqlite3_bind_int64(sel, 1, item_id);
+  for(first = 0; first < count; first += METADB_BATCH_CHUNK) {
+    const int num = MIN(METADB_BATCH_CHUNK, count - first);
 
-  rc = db_step(sel);
+    if(db_prepare_cached(db, &sel, mb_sql[MB_SQL_ITEM]) != SQLITE_OK)
+      goto bad;
 
-  if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
-    return METADATA_PERMANENT_ERROR;
+    for(i = 0; i < num; i++)
+      sqlite3_bind_text(sel, i + 1, urls[first + i], -1, SQLITE_STATIC);
+
+    while((rc = db_step(sel)) == SQLITE_ROW) {
+      const char *url = (const char *)sqlite3_column_text(sel, 1);
+
+      for(i = first; i < first + num; i++) {
+        if(mb->mdb_found[i] || strcmp(urls[i], url))
+          continue;
+
+        if(mtimes != NULL &&
+           (sqlite3_column_type(sel, 4) != SQLITE_INTEGER ||
+            sqlite3_column_int(sel, 4) != mtimes[i]))
+          continue;
+
+        mb->mdb_found[i] = 1;
+        mb->mdb_item_id[i] = sqlite3_column_int64(sel, 0);
+        mb->mdb_contenttype[i] = sqlite3_column_int(sel, 2);
+        mb->mdb_parented[i] = sqlite3_column_int(sel, 3) != 0;
+      }
+    }
+    db_release_cached(sel);
+
+    if(metadb_batch_load(db, mb, first, num))
+      goto bad;
   }
 
-  md->md_time = sqlite3_column_int(sel, 0);
-  md->md_manufacturer = rstr_alloc((void *)sqlite3_column_text(sel, 1));
-  md->md_equipment = rstr_alloc((void *)sqlite3_column_text(sel, 2));
-  sqlite3_finalize(sel);
-  return 0;
+  db_rollback(db);
+  metadb_batch_index_streams(mb);
+  return mb;
+
+ bad:
+  db_rollback(db);
+  metadb_batch_free(mb);
+  return NULL;
 }
 
 
 /**
- *
+ * Construct a metadata_t from row in batch, NULL if not found
  */
-static metadata_t *
-metadata_get(void *db, int item_id, int contenttype, get_cache_t *gc)
+metadata_t *
+metadb_batch_metadata(const metadb_batch_t *mb, int row)
 {
-  int64_t vi_id;
+  int i;
+  int atrack = 0;
+  int strack = 0;
+  int vtrack = 0;
+
+  if(!mb->mdb_found[row])
+    return NULL;
+
   metadata_t *md = metadata_create();
-  md->md_contenttype = contenttype;
-  
-  int r;
+  md->md_contenttype = mb->mdb_contenttype[row];
+
+  md->md_cache_status = mb->mdb_parented[row] ?
+    METADATA_CACHE_STATUS_FULL : METADATA_CACHE_STATUS_UNPARENTED;
+
   switch(md->md_contenttype) {
   case CONTENT_AUDIO:
-    r = metadb_metadata_get_audio(db, md, item_id, gc);
+    md->md_title    = rstr_dup(mb->mdb_title[row]);
+    md->md_album    = rstr_dup(mb->mdb_album[row]);
+    md->md_artist   = rstr_dup(mb->mdb_artist[row]);
+    md->md_duration = mb->mdb_duration[row] / 1000.0f;
+    md->md_track    = mb->mdb_track[row];
     break;
 
   case CONTENT_VIDEO:
-    vi_id = metadb_metadata_get_video(db, md, item_id, 1);
-    if(vi_id == -1) {
-      r = 1;
-      break;
+    md->md_title    = rstr_dup(mb->mdb_title[row]);
+    md->md_duration = mb->mdb_duration[row] / 1000.0f;
+    md->md_format   = rstr_dup(mb->mdb_format[row]);
+    md->md_year     = mb->mdb_year[row];
+
+    for(i = mb->mdb_stream_first[row] - 1;
+        i >= 0 && i < mb->mdb_num_streams; i++) {
+      const metadb_batch_stream_t *mbs = &mb->mdb_streams[i];
+      int tn;
+      if(mbs->mdbs_row != row)
+        break;
+
+      switch(mbs->mdbs_type) {
+      case MEDIA_TYPE_AUDIO:    tn = ++atrack; break;
+      case MEDIA_TYPE_VIDEO:    tn = ++vtrack; break;
+      default:                  tn = ++strack; break;
+      }
+
+      metadata_add_stream(md,
+                          rstr_get(mbs->mdbs_codec),
+                          mbs->mdbs_type,
+                          mbs->mdbs_index,
+                          rstr_get(mbs->mdbs_title),
+                          rstr_get(mbs->mdbs_info),
+                          rstr_get(mbs->mdbs_isolang),
+                          mbs->mdbs_disposition,
+                          tn, -1);
     }
-    r = metadb_metadata_get_streams(db, md, vi_id);
     break;
 
   case CONTENT_IMAGE:
-    r = metadb_metadata_get_image(db, md, item_id);
-    break;
-
-  case CONTENT_DIR:
-  case CONTENT_SHARE:
-  case CONTENT_DVD:
-    r = 0;
+    md->md_time         = mb->mdb_time[row];
+    md->md_manufacturer = rstr_dup(mb->mdb_manufacturer[row]);
+    md->md_equipment    = rstr_dup(mb->mdb_equipment[row]);
     break;
 
   default:
-    r = 1;
     break;
   }
-
-  if(r) {
-    metadata_destroy(md);
-    return NULL;
-  }
   return md;
 }
 
@@ -2182,49 +2480,12 @@ metadata_get(void *db, int item_id, int contenttype, get_cache_t *gc)
 metadata_t *
 metadb_metadata_get(void *db, const char *url, time_t mtime)
 {
-  int rc;
-  sqlite3_stmt *sel;
-
-  if(db_begin(db))
+  metadb_batch_t *mb = metadb_batch_get(db, &url, &mtime, 1);
+  if(mb == NULL)
     return NULL;
 
-  rc = db_prepare(db, &sel,
-		  "SELECT id,contenttype,parent from item "
-		  "where url=?1 AND "
-		  "mtime=?2");
-
-  if(rc != SQLITE_OK) {
-    db_rollback(db);
-    return NULL;
-  }
-
-  sqlite3_bind_text(sel, 1, url, -1, SQLITE_STATIC);
-  sqlite3_bind_int(sel, 2, mtime);
-
-  rc = db_step(sel);
-
-  if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
-    db_rollback(db);
-    return NULL;
-  }
-
-  get_cache_t gc = {0};
-
-  metadata_t *md = metadata_get(db, 
-				sqlite3_column_int64(sel, 0),
-				sqlite3_column_int(sel, 1),
-				&gc);
-  get_cache_release(&gc);
-
-  if(md != NULL)
-    md->md_cache_status = 
-      sqlite3_column_int(sel, 2) ? 
-      METADATA_CACHE_STATUS_FULL :
-      METADATA_CACHE_STATUS_UNPARENTED;
-
-  sqlite3_finalize(sel);
-  db_rollback(db);
+  metadata_t *md = metadb_batch_metadata(mb, 0);
+  metadb_batch_free(mb);
   return md;
 }
 
@@ -2268,13 +2529,17 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
 
   fa_dir_t *fd = fa_dir_alloc();
 
-  get_cache_t gc = {0};
+  // Items are collected first and then their metadata is fetched in bulk
+  int num = 0, capacity = 0, i;
+  fa_dir_entry_t **fdes = NULL;
+  int64_t *ids = NULL;
+  int *types = NULL;
+  int *indexstatus = NULL;
 
   while((rc = db_step(sel)) == SQLITE_ROW) {
     if(sqlite3_column_type(sel, 2) != SQLITE_INTEGER)
       continue;
 
-    int64_t item_id = sqlite3_column_int64(sel, 0);
     const char *url = (const char *)sqlite3_column_text(sel, 1);
     int contenttype = sqlite3_column_int(sel, 2);
     char fname[256];
@@ -2289,17 +2554,49 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
 	fde->fde_stat.fs_mtime = sqlite3_column_int(sel, 3);
       }
 
-      fde->fde_md = metadata_get(db, item_id, contenttype, &gc);
-      if(fde->fde_md != NULL) {
-	fde->fde_md->md_cache_status = METADATA_CACHE_STATUS_FULL;
-        fde->fde_md->md_index_status = sqlite3_column_int(sel, 4);
+      if(num == capacity) {
+        capacity = MAX(64, capacity * 2);
+        fdes        = realloc(fdes, capacity * sizeof(fa_dir_entry_t *));
+        ids         = realloc(ids, capacity * sizeof(int64_t));
+        types       = realloc(types, capacity * sizeof(int));
+        indexstatus = realloc(indexstatus, capacity * sizeof(int));
       }
+      fdes[num]        = fde;
+      ids[num]         = sqlite3_column_int64(sel, 0);
+      types[num]       = contenttype;
+      indexstatus[num] = sqlite3_column_int(sel, 4);
+      num++;
     }
   }
 
   sqlite3_finalize(sel);
 
-  get_cache_release(&gc);
+  metadb_batch_t *mb = metadb_batch_create(num);
+  for(i = 0; i < num; i++) {
+    mb->mdb_found[i] = 1;
+    mb->mdb_parented[i] = 1;
+    mb->mdb_item_id[i] = ids[i];
+    mb->mdb_contenttype[i] = types[i];
+  }
+
+  for(i = 0; i < num; i += METADB_BATCH_CHUNK)
+    if(metadb_batch_load(db, mb, i, MIN(METADB_BATCH_CHUNK, num - i)))
+      break;
+
+  if(i >= num) {
+    for(i = 0; i < num; i++) {
+      fa_dir_entry_t *fde = fdes[i];
+      fde->fde_md = metadb_batch_metadata(mb, i);
+      if(fde->fde_md != NULL)
+        fde->fde_md->md_index_status = indexstatus[i];
+    }
+  }
+
+  metadb_batch_free(mb);
+  free(fdes);
+  free(ids);
+  free(types);
+  free(indexstatus);
 
   db_rollback(db);
 
@@ -2318,34 +2615,51 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
 /**
  *
  */
-void
-metadb_unparent_item(void *db, const char *url)
+int
+metadb_unparent_itemx(void *db, const char *url)
 {
+  sqlite3_stmt *stmt;
   int rc;
- again:
-  if(db_begin(db))
-    return;
 
-  sqlite3_stmt *stmt;
-    
+  // Item is gone, don't let a pending write resurrect it
+  db_wb_cancel(metadb_wb, url);
+
   rc = db_prepare(db, &stmt,
 		  "UPDATE item SET parent = NULL WHERE url=?1"
 		  );
-  
-  if(rc != SQLITE_OK) {
-    db_rollback(db);
-    return;
-  }
+
+  if(rc != SQLITE_OK)
+    return METADATA_PERMANENT_ERROR;
 
   sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
   rc = db_step(stmt);
-  if(rc == SQLITE_LOCKED) {
+  sqlite3_finalize(stmt);
+  return rc2metadatacode(rc);
+}
+
+
+/**
+ *
+ */
+void
+metadb_unparent_item(void *db, const char *url)
+{
+  int rc;
+
+ again:
+  if(db_begin(db))
+    return;
+
+  rc = metadb_unparent_itemx(db, url);
+  if(rc == METADATA_DEADLOCK) {
     db_rollback_deadlock(db);
     goto again;
   }
 
-  sqlite3_finalize(stmt);
-  db_commit(db);
+  if(rc)
+    db_rollback(db);
+  else
+    db_commit(db);
 }
 
 
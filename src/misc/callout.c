@@ -18,28 +18,125 @@
  *  For more information, contact andreas@lonelycoder.com
  */
 #include <stdio.h>
+#include <assert.h>
 #include <time.h>
 #include "main.h"
 #include "prop/prop.h"
 #include "callout.h"
+#include "minmax.h"
 #include "arch/arch.h"
+#include "task.h"
 
-static LIST_HEAD(, callout) callouts;
+/**
+ * Armed callouts live in a hierarchical timing wheel with 1ms ticks.
+ * Level 0 has one slot per tick, each higher level covers 64 times the
+ * span of the one below. Arm and disarm are O(1), callouts on higher
+ * levels are cascaded down as time passes.
+ */
+#define CALLOUT_WHEEL_BITS   6
+#define CALLOUT_WHEEL_SIZE   (1 << CALLOUT_WHEEL_BITS)
+#define CALLOUT_WHEEL_MASK   (CALLOUT_WHEEL_SIZE - 1)
+#define CALLOUT_WHEEL_LEVELS 5  // 2^30 ms, about 12 days
+
+#define CALLOUT_WHEEL_SPAN (1ULL << (CALLOUT_WHEEL_BITS * CALLOUT_WHEEL_LEVELS))
+
+LIST_HEAD(callout_list, callout);
+
+static struct callout_list callout_wheel[CALLOUT_WHEEL_LEVELS][CALLOUT_WHEEL_SIZE];
+
+static uint64_t callout_tick; // First tick not yet processed
 
 static hts_mutex_t callout_mutex;
 static hts_cond_t callout_cond;
 
+
+/**
+ *
+ */
+static void
+callout_set_expire(callout_t *d)
+{
+  uint64_t e = (d->c_deadline + 999) / 1000;
+
+  if(d->c_flags & CALLOUT_SLACK) {
+    // Round up to the largest power of two ms within 1/8 of the delta
+    const int64_t slack = d->c_delta / 8000;
+    if(slack > 1) {
+      uint64_t g = 1;
+      while(g * 2 <= slack)
+        g *= 2;
+      e = (e + g - 1) & ~(g - 1);
+    }
+  }
+  d->c_expire = e;
+}
+
+
+/**
+ *
+ */
+static void
+callout_insert(callout_t *d)
+{
+  struct callout_list *l;
+
+  if(d->c_expire < callout_tick) {
+    // Already due, goes into the slot being processed
+    l = &callout_wheel[0][callout_tick & CALLOUT_WHEEL_MASK];
+  } else {
+    // Callouts beyond the span of the wheel are parked in the top
+    // level and cascaded (and parked again) until they are in range
+    const uint64_t e = MIN(d->c_expire, callout_tick + CALLOUT_WHEEL_SPAN - 1);
+    const uint64_t idx = e - callout_tick;
+    int level = 0;
+    while(idx >> (CALLOUT_WHEEL_BITS * (level + 1)))
+      level++;
+
+    int slot = (e >> (CALLOUT_WHEEL_BITS * level)) & CALLOUT_WHEEL_MASK;
+    l = &callout_wheel[level][slot];
+  }
+  LIST_INSERT_HEAD(l, d, c_link);
+}
+
+
+/**
+ * Return the first tick at or after 'from' that has callouts to
+ * expire or cascade
+ */
+static uint64_t
+callout_next_tick(uint64_t from)
+{
+  uint64_t best = UINT64_MAX;
+
+  for(int level = 0; level < CALLOUT_WHEEL_LEVELS; level++) {
+    const int shift = CALLOUT_WHEEL_BITS * level;
+    uint64_t t = ((from + (1ULL << shift) - 1) >> shift) << shift;
+
+    for(int i = 0; i < CALLOUT_WHEEL_SIZE && t < best; i++) {
+      if(LIST_FIRST(&callout_wheel[level][(t >> shift) & CALLOUT_WHEEL_MASK])){
+        best = t;
+        break;
+      }
+      t += 1ULL << shift;
+    }
+  }
+  return best;
+}
+
+
 /**
- *htsmsg_t *props
+ *
  */
-static int
-calloutcmp(callout_t *a, callout_t *b)
+static void
+callout_cascade(int level, int slot)
 {
-  if(a->c_deadline < b->c_deadline)
-    return -1;
-  else if(a->c_deadline > b->c_deadline)
-    return 1;
- return 0;
+  struct callout_list *l = &callout_wheel[level][slot];
+  callout_t *c;
+
+  while((c = LIST_FIRST(l)) != NULL) {
+    LIST_REMOVE(c, c_link);
+    callout_insert(c);
+  }
 }
 
 
@@ -48,10 +145,13 @@ calloutcmp(callout_t *a, callout_t *b)
  */
 static void
 callout_arm0(callout_t *d, callout_callback_t *callback, void *opaque,
-             int64_t delta, lockmgr_fn_t *lockmgr,
+             int64_t delta, lockmgr_fn_t *lockmgr, int flags,
              const char *file, int line)
 {
   lockmgr_fn_t *retain = NULL;
+
+  assert(lockmgr != NULL || !(flags & CALLOUT_WORKER));
+
   hts_mutex_lock(&callout_mutex);
 
   if(d == NULL) {
@@ -72,7 +172,10 @@ callout_arm0(callout_t *d, callout_callback_t *callback, void *opaque,
   d->c_armed_by_file = file;
   d->c_armed_by_line = line;
   d->c_lockmgr = lockmgr;
-  LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp, callout_t);
+  d->c_flags = flags;
+  d->c_generation++;
+  callout_set_expire(d);
+  callout_insert(d);
   hts_cond_signal(&callout_cond);
   hts_mutex_unlock(&callout_mutex);
   if(retain)
@@ -88,7 +191,7 @@ callout_arm_x(callout_t *d, callout_callback_t *callback,
               void *opaque, int delta,
               const char *file, int line)
 {
-  callout_arm0(d, callback, opaque, delta * 1000000LL, NULL, file, line);
+  callout_arm0(d, callback, opaque, delta * 1000000LL, NULL, 0, file, line);
 }
 
 /**
@@ -99,7 +202,7 @@ callout_arm_hires_x(callout_t *d, callout_callback_t *callback,
                     void *opaque, int64_t delta,
                     const char *file, int line)
 {
-  callout_arm0(d, callback, opaque, delta, NULL, file, line);
+  callout_arm0(d, callback, opaque, delta, NULL, 0, file, line);
 }
 
 
@@ -111,7 +214,19 @@ callout_arm_managed_x(callout_t *d, callout_callback_t *callback,
                       void *opaque, int64_t delta, lockmgr_fn_t *lockmgr,
                       const char *file, int line)
 {
-  callout_arm0(d, callback, opaque, delta, lockmgr, file, line);
+  callout_arm0(d, callback, opaque, delta, lockmgr, 0, file, line);
+}
+
+
+/**
+ *
+ */
+void
+callout_arm_flags_x(callout_t *d, callout_callback_t *callback,
+                    void *opaque, int64_t delta, lockmgr_fn_t *lockmgr,
+                    int flags, const char *file, int line)
+{
+  callout_arm0(d, callback, opaque, delta, lockmgr, flags, file, line);
 }
 
 
@@ -127,7 +242,9 @@ callout_rearm(callout_t *d, int64_t delta)
     d->c_deadline += delta - d->c_delta;
     d->c_delta = delta;
     LIST_REMOVE(d, c_link);
-    LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp, callout_t);
+    callout_set_expire(d);
+    callout_insert(d);
+    hts_cond_signal(&callout_cond);
   }
 
   hts_mutex_unlock(&callout_mutex);
@@ -149,59 +266,151 @@ callout_disarm(callout_t *c)
   } else {
     lm = NULL;
   }
+  // Cancels a CALLOUT_WORKER task that is already queued
+  c->c_generation++;
   hts_mutex_unlock(&callout_mutex);
   if(lm)
     lm(c->c_opaque, LOCKMGR_RELEASE);
 }
 
 
+/**
+ *
+ */
+static void
+callout_invoke(callout_t *c, callout_callback_t *cc, void *opaque,
+               lockmgr_fn_t *lm)
+{
+  if(lm != NULL)
+    lm(opaque, LOCKMGR_LOCK);
+
+  cc(c, opaque);
+
+  if(lm != NULL) {
+    lm(opaque, LOCKMGR_UNLOCK);
+    lm(opaque, LOCKMGR_RELEASE);
+  }
+}
+
+
+/**
+ *
+ */
+typedef struct callout_task {
+  callout_t *ct_callout;
+  callout_callback_t *ct_callback;
+  void *ct_opaque;
+  lockmgr_fn_t *ct_lockmgr;
+  unsigned int ct_generation;
+} callout_task_t;
+
+
+/**
+ * The callout is no longer armed once queued so the owner may have
+ * disarmed or rearmed it before we get the lock. The retained
+ * reference keeps the owner (and thus the callout) around
+ */
+static void
+callout_task(void *aux)
+{
+  callout_task_t *ct = aux;
+  callout_t *c = ct->ct_callout;
+  lockmgr_fn_t *lm = ct->ct_lockmgr;
+
+  lm(ct->ct_opaque, LOCKMGR_LOCK);
+
+  hts_mutex_lock(&callout_mutex);
+  const int stale = c->c_generation != ct->ct_generation;
+  hts_mutex_unlock(&callout_mutex);
+
+  if(!stale)
+    ct->ct_callback(c, ct->ct_opaque);
+
+  lm(ct->ct_opaque, LOCKMGR_UNLOCK);
+  lm(ct->ct_opaque, LOCKMGR_RELEASE);
+  free(ct);
+}
+
+
+/**
+ *
+ */
+static void
+callout_expire(callout_t *c, uint64_t now)
+{
+  callout_callback_t *cc = c->c_callback;
+  LIST_REMOVE(c, c_link);
+  c->c_callback = NULL;
+  lockmgr_fn_t *lm = c->c_lockmgr;
+  void *opaque     = c->c_opaque;
+
+  if(c->c_flags & CALLOUT_WORKER) {
+    callout_task_t *ct = malloc(sizeof(callout_task_t));
+    ct->ct_callout = c;
+    ct->ct_callback = cc;
+    ct->ct_opaque = opaque;
+    ct->ct_lockmgr = lm;
+    ct->ct_generation = c->c_generation;
+    task_run(callout_task, ct);
+    return;
+  }
+
+  const char *file = c->c_armed_by_file;
+  int line         = c->c_armed_by_line;
+  hts_mutex_unlock(&callout_mutex);
+
+  callout_invoke(c, cc, opaque, lm);
+
+  hts_mutex_lock(&callout_mutex);
+  int64_t ts = arch_get_ts();
+  if(ts - now > 1000000)
+    TRACE(TRACE_DEBUG, "Callout", "%s:%d executed for %dus",
+          file, line, (int)(ts - now));
+}
+
+
 /**
  *
  */
 static void *
 callout_loop(void *aux)
 {
-  uint64_t now;
-  callout_t *c;
-  callout_callback_t *cc;
-
   hts_mutex_lock(&callout_mutex);
 
   while(1) {
 
-    now = arch_get_ts();
+    uint64_t now = arch_get_ts();
+    const uint64_t now_tick = now / 1000;
 
-    while((c = LIST_FIRST(&callouts)) != NULL && c->c_deadline <= now) {
-      cc = c->c_callback;
-      LIST_REMOVE(c, c_link);
-      c->c_callback = NULL;
-      lockmgr_fn_t *lm = c->c_lockmgr;
-      const char *file = c->c_armed_by_file;
-      int line         = c->c_armed_by_line;
-      void *opaque     = c->c_opaque;
-      hts_mutex_unlock(&callout_mutex);
+    while(callout_tick <= now_tick) {
+      const uint64_t t = callout_tick;
 
-      if(lm != NULL)
-        lm(opaque, LOCKMGR_LOCK);
-
-      cc(c, opaque);
+      if((t & CALLOUT_WHEEL_MASK) == 0) {
+        for(int level = 1; level < CALLOUT_WHEEL_LEVELS; level++) {
+          int slot = (t >> (CALLOUT_WHEEL_BITS * level)) & CALLOUT_WHEEL_MASK;
+          callout_cascade(level, slot);
+          if(slot)
+            break;
+        }
+      }
 
-      if(lm != NULL) {
-        lm(opaque, LOCKMGR_UNLOCK);
-        lm(opaque, LOCKMGR_RELEASE);
+      // Callbacks may arm callouts that are already due, those end up
+      // in this slot too and are picked up before we move on
+      struct callout_list *l = &callout_wheel[0][t & CALLOUT_WHEEL_MASK];
+      callout_t *c;
+      while((c = LIST_FIRST(l)) != NULL) {
+        callout_expire(c, now);
+        now = arch_get_ts();
       }
 
-      hts_mutex_lock(&callout_mutex);
-      int64_t ts = arch_get_ts();
-      if(ts - now > 1000000)
-        TRACE(TRACE_DEBUG, "Callout", "%s:%d executed for %dus",
-              file, line, (int)(ts - now));
-      now = ts;
+      callout_tick = MIN(callout_next_tick(t + 1), now_tick + 1);
     }
 
-    if((c = LIST_FIRST(&callouts)) != NULL) {
+    const uint64_t next = callout_next_tick(callout_tick);
 
-      int timeout = (c->c_deadline - now + 999) / 1000;
+    if(next != UINT64_MAX) {
+      now = arch_get_ts();
+      int timeout = next * 1000 > now ? (next * 1000 - now + 999) / 1000 : 0;
       hts_cond_wait_timeout(&callout_cond, &callout_mutex, timeout);
     } else {
       hts_cond_wait(&callout_cond, &callout_mutex);
@@ -274,6 +483,8 @@ callout_init(void)
   hts_mutex_init(&callout_mutex);
   hts_cond_init(&callout_cond, &callout_mutex);
 
+  callout_tick = arch_get_ts() / 1000;
+
   hts_thread_create_detached("callout", callout_loop, NULL,
 			     THREAD_PRIO_BGTASK);
 
@@ -32,9 +32,12 @@ typedef struct callout {
   lockmgr_fn_t *c_lockmgr;
   void *c_opaque;
   uint64_t c_deadline;
+  uint64_t c_expire;  // Tick (ms) in the timer wheel, includes slack
   int64_t c_delta;
   const char *c_armed_by_file;
   int c_armed_by_line;
+  int c_flags;
+  unsigned int c_generation; // Bumped on every arm and disarm
 
 } callout_t;
 
@@ -58,6 +61,26 @@ void callout_arm_managed_x(callout_t *d, callout_callback_t *callback,
 #define callout_arm_managed(a,b,c,d,e) \
   callout_arm_managed_x(a,b,c,d,e,__FILE__,__LINE__);
 
+/**
+ * CALLOUT_SLACK lets the callout fire up to 1/8 of its delta late so
+ * that it can be coalesced with other timers.
+ *
+ * CALLOUT_WORKER runs the callback on a task thread instead of the
+ * callout thread. The callout must be managed, the task takes the lock
+ * and skips the callback if the callout was disarmed or rearmed after
+ * it fired.
+ */
+#define CALLOUT_SLACK  0x1
+#define CALLOUT_WORKER 0x2
+
+void callout_arm_flags_x(callout_t *d, callout_callback_t *callback,
+                         void *opaque, int64_t delta,
+                         lockmgr_fn_t *lockmgr, int flags,
+                         const char *file, int line);
+
+#define callout_arm_flags(a,b,c,d,e,f) \
+  callout_arm_flags_x(a,b,c,d,e,f,__FILE__,__LINE__);
+
 void callout_rearm(callout_t *c, int64_t delta);
 
 void callout_disarm(callout_t *c);
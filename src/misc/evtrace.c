@@ -0,0 +1,375 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Event tracer
+ *
+ * Each thread that emits an event gets its own ring buffer of fixed
+ * size binary records. A buffer is only ever written by its owning
+ * thread so recording takes no locks, the write index is published
+ * with a release store once the record is complete.
+ *
+ * The exporter copies a snapshot of each buffer and rereads the write
+ * index afterwards to discard any records that the owner may have
+ * overwritten while we were copying. All fields in a record are
+ * word sized so a record that races with the owner is at worst a mix
+ * of two valid records, never an invalid pointer.
+ *
+ * Buffers are kept when their thread exits so short lived threads
+ * (tasks, loaders) still show up in the capture. Once we have
+ * EVTRACE_MAX_THREADS buffers the ones belonging to exited threads
+ * are recycled, if there are none new threads simply don't record.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "main.h"
+#include "arch/threads.h"
+#include "evtrace.h"
+#include "htsmsg/htsbuf.h"
+
+#if ENABLE_HTTPSERVER
+#include "networking/http_server.h"
+#endif
+
+#define EVTRACE_RING_SIZE   8192 // Must be power of 2
+#define EVTRACE_MAX_THREADS 64
+
+int evtrace_enabled;
+
+/**
+ *
+ */
+typedef struct evtrace_event {
+  int64_t ee_ts;
+  const char *ee_cat;
+  const char *ee_name;
+  int64_t ee_arg;
+  intptr_t ee_type;
+} evtrace_event_t;
+
+
+/**
+ *
+ */
+typedef struct evtrace_buf {
+  unsigned int eb_head;  // Total number of events written
+  unsigned int eb_base;  // eb_head when this thread took the buffer
+  int eb_tid;
+  int eb_exited;
+  char eb_name[32];
+  evtrace_event_t eb_events[EVTRACE_RING_SIZE];
+} evtrace_buf_t;
+
+
+static evtrace_buf_t *evtrace_bufs[EVTRACE_MAX_THREADS];
+static int evtrace_num_bufs;
+static int evtrace_tid_tally;
+static HTS_MUTEX_DECL(evtrace_mutex);
+static hts_key_t evtrace_key;
+
+// Set for threads that failed to get a buffer so we don't retry forever
+static char evtrace_nobuf;
+
+#if defined(__ATOMIC_RELEASE)
+#define evtrace_head_publish(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define evtrace_head_load(p)       __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#else
+#define evtrace_head_publish(p, v) do { __sync_synchronize(); *(p) = v; } while(0)
+#define evtrace_head_load(p) ({ unsigned int v__ = *(volatile unsigned int *)(p); __sync_synchronize(); v__;})
+#endif
+
+
+/**
+ *
+ */
+static void
+evtrace_thread_exit(void *aux)
+{
+  evtrace_buf_t *eb = aux;
+  if(eb == (void *)&evtrace_nobuf)
+    return;
+  hts_mutex_lock(&evtrace_mutex);
+  eb->eb_exited = 1;
+  hts_mutex_unlock(&evtrace_mutex);
+}
+
+
+/**
+ *
+ */
+static evtrace_buf_t *
+evtrace_buf_get(void)
+{
+  evtrace_buf_t *eb = NULL;
+  char name[32];
+  int i;
+
+  hts_mutex_lock(&evtrace_mutex);
+
+  if(evtrace_num_bufs < EVTRACE_MAX_THREADS) {
+    eb = calloc(1, sizeof(evtrace_buf_t));
+    if(eb != NULL)
+      evtrace_bufs[evtrace_num_bufs++] = eb;
+  } else {
+    for(i = 0; i < evtrace_num_bufs; i++) {
+      if(evtrace_bufs[i]->eb_exited) {
+        eb = evtrace_bufs[i];
+        eb->eb_base = eb->eb_head;
+        eb->eb_exited = 0;
+        break;
+      }
+    }
+  }
+
+  if(eb != NULL) {
+    eb->eb_tid = ++evtrace_tid_tally;
+    snprintf(eb->eb_name, sizeof(eb->eb_name), "%s",
+             hts_thread_name(name, sizeof(name)));
+  }
+  hts_mutex_unlock(&evtrace_mutex);
+
+  hts_thread_set_specific(evtrace_key, eb ?: (void *)&evtrace_nobuf);
+  return eb;
+}
+
+
+/**
+ *
+ */
+void
+evtrace_emit(int type, const char *cat, const char *name, int64_t arg)
+{
+  evtrace_buf_t *eb = hts_thread_get_specific(evtrace_key);
+
+  if(unlikely(eb == NULL)) {
+    eb = evtrace_buf_get();
+    if(eb == NULL)
+      return;
+  } else if(unlikely(eb == (void *)&evtrace_nobuf)) {
+    return;
+  }
+
+  const unsigned int h = eb->eb_head;
+  evtrace_event_t *ee = &eb->eb_events[h & (EVTRACE_RING_SIZE - 1)];
+  ee->ee_ts   = arch_get_ts();
+  ee->ee_cat  = cat;
+  ee->ee_name = name;
+  ee->ee_arg  = arg;
+  ee->ee_type = type;
+  evtrace_head_publish(&eb->eb_head, h + 1);
+}
+
+
+/**
+ *
+ */
+void
+evtrace_set(int on)
+{
+  TRACE(TRACE_DEBUG, "evtrace", "Event tracing %s",
+        on ? "enabled" : "disabled");
+  evtrace_enabled = on;
+}
+
+
+/**
+ *
+ */
+static void
+evtrace_export_event(htsbuf_queue_t *hq, const evtrace_event_t *ee,
+                     int tid, int *first)
+{
+  const char *ph;
+
+  switch(ee->ee_type) {
+  case EVTRACE_BEGIN:      ph = "B"; break;
+  case EVTRACE_END:        ph = "E"; break;
+  case EVTRACE_INSTANT:    ph = "i"; break;
+  case EVTRACE_COUNTER:    ph = "C"; break;
+  case EVTRACE_FLOW_START: ph = "s"; break;
+  case EVTRACE_FLOW_END:   ph = "f"; break;
+  default:
+    return;
+  }
+
+  htsbuf_qprintf(hq, "%s\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,"
+                 "\"ts\":%"PRId64",\"cat\":",
+                 *first ? "" : ",", ph, tid, ee->ee_ts);
+  *first = 0;
+  htsbuf_append_and_escape_jsonstr(hq, ee->ee_cat);
+  htsbuf_append(hq, ",\"name\":", 8);
+  htsbuf_append_and_escape_jsonstr(hq, ee->ee_name);
+
+  switch(ee->ee_type) {
+  case EVTRACE_INSTANT:
+    htsbuf_append(hq, ",\"s\":\"t\"", 8);
+    break;
+  case EVTRACE_COUNTER:
+    htsbuf_append(hq, ",\"args\":{", 9);
+    htsbuf_append_and_escape_jsonstr(hq, ee->ee_name);
+    htsbuf_qprintf(hq, ":%"PRId64"}", ee->ee_arg);
+    break;
+  case EVTRACE_FLOW_START:
+  case EVTRACE_FLOW_END:
+    htsbuf_qprintf(hq, ",\"id\":\"0x%"PRIx64"\"", ee->ee_arg);
+    break;
+  }
+  htsbuf_append(hq, "}", 1);
+}
+
+
+/**
+ * Export all recorded events in Chrome trace event format
+ */
+void
+evtrace_export(htsbuf_queue_t *hq)
+{
+  evtrace_event_t *copy = malloc(sizeof(evtrace_event_t) * EVTRACE_RING_SIZE);
+  int first = 1;
+  int i;
+
+  htsbuf_qprintf(hq, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  if(copy == NULL)
+    goto done;
+
+  hts_mutex_lock(&evtrace_mutex);
+
+  for(i = 0; i < evtrace_num_bufs; i++) {
+    const evtrace_buf_t *eb = evtrace_bufs[i];
+    const unsigned int h1 = evtrace_head_load(&eb->eb_head);
+    unsigned int avail = h1 - eb->eb_base;
+    unsigned int j, lo, drop;
+
+    if(avail > EVTRACE_RING_SIZE)
+      avail = EVTRACE_RING_SIZE;
+    lo = h1 - avail;
+
+    for(j = 0; j < avail; j++)
+      copy[j] = eb->eb_events[(lo + j) & (EVTRACE_RING_SIZE - 1)];
+
+    // The owner may be writing record h2 (which overwrites h2 - SIZE)
+    // so everything older than that is suspect
+    const unsigned int h2 = evtrace_head_load(&eb->eb_head);
+    drop = h2 - lo + 1 > EVTRACE_RING_SIZE ? h2 - lo + 1 - EVTRACE_RING_SIZE : 0;
+    if(drop > avail)
+      drop = avail;
+
+    htsbuf_qprintf(hq, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"name\":\"thread_name\",\"args\":{\"name\":",
+                   first ? "" : ",", eb->eb_tid);
+    first = 0;
+    htsbuf_append_and_escape_jsonstr(hq, eb->eb_name);
+    htsbuf_append(hq, "}}", 2);
+
+    for(j = drop; j < avail; j++)
+      evtrace_export_event(hq, &copy[j], eb->eb_tid, &first);
+  }
+
+  hts_mutex_unlock(&evtrace_mutex);
+  free(copy);
+ done:
+  htsbuf_qprintf(hq, "\n]}\n");
+}
+
+
+/**
+ *
+ */
+int
+evtrace_write_file(const char *path)
+{
+  htsbuf_queue_t hq;
+  htsbuf_data_t *hd;
+  FILE *fp = fopen(path, "w");
+
+  if(fp == NULL) {
+    TRACE(TRACE_ERROR, "evtrace", "Unable to open %s -- %s",
+          path, strerror(errno));
+    return -1;
+  }
+
+  htsbuf_queue_init(&hq, 0);
+  evtrace_export(&hq);
+
+  TAILQ_FOREACH(hd, &hq.hq_q, hd_link)
+    fwrite(hd->hd_data + hd->hd_data_off,
+           hd->hd_data_len - hd->hd_data_off, 1, fp);
+
+  htsbuf_queue_flush(&hq);
+  fclose(fp);
+  TRACE(TRACE_INFO, "evtrace", "Event trace written to %s", path);
+  return 0;
+}
+
+
+/**
+ *
+ */
+INITIALIZER(evtrace_init)
+{
+  hts_thread_key_create(&evtrace_key, evtrace_thread_exit);
+}
+
+
+#if ENABLE_HTTPSERVER
+
+/**
+ * GET /api/evtrace[?enable=0|1]
+ *
+ * Returns the current capture, load it in chrome://tracing or
+ * ui.perfetto.dev
+ */
+static int
+hc_evtrace(http_connection_t *hc, const char *remain, void *opaque,
+           http_cmd_t method)
+{
+  htsbuf_queue_t out;
+  const char *s;
+
+  if((s = http_arg_get_req(hc, "enable")) != NULL) {
+    evtrace_set(!!atoi(s));
+    return 200;
+  }
+
+  htsbuf_queue_init(&out, 0);
+  evtrace_export(&out);
+  return http_send_reply(hc, 0, "application/json; charset=utf-8",
+                         NULL, NULL, 0, &out);
+}
+
+
+/**
+ *
+ */
+static void
+evtrace_http_init(void)
+{
+  http_path_add("/api/evtrace", NULL, hc_evtrace, 1);
+}
+
+INITME(INIT_GROUP_API, evtrace_http_init, NULL, 0);
+
+#endif
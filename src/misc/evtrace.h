@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+#include <stdint.h>
+#include "compiler.h"
+
+struct htsbuf_queue;
+
+/**
+ * Event tracer
+ *
+ * Events are recorded into a per-thread ring buffer and exported in
+ * Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+ *
+ * 'cat' and 'name' must be string literals (or otherwise live for the
+ * lifetime of the process), only the pointers are recorded.
+ *
+ * When tracing is disabled each trace point costs a test of
+ * evtrace_enabled.
+ */
+
+#define EVTRACE_BEGIN       1
+#define EVTRACE_END         2
+#define EVTRACE_INSTANT     3
+#define EVTRACE_COUNTER     4
+#define EVTRACE_FLOW_START  5
+#define EVTRACE_FLOW_END    6
+
+extern int evtrace_enabled;
+
+void evtrace_emit(int type, const char *cat, const char *name, int64_t arg);
+
+void evtrace_set(int on);
+
+void evtrace_export(struct htsbuf_queue *hq);
+
+int evtrace_write_file(const char *path);
+
+
+/**
+ *
+ */
+static __inline void
+evtrace_begin(const char *cat, const char *name)
+{
+  if(unlikely(evtrace_enabled))
+    evtrace_emit(EVTRACE_BEGIN, cat, name, 0);
+}
+
+
+/**
+ *
+ */
+static __inline void
+evtrace_end(const char *cat, const char *name)
+{
+  if(unlikely(evtrace_enabled))
+    evtrace_emit(EVTRACE_END, cat, name, 0);
+}
+
+
+/**
+ *
+ */
+static __inline void
+evtrace_instant(const char *cat, const char *name)
+{
+  if(unlikely(evtrace_enabled))
+    evtrace_emit(EVTRACE_INSTANT, cat, name, 0);
+}
+
+
+/**
+ *
+ */
+static __inline void
+evtrace_counter(const char *cat, const char *name, int64_t value)
+{
+  if(unlikely(evtrace_enabled))
+    evtrace_emit(EVTRACE_COUNTER, cat, name, value);
+}
+
+
+/**
+ * Flows link an event on one thread to an event on another,
+ * 'id' must be the same on both ends (typically a pointer to
+ * the object handed over). The end binds to the next slice
+ * started on the receiving thread
+ */
+static __inline void
+evtrace_flow_start(const char *cat, const char *name, const void *id)
+{
+  if(unlikely(evtrace_enabled))
+    evtrace_emit(EVTRACE_FLOW_START, cat, name, (intptr_t)id);
+}
+
+
+/**
+ *
+ */
+static __inline void
+evtrace_flow_end(const char *cat, const char *name, const void *id)
+{
+  if(unlikely(evtrace_enabled))
+    evtrace_emit(EVTRACE_FLOW_END, cat, name, (intptr_t)id);
+}
+
+
+/**
+ * Scoped begin/end. The end is only emitted if the begin was,
+ * so toggling tracing inside a scope won't produce unbalanced events
+ */
+typedef struct evtrace_scope {
+  const char *cat;
+  const char *name;
+} evtrace_scope_t;
+
+
+static __inline evtrace_scope_t
+evtrace_scope_begin(const char *cat, const char *name)
+{
+  evtrace_scope_t s = {NULL, NULL};
+  if(unlikely(evtrace_enabled)) {
+    evtrace_emit(EVTRACE_BEGIN, cat, name, 0);
+    s.cat = cat;
+    s.name = name;
+  }
+  return s;
+}
+
+
+static __inline void
+evtrace_scope_end(evtrace_scope_t *s)
+{
+  if(unlikely(s->name != NULL))
+    evtrace_emit(EVTRACE_END, s->cat, s->name, 0);
+}
+
+#ifdef __GNUC__
+#define EVTRACE_SCOPE(cat, name)                                        \
+  evtrace_scope_t HTS_JOIN(evtrace_scope_, __LINE__)                    \
+  __attribute__((cleanup(evtrace_scope_end))) =                         \
+    evtrace_scope_begin(cat, name)
+#else
+#define EVTRACE_SCOPE(cat, name)
+#endif
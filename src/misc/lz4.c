@@ -0,0 +1,232 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+/**
+ * A small implementation of the LZ4 block format. Single pass greedy
+ * matching with a 4096 entry hash table, good enough for caching
+ * pixel data where speed matters far more than ratio.
+ */
+
+#define HASH_BITS   12
+#define MIN_MATCH   4
+#define LAST_LITERALS 5   // Block must end with at least this many literals
+#define MFLIMIT     12    // No match may start closer than this to the end
+#define MAX_OFFSET  65535
+
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline unsigned int
+hash32(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+
+/**
+ *
+ */
+static uint8_t *
+put_length(uint8_t *op, const uint8_t *oend, size_t len)
+{
+  while(len >= 255) {
+    if(op >= oend)
+      return NULL;
+    *op++ = 255;
+    len -= 255;
+  }
+  if(op >= oend)
+    return NULL;
+  *op++ = len;
+  return op;
+}
+
+
+/**
+ *
+ */
+static uint8_t *
+put_sequence(uint8_t *op, const uint8_t *oend,
+             const uint8_t *lit, size_t litlen,
+             size_t offset, size_t matchlen)
+{
+  if(op >= oend)
+    return NULL;
+
+  uint8_t *token = op++;
+  *token = (litlen >= 15 ? 15 : litlen) << 4;
+
+  if(litlen >= 15 && (op = put_length(op, oend, litlen - 15)) == NULL)
+    return NULL;
+
+  if(oend - op < litlen)
+    return NULL;
+  memcpy(op, lit, litlen);
+  op += litlen;
+
+  if(matchlen == 0)
+    return op; // Last sequence, literals only
+
+  if(oend - op < 2)
+    return NULL;
+  *op++ = offset;
+  *op++ = offset >> 8;
+
+  matchlen -= MIN_MATCH;
+  *token |= matchlen >= 15 ? 15 : matchlen;
+  if(matchlen >= 15 && (op = put_length(op, oend, matchlen - 15)) == NULL)
+    return NULL;
+  return op;
+}
+
+
+/**
+ *
+ */
+size_t
+lz4_compress(const void *src, size_t srclen, void *dst, size_t dstcap)
+{
+  uint32_t table[1 << HASH_BITS] = {0};
+  const uint8_t *base = src;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  const uint8_t *iend = base + srclen;
+  uint8_t *op = dst;
+  const uint8_t *oend = op + dstcap;
+
+  if(srclen > MFLIMIT) {
+    const uint8_t *mflimit = iend - MFLIMIT;
+    const uint8_t *matchlimit = iend - LAST_LITERALS;
+
+    while(ip < mflimit) {
+      const uint32_t seq = read32(ip);
+      const unsigned int h = hash32(seq);
+      const uint8_t *ref = base + table[h];
+      table[h] = ip - base;
+
+      if(ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      // Extend backwards over pending literals
+      while(ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+
+      const uint8_t *mp = ip + MIN_MATCH;
+      const uint8_t *rp = ref + MIN_MATCH;
+      while(mp < matchlimit && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+      if(op == NULL)
+        return 0;
+
+      ip = anchor = mp;
+      if(ip < mflimit)
+        table[hash32(read32(ip - 2))] = ip - 2 - base;
+    }
+  }
+
+  op = put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+  if(op == NULL)
+    return 0;
+  return op - (uint8_t *)dst;
+}
+
+
+/**
+ *
+ */
+int
+lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+  const uint8_t *ip = src;
+  const uint8_t *iend = ip + srclen;
+  uint8_t *op = dst;
+  uint8_t *oend = op + dstlen;
+
+  while(ip < iend) {
+    const unsigned int token = *ip++;
+    size_t len = token >> 4;
+
+    if(len == 15) {
+      unsigned int b;
+      do {
+        if(ip >= iend)
+          return -1;
+        b = *ip++;
+        len += b;
+      } while(b == 255);
+    }
+
+    if(iend - ip < len || oend - op < len)
+      return -1;
+    memcpy(op, ip, len);
+    ip += len;
+    op += len;
+
+    if(ip == iend)
+      break; // Last sequence
+
+    if(iend - ip < 2)
+      return -1;
+    const size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+
+    if(offset == 0 || offset > op - (uint8_t *)dst)
+      return -1;
+
+    len = token & 15;
+    if(len == 15) {
+      unsigned int b;
+      do {
+        if(ip >= iend)
+          return -1;
+        b = *ip++;
+        len += b;
+      } while(b == 255);
+    }
+    len += MIN_MATCH;
+
+    if(oend - op < len)
+      return -1;
+
+    // Byte by byte since source and destination may overlap
+    const uint8_t *ref = op - offset;
+    while(len--)
+      *op++ = *ref++;
+  }
+  return op == oend ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+#include <stddef.h>
+
+/**
+ * Worst case output size of lz4_compress()
+ */
+#define LZ4_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16)
+
+/**
+ * Compress into LZ4 block format (no framing). Returns number of
+ * bytes written or 0 if dst is too small
+ */
+size_t lz4_compress(const void *src, size_t srclen, void *dst, size_t dstcap);
+
+/**
+ * Decompress an LZ4 block. Returns 0 if exactly dstlen bytes were
+ * produced, -1 if the input is corrupt or does not match dstlen
+ */
+int lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen);
@@ -0,0 +1,215 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lz4.h"
+
+/**
+ * Round trip tests for the LZ4 codec, configure with --enable-lz4test
+ */
+
+#define GUARD 16
+
+int lz4_test(void);
+
+static uint32_t lz4_test_seed = 1;
+
+static uint8_t
+lz4_test_rand(void)
+{
+  lz4_test_seed = lz4_test_seed * 1103515245 + 12345;
+  return lz4_test_seed >> 16;
+}
+
+
+/**
+ * Compress, decompress and compare. Also check that the decoder
+ * rejects a too short output buffer and truncated input, and that
+ * it never writes outside the output buffer
+ */
+static int
+lz4_test_roundtrip(const char *name, const uint8_t *src, size_t len)
+{
+  const size_t cap = LZ4_COMPRESS_BOUND(len);
+  uint8_t *c = malloc(cap);
+  uint8_t *d = malloc(len + GUARD);
+  const char *err = NULL;
+  size_t clen;
+  int i;
+
+  memset(d + len, 0xa5, GUARD);
+
+  clen = lz4_compress(src, len, c, cap);
+
+  if(clen == 0)
+    err = "compress failed";
+  else if(lz4_decompress(c, clen, d, len))
+    err = "decompress failed";
+  else if(memcmp(src, d, len))
+    err = "output differs";
+  else if(len > 0 && !lz4_decompress(c, clen, d, len - 1))
+    err = "short output buffer accepted";
+  else if(len > 0 && !lz4_decompress(c, clen - 1, d, len))
+    err = "truncated input accepted";
+
+  for(i = 0; i < GUARD && err == NULL; i++)
+    if(d[len + i] != 0xa5)
+      err = "wrote past end of output";
+
+  if(err != NULL)
+    printf("  %-24s %8zu bytes: FAILED, %s\n", name, len, err);
+  else
+    printf("  %-24s %8zu bytes -> %8zu\n", name, len, clen);
+
+  free(c);
+  free(d);
+  return err != NULL;
+}
+
+
+/**
+ * Corrupted input must fail cleanly, never crash or overrun
+ */
+static int
+lz4_test_corrupt(const uint8_t *src, size_t len, int rounds)
+{
+  const size_t cap = LZ4_COMPRESS_BOUND(len);
+  uint8_t *c = malloc(cap);
+  uint8_t *d = malloc(len + GUARD);
+  int i, j, fail = 0;
+
+  const size_t clen = lz4_compress(src, len, c, cap);
+
+  for(i = 0; i < rounds && !fail; i++) {
+    uint8_t *m = malloc(clen);
+    memcpy(m, c, clen);
+    for(j = 0; j < 4; j++)
+      m[lz4_test_seed % clen] = lz4_test_rand();
+
+    memset(d + len, 0xa5, GUARD);
+    lz4_decompress(m, clen, d, len);
+    for(j = 0; j < GUARD; j++)
+      if(d[len + j] != 0xa5)
+        fail = 1;
+    free(m);
+  }
+
+  printf("  %-24s %8d rounds%s\n", "corrupted input", rounds,
+         fail ? ": FAILED, wrote past end of output" : "");
+  free(c);
+  free(d);
+  return fail;
+}
+
+
+/**
+ * Returns non-zero on failure
+ */
+int
+lz4_test(void)
+{
+  const size_t size = 1024 * 1024;
+  uint8_t *buf = malloc(size);
+  char name[64];
+  int fail = 0;
+  size_t i, n;
+
+  printf("LZ4 round trip tests\n");
+
+  memset(buf, 0, size);
+  fail |= lz4_test_roundtrip("empty", buf, 0);
+
+  // Short inputs are all literals, straddle MFLIMIT
+  for(n = 1; n <= 32; n++) {
+    for(i = 0; i < n; i++)
+      buf[i] = i & 1 ? 'a' : lz4_test_rand();
+    snprintf(name, sizeof(name), "short %zu", n);
+    fail |= lz4_test_roundtrip(name, buf, n);
+  }
+
+  memset(buf, 0, size);
+  fail |= lz4_test_roundtrip("zeroes", buf, size);
+
+  for(i = 0; i < size; i++)
+    buf[i] = lz4_test_rand();
+  fail |= lz4_test_roundtrip("random", buf, size);
+
+  // Literal runs around the 15 and 15 + 255 length encoding steps
+  for(n = 14; n <= 16; n++) {
+    for(i = 0; i < n; i++)
+      buf[i] = lz4_test_rand();
+    memset(buf + n, 'x', 64);
+    snprintf(name, sizeof(name), "literals %zu", n);
+    fail |= lz4_test_roundtrip(name, buf, n + 64);
+  }
+  for(n = 268; n <= 272; n++) {
+    for(i = 0; i < n; i++)
+      buf[i] = lz4_test_rand();
+    memset(buf + n, 'x', 64);
+    snprintf(name, sizeof(name), "literals %zu", n);
+    fail |= lz4_test_roundtrip(name, buf, n + 64);
+  }
+
+  // Match lengths around the encoding steps
+  for(n = 17; n <= 20; n++) {
+    for(i = 0; i < 100; i++)
+      buf[i] = lz4_test_rand();
+    memcpy(buf + 100, buf + 50, n);
+    for(i = 100 + n; i < 200 + n; i++)
+      buf[i] = lz4_test_rand();
+    snprintf(name, sizeof(name), "match %zu", n);
+    fail |= lz4_test_roundtrip(name, buf, 200 + n);
+  }
+
+  for(i = 0; i < size; i++)
+    buf[i] = "abcdefg"[i % 7];
+  fail |= lz4_test_roundtrip("period 7", buf, size);
+
+  for(i = 0; i < size; i++)
+    buf[i] = i % 1000 < 500 ? lz4_test_rand() : buf[i - 500];
+  fail |= lz4_test_roundtrip("period 1000", buf, size);
+
+  // Repeats exactly at and just beyond the max match offset
+  for(i = 0; i < 65535; i++)
+    buf[i] = lz4_test_rand();
+  memcpy(buf + 65535, buf, 1000);
+  fail |= lz4_test_roundtrip("offset 65535", buf, 65535 + 1000);
+
+  memcpy(buf + 65536, buf, 1000);
+  fail |= lz4_test_roundtrip("offset 65536", buf, 65536 + 1000);
+
+  // What pixcache stores, a BGRA gradient with an alpha channel
+  for(i = 0; i < size / 4; i++) {
+    buf[i * 4 + 0] = i;
+    buf[i * 4 + 1] = i >> 4;
+    buf[i * 4 + 2] = (i % 512) >> 1;
+    buf[i * 4 + 3] = 255;
+  }
+  fail |= lz4_test_roundtrip("gradient", buf, size);
+
+  fail |= lz4_test_corrupt(buf, 65536, 10000);
+
+  printf("LZ4 tests %s\n", fail ? "FAILED" : "passed");
+  free(buf);
+  return fail;
+}
@@ -75,6 +75,27 @@ typedef struct pool_segment {
 
 #define ROUND_UP(p, round) ((p + round - 1) & ~(round - 1))
 
+
+/**
+ * Per thread caches for POOL_THREAD_CACHE pools
+ */
+#define POOL_TC_SLOTS 8
+#define POOL_TC_BATCH 32
+
+typedef struct pool_tc_slot {
+  pool_item_t *pts_items;
+  int pts_count;
+} pool_tc_slot_t;
+
+typedef struct pool_tc {
+  pool_tc_slot_t ptc_slots[POOL_TC_SLOTS];
+} pool_tc_t;
+
+static pool_t *pool_tc_pools[POOL_TC_SLOTS];
+static int pool_tc_num_slots;
+static hts_key_t pool_tc_key;
+static HTS_MUTEX_DECL(pool_tc_mutex);
+
 /**
  *
  */
@@ -104,6 +125,146 @@ pool_segment_create(pool_t *p)
 }
 
 
+/**
+ * Return 'count' items from the head of a thread cache to the pool
+ */
+static void
+pool_tc_flush(pool_t *p, pool_tc_slot_t *pts, int count)
+{
+  pool_item_t *first = pts->pts_items, *last = first;
+  int i;
+
+  for(i = 1; i < count; i++)
+    last = last->link;
+
+  pts->pts_items = last->link;
+  pts->pts_count -= count;
+
+  hts_mutex_lock(&p->p_mutex);
+  last->link = p->p_item;
+  p->p_item = first;
+  p->p_num_out -= count;
+  hts_mutex_unlock(&p->p_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+pool_tc_refill(pool_t *p, pool_tc_slot_t *pts)
+{
+  pool_item_t *pi;
+  int i;
+
+  hts_mutex_lock(&p->p_mutex);
+  for(i = 0; i < POOL_TC_BATCH; i++) {
+    if(p->p_item == NULL)
+      pool_segment_create(p);
+    pi = p->p_item;
+    p->p_item = pi->link;
+    pi->link = pts->pts_items;
+    pts->pts_items = pi;
+  }
+  p->p_num_out += POOL_TC_BATCH;
+  hts_mutex_unlock(&p->p_mutex);
+  pts->pts_count += POOL_TC_BATCH;
+}
+
+
+/**
+ * Thread exit, hand everything back
+ */
+static void
+pool_tc_destroy(void *aux)
+{
+  pool_tc_t *ptc = aux;
+  int i;
+
+  for(i = 0; i < POOL_TC_SLOTS; i++) {
+    pool_tc_slot_t *pts = &ptc->ptc_slots[i];
+    if(pts->pts_count)
+      pool_tc_flush(pool_tc_pools[i], pts, pts->pts_count);
+  }
+  free(ptc);
+}
+
+
+/**
+ *
+ */
+static pool_tc_slot_t *
+pool_tc_slot(pool_t *p)
+{
+  if(p->p_tc_slot == -1)
+    return NULL;
+
+  pool_tc_t *ptc = hts_thread_get_specific(pool_tc_key);
+  if(ptc == NULL) {
+    ptc = calloc(1, sizeof(pool_tc_t));
+    hts_thread_set_specific(pool_tc_key, ptc);
+  }
+  return &ptc->ptc_slots[p->p_tc_slot];
+}
+
+
+/**
+ *
+ */
+static pool_item_t *
+pool_tc_get(pool_t *p)
+{
+  pool_item_t *pi;
+  pool_tc_slot_t *pts = pool_tc_slot(p);
+
+  if(pts == NULL) {
+    // Out of cache slots, just serialize on the pool
+    hts_mutex_lock(&p->p_mutex);
+    if(p->p_item == NULL)
+      pool_segment_create(p);
+    pi = p->p_item;
+    p->p_item = pi->link;
+    p->p_num_out++;
+    hts_mutex_unlock(&p->p_mutex);
+    return pi;
+  }
+
+  if(pts->pts_items == NULL)
+    pool_tc_refill(p, pts);
+
+  pi = pts->pts_items;
+  pts->pts_items = pi->link;
+  pts->pts_count--;
+  return pi;
+}
+
+
+/**
+ *
+ */
+static void
+pool_tc_put(pool_t *p, pool_item_t *pi)
+{
+  pool_tc_slot_t *pts = pool_tc_slot(p);
+
+  if(pts == NULL) {
+    hts_mutex_lock(&p->p_mutex);
+    pi->link = p->p_item;
+    p->p_item = pi;
+    p->p_num_out--;
+    hts_mutex_unlock(&p->p_mutex);
+    return;
+  }
+
+  pi->link = pts->pts_items;
+  pts->pts_items = pi;
+  pts->pts_count++;
+
+  if(pts->pts_count > POOL_TC_BATCH * 2)
+    pool_tc_flush(p, pts, POOL_TC_BATCH);
+}
+
+
 /**
  *
  */
@@ -121,6 +282,21 @@ pool_init(pool_t *p, const char *name, size_t item_size, int flags)
 
   p->p_item_size = item_size;
   p->p_flags = flags;
+  p->p_tc_slot = -1;
+
+  if(flags & POOL_THREAD_CACHE) {
+    hts_mutex_init(&p->p_mutex);
+
+    hts_mutex_lock(&pool_tc_mutex);
+    if(pool_tc_num_slots == 0)
+      hts_thread_key_create(&pool_tc_key, pool_tc_destroy);
+
+    if(pool_tc_num_slots < POOL_TC_SLOTS) {
+      p->p_tc_slot = pool_tc_num_slots;
+      pool_tc_pools[pool_tc_num_slots++] = p;
+    }
+    hts_mutex_unlock(&pool_tc_mutex);
+  }
 }
 
 
@@ -189,6 +365,8 @@ pool_destroy(pool_t *p)
 {
   pool_segment_t *ps;
 
+  assert(p->p_tc_slot == -1); // Thread caches may still refer to us
+
 #ifdef POOL_DEBUG
   if(1) {
 
@@ -242,24 +420,31 @@ pool_get_ex(pool_t *p, const char *file, int line)
 pool_get(pool_t *p)
 #endif
 {
-  p->p_num_out++;
 #if defined(POOL_BY_MMAP)
+  p->p_num_out++;
   return mmap(NULL, p->p_item_size_req, PROT_WRITE | PROT_READ,
               MAP_ANON | MAP_PRIVATE, -1, 0);
 
 #elif defined(POOL_BY_MALLOC)
+  p->p_num_out++;
   if(p->p_flags & POOL_ZERO_MEM)
     return calloc(1, p->p_item_size_req);
   else
     return malloc(p->p_item_size_req);
 #else
-  pool_item_t *pi = p->p_item;
-  if(pi == NULL) {
-    pool_segment_create(p);
+  pool_item_t *pi;
+
+  if(p->p_flags & POOL_THREAD_CACHE) {
+    pi = pool_tc_get(p);
+  } else {
+    p->p_num_out++;
     pi = p->p_item;
+    if(pi == NULL) {
+      pool_segment_create(p);
+      pi = p->p_item;
+    }
+    p->p_item = pi->link;
   }
-  p->p_item = pi->link;
-
 
   if(p->p_flags & POOL_ZERO_MEM)
     memset(pi, 0, p->p_item_size);
@@ -291,8 +476,10 @@ pool_put(pool_t *p, void *ptr)
   madvise(ptr, p->p_item_size_req, MADV_DONTNEED);
 #endif
   mprotect(ptr, p->p_item_size_req, PROT_NONE);
+  p->p_num_out--;
 #elif defined(POOL_BY_MALLOC)
   free(ptr);
+  p->p_num_out--;
 #else
 
 #ifdef POOL_DEBUG
@@ -303,10 +490,14 @@ pool_put(pool_t *p, void *ptr)
 
 #ifdef POOL_DEBUG
   pool_segment_t *ps;
+  if(p->p_flags & POOL_THREAD_CACHE)
+    hts_mutex_lock(&p->p_mutex);
   LIST_FOREACH(ps, &p->p_segments, ps_link)
     if((uintptr_t)pi >= (uintptr_t)ps->ps_addr &&
        (uintptr_t)pi < (uintptr_t)ps->ps_addr + ps->ps_avail_size)
       break;
+  if(p->p_flags & POOL_THREAD_CACHE)
+    hts_mutex_unlock(&p->p_mutex);
 
   if(ps == NULL) {
     TRACE(TRACE_ERROR, "POOL", "%s: Item %p not in any segment",
@@ -324,10 +515,14 @@ pool_put(pool_t *p, void *ptr)
   memset(pi, 0xff, p->p_item_size);
 #endif
 
-  pi->link = p->p_item;
-  p->p_item = pi;
+  if(p->p_flags & POOL_THREAD_CACHE) {
+    pool_tc_put(p, pi);
+  } else {
+    pi->link = p->p_item;
+    p->p_item = pi;
+    p->p_num_out--;
+  }
 #endif
-  p->p_num_out--;
 }
 
 
@@ -350,6 +545,9 @@ pool_foreach(pool_t *p, void (*fn)(void *ptr, void *opaque), void *opaque)
 {
   pool_segment_t *ps;
 
+  if(p->p_flags & POOL_THREAD_CACHE)
+    hts_mutex_lock(&p->p_mutex);
+
   mark_segments(p);
 
   LIST_FOREACH(ps, &p->p_segments, ps_link) {
@@ -363,5 +561,8 @@ pool_foreach(pool_t *p, void (*fn)(void *ptr, void *opaque), void *opaque)
   }
 
   unmark_segments(p);
+
+  if(p->p_flags & POOL_THREAD_CACHE)
+    hts_mutex_unlock(&p->p_mutex);
 }
 #endif
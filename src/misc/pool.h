@@ -43,11 +43,21 @@ typedef struct pool {
   struct pool_item *p_item;
 
   int p_num_out;
+  int p_tc_slot;
   const char *p_name;
 } pool_t;
 
 
-#define POOL_ZERO_MEM  0x2
+#define POOL_ZERO_MEM      0x2
+
+/**
+ * Keep a small per-thread cache of free items in front of the pool.
+ * Items move between the thread caches and the shared free list in
+ * batches under p_mutex, so such a pool can be used from any thread
+ * without external locking. Items parked in a thread cache count as
+ * being out (pool_num())
+ */
+#define POOL_THREAD_CACHE  0x4
 
 pool_t *pool_create(const char *name, size_t item_size, int flags);
 
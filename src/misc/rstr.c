@@ -23,12 +23,18 @@
 #include <stddef.h>
 
 #include "rstr.h"
+#include "murmur3.h"
+#include "arch/threads.h"
 
 #ifdef RSTR_STATS
-int rstr_allocs;
-int rstr_dups;
-int rstr_releases;
-int rstr_frees;
+atomic_t rstr_allocs;
+atomic_t rstr_dups;
+atomic_t rstr_releases;
+atomic_t rstr_frees;
+static atomic_t rstr_intern_hits;
+static atomic_t rstr_intern_misses;
+static atomic_t rstr_intern_live;
+static atomic_t rstr_intern_bytes_saved;
 #endif
 
 rstr_t *
@@ -42,11 +48,12 @@ rstr_alloc(const char *in)
   rstr_t *rs = malloc(sizeof(rstr_t) + l + 1);
 #ifdef USE_RSTR_REFCOUNTING
   atomic_set(&rs->refcnt, 1);
+  rs->interned = 0;
 #endif
   memcpy(rs->str, in, l + 1);
 
 #ifdef RSTR_STATS
-    atomic_add(&rstr_allocs, 1);
+  atomic_inc(&rstr_allocs);
 #endif
   return rs;
 }
@@ -57,16 +64,173 @@ rstr_allocl(const char *in, size_t len)
   rstr_t *rs = malloc(sizeof(rstr_t) + len + 1);
 #ifdef USE_RSTR_REFCOUNTING
   atomic_set(&rs->refcnt, 1);
+  rs->interned = 0;
 #endif
   if(in != NULL)
     memcpy(rs->str, in, len);
   rs->str[len] = 0;
 #ifdef RSTR_STATS
-    atomic_add(&rstr_allocs, 1);
+  atomic_inc(&rstr_allocs);
 #endif
   return rs;
 }
 
+
+#ifdef USE_RSTR_REFCOUNTING
+
+/**
+ * The intern table is split in shards, each with its own lock and
+ * chained hash table. An entry whose refcount has dropped to zero is
+ * dead: lookups skip it (atomic_inc_not_zero() fails) and the releasing
+ * thread unlinks and frees it in rstr_intern_reclaim()
+ */
+#define RSTR_INTERN_SHARDS 16
+
+typedef struct rstr_intern_entry {
+  struct rstr_intern_entry *rie_next;
+  uint32_t rie_hash;
+  rstr_t rie_rstr; // Must be last
+} rstr_intern_entry_t;
+
+typedef struct rstr_intern_shard {
+  hts_mutex_t ris_mutex;
+  rstr_intern_entry_t **ris_buckets;
+  unsigned int ris_size;
+  unsigned int ris_count;
+} rstr_intern_shard_t;
+
+static rstr_intern_shard_t rstr_intern_shards[RSTR_INTERN_SHARDS];
+
+
+/**
+ *
+ */
+static void __attribute__((constructor))
+rstr_intern_init(void)
+{
+  for(int i = 0; i < RSTR_INTERN_SHARDS; i++) {
+    rstr_intern_shard_t *ris = &rstr_intern_shards[i];
+    hts_mutex_init(&ris->ris_mutex);
+    ris->ris_size = 64;
+    ris->ris_buckets = calloc(ris->ris_size, sizeof(rstr_intern_entry_t *));
+  }
+}
+
+
+/**
+ *
+ */
+static void
+rstr_intern_grow(rstr_intern_shard_t *ris)
+{
+  const unsigned int size = ris->ris_size * 2;
+  rstr_intern_entry_t **b = calloc(size, sizeof(rstr_intern_entry_t *));
+  rstr_intern_entry_t *rie, *next;
+
+  for(unsigned int i = 0; i < ris->ris_size; i++) {
+    for(rie = ris->ris_buckets[i]; rie != NULL; rie = next) {
+      next = rie->rie_next;
+      unsigned int j = (rie->rie_hash / RSTR_INTERN_SHARDS) & (size - 1);
+      rie->rie_next = b[j];
+      b[j] = rie;
+    }
+  }
+  free(ris->ris_buckets);
+  ris->ris_buckets = b;
+  ris->ris_size = size;
+}
+
+
+/**
+ *
+ */
+rstr_t *
+rstr_intern(const char *in)
+{
+  if(in == NULL)
+    return NULL;
+
+  const size_t len = strlen(in);
+  const uint32_t hash = MurHash3_32(in, len, 0);
+  rstr_intern_shard_t *ris = &rstr_intern_shards[hash % RSTR_INTERN_SHARDS];
+  rstr_intern_entry_t *rie;
+
+  hts_mutex_lock(&ris->ris_mutex);
+
+  rstr_intern_entry_t **bp =
+    &ris->ris_buckets[(hash / RSTR_INTERN_SHARDS) & (ris->ris_size - 1)];
+
+  for(rie = *bp; rie != NULL; rie = rie->rie_next) {
+    if(rie->rie_hash == hash && !strcmp(rie->rie_rstr.str, in) &&
+       atomic_inc_not_zero(&rie->rie_rstr.refcnt)) {
+      hts_mutex_unlock(&ris->ris_mutex);
+#ifdef RSTR_STATS
+      atomic_inc(&rstr_intern_hits);
+      atomic_add(&rstr_intern_bytes_saved, len + 1);
+#endif
+      return &rie->rie_rstr;
+    }
+  }
+
+  rie = malloc(sizeof(rstr_intern_entry_t) + len + 1);
+  rie->rie_hash = hash;
+  atomic_set(&rie->rie_rstr.refcnt, 1);
+  rie->rie_rstr.interned = 1;
+  memcpy(rie->rie_rstr.str, in, len + 1);
+  rie->rie_next = *bp;
+  *bp = rie;
+
+  if(++ris->ris_count > ris->ris_size)
+    rstr_intern_grow(ris);
+
+  hts_mutex_unlock(&ris->ris_mutex);
+#ifdef RSTR_STATS
+  atomic_inc(&rstr_allocs);
+  atomic_inc(&rstr_intern_misses);
+  atomic_inc(&rstr_intern_live);
+#endif
+  return &rie->rie_rstr;
+}
+
+
+/**
+ * Called from rstr_release() when the last reference is gone
+ */
+void
+rstr_intern_reclaim(rstr_t *rs)
+{
+  rstr_intern_entry_t *rie = (rstr_intern_entry_t *)
+    ((char *)rs - offsetof(rstr_intern_entry_t, rie_rstr));
+  rstr_intern_shard_t *ris =
+    &rstr_intern_shards[rie->rie_hash % RSTR_INTERN_SHARDS];
+  rstr_intern_entry_t **p;
+
+  hts_mutex_lock(&ris->ris_mutex);
+
+  p = &ris->ris_buckets[(rie->rie_hash / RSTR_INTERN_SHARDS) &
+                        (ris->ris_size - 1)];
+  while(*p != rie)
+    p = &(*p)->rie_next;
+  *p = rie->rie_next;
+  ris->ris_count--;
+
+  hts_mutex_unlock(&ris->ris_mutex);
+#ifdef RSTR_STATS
+  atomic_dec(&rstr_intern_live);
+#endif
+  free(rie);
+}
+
+#else // USE_RSTR_REFCOUNTING
+
+rstr_t *
+rstr_intern(const char *in)
+{
+  return rstr_alloc(in);
+}
+
+#endif // USE_RSTR_REFCOUNTING
+
 rstr_t *
 rstr_spn(rstr_t *s, const char *set, int offset)
 {
@@ -90,10 +254,18 @@ print_rstr_stats(void)
 	 "  %d frees\n"
 	 "  %d dups\n"
 	 "  %d releases\n",
-	 rstr_allocs,
-	 rstr_frees,
-	 rstr_dups,
-	 rstr_releases);
+	 atomic_get(&rstr_allocs),
+	 atomic_get(&rstr_frees),
+	 atomic_get(&rstr_dups),
+	 atomic_get(&rstr_releases));
+  printf("  %d interned (live)\n"
+         "  %d intern hits\n"
+         "  %d intern misses\n"
+         "  %d bytes saved by interning\n",
+         atomic_get(&rstr_intern_live),
+         atomic_get(&rstr_intern_hits),
+         atomic_get(&rstr_intern_misses),
+         atomic_get(&rstr_intern_bytes_saved));
 }
 
 static void __attribute__((constructor)) rstr_setup(void)
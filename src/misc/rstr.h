@@ -33,16 +33,17 @@
 // #define RSTR_STATS
 
 #ifdef RSTR_STATS
-extern int rstr_allocs;
-extern int rstr_dups;
-extern int rstr_releases;
-extern int rstr_frees;
+extern atomic_t rstr_allocs;
+extern atomic_t rstr_dups;
+extern atomic_t rstr_releases;
+extern atomic_t rstr_frees;
 #endif
 
 
 typedef struct rstr {
 #ifdef USE_RSTR_REFCOUNTING
   atomic_t refcnt;
+  uint8_t interned;
 #endif
   char str[0];
 } rstr_t;
@@ -51,6 +52,18 @@ rstr_t *rstr_alloc(const char *in) attribute_malloc;
 
 rstr_t *rstr_allocl(const char *in, size_t len) attribute_malloc;
 
+/**
+ * Return a shared copy of 'in' from the global intern table. All live
+ * interned rstrs with the same content are the same pointer, so
+ * rstr_eq() on two interned strings never needs to strcmp().
+ *
+ * Worth it for strings that repeat a lot (artist, album, codec names,
+ * etc), not for one-off titles or URLs as every call takes a lock.
+ */
+rstr_t *rstr_intern(const char *in);
+
+void rstr_intern_reclaim(rstr_t *rs);
+
 static __inline const char *rstr_get(const rstr_t *rs)
 {
   return rs ? rs->str : NULL;
@@ -74,7 +87,7 @@ rstr_dup(rstr_t *rs)
   if(rs != NULL)
     atomic_inc(&rs->refcnt);
 #ifdef RSTR_STATS
-  atomic_add(&rstr_dups, 1);
+  atomic_inc(&rstr_dups);
 #endif
   return rs;
 #else // USE_RSTR_REFCOUNTING
@@ -86,13 +99,16 @@ static __inline void rstr_release(rstr_t *rs)
 {
 #ifdef USE_RSTR_REFCOUNTING
 #ifdef RSTR_STATS
-  atomic_add(&rstr_releases, 1);
+  atomic_inc(&rstr_releases);
 #endif
   if(rs != NULL && !atomic_dec(&rs->refcnt)) {
 #ifdef RSTR_STATS
-    atomic_add(&rstr_frees, 1);
+    atomic_inc(&rstr_frees);
 #endif
-    free(rs);
+    if(rs->interned)
+      rstr_intern_reclaim(rs);
+    else
+      free(rs);
   }
 #else // USE_RSTR_REFCOUNTING
   free(rs);
@@ -113,6 +129,12 @@ static __inline int rstr_eq(const rstr_t *a, const rstr_t *b)
     return 1;
   if(a == NULL || b == NULL)
     return 0;
+  if(a == b)
+    return 1;
+#ifdef USE_RSTR_REFCOUNTING
+  if(a->interned && b->interned)
+    return 0;
+#endif
   return !strcmp(rstr_get(a), rstr_get(b));
 }
 
@@ -972,6 +972,70 @@ mystrstr(const char *haystack, const char *needle)
 
 
 
+/**
+ * Write casefolded version of 'src' to 'dst'. If 'dst' is NULL only
+ * the length is computed. Returns length of output excluding the
+ * terminating zero
+ */
+size_t
+utf8_casefold(char *dst, const char *src)
+{
+  size_t len = 0;
+  int c;
+
+  while((c = utf8_get(&src)) != 0)
+    len += utf8_put(dst ? dst + len : NULL, unicode_casefold(c));
+
+  if(dst != NULL)
+    dst[len] = 0;
+  return len;
+}
+
+
+/**
+ * Write a collation key for 'src' to 'dst' such that strcmp() of two
+ * keys has the same sign as dictcmp() of the original strings.
+ *
+ * Characters are casefolded and each run of digits is written as '0',
+ * the number of significant digits and then the digits themselves.
+ * If 'dst' is NULL only the length is computed.
+ */
+size_t
+dictcmp_key(char *dst, const char *src)
+{
+  size_t len = 0;
+  int c;
+
+  src = no_the(src);
+
+  while((c = utf8_get(&src)) != 0) {
+    if(c >= '0' && c <= '9') {
+      const char *digits = src - 1;
+      while(*digits == '0' && digits[1] >= '0' && digits[1] <= '9')
+        digits++;
+      while(*src >= '0' && *src <= '9')
+        src++;
+      int n = src - digits;
+      if(n > 255)
+        n = 255;
+      if(dst != NULL) {
+        dst[len] = '0';
+        dst[len + 1] = n;
+        memcpy(dst + len + 2, digits, n);
+      }
+      len += 2 + n;
+      continue;
+    }
+    len += utf8_put(dst ? dst + len : NULL, unicode_casefold(c));
+  }
+
+  if(dst != NULL)
+    dst[len] = 0;
+  return len;
+}
+
+
+
 /**
  *
  */
@@ -68,6 +68,10 @@ char *utf8_cleanup(const char *str);
 
 const char *mystrstr(const char *haystack, const char *needle);
 
+size_t utf8_casefold(char *dst, const char *src);
+
+size_t dictcmp_key(char *dst, const char *src);
+
 void strvec_addp(char ***str, const char *v);
 
 void strvec_addpn(char ***str, const char *v, size_t len);
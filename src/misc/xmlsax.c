@@ -0,0 +1,604 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+/**
+ * Incremental (push) XML parser
+ *
+ * Input can be fed in arbitrary pieces (typically as it's received
+ * from the network). Only the currently incomplete markup is buffered,
+ * character data is passed on as soon as it has been seen so memory
+ * usage does not depend on the size of the document.
+ *
+ * Supports the same subset as htsmsg_xml.c: UTF-8 and ISO-8859-1
+ * encodings, comments, processing instructions, CDATA sections and
+ * label and character references. DOCTYPE declarations are skipped.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+#include "xmlsax.h"
+#include "str.h"
+#include "minmax.h"
+
+#define XS_MAX_MARKUP  (1024 * 1024) // Max size of a tag, comment, etc
+#define XS_MAX_ATTRIBS 32
+#define XS_MAX_REFLEN  32
+
+enum {
+  XS_ENCODING_UTF8,
+  XS_ENCODING_8859_1,
+};
+
+struct xml_sax {
+  const xml_sax_callbacks_t *xs_cb;
+  void *xs_opaque;
+
+  char *xs_buf;        // Input not yet consumed
+  size_t xs_len;
+  size_t xs_size;
+  int64_t xs_offset;   // Document offset of xs_buf[0]
+
+  char *xs_tmp;        // Scratch space for decoded attributes
+  size_t xs_tmp_size;
+
+  int xs_depth;
+  char xs_encoding;
+  char xs_in_cdata;
+  char xs_got_root;
+  char xs_bom_checked;
+
+  char xs_errmsg[128];
+};
+
+
+/**
+ *
+ */
+static void
+xs_err(xml_sax_t *xs, const char *pos, const char *fmt, ...)
+{
+  char tmp[100];
+  va_list ap;
+
+  if(xs->xs_errmsg[0])
+    return;
+
+  va_start(ap, fmt);
+  vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+
+  snprintf(xs->xs_errmsg, sizeof(xs->xs_errmsg), "%s at byte %"PRId64,
+           tmp, xs->xs_offset + (pos - xs->xs_buf));
+}
+
+
+/**
+ *
+ */
+static __inline int
+is_xmlws(char c)
+{
+  return c > 0 && c <= 32;
+}
+
+
+/**
+ *
+ */
+static const char *
+xs_local_name(const char *name)
+{
+  const char *s;
+  if(!strncmp(name, "xmlns", 5) || (s = strrchr(name, ':')) == NULL)
+    return name;
+  return s + 1;
+}
+
+
+/**
+ *
+ */
+static char *
+xs_find(char *p, const char *end, const char *needle, size_t len)
+{
+  while(end - p >= len) {
+    if((p = memchr(p, needle[0], end - p - len + 1)) == NULL)
+      return NULL;
+    if(!memcmp(p, needle, len))
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+
+/**
+ * Decode a reference, 'src' points to the name (after '&') and 'len'
+ * is the length of it (excluding ';')
+ */
+static int
+xs_decode_ref(const char *src, size_t len)
+{
+  char name[XS_MAX_REFLEN];
+
+  if(len < 1 || len >= sizeof(name))
+    return -1;
+
+  memcpy(name, src, len);
+  name[len] = 0;
+  int c = html_entity_lookup(name);
+  return c > 0 && c < 0x110000 ? c : -1;
+}
+
+
+/**
+ *
+ */
+static void
+xs_emit(xml_sax_t *xs, const char *str, size_t len)
+{
+  if(len == 0 || xs->xs_depth == 0 || xs->xs_cb->xsc_cdata == NULL)
+    return;
+  xs->xs_cb->xsc_cdata(xs->xs_opaque, str, len);
+}
+
+
+/**
+ * Emit character data from the document, converting to UTF-8 if needed
+ */
+static void
+xs_emit_text(xml_sax_t *xs, const char *str, size_t len)
+{
+  char tmp[1024];
+
+  if(xs->xs_encoding == XS_ENCODING_UTF8) {
+    xs_emit(xs, str, len);
+    return;
+  }
+
+  while(len > 0) {
+    size_t o = 0;
+    while(len > 0 && o < sizeof(tmp) - 2) {
+      o += utf8_put(tmp + o, (uint8_t)*str++);
+      len--;
+    }
+    xs_emit(xs, tmp, o);
+  }
+}
+
+
+/**
+ * Decode an attribute value. The output buffer must be twice the size
+ * of the input (ISO-8859-1 to UTF-8 conversion)
+ */
+static int
+xs_decode(xml_sax_t *xs, char *dst, const char *s, const char *e)
+{
+  char *d = dst;
+  const char *q;
+  int c;
+
+  while(s < e) {
+    if(*s == '&') {
+      if((q = memchr(s, ';', e - s)) == NULL ||
+         (c = xs_decode_ref(s + 1, q - s - 1)) == -1) {
+        xs_err(xs, s, "Invalid reference in attribute value");
+        return -1;
+      }
+      d += utf8_put(d, c);
+      s = q + 1;
+    } else if(xs->xs_encoding == XS_ENCODING_8859_1) {
+      d += utf8_put(d, (uint8_t)*s++);
+    } else {
+      *d++ = *s++;
+    }
+  }
+  *d = 0;
+  return d - dst;
+}
+
+
+/**
+ * Processing instruction, only used to figure out encoding
+ */
+static void
+xs_pi(xml_sax_t *xs, char *s, char *e)
+{
+  char *v, quote;
+
+  *e = 0;
+  if(strncmp(s, "xml", 3) || !is_xmlws(s[3]))
+    return;
+
+  if((v = strstr(s, "encoding")) == NULL)
+    return;
+  v += strlen("encoding");
+  while(is_xmlws(*v))
+    v++;
+  if(*v++ != '=')
+    return;
+  while(is_xmlws(*v))
+    v++;
+  quote = *v++;
+  if(quote != '"' && quote != '\'')
+    return;
+
+  if(!strncasecmp(v, "iso-8859-1", 10) ||
+     !strncasecmp(v, "iso-8859_1", 10) ||
+     !strncasecmp(v, "iso_8859-1", 10) ||
+     !strncasecmp(v, "iso_8859_1", 10))
+    xs->xs_encoding = XS_ENCODING_8859_1;
+}
+
+
+/**
+ * Start tag, 's' points after '<' and 'e' at '>'
+ */
+static int
+xs_tag(xml_sax_t *xs, char *s, char *e)
+{
+  const char *attrs[XS_MAX_ATTRIBS * 2 + 1];
+  char *name = s, *name_end, *an, *an_end, *av, *tmp;
+  int empty = 0, na = 0, l;
+  char quote;
+
+  if(e > s && e[-1] == '/') {
+    empty = 1;
+    e--;
+  }
+
+  while(s < e && !is_xmlws(*s))
+    s++;
+
+  if(s == name) {
+    xs_err(xs, name, "Invalid tag name");
+    return -1;
+  }
+  name_end = s;
+
+  // Decoded values can't be more than twice the size of the input
+  l = 2 * (e - s) + XS_MAX_ATTRIBS;
+  if(xs->xs_tmp_size < l) {
+    xs->xs_tmp_size = l;
+    free(xs->xs_tmp);
+    xs->xs_tmp = malloc(l);
+  }
+  tmp = xs->xs_tmp;
+
+  while(1) {
+    while(s < e && is_xmlws(*s))
+      s++;
+    if(s == e)
+      break;
+
+    an = s;
+    while(s < e && *s != '=' && !is_xmlws(*s))
+      s++;
+    an_end = s;
+
+    while(s < e && is_xmlws(*s))
+      s++;
+    if(s == e || *s != '=') {
+      xs_err(xs, s, "Expected '=' in attribute parsing");
+      return -1;
+    }
+    s++;
+    while(s < e && is_xmlws(*s))
+      s++;
+
+    if(s == e || (*s != '"' && *s != '\'')) {
+      xs_err(xs, s, "Expected ' or \" before attribute value");
+      return -1;
+    }
+    quote = *s++;
+    av = s;
+    while(s < e && *s != quote)
+      s++;
+    if(s == e) {
+      xs_err(xs, av, "Unterminated attribute value");
+      return -1;
+    }
+
+    if(na < XS_MAX_ATTRIBS) {
+      if((l = xs_decode(xs, tmp, av, s)) < 0)
+        return -1;
+      *an_end = 0;
+      attrs[na * 2 + 0] = xs_local_name(an);
+      attrs[na * 2 + 1] = tmp;
+      tmp += l + 1;
+      na++;
+    }
+    s++;
+  }
+
+  attrs[na * 2] = NULL;
+  *name_end = 0;
+  name = (char *)xs_local_name(name);
+
+  xs->xs_got_root = 1;
+  xs->xs_depth++;
+  if(xs->xs_cb->xsc_start != NULL)
+    xs->xs_cb->xsc_start(xs->xs_opaque, name, attrs);
+
+  if(empty) {
+    xs->xs_depth--;
+    if(xs->xs_cb->xsc_end != NULL)
+      xs->xs_cb->xsc_end(xs->xs_opaque, name);
+  }
+  return 0;
+}
+
+
+/**
+ * End tag, 's' points after '</' and 'e' at '>'
+ */
+static int
+xs_end_tag(xml_sax_t *xs, char *s, char *e)
+{
+  if(xs->xs_depth == 0) {
+    xs_err(xs, s, "Unexpected close tag");
+    return -1;
+  }
+
+  while(e > s && is_xmlws(e[-1]))
+    e--;
+  *e = 0;
+
+  xs->xs_depth--;
+  if(xs->xs_cb->xsc_end != NULL)
+    xs->xs_cb->xsc_end(xs->xs_opaque, xs_local_name(s));
+  return 0;
+}
+
+
+/**
+ * Parse markup starting at 'p' (which points to '<')
+ *
+ * Returns pointer to first byte after the markup or NULL if more
+ * data is needed (or an error occured)
+ */
+static char *
+xs_markup(xml_sax_t *xs, char *p, char *end, int eof)
+{
+  size_t avail = end - p;
+  char *q, quote = 0;
+  int depth = 0;
+
+  if(avail < 2)
+    goto more;
+
+  switch(p[1]) {
+  case '!':
+    if(avail < 9 && !memcmp(p, "<![CDATA[", avail))
+      goto more;
+
+    if(avail >= 9 && !memcmp(p, "<![CDATA[", 9)) {
+      xs->xs_in_cdata = 1;
+      return p + 9;
+    }
+
+    if(avail < 4)
+      goto more;
+
+    if(p[2] == '-' && p[3] == '-') {
+      if((q = xs_find(p + 4, end, "-->", 3)) == NULL)
+        goto more;
+      return q + 3;
+    }
+
+    // <!DOCTYPE and friends. Skip, including any internal subset
+    for(q = p + 2; q < end; q++) {
+      if(*q == '[')
+        depth++;
+      else if(*q == ']')
+        depth--;
+      else if(*q == '>' && depth <= 0)
+        return q + 1;
+    }
+    goto more;
+
+  case '?':
+    if((q = xs_find(p + 2, end, "?>", 2)) == NULL)
+      goto more;
+    xs_pi(xs, p + 2, q);
+    return q + 2;
+
+  case '/':
+    if((q = memchr(p + 2, '>', avail - 2)) == NULL)
+      goto more;
+    return xs_end_tag(xs, p + 2, q) ? NULL : q + 1;
+
+  default:
+    for(q = p + 1; q < end; q++) {
+      if(quote) {
+        if(*q == quote)
+          quote = 0;
+      } else if(*q == '"' || *q == '\'') {
+        quote = *q;
+      } else if(*q == '>') {
+        return xs_tag(xs, p + 1, q) ? NULL : q + 1;
+      }
+    }
+    goto more;
+  }
+
+ more:
+  if(eof)
+    xs_err(xs, p, "Unexpected end of file inside markup");
+  else if(avail > XS_MAX_MARKUP)
+    xs_err(xs, p, "Markup too long");
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+xs_process(xml_sax_t *xs, int eof)
+{
+  char *p = xs->xs_buf, *end = p + xs->xs_len, *q;
+  char u[8];
+  int c;
+
+  if(!xs->xs_bom_checked) {
+    if(xs->xs_len < 3 && !eof)
+      return;
+    if(xs->xs_len >= 3 && !memcmp(p, "\xef\xbb\xbf", 3))
+      p += 3;
+    xs->xs_bom_checked = 1;
+  }
+
+  while(p < end && !xs->xs_errmsg[0]) {
+
+    if(xs->xs_in_cdata) {
+      if((q = xs_find(p, end, "]]>", 3)) == NULL) {
+        // Hold back what might be the start of the terminator
+        q = MAX(p, end - 2);
+        xs_emit_text(xs, p, q - p);
+        p = q;
+        break;
+      }
+      xs_emit_text(xs, p, q - p);
+      p = q + 3;
+      xs->xs_in_cdata = 0;
+      continue;
+    }
+
+    if(*p == '<') {
+      if((q = xs_markup(xs, p, end, eof)) == NULL)
+        break;
+      p = q;
+      continue;
+    }
+
+    if(*p == '&') {
+      if((q = memchr(p, ';', MIN(end - p, XS_MAX_REFLEN))) == NULL) {
+        if(end - p < XS_MAX_REFLEN && !eof)
+          break;
+        xs_err(xs, p, "Unterminated reference");
+        break;
+      }
+      if((c = xs_decode_ref(p + 1, q - p - 1)) == -1) {
+        xs_err(xs, p, "Invalid reference");
+        break;
+      }
+      xs_emit(xs, u, utf8_put(u, c));
+      p = q + 1;
+      continue;
+    }
+
+    for(q = p; q < end && *q != '<' && *q != '&'; q++) {}
+    xs_emit_text(xs, p, q - p);
+    p = q;
+  }
+
+  xs->xs_offset += p - xs->xs_buf;
+  xs->xs_len = end - p;
+  memmove(xs->xs_buf, p, xs->xs_len);
+}
+
+
+/**
+ *
+ */
+xml_sax_t *
+xml_sax_create(const xml_sax_callbacks_t *cb, void *opaque)
+{
+  xml_sax_t *xs = calloc(1, sizeof(xml_sax_t));
+  xs->xs_cb = cb;
+  xs->xs_opaque = opaque;
+  xs->xs_size = 4096;
+  xs->xs_buf = malloc(xs->xs_size);
+  return xs;
+}
+
+
+/**
+ * Returns -1 if the document is malformed (or a callback has called
+ * xml_sax_fail()). The error can be retrieved using xml_sax_finish()
+ */
+int
+xml_sax_feed(xml_sax_t *xs, const void *data, size_t len)
+{
+  if(xs->xs_errmsg[0])
+    return -1;
+
+  if(xs->xs_len + len > xs->xs_size) {
+    xs->xs_size = MAX(xs->xs_len + len, xs->xs_size * 2);
+    xs->xs_buf = realloc(xs->xs_buf, xs->xs_size);
+  }
+  memcpy(xs->xs_buf + xs->xs_len, data, len);
+  xs->xs_len += len;
+
+  xs_process(xs, 0);
+  return xs->xs_errmsg[0] ? -1 : 0;
+}
+
+
+/**
+ * Signal end of document. Returns 0 if the document was well formed
+ */
+int
+xml_sax_finish(xml_sax_t *xs, char *errbuf, size_t errlen)
+{
+  if(!xs->xs_errmsg[0]) {
+    xs_process(xs, 1);
+
+    if(xs->xs_in_cdata)
+      xs_err(xs, xs->xs_buf, "Unexpected end of file inside CDATA");
+    else if(xs->xs_depth > 0)
+      xs_err(xs, xs->xs_buf, "Unexpected end of file, %d unclosed tags",
+             xs->xs_depth);
+    else if(!xs->xs_got_root)
+      xs_err(xs, xs->xs_buf, "No root element");
+  }
+
+  if(!xs->xs_errmsg[0])
+    return 0;
+
+  snprintf(errbuf, errlen, "%s", xs->xs_errmsg);
+  return -1;
+}
+
+
+/**
+ * Can be called from callbacks to abort parsing
+ */
+void
+xml_sax_fail(xml_sax_t *xs, const char *msg)
+{
+  if(!xs->xs_errmsg[0])
+    snprintf(xs->xs_errmsg, sizeof(xs->xs_errmsg), "%s", msg);
+}
+
+
+/**
+ *
+ */
+void
+xml_sax_destroy(xml_sax_t *xs)
+{
+  free(xs->xs_buf);
+  free(xs->xs_tmp);
+  free(xs);
+}
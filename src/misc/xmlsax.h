@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+#include <stddef.h>
+
+typedef struct xml_sax xml_sax_t;
+
+/**
+ * Callbacks for the streaming XML parser
+ *
+ * Element and attribute names are passed without namespace prefix
+ * (except for xmlns declarations). Attributes are passed as a NULL
+ * terminated array of name, value pairs.
+ *
+ * Character data is UTF-8 with all references decoded. It's delivered
+ * as it arrives so the content of a single element may be split over
+ * several calls
+ */
+typedef struct xml_sax_callbacks {
+  void (*xsc_start)(void *opaque, const char *name, const char **attrs);
+
+  void (*xsc_end)(void *opaque, const char *name);
+
+  void (*xsc_cdata)(void *opaque, const char *str, size_t len);
+
+} xml_sax_callbacks_t;
+
+xml_sax_t *xml_sax_create(const xml_sax_callbacks_t *cb, void *opaque);
+
+int xml_sax_feed(xml_sax_t *xs, const void *data, size_t len);
+
+int xml_sax_finish(xml_sax_t *xs, char *errbuf, size_t errlen);
+
+void xml_sax_fail(xml_sax_t *xs, const char *msg);
+
+void xml_sax_destroy(xml_sax_t *xs);
@@ -131,6 +131,26 @@ void asyncio_send(asyncio_fd_t *af, const void *buf, size_t len, int cork);
 
 void asyncio_sendq(asyncio_fd_t *af, htsbuf_queue_t *q, int cork);
 
+/**
+ * Invoked when the send queue is empty and the socket can take more.
+ * Return non-zero if more data was queued (with cork set) or sent
+ * using asyncio_sendfile()
+ */
+typedef int (asyncio_drain_callback_t)(void *opaque);
+
+void asyncio_set_drain_callback(asyncio_fd_t *af,
+                                asyncio_drain_callback_t *cb);
+
+/**
+ * Send directly from a file descriptor, only valid from within the
+ * drain callback. Returns number of bytes sent, 0 if socket is full
+ * (drain callback will be invoked again once it's writable) or -1 if
+ * not possible (TLS, platform, type of fd) in which case the caller
+ * should read the file and queue the data itself
+ */
+int64_t asyncio_sendfile(asyncio_fd_t *af, int fd, int64_t offset,
+                         int64_t len);
+
 int asyncio_get_port(asyncio_fd_t *af);
 
 void asyncio_set_timeout_delta_sec(asyncio_fd_t *af, int seconds);
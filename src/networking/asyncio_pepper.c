@@ -56,6 +56,7 @@ struct asyncio_fd {
   };
 
   asyncio_read_callback_t *af_read_callback;
+  asyncio_drain_callback_t *af_drain_callback;
 
   htsbuf_queue_t af_sendq;
   htsbuf_queue_t af_recvq;
@@ -578,8 +579,12 @@ tcp_do_write(asyncio_fd_t *af)
     return;
 
   const htsbuf_data_t *hd = TAILQ_FIRST(&af->af_sendq.hq_q);
-  if(hd == NULL)
-    return;
+  if(hd == NULL) {
+    if(af->af_drain_callback == NULL || !af->af_drain_callback(af->af_opaque))
+      return;
+    if((hd = TAILQ_FIRST(&af->af_sendq.hq_q)) == NULL)
+      return;
+  }
 
   int size = hd->hd_data_len - hd->hd_data_off;
   assert(size > 0);
@@ -618,6 +623,26 @@ asyncio_sendq(asyncio_fd_t *af, htsbuf_queue_t *q, int cork)
 }
 
 
+/**
+ *
+ */
+void
+asyncio_set_drain_callback(asyncio_fd_t *af, asyncio_drain_callback_t *cb)
+{
+  af->af_drain_callback = cb;
+}
+
+
+/**
+ * No sendfile() in pepper, caller will queue data instead
+ */
+int64_t
+asyncio_sendfile(asyncio_fd_t *af, int fd, int64_t offset, int64_t len)
+{
+  return -1;
+}
+
+
 /**
  *
  */
@@ -26,6 +26,10 @@
 #include <errno.h>
 #include <netinet/in.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 #include "main.h"
 #include "arch/arch.h"
 #include "arch/threads.h"
@@ -116,6 +120,7 @@ struct asyncio_fd {
 
 
   asyncio_read_callback_t *af_read_callback;
+  asyncio_drain_callback_t *af_drain_callback;
 
   htsbuf_queue_t af_sendq;
   htsbuf_queue_t af_recvq;
@@ -139,6 +144,7 @@ struct asyncio_fd {
   int af_suspended : 1;
   int af_bind_any : 1;
   int af_broadcast : 1;
+  int af_drain_blocked : 1;
 
 #if ENABLE_OPENSSL
   int af_ssl_read_status;
@@ -899,20 +905,30 @@ do_write(asyncio_fd_t *af)
   }
 #endif
 
-  char tmp[1024];
+  const htsbuf_data_t *hd;
 
   while(1) {
-    int avail = htsbuf_peek(&af->af_sendq, tmp, sizeof(tmp));
-    if(avail == 0) {
+    hd = TAILQ_FIRST(&af->af_sendq.hq_q);
+    if(hd == NULL) {
+      if(af->af_drain_callback != NULL) {
+        af->af_drain_blocked = 0;
+        if(af->af_drain_callback(af->af_opaque))
+          continue;
+        if(af->af_drain_blocked)
+          break;
+      }
       // Nothing more to send
       asyncio_rem_events(af, ASYNCIO_WRITE);
       return;
     }
 
+    // Send straight from the queue, no need to copy
+    int avail = hd->hd_data_len - hd->hd_data_off;
+    const void *ptr = hd->hd_data + hd->hd_data_off;
 #ifdef MSG_NOSIGNAL
-    int r = send(af->af_fd, tmp, avail, MSG_NOSIGNAL);
+    int r = send(af->af_fd, ptr, avail, MSG_NOSIGNAL);
 #else
-    int r = send(af->af_fd, tmp, avail, 0);
+    int r = send(af->af_fd, ptr, avail, 0);
 #endif
     if(r == 0)
       break;
@@ -1079,6 +1095,56 @@ asyncio_sendq(asyncio_fd_t *af, htsbuf_queue_t *q, int cork)
 }
 
 
+/**
+ *
+ */
+void
+asyncio_set_drain_callback(asyncio_fd_t *af, asyncio_drain_callback_t *cb)
+{
+  asyncio_verify_thread();
+  af->af_drain_callback = cb;
+}
+
+
+/**
+ *
+ */
+int64_t
+asyncio_sendfile(asyncio_fd_t *af, int fd, int64_t offset, int64_t len)
+{
+  asyncio_verify_thread();
+  assert(TAILQ_FIRST(&af->af_sendq.hq_q) == NULL);
+
+#if ENABLE_OPENSSL
+  if(af->af_ssl != NULL)
+    return -1;
+#endif
+
+#if defined(__linux__)
+  off_t off = offset;
+  ssize_t r = sendfile(af->af_fd, fd, &off, MIN(len, 0x7ffff000));
+  if(r > 0)
+    return r;
+
+  if(r == 0)
+    return -1; // File is shorter than expected, let caller deal with it
+
+  if(errno == EAGAIN || errno == EWOULDBLOCK) {
+    af->af_drain_blocked = 1;
+    return 0;
+  }
+
+  if(errno == EINVAL || errno == ENOSYS)
+    return -1;
+
+  af->af_pending_errno = errno;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+
 /**
  *
  */
@@ -1699,7 +1765,13 @@ asyncio_ssl_write(asyncio_fd_t *af)
 
   af->af_ssl_write_status = 0;
 
-  while((hd = TAILQ_FIRST(&q->hq_q)) != NULL) {
+  while(1) {
+
+    if((hd = TAILQ_FIRST(&q->hq_q)) == NULL) {
+      if(af->af_drain_callback != NULL && af->af_drain_callback(af->af_opaque))
+        continue;
+      return;
+    }
 
     len = hd->hd_data_len - hd->hd_data_off;
     assert(len > 0);
@@ -34,13 +34,16 @@ typedef enum {
 
 
 #define HTTP_STATUS_OK           200
+#define HTTP_STATUS_PARTIAL_CONTENT 206
 #define HTTP_STATUS_FOUND        302
+#define HTTP_STATUS_NOT_MODIFIED 304
 #define HTTP_STATUS_BAD_REQUEST  400
 #define HTTP_STATUS_UNAUTHORIZED 401
 #define HTTP_STATUS_NOT_FOUND    404
 #define HTTP_STATUS_METHOD_NOT_ALLOWED 405
 #define HTTP_STATUS_PRECONDITION_FAILED 412
 #define HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE 415
+#define HTTP_STATUS_RANGE_NOT_SATISFIABLE 416
 #define HTTP_NOT_IMPLEMENTED 501
 
 LIST_HEAD(http_header_list, http_header);
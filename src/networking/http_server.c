@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <libavutil/base64.h>
 
@@ -36,9 +37,14 @@
 #include "websocket.h"
 #include "upnp/upnp.h"
 #include "misc/bytestream.h"
+#include "misc/minmax.h"
+#include "fileaccess/fileaccess.h"
+
+#define HTTP_FILE_CHUNK (64 * 1024)
 
 static LIST_HEAD(, http_path) http_paths;
 static HTS_LWMUTEX_DECL(http_paths_lwmutex);
+static atomic_t http_paths_generation;
 
 LIST_HEAD(http_connection_list, http_connection);
 int http_server_port;
@@ -65,6 +71,37 @@ struct http_path {
 };
 
 
+/**
+ * Radix tree node. Labels point into hp_path of paths retained by
+ * the router so they don't need to be copied
+ */
+typedef struct http_route_node {
+  struct http_route_node *hrn_child;
+  struct http_route_node *hrn_sibling;
+  const char *hrn_label;
+  int hrn_label_len;
+  http_path_t *hrn_path;  // Path ending at this node
+} http_route_node_t;
+
+
+/**
+ * Immutable snapshot of all registered paths
+ *
+ * Requests are only dispatched on the asyncio thread so that's the
+ * only place the router is used. Registration just bumps
+ * http_paths_generation and the router is rebuilt on next lookup,
+ * thus lookups never need to take a lock
+ */
+typedef struct http_router {
+  http_route_node_t hr_root;
+  http_path_t **hr_paths;
+  int hr_num_paths;
+  int hr_generation;
+} http_router_t;
+
+static http_router_t *http_router;
+
+
 /**
  *
  */
@@ -118,6 +155,17 @@ struct http_connection {
 
   asyncio_timer_t hc_ws_timeout;
   int hc_ws_missing_ping;
+
+  /**
+   * File being streamed by http_send_file(). Further input is held
+   * back in hc_input until it's all sent
+   */
+  fa_handle_t *hc_file;
+  int hc_file_fd;  // For sendfile(), -1 if we need to read it ourselves
+  int64_t hc_file_offset;
+  int64_t hc_file_remain;
+  asyncio_timer_t hc_file_timer;
+  htsbuf_queue_t *hc_input;
 };
 
 static struct http_connection_list http_connections;
@@ -150,6 +198,10 @@ static int http_write(http_connection_t *hc);
 
 static void http_ws_send_ping(void *aux);
 
+static void http_io_read(void *opaque, htsbuf_queue_t *q);
+
+static void http_close(http_connection_t *hc);
+
 /**
  *
  */
@@ -175,15 +227,6 @@ http_path_retain(http_path_t *hp)
 }
 
 
-/**
- *
- */
-static int
-hp_cmp(const http_path_t *a, const http_path_t *b)
-{
-  return b->hp_len - a->hp_len;
-}
-
 /**
  * Add a callback for a given "virtual path" on our HTTP server
  */
@@ -199,7 +242,8 @@ http_path_add(const char *path, void *opaque, http_callback_t *callback,
   hp->hp_callback = callback;
   hp->hp_mode = !!leaf;
   hts_lwmutex_lock(&http_paths_lwmutex);
-  LIST_INSERT_SORTED(&http_paths, hp, hp_link, hp_cmp, http_path_t);
+  LIST_INSERT_HEAD(&http_paths, hp, hp_link);
+  atomic_inc(&http_paths_generation);
   hts_lwmutex_unlock(&http_paths_lwmutex);
   return hp;
 }
@@ -228,6 +272,7 @@ http_add_websocket(const char *path,
   hp->hp_mode = HTTP_PATH_MODE_WEBSOCKET;
   hts_lwmutex_lock(&http_paths_lwmutex);
   LIST_INSERT_HEAD(&http_paths, hp, hp_link);
+  atomic_inc(&http_paths_generation);
   hts_lwmutex_unlock(&http_paths_lwmutex);
   return hp;
 }
@@ -257,10 +302,155 @@ http_path_remove(struct http_path *hp)
 {
   hts_lwmutex_lock(&http_paths_lwmutex);
   LIST_REMOVE(hp, hp_link);
+  atomic_inc(&http_paths_generation);
   hts_lwmutex_unlock(&http_paths_lwmutex);
   http_path_release(hp);
 }
 
+
+/**
+ *
+ */
+static void
+http_route_insert(http_route_node_t *n, const char *s, http_path_t *hp)
+{
+  http_route_node_t *c;
+  int i;
+
+  while(*s) {
+    for(c = n->hrn_child; c != NULL; c = c->hrn_sibling)
+      if(c->hrn_label[0] == *s)
+        break;
+
+    if(c == NULL) {
+      c = calloc(1, sizeof(http_route_node_t));
+      c->hrn_label = s;
+      c->hrn_label_len = strlen(s);
+      c->hrn_sibling = n->hrn_child;
+      n->hrn_child = c;
+      n = c;
+      break;
+    }
+
+    for(i = 1; i < c->hrn_label_len && s[i] == c->hrn_label[i]; i++) {}
+
+    if(i < c->hrn_label_len) {
+      // Split edge
+      http_route_node_t *tail = calloc(1, sizeof(http_route_node_t));
+      tail->hrn_label = c->hrn_label + i;
+      tail->hrn_label_len = c->hrn_label_len - i;
+      tail->hrn_path = c->hrn_path;
+      tail->hrn_child = c->hrn_child;
+      c->hrn_label_len = i;
+      c->hrn_path = NULL;
+      c->hrn_child = tail;
+    }
+    n = c;
+    s += i;
+  }
+
+  // Paths are inserted most recently added first, and that one wins
+  if(n->hrn_path == NULL)
+    n->hrn_path = hp;
+}
+
+
+/**
+ *
+ */
+static void
+http_route_free(http_route_node_t *n)
+{
+  http_route_node_t *c, *next;
+  for(c = n->hrn_child; c != NULL; c = next) {
+    next = c->hrn_sibling;
+    http_route_free(c);
+    free(c);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+http_router_destroy(http_router_t *hr)
+{
+  int i;
+  http_route_free(&hr->hr_root);
+  for(i = 0; i < hr->hr_num_paths; i++)
+    http_path_release(hr->hr_paths[i]);
+  free(hr->hr_paths);
+  free(hr);
+}
+
+
+/**
+ *
+ */
+static http_router_t *
+http_router_get(void)
+{
+  const int gen = atomic_get(&http_paths_generation);
+  http_path_t *hp;
+
+  if(http_router != NULL && http_router->hr_generation == gen)
+    return http_router;
+
+  http_router_t *hr = calloc(1, sizeof(http_router_t));
+
+  hts_lwmutex_lock(&http_paths_lwmutex);
+  hr->hr_generation = atomic_get(&http_paths_generation);
+
+  LIST_FOREACH(hp, &http_paths, hp_link)
+    hr->hr_num_paths++;
+
+  hr->hr_paths = malloc(hr->hr_num_paths * sizeof(http_path_t *));
+  hr->hr_num_paths = 0;
+
+  LIST_FOREACH(hp, &http_paths, hp_link) {
+    hr->hr_paths[hr->hr_num_paths++] = http_path_retain(hp);
+    http_route_insert(&hr->hr_root, hp->hp_path, hp);
+  }
+  hts_lwmutex_unlock(&http_paths_lwmutex);
+
+  if(http_router != NULL)
+    http_router_destroy(http_router);
+  http_router = hr;
+  return hr;
+}
+
+
+/**
+ * Find longest registered path that is a prefix of url and ends at
+ * a path component or argument boundary
+ */
+static http_path_t *
+http_route_lookup(const http_route_node_t *n, const char *url)
+{
+  http_path_t *best = NULL;
+  const http_route_node_t *c;
+
+  while(1) {
+    if(n->hrn_path != NULL && (*url == 0 || *url == '/' || *url == '?'))
+      best = n->hrn_path;
+
+    if(*url == 0)
+      break;
+
+    for(c = n->hrn_child; c != NULL; c = c->hrn_sibling)
+      if(c->hrn_label[0] == *url)
+        break;
+
+    if(c == NULL || strncmp(url, c->hrn_label, c->hrn_label_len))
+      break;
+
+    url += c->hrn_label_len;
+    n = c;
+  }
+  return best;
+}
+
 /**
  *
  */
@@ -274,15 +464,7 @@ http_resolve(http_connection_t *hc, char **remainp, char **argsp)
     memcpy(url, "/api", 4);
   }
 
-  LIST_FOREACH(hp, &http_paths, hp_link) {
-    if(!strncmp(url, hp->hp_path, hp->hp_len)) {
-      if(url[hp->hp_len] == 0 ||
-         url[hp->hp_len] == '/' ||
-	 url[hp->hp_len] == '?')
-	break;
-    }
-  }
-
+  hp = http_route_lookup(&http_router_get()->hr_root, url);
   if(hp == NULL)
     return NULL;
 
@@ -329,6 +511,8 @@ http_rc2str(int code)
 {
   switch(code) {
   case HTTP_STATUS_OK:              return "Ok";
+  case HTTP_STATUS_PARTIAL_CONTENT: return "Partial Content";
+  case HTTP_STATUS_NOT_MODIFIED:    return "Not Modified";
   case HTTP_STATUS_NOT_FOUND:       return "Not found";
   case HTTP_STATUS_UNAUTHORIZED:    return "Unauthorized";
   case HTTP_STATUS_BAD_REQUEST:     return "Bad request";
@@ -336,6 +520,7 @@ http_rc2str(int code)
   case HTTP_STATUS_METHOD_NOT_ALLOWED: return "Method not allowed";
   case HTTP_STATUS_PRECONDITION_FAILED: return "Precondition failed";
   case HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE: return "Unsupported media type";
+  case HTTP_STATUS_RANGE_NOT_SATISFIABLE: return "Range not satisfiable";
   case HTTP_NOT_IMPLEMENTED: return "Not implemented";
   case 500: return "Internal Server Error";
   default:
@@ -349,7 +534,7 @@ http_rc2str(int code)
  */
 static void
 http_send_header(http_connection_t *hc, int rc, const char *content,
-		 int contentlen, const char *encoding, const char *location,
+		 int64_t contentlen, const char *encoding, const char *location,
 		 int maxage, const char *range)
 {
   htsbuf_queue_t hdrs;
@@ -397,7 +582,10 @@ http_send_header(http_connection_t *hc, int rc, const char *content,
   if(content != NULL)
     htsbuf_qprintf(&hdrs, "Content-Type: %s\r\n", content);
 
-  htsbuf_qprintf(&hdrs, "Content-Length: %d\r\n", contentlen);
+  htsbuf_qprintf(&hdrs, "Content-Length: %"PRId64"\r\n", contentlen);
+
+  if(range != NULL)
+    htsbuf_qprintf(&hdrs, "Content-Range: %s\r\n", range);
 
   LIST_FOREACH(hh, &hc->hc_response_headers, hh_link)
     htsbuf_qprintf(&hdrs, "%s: %s\r\n", hh->hh_key, hh->hh_value);
@@ -534,6 +722,264 @@ http_redirect(http_connection_t *hc, const char *location)
 }
 
 
+/**
+ * Parse a Range: header
+ *
+ * Returns 1 if range is valid, 0 if it should be ignored (and the
+ * entire file sent) and -1 if it can't be satisfied
+ */
+static int
+http_parse_range(const char *v, int64_t size, int64_t *startp, int64_t *endp)
+{
+  int64_t start, end;
+  char *e;
+
+  // Multiple ranges are allowed to be answered with the entire file
+  if(strncmp(v, "bytes=", 6) || strchr(v, ',') != NULL)
+    return 0;
+
+  v += 6;
+
+  if(*v == '-') {
+    int64_t suffix = strtoll(v + 1, &e, 10);
+    if(e == v + 1 || *e)
+      return 0;
+    if(suffix == 0)
+      return -1;
+    start = MAX(size - suffix, 0);
+    end = size - 1;
+  } else {
+    start = strtoll(v, &e, 10);
+    if(e == v || *e != '-')
+      return 0;
+    v = e + 1;
+    if(*v == 0) {
+      end = size - 1;
+    } else {
+      end = strtoll(v, &e, 10);
+      if(*e || end < start)
+        return 0;
+      end = MIN(end, size - 1);
+    }
+  }
+
+  if(start >= size)
+    return -1;
+
+  *startp = start;
+  *endp = end;
+  return 1;
+}
+
+
+/**
+ *
+ */
+static void
+http_file_close(http_connection_t *hc)
+{
+  fa_close(hc->hc_file);
+  hc->hc_file = NULL;
+}
+
+
+/**
+ * Send a file straight from disk (or whatever fileaccess can open)
+ *
+ * Supports byte ranges and conditional GET. The body is pulled from the
+ * file as the socket drains so memory usage is independent of file size
+ */
+int
+http_send_file(http_connection_t *hc, const char *url, const char *content)
+{
+  char errbuf[256];
+  char etag[64];
+  char date[64];
+  char range[128];
+  struct fa_stat fs;
+  int64_t size, start, end;
+  int rc = HTTP_STATUS_OK;
+  const char *v;
+  time_t t;
+
+  assert(hc->hc_file == NULL);
+
+  fa_handle_t *fh = fa_open(url, errbuf, sizeof(errbuf));
+  if(fh == NULL)
+    return HTTP_STATUS_NOT_FOUND;
+
+  if((size = fa_fsize(fh)) < 0) {
+    fa_close(fh);
+    return http_error(hc, 500, "Size of %s is unknown", url);
+  }
+
+  if(fa_stat(url, &fs, NULL, 0))
+    fs.fs_mtime = 0;
+
+  snprintf(etag, sizeof(etag), "\"%"PRIx64"-%"PRIx64"\"",
+           size, (int64_t)fs.fs_mtime);
+
+  http_set_response_hdr(hc, "ETag", etag);
+  http_set_response_hdr(hc, "Accept-Ranges", "bytes");
+  if(fs.fs_mtime)
+    http_set_response_hdr(hc, "Last-Modified",
+                          http_asctime(fs.fs_mtime, date, sizeof(date)));
+
+  // Conditional GET
+
+  if((v = http_arg_get_hdr(hc, "If-None-Match")) != NULL) {
+    if(!strcmp(v, "*") || strstr(v, etag) != NULL)
+      rc = HTTP_STATUS_NOT_MODIFIED;
+  } else if(fs.fs_mtime &&
+            (v = http_arg_get_hdr(hc, "If-Modified-Since")) != NULL) {
+    if(!http_ctime(&t, v) && fs.fs_mtime <= t)
+      rc = HTTP_STATUS_NOT_MODIFIED;
+  }
+
+  if(rc == HTTP_STATUS_NOT_MODIFIED) {
+    fa_close(fh);
+    http_send_header(hc, rc, NULL, 0, NULL, NULL, 0, NULL);
+    http_write(hc);
+    return 0;
+  }
+
+  // Byte range
+
+  start = 0;
+  end = size - 1;
+
+  v = http_arg_get_hdr(hc, "Range");
+
+  if(v != NULL) {
+    // If-Range says only send the range if file is unchanged
+    const char *ir = http_arg_get_hdr(hc, "If-Range");
+    if(ir != NULL && strcmp(ir, etag) &&
+       (http_ctime(&t, ir) || t != fs.fs_mtime))
+      v = NULL;
+  }
+
+  if(v != NULL) {
+    switch(http_parse_range(v, size, &start, &end)) {
+    case -1:
+      fa_close(fh);
+      snprintf(range, sizeof(range), "bytes */%"PRId64, size);
+      http_send_header(hc, HTTP_STATUS_RANGE_NOT_SATISFIABLE, NULL, 0,
+                       NULL, NULL, 0, range);
+      http_write(hc);
+      return 0;
+
+    case 1:
+      rc = HTTP_STATUS_PARTIAL_CONTENT;
+      snprintf(range, sizeof(range), "bytes %"PRId64"-%"PRId64"/%"PRId64,
+               start, end, size);
+      break;
+    }
+  }
+
+  hc->hc_file_fd = fa_native_fd(fh);
+
+  if(hc->hc_file_fd == -1 && start && fa_seek(fh, start, SEEK_SET) != start) {
+    fa_close(fh);
+    return http_error(hc, 500, "Unable to seek in %s", url);
+  }
+
+  http_send_header(hc, rc, content, end - start + 1, NULL, NULL, 0,
+                   rc == HTTP_STATUS_PARTIAL_CONTENT ? range : NULL);
+
+  if(hc->hc_no_output || end < start) {
+    fa_close(fh);
+  } else {
+    hc->hc_file = fh;
+    hc->hc_file_offset = start;
+    hc->hc_file_remain = end - start + 1;
+  }
+
+  // Body is sent from http_file_drain()
+  http_write(hc);
+  return 0;
+}
+
+
+/**
+ * Called by asyncio when socket wants more data
+ */
+static int
+http_file_drain(void *opaque)
+{
+  http_connection_t *hc = opaque;
+
+  if(hc->hc_file == NULL)
+    return 0;
+
+  if(hc->hc_file_remain == 0) {
+    // Everything handed over to the kernel, continue with next request
+    http_file_close(hc);
+    asyncio_timer_arm(&hc->hc_file_timer, async_current_time());
+    return 0;
+  }
+
+  if(hc->hc_file_fd != -1) {
+    int64_t r = asyncio_sendfile(hc->hc_afd, hc->hc_file_fd,
+                                 hc->hc_file_offset, hc->hc_file_remain);
+    if(r == 0)
+      return 0;
+
+    if(r > 0) {
+      hc->hc_file_offset += r;
+      hc->hc_file_remain -= r;
+      return 1;
+    }
+
+    // Can't sendfile() on this connection, read and queue instead
+    hc->hc_file_fd = -1;
+    if(fa_seek(hc->hc_file, hc->hc_file_offset, SEEK_SET) !=
+       hc->hc_file_offset)
+      goto bad;
+  }
+
+  size_t size = MIN(hc->hc_file_remain, HTTP_FILE_CHUNK);
+  void *buf = malloc(size);
+  int r = fa_read(hc->hc_file, buf, size);
+  if(r <= 0) {
+    free(buf);
+    goto bad;
+  }
+
+  htsbuf_append_prealloc(&hc->hc_output, buf, r);
+  asyncio_sendq(hc->hc_afd, &hc->hc_output, 1);
+  hc->hc_file_offset += r;
+  hc->hc_file_remain -= r;
+  return 1;
+
+ bad:
+  // We've promised a Content-Length we can't deliver, so disconnect
+  TRACE(TRACE_ERROR, "HTTPSRV", "%s -- Read failed at offset %"PRId64,
+        hc->hc_url_orig, hc->hc_file_offset);
+  http_file_close(hc);
+  hc->hc_keep_alive = 0;
+  asyncio_timer_arm(&hc->hc_file_timer, async_current_time());
+  return 0;
+}
+
+
+/**
+ * File is sent, resume processing of input
+ */
+static void
+http_file_done(void *aux)
+{
+  http_connection_t *hc = aux;
+
+  if(!hc->hc_keep_alive) {
+    http_close(hc);
+    return;
+  }
+
+  if(hc->hc_input != NULL && hc->hc_input->hq_size)
+    http_io_read(hc, hc->hc_input);
+}
+
+
 /**
  *
  */
@@ -680,17 +1126,14 @@ http_cmd_get(http_connection_t *hc, http_cmd_t method)
   char *remain;
   char *args;
   int r = 0;
-  hts_lwmutex_lock(&http_paths_lwmutex);
 
   hp = http_resolve(hc, &remain, &args);
   if(hp == NULL || (hp->hp_mode && remain != NULL)) {
-    hts_lwmutex_unlock(&http_paths_lwmutex);
     http_error(hc, HTTP_STATUS_NOT_FOUND, NULL);
     return 0;
   }
 
   hp = http_path_retain(hp);
-  hts_lwmutex_unlock(&http_paths_lwmutex);
 
   if(args != NULL)
     http_parse_uri_args(&hc->hc_req_args, args, 0);
@@ -759,15 +1202,12 @@ http_read_post(http_connection_t *hc, htsbuf_queue_t *q)
       http_parse_uri_args(&hc->hc_req_args, hc->hc_post_data, 0);
   }
 
-  hts_lwmutex_lock(&http_paths_lwmutex);
   hp = http_resolve(hc, &remain, &args);
   if(hp == NULL) {
-    hts_lwmutex_unlock(&http_paths_lwmutex);
     http_error(hc, HTTP_STATUS_NOT_FOUND, NULL);
     return 0;
   }
   hp = http_path_retain(hp);
-  hts_lwmutex_unlock(&http_paths_lwmutex);
   http_exec(hc, hp, remain, HTTP_CMD_POST);
   http_path_release(hp);
   return 0;
@@ -999,6 +1439,12 @@ http_handle_input(http_connection_t *hc, htsbuf_queue_t *q)
 	  return 1;
         }
 
+        if(hc->hc_file != NULL) {
+          // Pipelined requests are dealt with once file is sent
+          free(buf);
+          return 0;
+        }
+
 	if(TAILQ_FIRST(&hc->hc_output.hq_q) == NULL && !hc->hc_keep_alive) {
           free(buf);
 	  return 1;
@@ -1059,6 +1505,10 @@ http_close(http_connection_t *hc)
   free(hc->hc_post_data);
   free(hc->hc_ws.packet);
 
+  if(hc->hc_file != NULL)
+    http_file_close(hc);
+  asyncio_timer_disarm(&hc->hc_file_timer);
+
   if(hc->hc_path != NULL && hc->hc_path->hp_ws_disconnected != NULL)
     hc->hc_path->hp_ws_disconnected(hc, hc->hc_opaque);
 
@@ -1107,6 +1557,11 @@ static void
 http_io_read(void *opaque, htsbuf_queue_t *q)
 {
   http_connection_t *hc = opaque;
+
+  hc->hc_input = q;
+  if(hc->hc_file != NULL)
+    return;
+
   if(http_handle_input(hc, q)) {
     http_close(hc);
     return;
@@ -1150,6 +1605,8 @@ http_accept(void *opaque, int fd, const net_addr_t *local_addr,
 
   hc->hc_afd = asyncio_attach("HTTP connection", fd,
                               http_io_error, http_io_read, hc, opaque);
+  asyncio_set_drain_callback(hc->hc_afd, http_file_drain);
+  asyncio_timer_init(&hc->hc_file_timer, http_file_done, hc);
   htsbuf_queue_init(&hc->hc_output, 0);
 
   hc->hc_local_addr  = *local_addr;
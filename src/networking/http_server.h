@@ -74,6 +74,9 @@ int http_send_reply(http_connection_t *hc, int rc, const char *content,
 		    const char *encoding, const char *location, int maxage,
 		    htsbuf_queue_t *output);
 
+int http_send_file(http_connection_t *hc, const char *url,
+                   const char *content);
+
 int http_send_raw(http_connection_t *hc, int rc, const char *rctxt,
 		  struct http_header_list *headers, htsbuf_queue_t *output);
 
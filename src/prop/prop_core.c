@@ -50,6 +50,9 @@ pool_t *sub_pool;
 pool_t *pot_pool;
 pool_t *psd_pool;
 
+// Strings shorter than this are interned by prop_set_string()
+#define PROP_STRING_INTERN_MAXLEN 16
+
 
 // Global dispatch
 
@@ -119,7 +122,7 @@ propname(prop_t *p)
 rstr_t *
 prop_get_name0(prop_t *p)
 {
-  return p->hp_name ? rstr_alloc(p->hp_name) : NULL;
+  return p->hp_name ? rstr_intern(p->hp_name) : NULL;
 }
 
 
@@ -457,11 +460,12 @@ prop_psd_release(prop_sub_dispatch_t *psd)
 /**
  *
  */
-void
-prop_sub_ref_dec_locked(prop_sub_t *s)
+static void
+prop_sub_release0(prop_sub_t *s)
 {
-  if(atomic_dec(&s->hps_refcount))
-    return;
+  if(s->hps_prof != NULL)
+    prop_profile_sub_release(s);
+
   s->hps_lockmgr(s->hps_lock, LOCKMGR_RELEASE);
 
   if(s->hps_dispatch_mode == PROP_SUB_DISPATCH_MODE_GROUP) {
@@ -472,6 +476,32 @@ prop_sub_ref_dec_locked(prop_sub_t *s)
 }
 
 
+/**
+ *
+ */
+void
+prop_sub_ref_dec_locked(prop_sub_t *s)
+{
+  if(atomic_dec(&s->hps_refcount))
+    return;
+  prop_sub_release0(s);
+}
+
+
+/**
+ * Only grabs prop_mutex if this was the last reference
+ */
+void
+prop_sub_ref_dec(prop_sub_t *s)
+{
+  if(atomic_dec(&s->hps_refcount))
+    return;
+  hts_mutex_lock(&prop_mutex);
+  prop_sub_release0(s);
+  hts_mutex_unlock(&prop_mutex);
+}
+
+
 /**
  *
  */
@@ -564,6 +594,18 @@ prop_notify_free(prop_notify_t *n)
 }
 
 
+/**
+ * Release a dispatched notification (payload already consumed).
+ * Does not need prop_mutex as notify_pool is thread cached
+ */
+void
+prop_notify_release(prop_notify_t *n)
+{
+  prop_sub_ref_dec(n->hpn_sub);
+  pool_put(notify_pool, n);
+}
+
+
 /**
  *
  */
@@ -935,11 +977,20 @@ prop_dispatch_one(prop_notify_t *n, int lockmode)
     if(s->hps_lock != NULL)
       s->hps_lockmgr(s->hps_lock, 0);
 
+    if(n->hpn_ts)
+      prop_profile_dispatched(s, n, 0, 0);
+
     prop_notify_free_payload(n);
     return 0;
   }
 
-  notify_invoke(s, n);
+  if(n->hpn_ts) {
+    int64_t t0 = arch_get_ts();
+    notify_invoke(s, n);
+    prop_profile_dispatched(s, n, t0, arch_get_ts());
+  } else {
+    notify_invoke(s, n);
+  }
 
   if(s->hps_lock != NULL)
     s->hps_lockmgr(s->hps_lock, 0);
@@ -979,15 +1030,57 @@ prop_notify_dispatch(struct prop_notify_queue *q, const char *trace_name)
       prop_dispatch_one(n, LOCKMGR_LOCK);
   }
 
-  hts_mutex_lock(&prop_mutex);
-
   for(n = TAILQ_FIRST(q); n != NULL; n = next) {
     next = TAILQ_NEXT(n, hpn_link);
+    prop_notify_release(n);
+  }
+}
 
-    prop_sub_ref_dec_locked(n->hpn_sub);
-    pool_put(notify_pool, n);
+
+/**
+ * Move all notifications in 'inbox' to the tail of 'q' in the order
+ * they were pushed
+ */
+static void
+courier_inbox_drain(struct prop_notify **inbox, struct prop_notify_queue *q)
+{
+  prop_notify_t *n, *next, *fifo = NULL;
+
+  if(*(struct prop_notify * volatile *)inbox == NULL)
+    return;
+
+  for(n = atomic_ptr_xchg((void **)inbox, NULL); n != NULL; n = next) {
+    next = n->hpn_inbox_next;
+    n->hpn_inbox_next = fifo;
+    fifo = n;
+  }
+
+  for(n = fifo; n != NULL; n = next) {
+    next = n->hpn_inbox_next;
+    TAILQ_INSERT_TAIL(q, n, hpn_link);
   }
-  hts_mutex_unlock(&prop_mutex);
+}
+
+
+/**
+ * Must only be called by the thread consuming the courier
+ */
+void
+prop_courier_collect(prop_courier_t *pc)
+{
+  courier_inbox_drain(&pc->pc_inbox_exp, &pc->pc_queue_exp);
+  courier_inbox_drain(&pc->pc_inbox_nor, &pc->pc_queue_nor);
+}
+
+
+/**
+ *
+ */
+static int
+courier_inbox_empty(prop_courier_t *pc)
+{
+  return *(struct prop_notify * volatile *)&pc->pc_inbox_exp == NULL &&
+    *(struct prop_notify * volatile *)&pc->pc_inbox_nor == NULL;
 }
 
 
@@ -1004,14 +1097,18 @@ prop_courier(void *aux)
 
   if(pc->pc_prologue)
     pc->pc_prologue();
-  
-  hts_mutex_lock(&prop_mutex);
 
   while(pc->pc_run) {
 
+    prop_courier_collect(pc);
+
     if(TAILQ_FIRST(&pc->pc_queue_exp) == NULL &&
        TAILQ_FIRST(&pc->pc_queue_nor) == NULL) {
-      hts_cond_wait(&pc->pc_cond, &prop_mutex);
+      // Producers push and signal with prop_mutex held
+      hts_mutex_lock(&prop_mutex);
+      if(pc->pc_run && courier_inbox_empty(pc))
+        hts_cond_wait(&pc->pc_cond, &prop_mutex);
+      hts_mutex_unlock(&prop_mutex);
       continue;
     }
 
@@ -1026,12 +1123,14 @@ prop_courier(void *aux)
 
     const char *tt = pc->pc_flags & PROP_COURIER_TRACE_TIMES ?
       pc->pc_name : NULL;
-    hts_mutex_unlock(&prop_mutex);
     prop_notify_dispatch(&q_exp, tt);
     prop_notify_dispatch(&q_nor, tt);
-    hts_mutex_lock(&prop_mutex);
   }
 
+  hts_mutex_lock(&prop_mutex);
+
+  prop_courier_collect(pc);
+
   while((n = TAILQ_FIRST(&pc->pc_queue_exp)) != NULL) {
     TAILQ_REMOVE(&pc->pc_queue_exp, n, hpn_link);
     prop_notify_free(n);
@@ -1042,8 +1141,11 @@ prop_courier(void *aux)
     prop_notify_free(n);
   }
 
-  if(pc->pc_detached)
+  if(pc->pc_detached) {
+    if(pc->pc_prof != NULL)
+      prop_profile_courier_destroy(pc);
     free(pc);
+  }
 
   hts_mutex_unlock(&prop_mutex);
 
@@ -1197,14 +1299,21 @@ courier_enqueue0(prop_sub_t *s, prop_notify_t *n, int expedite)
   prop_courier_t *pc;
   prop_sub_dispatch_t *psd;
 
+  if(prop_profile_enabled)
+    prop_profile_enqueue(s, n);
+
   switch(s->hps_dispatch_mode) {
   case PROP_SUB_DISPATCH_MODE_COURIER:
     pc = s->hps_dispatch;
 
-    if(expedite)
-      TAILQ_INSERT_TAIL(&pc->pc_queue_exp, n, hpn_link);
-    else
-      TAILQ_INSERT_TAIL(&pc->pc_queue_nor, n, hpn_link);
+    struct prop_notify **inbox =
+      expedite ? &pc->pc_inbox_exp : &pc->pc_inbox_nor;
+    prop_notify_t *head;
+
+    do {
+      head = *(struct prop_notify * volatile *)inbox;
+      n->hpn_inbox_next = head;
+    } while(!atomic_ptr_cas((void **)inbox, head, n));
 
     courier_notify(pc);
     break;
@@ -1254,6 +1363,7 @@ prop_get_notify(prop_sub_t *s)
   prop_notify_t *n = pool_get(notify_pool);
   atomic_inc(&s->hps_refcount);
   n->hpn_sub = s;
+  n->hpn_ts = 0;
   return n;
 }
 
@@ -3202,6 +3312,7 @@ prop_subscribe_ex(const char *file, int line, int flags, ...)
   s->hps_multiple_origins = 0;
   s->hps_origin = NULL;
   s->hps_zombie = 0;
+  s->hps_prof = NULL;
   s->hps_flags = flags;
   s->hps_trampoline = trampoline;
   s->hps_callback = cb;
@@ -3512,9 +3623,10 @@ prop_init(void)
   TAILQ_INIT(&prop_global_dispatch_dispatching_queue);
 
 
-  prop_pool   = pool_create("prop", sizeof(prop_t), 0);
-  notify_pool = pool_create("notify", sizeof(prop_notify_t), 0);
-  sub_pool    = pool_create("subs", sizeof(prop_sub_t), 0);
+  prop_pool   = pool_create("prop", sizeof(prop_t), POOL_THREAD_CACHE);
+  notify_pool = pool_create("notify", sizeof(prop_notify_t),
+                            POOL_THREAD_CACHE);
+  sub_pool    = pool_create("subs", sizeof(prop_sub_t), POOL_THREAD_CACHE);
   pot_pool    = pool_create("pots", sizeof(prop_originator_tracking_t), 0);
   psd_pool    = pool_create("psds", sizeof(prop_sub_dispatch_t), 0);
 
@@ -3569,7 +3681,9 @@ prop_set_string_exl(prop_t *p, prop_sub_t *skipme, const char *str,
     rstr_release(p->hp_rstring);
   }
 
-  p->hp_rstring = rstr_alloc(str);
+  // Short strings (types, codecs, languages, ...) repeat a lot
+  p->hp_rstring = strlen(str) < PROP_STRING_INTERN_MAXLEN ?
+    rstr_intern(str) : rstr_alloc(str);
   p->hp_type = PROP_RSTRING;
 
   p->hp_rstrtype = type;
@@ -3618,7 +3732,7 @@ prop_set_rstring_exl(prop_t *p, prop_sub_t *skipme, rstr_t *rstr,
     if(prop_clean(p))
       return;
 
-  } else if(!strcmp(rstr_get(p->hp_rstring), rstr_get(rstr))) {
+  } else if(rstr_eq(p->hp_rstring, rstr)) {
     return;
   } else {
     rstr_release(p->hp_rstring);
@@ -5205,7 +5319,6 @@ prop_courier_create(void)
   TAILQ_INIT(&pc->pc_queue_nor);
   TAILQ_INIT(&pc->pc_queue_exp);
   TAILQ_INIT(&pc->pc_dispatch_queue);
-  TAILQ_INIT(&pc->pc_free_queue);
   return pc;
 }
 
@@ -5281,18 +5394,24 @@ int
 prop_courier_wait(prop_courier_t *pc, struct prop_notify_queue *q, int timeout)
 {
   int r = 0;
-  hts_mutex_lock(&prop_mutex);
+
+  prop_courier_collect(pc);
+
   if(TAILQ_FIRST(&pc->pc_queue_exp) == NULL &&
      TAILQ_FIRST(&pc->pc_queue_nor) == NULL) {
-    if(timeout)
-      r = hts_cond_wait_timeout(&pc->pc_cond, &prop_mutex, timeout);
-    else
-      hts_cond_wait(&pc->pc_cond, &prop_mutex);
+    hts_mutex_lock(&prop_mutex);
+    if(courier_inbox_empty(pc)) {
+      if(timeout)
+        r = hts_cond_wait_timeout(&pc->pc_cond, &prop_mutex, timeout);
+      else
+        hts_cond_wait(&pc->pc_cond, &prop_mutex);
+    }
+    hts_mutex_unlock(&prop_mutex);
+    prop_courier_collect(pc);
   }
 
   TAILQ_MOVE(q, &pc->pc_queue_exp, hpn_link);
   TAILQ_MERGE(q, &pc->pc_queue_nor, hpn_link);
-  hts_mutex_unlock(&prop_mutex);
   return r;
 }
 
@@ -5358,6 +5477,9 @@ prop_courier_destroy(prop_courier_t *pc)
   if(pc->pc_has_cond)
     hts_cond_destroy(&pc->pc_cond);
 
+  if(pc->pc_prof != NULL)
+    prop_profile_courier_destroy(pc);
+
   free(pc->pc_name);
 
   free(pc);
@@ -5383,10 +5505,9 @@ void
 prop_courier_poll(prop_courier_t *pc)
 {
   struct prop_notify_queue q;
-  hts_mutex_lock(&prop_mutex);
+  prop_courier_collect(pc);
   TAILQ_MOVE(&q, &pc->pc_queue_exp, hpn_link);
   TAILQ_MERGE(&q, &pc->pc_queue_nor, hpn_link);
-  hts_mutex_unlock(&prop_mutex);
   prop_notify_dispatch(&q, 0);
 }
 
@@ -5400,29 +5521,18 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
   if(maxtime == -1)
     return prop_courier_poll(pc);
 
-  prop_notify_t *n, *next;
-
-  if(!hts_mutex_trylock(&prop_mutex)) {
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
-
-    for(n = TAILQ_FIRST(&pc->pc_free_queue); n != NULL; n = next) {
-      next = TAILQ_NEXT(n, hpn_link);
-
-      prop_sub_ref_dec_locked(n->hpn_sub);
-      pool_put(notify_pool, n);
-    }
-    TAILQ_INIT(&pc->pc_free_queue);
+  prop_notify_t *n;
 
-    hts_mutex_unlock(&prop_mutex);
-  }
+  prop_courier_collect(pc);
+  TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
+  TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
 
   int64_t ts = arch_get_ts();
 
   while((n = TAILQ_FIRST(&pc->pc_dispatch_queue)) != NULL) {
     prop_dispatch_one(n, LOCKMGR_LOCK);
     TAILQ_REMOVE(&pc->pc_dispatch_queue, n, hpn_link);
-    TAILQ_INSERT_TAIL(&pc->pc_free_queue, n, hpn_link);
+    prop_notify_release(n);
     if(arch_get_ts() > ts + maxtime)
       break;
   }
@@ -5435,10 +5545,8 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
 int
 prop_courier_check(prop_courier_t *pc)
 {
-  hts_mutex_lock(&prop_mutex);
-  int r = TAILQ_FIRST(&pc->pc_queue_exp) || TAILQ_FIRST(&pc->pc_queue_nor);
-  hts_mutex_unlock(&prop_mutex);
-  return r;
+  prop_courier_collect(pc);
+  return TAILQ_FIRST(&pc->pc_queue_exp) || TAILQ_FIRST(&pc->pc_queue_nor);
 
 }
 
@@ -21,6 +21,7 @@
 #include <assert.h>
 
 #include "networking/http_server.h"
+#include "htsmsg/htsmsg_json.h"
 #include "prop_i.h"
 #include "misc/str.h"
 
@@ -247,6 +248,36 @@ hc_prop(http_connection_t *hc, const char *remain, void *opaque,
 }
 
 
+/**
+ * /api/prop/profile[?enable=0|1][&reset=1][&limit=N]
+ */
+static int
+hc_prop_profile(http_connection_t *hc, const char *remain, void *opaque,
+                http_cmd_t method)
+{
+  htsbuf_queue_t out;
+  const char *s;
+  int limit = 100;
+
+  if((s = http_arg_get_req(hc, "enable")) != NULL)
+    prop_profile_set(!!atoi(s));
+
+  if((s = http_arg_get_req(hc, "reset")) != NULL && atoi(s))
+    prop_profile_reset();
+
+  if((s = http_arg_get_req(hc, "limit")) != NULL)
+    limit = atoi(s);
+
+  htsmsg_t *m = prop_profile_dump(limit);
+  htsbuf_queue_init(&out, 0);
+  htsmsg_json_serialize(m, &out, 1);
+  htsmsg_release(m);
+
+  return http_send_reply(hc, 0, "application/json; charset=utf-8",
+                         NULL, NULL, 0, &out);
+}
+
+
 #ifdef PROP_DEBUG
 /**
  *
@@ -272,6 +303,7 @@ static void
 prop_http_init(void)
 {
   http_path_add("/api/prop", NULL, hc_prop, 0);
+  http_path_add("/api/prop/profile", NULL, hc_prop_profile, 1);
 #ifdef PROP_DEBUG
   http_path_add("/subtrack", NULL, hc_subtrack, 0);
 #endif
@@ -47,11 +47,19 @@ TAILQ_HEAD(prop_sub_dispatch_queue, prop_sub_dispatch);
  */
 struct prop_courier {
 
+  /**
+   * Inboxes are lock free LIFO lists. Any thread may push to them
+   * (courier_enqueue0) but only the thread consuming the courier
+   * drains them (prop_courier_collect) into the queues below, which
+   * are private to the consumer
+   */
+  struct prop_notify *pc_inbox_nor;
+  struct prop_notify *pc_inbox_exp;
+
   struct prop_notify_queue pc_queue_nor;
   struct prop_notify_queue pc_queue_exp;
 
   struct prop_notify_queue pc_dispatch_queue;
-  struct prop_notify_queue pc_free_queue;
 
   void *pc_entry_lock;
   lockmgr_fn_t *pc_lockmgr;
@@ -72,6 +80,8 @@ struct prop_courier {
 
   int pc_refcount;
   char *pc_name;
+
+  struct prop_prof_courier *pc_prof;
 };
 
 
@@ -81,6 +91,7 @@ struct prop_courier {
  */
 typedef struct prop_notify {
   TAILQ_ENTRY(prop_notify) hpn_link;
+#define hpn_inbox_next hpn_link.tqe_next
   prop_sub_t *hpn_sub;
   prop_event_t hpn_event;
 
@@ -119,11 +130,17 @@ typedef struct prop_notify {
   prop_t *hpn_prop_extra;
   int hpn_flags;
 
+  int64_t hpn_ts;  // Enqueue time if profiled, 0 otherwise
+
 } prop_notify_t;
 
 
 prop_notify_t *prop_get_notify(prop_sub_t *s);
 
+void prop_notify_release(prop_notify_t *n);
+
+void prop_courier_collect(prop_courier_t *pc);
+
 
 
 /**
@@ -543,6 +560,12 @@ struct prop_sub {
   const char *hps_file;
   int hps_line;
 #endif
+
+  /**
+   * Profiling record. Created by the dispatching thread when profiling
+   * is enabled
+   */
+  struct prop_prof_sub *hps_prof;
 };
 
 #ifdef PROP_DEBUG
@@ -599,10 +622,32 @@ void prop_set_string_exl(prop_t *p, prop_sub_t *skipme, const char *str,
 
 void prop_sub_ref_dec_locked(prop_sub_t *s);
 
+void prop_sub_ref_dec(prop_sub_t *s);
+
 int prop_dispatch_one(prop_notify_t *n, int lockmode);
 
 void prop_courier_enqueue(prop_sub_t *s, prop_notify_t *n);
 
 const char *prop_get_DN(prop_t *p, int compact);
 
+/**
+ * Profiling, see prop_profile.c
+ */
+extern int prop_profile_enabled;
+
+void prop_profile_enqueue(prop_sub_t *s, prop_notify_t *n);
+
+void prop_profile_dispatched(prop_sub_t *s, prop_notify_t *n,
+                             int64_t t0, int64_t t1);
+
+void prop_profile_sub_release(prop_sub_t *s);
+
+void prop_profile_courier_destroy(prop_courier_t *pc);
+
+void prop_profile_set(int on);
+
+void prop_profile_reset(void);
+
+struct htsmsg *prop_profile_dump(int limit);
+
 #endif // PROP_I_H__
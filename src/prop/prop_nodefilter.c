@@ -79,6 +79,9 @@ typedef struct nfnode {
   struct nfn_pred_list preds;
 
   struct prop_nf *nf;
+
+  char *searchkey;  // Casefolded strings of node, NULL if not computed
+
   char inserted:1;
   char sortkey_type[MAX_SORT_KEYS];
 
@@ -91,6 +94,7 @@ typedef struct nfnode {
 
   prop_sub_t *sortsub[MAX_SORT_KEYS];
 
+  // SORTKEY_RSTR keys are stored as collation keys, see dictcmp_key()
   union {
     rstr_t *rstr;
     const char *cstr;
@@ -144,7 +148,7 @@ typedef struct prop_nf {
   struct nfnode_queue out_queue;
   struct nfnode_tree out_tree;
 
-  char *filter;
+  char *filter;  // Casefolded
 
   char *sortkey[MAX_SORT_KEYS];
   sortmap_t *sortmap[MAX_SORT_KEYS];
@@ -239,18 +243,39 @@ eval_preds(nfnode_t *nfn)
 /**
  *
  */
-static int
-filterstr(const char *s, const char *q)
+static char *
+casefold_str(const char *str)
 {
-  return !!mystrstr(s, q);
+  char *r = malloc(utf8_casefold(NULL, str) + 1);
+  utf8_casefold(r, str);
+  return r;
 }
 
 
 /**
  *
  */
-static int
-nf_filtercheck(prop_t *p, const char *q)
+static void
+searchkey_add(char **bufp, size_t *lenp, const char *str)
+{
+  if(str == NULL)
+    return;
+
+  size_t len = utf8_casefold(NULL, str);
+  *bufp = realloc(*bufp, *lenp + len + 2);
+  utf8_casefold(*bufp + *lenp, str);
+  *lenp += len;
+  (*bufp)[(*lenp)++] = '\n';
+  (*bufp)[*lenp] = 0;
+}
+
+
+/**
+ * Collect all strings in the tree as a casefolded, newline separated,
+ * string so filtering is a plain strstr()
+ */
+static void
+searchkey_build(prop_t *p, char **bufp, size_t *lenp)
 {
   prop_t *c;
 
@@ -259,23 +284,40 @@ nf_filtercheck(prop_t *p, const char *q)
 
   switch(p->hp_type) {
   case PROP_RSTRING:
-    return filterstr(rstr_get(p->hp_rstring), q);
+    searchkey_add(bufp, lenp, rstr_get(p->hp_rstring));
+    break;
 
   case PROP_CSTRING:
-    return filterstr(p->hp_cstring, q);
+    searchkey_add(bufp, lenp, p->hp_cstring);
+    break;
 
   case PROP_URI:
-    return filterstr(rstr_get(p->hp_uri_title), q);
+    searchkey_add(bufp, lenp, rstr_get(p->hp_uri_title));
+    break;
 
   case PROP_DIR:
     TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(nf_filtercheck(c, q))
-	return 1;
+      searchkey_build(c, bufp, lenp);
     break;
   default:
     break;
   }
-  return 0;
+}
+
+
+/**
+ *
+ */
+static int
+nf_filtercheck(nfnode_t *nfn, const char *q)
+{
+  if(nfn->searchkey == NULL) {
+    size_t len = 0;
+    searchkey_build(nfn->in, &nfn->searchkey, &len);
+    if(nfn->searchkey == NULL)
+      nfn->searchkey = strdup("");
+  }
+  return strstr(nfn->searchkey, q) != NULL;
 }
 
 
@@ -296,7 +338,7 @@ nf_egress_cmp(const nfnode_t *a, const nfnode_t *b)
 
     switch(a->sortkey_type[i]) {
     case SORTKEY_RSTR:
-      r = dictcmp(rstr_get(a->sk[i].rstr), rstr_get(b->sk[i].rstr));
+      r = strcmp(rstr_get(a->sk[i].rstr), rstr_get(b->sk[i].rstr));
       break;
 
     case SORTKEY_CSTR:
@@ -400,7 +442,7 @@ nf_update_egress(prop_nf_t *nf, nfnode_t *nfn)
       en = 0;
 
   // Check filtering
-  if(en && nf->filter != NULL && !nf_filtercheck(nfn->in, nf->filter))
+  if(en && nf->filter != NULL && !nf_filtercheck(nfn, nf->filter))
     en = 0;
 
   if(eval_preds(nfn))
@@ -442,6 +484,10 @@ nf_multi_filter(void *opaque, prop_event_t event, ...)
   nfnode_t *nfn = opaque;
   prop_nf_t *nf = nfn->nf;
 
+  // Something changed in the node, search key must be recomputed
+  free(nfn->searchkey);
+  nfn->searchkey = NULL;
+
   nf_update_egress(nf, nfn);
 }
 
@@ -467,6 +513,10 @@ nf_update_multisub(prop_nf_t *nf, nfnode_t *nfn)
 
     prop_unsubscribe0(nfn->multisub);
     nfn->multisub = NULL;
+
+    // Not tracking changes anymore so key can't be trusted
+    free(nfn->searchkey);
+    nfn->searchkey = NULL;
   }
 }
 
@@ -589,7 +639,9 @@ nf_set_sortkey_x(int x, nfnode_t *nfn, prop_event_t event, va_list ap)
       nfn->sk[x].i = map->val;
       nfn->sortkey_type[x] = SORTKEY_INT;
     } else {
-      nfn->sk[x].rstr = rstr_dup(r);
+      const char *str = rstr_get(r) ?: "";
+      nfn->sk[x].rstr = rstr_allocl(NULL, dictcmp_key(NULL, str));
+      dictcmp_key(rstr_data(nfn->sk[x].rstr), str);
       nfn->sortkey_type[x] = SORTKEY_RSTR;
     }
     break;
@@ -812,6 +864,7 @@ nf_del_node(prop_nf_t *nf, nfnode_t *nfn)
     if(nfn->sortkey_type[i] == SORTKEY_RSTR)
       rstr_release(nfn->sk[i].rstr);
 
+  free(nfn->searchkey);
   free(nfn);
 }
 
@@ -1124,11 +1177,30 @@ nf_set_filter(void *opaque, const char *str)
 {
   prop_nf_t *nf = opaque;
   nfnode_t *nfn;
+  char *filter = NULL;
 
-  if(str != NULL && str[0] == 0)
-    str = NULL;
+  if(str != NULL && str[0] != 0)
+    filter = casefold_str(str);
+
+  if(filter != NULL && nf->filter != NULL && strstr(filter, nf->filter)) {
+    // The query was refined, only nodes that match now may be hidden
+
+    if(!strcmp(filter, nf->filter)) {
+      free(filter);
+      return;
+    }
+
+    free(nf->filter);
+    nf->filter = filter;
+
+    TAILQ_FOREACH(nfn, &nf->in, in_link)
+      if(nfn->out != NULL)
+        nf_update_egress(nf, nfn);
+    return;
+  }
 
-  mystrset(&nf->filter, str);
+  free(nf->filter);
+  nf->filter = filter;
 
   if(nf->filter == NULL && nf->pending_have_more) {
     prop_have_more_childs0(nf->dst,
@@ -44,22 +44,11 @@ int alarm_fired = 0;
 void
 prop_courier_poll_with_alarm(prop_courier_t *pc, int maxtime)
 {
-  prop_notify_t *n, *next;
+  prop_notify_t *n;
 
-  if(!hts_mutex_trylock(&prop_mutex)) {
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
-    TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
-
-    for(n = TAILQ_FIRST(&pc->pc_free_queue); n != NULL; n = next) {
-      next = TAILQ_NEXT(n, hpn_link);
-
-      prop_sub_ref_dec_locked(n->hpn_sub);
-      pool_put(notify_pool, n);
-    }
-    TAILQ_INIT(&pc->pc_free_queue);
-
-    hts_mutex_unlock(&prop_mutex);
-  }
+  prop_courier_collect(pc);
+  TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
+  TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
 
   if(TAILQ_FIRST(&pc->pc_dispatch_queue) == NULL)
     return;
@@ -77,7 +66,7 @@ prop_courier_poll_with_alarm(prop_courier_t *pc, int maxtime)
   while((n = TAILQ_FIRST(&pc->pc_dispatch_queue)) != NULL && !alarm_fired) {
     prop_dispatch_one(n, LOCKMGR_LOCK);
     TAILQ_REMOVE(&pc->pc_dispatch_queue, n, hpn_link);
-    TAILQ_INSERT_TAIL(&pc->pc_free_queue, n, hpn_link);
+    prop_notify_release(n);
   }
 
   it.it_value.tv_usec = 0;
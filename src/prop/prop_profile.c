@@ -0,0 +1,402 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Prop dispatch profiler
+ *
+ * When enabled every notification routed via a courier (or the global
+ * dispatch threads) is stamped when enqueued. On dispatch we account
+ * set-to-dispatch latency and queue depth to the courier and callback
+ * count and time to the subscription.
+ *
+ * Subscriptions marked PROP_SUB_INTERNAL run inline in the producer
+ * and are not accounted here, their cost shows up in the caller.
+ *
+ * When disabled the cost is a test of prop_profile_enabled on enqueue
+ * and a test of hpn_ts on dispatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "prop_i.h"
+#include "htsmsg/htsmsg.h"
+
+LIST_HEAD(prop_prof_sub_list, prop_prof_sub);
+LIST_HEAD(prop_prof_courier_list, prop_prof_courier);
+
+/**
+ *
+ */
+typedef struct prop_prof_courier {
+  LIST_ENTRY(prop_prof_courier) ppc_link;
+  char ppc_name[64];
+  int ppc_alive;
+  int ppc_mark;
+
+  atomic_t ppc_depth;   // Enqueued but not yet dispatched
+  int ppc_depth_max;
+
+  int64_t ppc_dispatched;
+  int64_t ppc_latency_sum;
+  int ppc_latency_max;
+  int64_t ppc_time_sum;
+} prop_prof_courier_t;
+
+
+/**
+ * Only modified by the thread dispatching the subscription
+ */
+typedef struct prop_prof_sub {
+  LIST_ENTRY(prop_prof_sub) pps_link;
+  prop_prof_courier_t *pps_courier;
+  const void *pps_sub;
+  const void *pps_callback;
+#ifdef PROP_SUB_RECORD_SOURCE
+  const char *pps_file;
+  int pps_line;
+#endif
+  int pps_alive;
+
+  int64_t pps_calls;
+  int64_t pps_time;
+  int pps_time_max;
+} prop_prof_sub_t;
+
+
+int prop_profile_enabled;
+
+static int64_t prop_profile_since;
+
+static HTS_MUTEX_DECL(prop_profile_mutex);
+
+static struct prop_prof_sub_list prop_prof_subs;
+static struct prop_prof_courier_list prop_prof_couriers;
+
+static prop_prof_courier_t prop_prof_global = {
+  .ppc_name = "global dispatch",
+  .ppc_alive = 1,
+};
+
+
+/**
+ *
+ */
+static prop_prof_courier_t *
+prop_profile_courier(prop_sub_t *s)
+{
+  if(s->hps_dispatch_mode != PROP_SUB_DISPATCH_MODE_COURIER)
+    return &prop_prof_global;
+
+  prop_courier_t *pc = s->hps_dispatch;
+  return pc->pc_prof;
+}
+
+
+/**
+ * Called with prop_mutex held
+ */
+void
+prop_profile_enqueue(prop_sub_t *s, prop_notify_t *n)
+{
+  prop_prof_courier_t *ppc;
+
+  if(s->hps_dispatch_mode == PROP_SUB_DISPATCH_MODE_COURIER) {
+    prop_courier_t *pc = s->hps_dispatch;
+    if(pc->pc_prof == NULL) {
+      ppc = calloc(1, sizeof(prop_prof_courier_t));
+      if(pc->pc_name != NULL)
+        snprintf(ppc->ppc_name, sizeof(ppc->ppc_name), "%s", pc->pc_name);
+      else
+        snprintf(ppc->ppc_name, sizeof(ppc->ppc_name), "%p", pc);
+      ppc->ppc_alive = 1;
+
+      hts_mutex_lock(&prop_profile_mutex);
+      LIST_INSERT_HEAD(&prop_prof_couriers, ppc, ppc_link);
+      hts_mutex_unlock(&prop_profile_mutex);
+      pc->pc_prof = ppc;
+    }
+    ppc = pc->pc_prof;
+  } else {
+    ppc = &prop_prof_global;
+  }
+
+  int depth = atomic_add_and_fetch(&ppc->ppc_depth, 1);
+  if(depth > ppc->ppc_depth_max)
+    ppc->ppc_depth_max = depth;
+
+  n->hpn_ts = arch_get_ts();
+}
+
+
+/**
+ * t0 == 0 means the notification was dropped (subscription is a zombie)
+ */
+void
+prop_profile_dispatched(prop_sub_t *s, prop_notify_t *n,
+                        int64_t t0, int64_t t1)
+{
+  prop_prof_courier_t *ppc = prop_profile_courier(s);
+  prop_prof_sub_t *pps;
+
+  atomic_dec(&ppc->ppc_depth);
+
+  if(t0 == 0)
+    return;
+
+  const int latency = t0 - n->hpn_ts;
+  const int elapsed = t1 - t0;
+
+  hts_mutex_lock(&prop_profile_mutex);
+
+  ppc->ppc_dispatched++;
+  ppc->ppc_latency_sum += latency;
+  if(latency > ppc->ppc_latency_max)
+    ppc->ppc_latency_max = latency;
+  ppc->ppc_time_sum += elapsed;
+
+  if((pps = s->hps_prof) == NULL) {
+    pps = calloc(1, sizeof(prop_prof_sub_t));
+    pps->pps_courier = ppc;
+    pps->pps_sub = s;
+    pps->pps_callback = s->hps_callback;
+#ifdef PROP_SUB_RECORD_SOURCE
+    pps->pps_file = s->hps_file;
+    pps->pps_line = s->hps_line;
+#endif
+    pps->pps_alive = 1;
+    LIST_INSERT_HEAD(&prop_prof_subs, pps, pps_link);
+    s->hps_prof = pps;
+  }
+
+  hts_mutex_unlock(&prop_profile_mutex);
+
+  pps->pps_calls++;
+  pps->pps_time += elapsed;
+  if(elapsed > pps->pps_time_max)
+    pps->pps_time_max = elapsed;
+}
+
+
+/**
+ *
+ */
+void
+prop_profile_sub_release(prop_sub_t *s)
+{
+  hts_mutex_lock(&prop_profile_mutex);
+  s->hps_prof->pps_alive = 0;
+  s->hps_prof->pps_sub = NULL;
+  s->hps_prof = NULL;
+  hts_mutex_unlock(&prop_profile_mutex);
+}
+
+
+/**
+ *
+ */
+void
+prop_profile_courier_destroy(prop_courier_t *pc)
+{
+  hts_mutex_lock(&prop_profile_mutex);
+  pc->pc_prof->ppc_alive = 0;
+  pc->pc_prof = NULL;
+  hts_mutex_unlock(&prop_profile_mutex);
+}
+
+
+/**
+ *
+ */
+void
+prop_profile_set(int on)
+{
+  if(on == prop_profile_enabled)
+    return;
+
+  if(on)
+    prop_profile_since = arch_get_ts();
+
+  prop_profile_enabled = on;
+  TRACE(TRACE_INFO, "prop", "Profiling %s", on ? "enabled" : "disabled");
+}
+
+
+/**
+ *
+ */
+static void
+prop_profile_courier_clear(prop_prof_courier_t *ppc)
+{
+  ppc->ppc_depth_max = atomic_get(&ppc->ppc_depth);
+  ppc->ppc_dispatched = 0;
+  ppc->ppc_latency_sum = 0;
+  ppc->ppc_latency_max = 0;
+  ppc->ppc_time_sum = 0;
+}
+
+
+/**
+ * Forget records of dead subscriptions and couriers and clear the rest
+ */
+void
+prop_profile_reset(void)
+{
+  prop_prof_sub_t *pps, *pps_next;
+  prop_prof_courier_t *ppc, *ppc_next;
+
+  hts_mutex_lock(&prop_profile_mutex);
+
+  for(pps = LIST_FIRST(&prop_prof_subs); pps != NULL; pps = pps_next) {
+    pps_next = LIST_NEXT(pps, pps_link);
+    if(!pps->pps_alive) {
+      LIST_REMOVE(pps, pps_link);
+      free(pps);
+    } else {
+      pps->pps_calls = 0;
+      pps->pps_time = 0;
+      pps->pps_time_max = 0;
+    }
+  }
+
+  LIST_FOREACH(ppc, &prop_prof_couriers, ppc_link)
+    ppc->ppc_mark = 0;
+
+  LIST_FOREACH(pps, &prop_prof_subs, pps_link)
+    pps->pps_courier->ppc_mark = 1;
+
+  for(ppc = LIST_FIRST(&prop_prof_couriers); ppc != NULL; ppc = ppc_next) {
+    ppc_next = LIST_NEXT(ppc, ppc_link);
+    if(!ppc->ppc_alive && !ppc->ppc_mark) {
+      LIST_REMOVE(ppc, ppc_link);
+      free(ppc);
+    } else {
+      prop_profile_courier_clear(ppc);
+    }
+  }
+
+  prop_profile_courier_clear(&prop_prof_global);
+  prop_profile_since = arch_get_ts();
+
+  hts_mutex_unlock(&prop_profile_mutex);
+}
+
+
+/**
+ *
+ */
+static htsmsg_t *
+prop_profile_dump_courier(const prop_prof_courier_t *ppc)
+{
+  htsmsg_t *m = htsmsg_create_map();
+  htsmsg_add_str(m, "name", ppc->ppc_name);
+  htsmsg_add_u32(m, "alive", ppc->ppc_alive);
+  htsmsg_add_s64(m, "dispatched", ppc->ppc_dispatched);
+  htsmsg_add_s64(m, "depth", atomic_get(&ppc->ppc_depth));
+  htsmsg_add_s64(m, "depthMax", ppc->ppc_depth_max);
+  htsmsg_add_s64(m, "latencyAvg", ppc->ppc_dispatched ?
+                 ppc->ppc_latency_sum / ppc->ppc_dispatched : 0);
+  htsmsg_add_s64(m, "latencyMax", ppc->ppc_latency_max);
+  htsmsg_add_s64(m, "time", ppc->ppc_time_sum);
+  return m;
+}
+
+
+/**
+ *
+ */
+static int
+pps_time_cmp(const void *A, const void *B)
+{
+  const prop_prof_sub_t *a = *(const prop_prof_sub_t **)A;
+  const prop_prof_sub_t *b = *(const prop_prof_sub_t **)B;
+  if(a->pps_time > b->pps_time)
+    return -1;
+  return a->pps_time < b->pps_time;
+}
+
+
+/**
+ * All times are in microseconds. Subscriptions are sorted on total
+ * callback time and at most 'limit' are returned
+ */
+htsmsg_t *
+prop_profile_dump(int limit)
+{
+  prop_prof_sub_t *pps, **vec;
+  prop_prof_courier_t *ppc;
+  int i, cnt = 0;
+  char buf[32];
+
+  htsmsg_t *m = htsmsg_create_map();
+  htsmsg_t *couriers = htsmsg_create_list();
+  htsmsg_t *subs = htsmsg_create_list();
+
+  hts_mutex_lock(&prop_profile_mutex);
+
+  htsmsg_add_u32(m, "enabled", prop_profile_enabled);
+  htsmsg_add_s64(m, "duration", arch_get_ts() - prop_profile_since);
+
+  htsmsg_add_msg(couriers, NULL, prop_profile_dump_courier(&prop_prof_global));
+  LIST_FOREACH(ppc, &prop_prof_couriers, ppc_link)
+    htsmsg_add_msg(couriers, NULL, prop_profile_dump_courier(ppc));
+
+  LIST_FOREACH(pps, &prop_prof_subs, pps_link)
+    cnt++;
+
+  vec = malloc(sizeof(prop_prof_sub_t *) * cnt);
+  i = 0;
+  LIST_FOREACH(pps, &prop_prof_subs, pps_link)
+    vec[i++] = pps;
+
+  qsort(vec, cnt, sizeof(prop_prof_sub_t *), pps_time_cmp);
+
+  for(i = 0; i < cnt && i < limit; i++) {
+    pps = vec[i];
+    htsmsg_t *s = htsmsg_create_map();
+
+    snprintf(buf, sizeof(buf), "%p", pps->pps_callback);
+    htsmsg_add_str(s, "callback", buf);
+    if(pps->pps_sub != NULL) {
+      snprintf(buf, sizeof(buf), "%p", pps->pps_sub);
+      htsmsg_add_str(s, "sub", buf);
+    }
+#ifdef PROP_SUB_RECORD_SOURCE
+    htsmsg_add_str(s, "file", pps->pps_file);
+    htsmsg_add_u32(s, "line", pps->pps_line);
+#endif
+    htsmsg_add_str(s, "courier", pps->pps_courier->ppc_name);
+    htsmsg_add_u32(s, "alive", pps->pps_alive);
+    htsmsg_add_s64(s, "calls", pps->pps_calls);
+    htsmsg_add_s64(s, "time", pps->pps_time);
+    htsmsg_add_s64(s, "timeMax", pps->pps_time_max);
+    htsmsg_add_msg(subs, NULL, s);
+  }
+
+  hts_mutex_unlock(&prop_profile_mutex);
+
+  free(vec);
+
+  htsmsg_add_msg(m, "couriers", couriers);
+  htsmsg_add_msg(m, "subscriptions", subs);
+  return m;
+}
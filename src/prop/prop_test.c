@@ -24,12 +24,13 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <math.h>
-#include <sys/time.h>
 
+#include "main.h"
 #include "arch/atomic.h"
 
 #include "prop.h"
 #include "prop_i.h"
+#include "prop_nodefilter.h"
 
 #ifdef PROP_DEBUG
 
@@ -318,6 +319,172 @@ prop_test2(void)
 
 
 
+/**
+ * Benchmark node filter keystrokes and re-sorts on a large list
+ */
+static void
+prop_test_nodefilter(void)
+{
+  static const char *words[] = {
+    "Alpha", "Bravo", "Charlie", "Delta", "Echo", "Foxtrot", "Golf",
+    "Hotel", "India", "Juliett", "Kilo", "Lima", "Mike", "November"
+  };
+  static const char *keystrokes[] = {
+    "e", "ec", "ech", "echo", "echo ", "echo 1", "echo", "e", NULL
+  };
+  const int num_words = sizeof(words) / sizeof(words[0]);
+  char buf[64];
+  int i;
+  int64_t ts;
+
+#define NF_TEST_NODES 50000
+
+  printf("Running nodefilter benchmark with %d nodes\n", NF_TEST_NODES);
+
+  prop_t *src    = prop_create_root(NULL);
+  prop_t *dst    = prop_create_root(NULL);
+  prop_t *filter = prop_create_root(NULL);
+
+  struct prop_nf *nf = prop_nf_create(dst, src, filter, 0);
+  prop_nf_sort(nf, "node.title", 0, 0, NULL, 0);
+
+  ts = arch_get_ts();
+  for(i = 0; i < NF_TEST_NODES; i++) {
+    prop_t *n = prop_create(src, NULL);
+    snprintf(buf, sizeof(buf), "%s %d %s", words[i % num_words],
+             (i * 7919) % NF_TEST_NODES, words[(i / num_words) % num_words]);
+    prop_set(n, "title", PROP_SET_STRING, buf);
+  }
+  printf("  Insert: %d ms\n", (int)((arch_get_ts() - ts) / 1000));
+
+  for(i = 0; keystrokes[i] != NULL; i++) {
+    ts = arch_get_ts();
+    prop_set_string(filter, keystrokes[i]);
+    printf("  Filter '%s': %d ms\n", keystrokes[i],
+           (int)((arch_get_ts() - ts) / 1000));
+  }
+
+  prop_set_string(filter, NULL);
+
+  for(i = 0; i < 4; i++) {
+    ts = arch_get_ts();
+    prop_nf_sort(nf, "node.title", !(i & 1), 0, NULL, 0);
+    printf("  Sort %s: %d ms\n", i & 1 ? "ascending" : "descending",
+           (int)((arch_get_ts() - ts) / 1000));
+  }
+
+  prop_nf_release(nf);
+  prop_destroy(src);
+  prop_destroy(dst);
+  prop_destroy(filter);
+}
+
+
+/**
+ * Benchmark notification throughput from a few producer threads
+ * to a courier thread
+ */
+#define NB_PRODUCERS 4
+#define NB_PROPS     64
+#define NB_SETS      100000
+#define NB_TIMEOUT   30000000 // Max time to wait for delivery (µs)
+
+static atomic_t notify_bench_count;
+static int64_t notify_bench_start;
+static int64_t notify_bench_latency_sum;
+static int notify_bench_latency_max;
+
+static void
+notify_bench_cb(void *opaque, int value)
+{
+  // Value is the time of prop_set_int() relative to start of test
+  int latency = arch_get_ts() - notify_bench_start - value;
+  notify_bench_latency_sum += latency;
+  if(latency > notify_bench_latency_max)
+    notify_bench_latency_max = latency;
+  atomic_inc(&notify_bench_count);
+}
+
+static void *
+notify_bench_producer(void *aux)
+{
+  prop_t **props = aux;
+  int i;
+
+  for(i = 0; i < NB_SETS; i++)
+    prop_set_int(props[i % NB_PROPS], arch_get_ts() - notify_bench_start);
+  return NULL;
+}
+
+static void
+prop_test_notify(void)
+{
+  prop_t *props[NB_PRODUCERS][NB_PROPS];
+  prop_sub_t *subs[NB_PRODUCERS][NB_PROPS];
+  hts_thread_t tids[NB_PRODUCERS];
+  const int total = NB_PRODUCERS * NB_SETS;
+  int64_t ts, produced;
+  int i, j;
+
+  printf("Running notify benchmark, %d producers, %d notifications\n",
+         NB_PRODUCERS, total);
+
+  prop_t *root = prop_create_root(NULL);
+  prop_courier_t *pc = prop_courier_create_thread(NULL, "notifybench", 0);
+
+  for(i = 0; i < NB_PRODUCERS; i++) {
+    for(j = 0; j < NB_PROPS; j++) {
+      props[i][j] = prop_create(root, NULL);
+      subs[i][j] =
+        prop_subscribe(PROP_SUB_NO_INITIAL_UPDATE,
+                       PROP_TAG_CALLBACK_INT, notify_bench_cb, NULL,
+                       PROP_TAG_ROOT, props[i][j],
+                       PROP_TAG_COURIER, pc,
+                       NULL);
+    }
+  }
+
+  atomic_set(&notify_bench_count, 0);
+  notify_bench_latency_sum = 0;
+  notify_bench_latency_max = 0;
+  ts = notify_bench_start = arch_get_ts();
+
+  for(i = 0; i < NB_PRODUCERS; i++)
+    hts_thread_create_joinable("notifybench", &tids[i],
+                               notify_bench_producer, props[i],
+                               THREAD_PRIO_MODEL);
+  for(i = 0; i < NB_PRODUCERS; i++)
+    hts_thread_join(&tids[i]);
+
+  produced = arch_get_ts() - ts;
+
+  // Every prop_set_int() must be delivered, fail rather than hang
+  const int64_t deadline = arch_get_ts() + NB_TIMEOUT;
+  while(atomic_get(&notify_bench_count) < total &&
+        arch_get_ts() < deadline)
+    usleep(1000);
+
+  if(atomic_get(&notify_bench_count) < total)
+    printf("  Only %d of %d notifications delivered\n",
+           atomic_get(&notify_bench_count), total);
+  assert(atomic_get(&notify_bench_count) == total);
+
+  ts = arch_get_ts() - ts;
+  printf("  Produced in %d ms, delivered in %d ms, %d ns/notification\n",
+         (int)(produced / 1000), (int)(ts / 1000),
+         (int)(ts * 1000 / total));
+  printf("  Latency avg %d us, max %d us\n",
+         (int)(notify_bench_latency_sum / total), notify_bench_latency_max);
+
+  for(i = 0; i < NB_PRODUCERS; i++)
+    for(j = 0; j < NB_PROPS; j++)
+      prop_unsubscribe(subs[i][j]);
+
+  prop_courier_destroy(pc);
+  prop_destroy(root);
+}
+
+
 /**
  *
  */
@@ -326,5 +493,7 @@ prop_test(void)
 {
   prop_test1();
   prop_test2();
+  prop_test_nodefilter();
+  prop_test_notify();
 }
 #endif
@@ -0,0 +1,483 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "arch/atomic.h"
+
+#include "main.h"
+#include "prop_i.h"
+#include "prop_vdir.h"
+#include "task.h"
+#include "misc/minmax.h"
+
+#define VDIR_CHUNK       100  // Rows created per PROP_WANT_MORE_CHILDS
+#define VDIR_FULL_RADIUS 50   // Rows around focus that are fully populated
+#define VDIR_STUB_RADIUS 1000 // Rows around focus that have stub contents
+
+/**
+ * Rows are in one of three states depending on distance from focus:
+ * full, stub or bare (an empty prop that just holds the row's place in
+ * the directory)
+ */
+enum {
+  VDIR_ROW_BARE,
+  VDIR_ROW_STUB,
+  VDIR_ROW_FULL,
+};
+
+/**
+ *
+ */
+struct prop_vdir {
+  atomic_t vd_refcount;
+
+  hts_mutex_t vd_mutex;
+
+  prop_vdir_row_t *vd_row;
+  prop_vdir_release_t *vd_release;
+  void *vd_opaque;
+
+  prop_t *vd_dst;
+  prop_t *vd_entries;
+
+  /*
+   * Protected by vd_mutex
+   */
+  prop_t **vd_rows;
+  unsigned int vd_count;
+  unsigned int vd_created;     // Rows [0, vd_created) exist in dst
+  unsigned int vd_full_start;  // Rows [vd_full_start, vd_full_end) are
+  unsigned int vd_full_end;    // fully populated
+  unsigned int vd_stub_start;  // Rows [vd_stub_start, vd_stub_end) have
+  unsigned int vd_stub_end;    // at least stub contents, always covers
+                               // the full range
+  unsigned int vd_focus;
+
+  /*
+   * Protected by prop_mutex
+   */
+  prop_sub_t *vd_sub;
+  prop_t *vd_selected;
+  int vd_want_more;
+  int vd_task_pending;
+};
+
+
+/**
+ *
+ */
+static void
+vdir_release(prop_vdir_t *vd)
+{
+  if(atomic_dec(&vd->vd_refcount))
+    return;
+
+  for(unsigned int i = 0; i < vd->vd_created; i++)
+    prop_ref_dec(vd->vd_rows[i]);
+  free(vd->vd_rows);
+
+  prop_ref_dec(vd->vd_dst);
+  prop_ref_dec(vd->vd_entries);
+
+  if(vd->vd_release != NULL)
+    vd->vd_release(vd->vd_opaque);
+
+  hts_mutex_destroy(&vd->vd_mutex);
+  free(vd);
+}
+
+
+/**
+ * Final release can't happen in the subscription callback as that runs
+ * with prop_mutex held
+ */
+static void
+vdir_release_task(void *aux)
+{
+  vdir_release(aux);
+}
+
+
+/**
+ *
+ */
+static int
+vdir_row_state(unsigned int i,
+               unsigned int full_start, unsigned int full_end,
+               unsigned int stub_start, unsigned int stub_end)
+{
+  if(i >= full_start && i < full_end)
+    return VDIR_ROW_FULL;
+  if(i >= stub_start && i < stub_end)
+    return VDIR_ROW_STUB;
+  return VDIR_ROW_BARE;
+}
+
+
+/**
+ *
+ */
+static void
+vdir_row_set_state(prop_vdir_t *vd, unsigned int i, int from, int to)
+{
+  if(from == to)
+    return;
+
+  if(to < from)
+    prop_destroy_childs(vd->vd_rows[i]);
+
+  if(to != VDIR_ROW_BARE)
+    vd->vd_row(vd->vd_opaque, vd->vd_rows[i], i,
+               to == VDIR_ROW_FULL ? PROP_VDIR_ROW_FULL : 0);
+}
+
+
+/**
+ * Compute a new [*sp, *ep) covering 'radius' rows on each side of the
+ * focus. The range grows rather than moves (up to four times the
+ * radius) so short back and forth navigation doesn't churn rows.
+ */
+static void
+vdir_window(const prop_vdir_t *vd, unsigned int radius,
+            unsigned int *sp, unsigned int *ep)
+{
+  const unsigned int f = vd->vd_focus;
+  const unsigned int max = radius * 4;
+  unsigned int s = f > radius ? f - radius : 0;
+  unsigned int e = MIN(f + radius, vd->vd_created);
+
+  if(s >= *sp && e <= *ep)
+    return;
+
+  if(*sp != *ep && s <= *ep && e >= *sp) {
+    s = MIN(s, *sp);
+    e = MAX(e, *ep);
+
+    if(e - s > max) {
+      // Trim the side farthest away from focus
+      if(f - s > e - f)
+        s = e - max;
+      else
+        e = s + max;
+    }
+  }
+  *sp = s;
+  *ep = e;
+}
+
+
+/**
+ *
+ */
+static void
+vdir_update(prop_vdir_t *vd)
+{
+  unsigned int fs = vd->vd_full_start, fe = vd->vd_full_end;
+  unsigned int ss = vd->vd_stub_start, se = vd->vd_stub_end;
+  unsigned int i;
+
+  vdir_window(vd, VDIR_FULL_RADIUS, &fs, &fe);
+  vdir_window(vd, VDIR_STUB_RADIUS, &ss, &se);
+
+  // Full range is within the stub range so these two loops cover
+  // every row that may change state
+  for(i = vd->vd_stub_start; i < vd->vd_stub_end; i++)
+    vdir_row_set_state(vd, i,
+                       vdir_row_state(i, vd->vd_full_start, vd->vd_full_end,
+                                      vd->vd_stub_start, vd->vd_stub_end),
+                       vdir_row_state(i, fs, fe, ss, se));
+
+  for(i = ss; i < se; i++)
+    if(i < vd->vd_stub_start || i >= vd->vd_stub_end)
+      vdir_row_set_state(vd, i, VDIR_ROW_BARE,
+                         vdir_row_state(i, fs, fe, ss, se));
+
+  vd->vd_full_start = fs;
+  vd->vd_full_end = fe;
+  vd->vd_stub_start = ss;
+  vd->vd_stub_end = se;
+}
+
+
+/**
+ *
+ */
+static void
+vdir_create_rows(prop_vdir_t *vd, unsigned int end)
+{
+  end = MIN(end, vd->vd_count);
+  if(end <= vd->vd_created)
+    return;
+
+  prop_vec_t *pv = prop_vec_create(end - vd->vd_created);
+
+  for(unsigned int i = vd->vd_created; i < end; i++) {
+    prop_t *p = prop_create_root(NULL);
+    vd->vd_rows[i] = prop_ref_inc(p);
+    pv = prop_vec_append(pv, p);
+  }
+
+  vd->vd_created = end;
+  prop_set_parent_vector(pv, vd->vd_dst, NULL, NULL);
+  prop_vec_release(pv);
+}
+
+
+/**
+ *
+ */
+static int
+vdir_find_row(prop_vdir_t *vd, prop_t *p)
+{
+  // Search outwards from current focus, selection rarely moves far
+  const int f = MIN(vd->vd_focus, vd->vd_created);
+  for(int d = 0; d <= (int)vd->vd_created; d++) {
+    if(f + d < vd->vd_created && vd->vd_rows[f + d] == p)
+      return f + d;
+    if(d > 0 && f - d >= 0 && vd->vd_rows[f - d] == p)
+      return f - d;
+  }
+  return -1;
+}
+
+
+/**
+ *
+ */
+static void
+vdir_task(void *aux)
+{
+  prop_vdir_t *vd = aux;
+
+  while(1) {
+    hts_mutex_lock(&prop_mutex);
+    prop_t *selected = vd->vd_selected;
+    int want_more = vd->vd_want_more;
+    int alive = vd->vd_sub != NULL;
+    vd->vd_selected = NULL;
+    vd->vd_want_more = 0;
+    if(!alive || (selected == NULL && want_more == 0)) {
+      vd->vd_task_pending = 0;
+      hts_mutex_unlock(&prop_mutex);
+      if(selected != NULL)
+        prop_ref_dec(selected);
+      break;
+    }
+    hts_mutex_unlock(&prop_mutex);
+
+    hts_mutex_lock(&vd->vd_mutex);
+
+    if(want_more) {
+      const unsigned int prev = vd->vd_created;
+      vdir_create_rows(vd, vd->vd_created + VDIR_CHUNK * want_more);
+      if(prev > 0)
+        vd->vd_focus = prev - 1;
+      prop_have_more_childs(vd->vd_dst, vd->vd_created < vd->vd_count);
+    }
+
+    if(selected != NULL) {
+      int idx = vdir_find_row(vd, selected);
+      if(idx >= 0)
+        vd->vd_focus = idx;
+      prop_ref_dec(selected);
+    }
+
+    vdir_update(vd);
+    hts_mutex_unlock(&vd->vd_mutex);
+  }
+  vdir_release(vd);
+}
+
+
+/**
+ * Called with prop_mutex held
+ */
+static void
+vdir_schedule(prop_vdir_t *vd)
+{
+  if(vd->vd_task_pending)
+    return;
+  vd->vd_task_pending = 1;
+  atomic_inc(&vd->vd_refcount);
+  task_run(vdir_task, vd);
+}
+
+
+/**
+ *
+ */
+static void
+vdir_dst_cb(void *opaque, prop_event_t event, ...)
+{
+  prop_vdir_t *vd = opaque;
+  prop_t *p;
+  va_list ap;
+  va_start(ap, event);
+
+  switch(event) {
+  case PROP_DESTROYED:
+    if(vd->vd_sub != NULL) {
+      prop_unsubscribe0(vd->vd_sub);
+      vd->vd_sub = NULL;
+      if(vd->vd_selected != NULL) {
+        prop_ref_dec_locked(vd->vd_selected);
+        vd->vd_selected = NULL;
+      }
+      task_run(vdir_release_task, vd);
+    }
+    break;
+
+  case PROP_WANT_MORE_CHILDS:
+    vd->vd_want_more++;
+    vdir_schedule(vd);
+    break;
+
+  case PROP_SELECT_CHILD:
+    p = va_arg(ap, prop_t *);
+    if(p == NULL)
+      break;
+    if(vd->vd_selected != NULL)
+      prop_ref_dec_locked(vd->vd_selected);
+    vd->vd_selected = prop_ref_inc(p);
+    vdir_schedule(vd);
+    break;
+
+  default:
+    break;
+  }
+  va_end(ap);
+}
+
+
+/**
+ *
+ */
+prop_vdir_t *
+prop_vdir_create(prop_t *dst, prop_t *entries, unsigned int count,
+                 prop_vdir_row_t *row, prop_vdir_release_t *release,
+                 void *opaque, int flags)
+{
+  prop_vdir_t *vd = calloc(1, sizeof(prop_vdir_t));
+
+  // One reference for the subscription and one for the creator
+  atomic_set(&vd->vd_refcount,
+             1 + (flags & PROP_VDIR_AUTODESTROY ? 0 : 1));
+  hts_mutex_init(&vd->vd_mutex);
+  vd->vd_row = row;
+  vd->vd_release = release;
+  vd->vd_opaque = opaque;
+  vd->vd_dst = prop_ref_inc(dst);
+  vd->vd_entries = prop_ref_inc(entries);
+  vd->vd_count = count;
+  vd->vd_rows = malloc(sizeof(prop_t *) * MAX(count, 1));
+
+  prop_set_int(entries, count);
+
+  hts_mutex_lock(&vd->vd_mutex);
+  vdir_create_rows(vd, VDIR_CHUNK);
+  vdir_update(vd);
+  prop_have_more_childs(dst, vd->vd_created < vd->vd_count);
+  hts_mutex_unlock(&vd->vd_mutex);
+
+  hts_mutex_lock(&prop_mutex);
+  vd->vd_sub = prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_DONTLOCK |
+                              PROP_SUB_TRACK_DESTROY |
+                              PROP_SUB_NO_INITIAL_UPDATE,
+                              PROP_TAG_CALLBACK, vdir_dst_cb, vd,
+                              PROP_TAG_ROOT, dst,
+                              NULL);
+  hts_mutex_unlock(&prop_mutex);
+  return vd;
+}
+
+
+/**
+ *
+ */
+void
+prop_vdir_set_count(prop_vdir_t *vd, unsigned int count)
+{
+  hts_mutex_lock(&vd->vd_mutex);
+
+  if(count > vd->vd_count) {
+    vd->vd_rows = realloc(vd->vd_rows, sizeof(prop_t *) * count);
+  } else {
+    while(vd->vd_created > count) {
+      prop_t *p = vd->vd_rows[--vd->vd_created];
+      prop_destroy(p);
+      prop_ref_dec(p);
+    }
+    vd->vd_full_start = MIN(vd->vd_full_start, count);
+    vd->vd_full_end   = MIN(vd->vd_full_end, count);
+    vd->vd_stub_start = MIN(vd->vd_stub_start, count);
+    vd->vd_stub_end   = MIN(vd->vd_stub_end, count);
+  }
+  vd->vd_count = count;
+  prop_set_int(vd->vd_entries, count);
+
+  if(vd->vd_created < VDIR_CHUNK)
+    vdir_create_rows(vd, VDIR_CHUNK);
+  vdir_update(vd);
+  prop_have_more_childs(vd->vd_dst, vd->vd_created < vd->vd_count);
+  hts_mutex_unlock(&vd->vd_mutex);
+}
+
+
+/**
+ * Row contents changed, refill it if it exists
+ */
+void
+prop_vdir_invalidate(prop_vdir_t *vd, unsigned int index)
+{
+  hts_mutex_lock(&vd->vd_mutex);
+  if(index < vd->vd_created) {
+    int state = vdir_row_state(index, vd->vd_full_start, vd->vd_full_end,
+                               vd->vd_stub_start, vd->vd_stub_end);
+    vdir_row_set_state(vd, index, state, VDIR_ROW_BARE);
+    vdir_row_set_state(vd, index, VDIR_ROW_BARE, state);
+  }
+  hts_mutex_unlock(&vd->vd_mutex);
+}
+
+
+/**
+ *
+ */
+void
+prop_vdir_destroy(prop_vdir_t *vd)
+{
+  hts_mutex_lock(&prop_mutex);
+  if(vd->vd_sub != NULL) {
+    prop_unsubscribe0(vd->vd_sub);
+    vd->vd_sub = NULL;
+    if(vd->vd_selected != NULL) {
+      prop_ref_dec_locked(vd->vd_selected);
+      vd->vd_selected = NULL;
+    }
+    hts_mutex_unlock(&prop_mutex);
+    vdir_release(vd);
+  } else {
+    hts_mutex_unlock(&prop_mutex);
+  }
+  vdir_release(vd);
+}
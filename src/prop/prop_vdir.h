@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+#include "prop.h"
+
+/**
+ * Virtual directory
+ *
+ * Exposes a list of 'count' rows in 'dst' without building a prop
+ * subtree for each of them up front. Rows are created in chunks as the
+ * consumer asks for more (PROP_WANT_MORE_CHILDS). Only rows close to
+ * the selected one are fully populated (PROP_VDIR_ROW_FULL), rows a bit
+ * further away get stub contents and rows far away are emptied, leaving
+ * just a placeholder prop.
+ *
+ * The row callback is called without any prop locks held, serialized
+ * with the vdir's internal mutex. It should populate 'row' with
+ * whatever is needed to display it (type, url, title, ...) and, when
+ * PROP_VDIR_ROW_FULL is set, everything else.
+ *
+ * 'release' is called once the vdir is gone. With PROP_VDIR_AUTODESTROY
+ * that happens when 'dst' is destroyed and the returned handle must not
+ * be used once that may have happened. Otherwise the creator must call
+ * prop_vdir_destroy().
+ */
+
+typedef struct prop_vdir prop_vdir_t;
+
+#define PROP_VDIR_ROW_FULL 0x1
+
+#define PROP_VDIR_AUTODESTROY 0x1
+
+typedef void (prop_vdir_row_t)(void *opaque, prop_t *row,
+                               unsigned int index, int flags);
+
+typedef void (prop_vdir_release_t)(void *opaque);
+
+prop_vdir_t *prop_vdir_create(prop_t *dst, prop_t *entries,
+                              unsigned int count,
+                              prop_vdir_row_t *row,
+                              prop_vdir_release_t *release,
+                              void *opaque, int flags);
+
+void prop_vdir_set_count(prop_vdir_t *vd, unsigned int count);
+
+void prop_vdir_invalidate(prop_vdir_t *vd, unsigned int index);
+
+void prop_vdir_destroy(prop_vdir_t *vd);
@@ -1568,6 +1568,9 @@ init_dev_settings(void)
   add_dev_bool("Disable HTTP connection reuse",
 	       "nohttpreuse", &gconf.disable_http_reuse);
 
+  add_dev_bool("Disable cache of processed images",
+	       "nopixcache", &gconf.disable_image_pixcache);
+
   add_dev_bool("Enable indexer option",
 	       "enable_indexer", &gconf.enable_indexer);
 
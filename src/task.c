@@ -24,6 +24,7 @@
 
 #include "task.h"
 #include "misc/queue.h"
+#include "misc/evtrace.h"
 
 #define MAX_TASK_THREADS 16
 #define MAX_IDLE_TASK_THREADS 2
@@ -50,6 +51,7 @@ static struct task_queue tasks = TAILQ_HEAD_INITIALIZER(tasks);
 static struct task_group_queue task_groups =TAILQ_HEAD_INITIALIZER(task_groups);
 static unsigned int num_task_threads;
 static unsigned int num_task_threads_avail;
+static int num_tasks_pending;
 static hts_mutex_t task_mutex;
 static hts_cond_t task_cond;
 
@@ -67,6 +69,18 @@ task_group_release(task_group_t *tg)
 }
 
 
+/**
+ *
+ */
+static void
+task_invoke(task_t *t)
+{
+  evtrace_flow_end("task", "queued", t);
+  EVTRACE_SCOPE("task", "run");
+  t->t_fn(t->t_opaque);
+}
+
+
 /**
  *
  */
@@ -93,8 +107,10 @@ task_thread(void *aux)
 
     if(t != NULL) {
       TAILQ_REMOVE(&tasks, t, t_link);
+      num_tasks_pending--;
+      evtrace_counter("task", "pending", num_tasks_pending);
       hts_mutex_unlock(&task_mutex);
-      t->t_fn(t->t_opaque);
+      task_invoke(t);
       free(t);
       hts_mutex_lock(&task_mutex);
       // Released lock, must recheck for task groups
@@ -107,8 +123,10 @@ task_thread(void *aux)
       TAILQ_REMOVE(&task_groups, tg, tg_link);
 
       t = TAILQ_FIRST(&tg->tg_tasks);
+      num_tasks_pending--;
+      evtrace_counter("task", "pending", num_tasks_pending);
       hts_mutex_unlock(&task_mutex);
-      t->t_fn(t->t_opaque);
+      task_invoke(t);
       hts_mutex_lock(&task_mutex);
 
       // Note that we remove _after_ execution because we don't want
@@ -161,8 +179,11 @@ task_run(task_fn_t *fn, void *opaque)
   task_t *t = calloc(1, sizeof(task_t));
   t->t_fn = fn;
   t->t_opaque = opaque;
+  evtrace_flow_start("task", "queued", t);
   hts_mutex_lock(&task_mutex);
   TAILQ_INSERT_TAIL(&tasks, t, t_link);
+  num_tasks_pending++;
+  evtrace_counter("task", "pending", num_tasks_pending);
   task_schedule();
   hts_mutex_unlock(&task_mutex);
 }
@@ -203,11 +224,14 @@ task_run_in_group(task_fn_t *fn, void *opaque, task_group_t *tg)
   t->t_opaque = opaque;
   t->t_group = tg;
   atomic_inc(&tg->tg_refcount);
+  evtrace_flow_start("task", "queued", t);
   hts_mutex_lock(&task_mutex);
   if(TAILQ_FIRST(&tg->tg_tasks) == NULL)
     TAILQ_INSERT_TAIL(&task_groups, tg, tg_link);
 
   TAILQ_INSERT_TAIL(&tg->tg_tasks, t, t_link);
+  num_tasks_pending++;
+  evtrace_counter("task", "pending", num_tasks_pending);
   task_schedule();
   hts_mutex_unlock(&task_mutex);
 }
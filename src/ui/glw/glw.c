@@ -39,6 +39,7 @@
 #include "api/screenshot.h"
 
 #include "fileaccess/fileaccess.h"
+#include "misc/evtrace.h"
 
 static void glw_focus_init_widget(glw_t *w, float weight);
 static void glw_focus_leave(glw_t *w);
@@ -675,6 +676,9 @@ glw_prepare_frame(glw_root_t *gr, int flags)
 {
   glw_t *w;
 
+  evtrace_instant("glw", "frame");
+  EVTRACE_SCOPE("glw", "prepare");
+
   glw_update_size(gr);
 
   gr->gr_frame_start        = arch_get_ts();
@@ -696,6 +700,7 @@ glw_prepare_frame(glw_root_t *gr, int flags)
   gr->gr_frames++;
 
   gr->gr_num_render_jobs = 0;
+  gr->gr_tex_uploads = 0;
   gr->gr_vertex_offset = 0;
   gr->gr_index_offset = 0;
 
@@ -704,8 +709,10 @@ glw_prepare_frame(glw_root_t *gr, int flags)
   prop_set_int(gr->gr_prop_height, gr->gr_height);
   prop_set_float(gr->gr_prop_aspect, (float)gr->gr_width / gr->gr_height);
 
-  if(gr->gr_prop_dispatcher != NULL)
+  if(gr->gr_prop_dispatcher != NULL) {
+    EVTRACE_SCOPE("glw", "props");
     gr->gr_prop_dispatcher(gr->gr_courier, gr->gr_prop_maxtime);
+  }
 
   LIST_FOREACH(w, &gr->gr_every_frame_list, glw_every_frame_link)
     w->glw_class->gc_newframe(w, flags);
@@ -763,7 +770,12 @@ glw_prepare_frame(glw_root_t *gr, int flags)
 void
 glw_post_scene(glw_root_t *gr)
 {
-  glw_renderer_render(gr);
+  evtrace_counter("glw", "render jobs", gr->gr_num_render_jobs);
+  evtrace_counter("glw", "tex uploads", gr->gr_tex_uploads);
+  {
+    EVTRACE_SCOPE("glw", "render");
+    glw_renderer_render(gr);
+  }
 #if CONFIG_GLW_REC
   if(gr->gr_rec != NULL) {
     pixmap_t *pm = gr->gr_br_read_pixels(gr);
@@ -1004,6 +1004,7 @@ typedef struct glw_root {
 #endif
 
   int gr_num_render_jobs;
+  int gr_tex_uploads;  // Statistics, reset in glw_prepare_frame()
   int gr_render_jobs_capacity;
   struct glw_render_job *gr_render_jobs;
   struct glw_render_order *gr_render_order;
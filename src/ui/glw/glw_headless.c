@@ -0,0 +1,628 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Headless GLW frontend
+ *
+ * Renders the UI into an EGL pbuffer. With Mesa's surfaceless platform
+ * (and llvmpipe) this works without an X server or a GPU so the full
+ * GLW pipeline (layout, tessellation, render job sorting, shaders and
+ * texture uploads) can be exercised in CI.
+ *
+ * Without --glw-bench the UI just runs at 60Hz. With it, a script
+ * is replayed as fast as possible and per-section statistics are
+ * printed to stdout, after which we ask the app to shut down.
+ *
+ * Script syntax, one command per line, '#' starts a comment:
+ *
+ *   size <width> <height>   Pbuffer size (global, default 1280x720)
+ *   section <name>          Report stats for the previous section
+ *   frames <count>          Render <count> frames
+ *   action <name>           Inject action (same names as keymaps)
+ *   open <url>              Inject an openurl event
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "main.h"
+#include "glw.h"
+#include "glw_video_common.h"
+#include "event.h"
+#include "navigator.h"
+#include "misc/minmax.h"
+#include "misc/evtrace.h"
+#include "arch/linux/linux.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+#define HEADLESS_CMD_FRAMES  1
+#define HEADLESS_CMD_ACTION  2
+#define HEADLESS_CMD_OPEN    3
+#define HEADLESS_CMD_SECTION 4
+
+/**
+ *
+ */
+typedef struct headless_cmd {
+  TAILQ_ENTRY(headless_cmd) hc_link;
+  int hc_type;
+  int hc_count;
+  char *hc_arg;
+} headless_cmd_t;
+
+TAILQ_HEAD(headless_cmd_queue, headless_cmd);
+
+
+/**
+ * Per frame sample
+ */
+typedef struct headless_frame {
+  int64_t hf_total;
+  int64_t hf_prepare;
+  int64_t hf_layout;   // glw_layout0()
+  int64_t hf_render;   // glw_render0(), collects render jobs
+  int64_t hf_draw;     // glw_post_scene() and glFinish()
+  int hf_render_jobs;
+  int hf_tex_uploads;
+} headless_frame_t;
+
+
+/**
+ *
+ */
+typedef struct glw_headless {
+
+  glw_root_t gr;
+
+  int running;
+  hts_thread_t thread;
+
+  EGLDisplay display;
+  EGLSurface surface;
+  EGLContext context;
+
+  int width;
+  int height;
+
+  int bench;
+  struct headless_cmd_queue cmds;
+
+  char *section;
+  headless_frame_t *frames;
+  int num_frames;
+  int frames_capacity;
+
+} glw_headless_t;
+
+
+/**
+ *
+ */
+static void
+headless_cmd_add(glw_headless_t *gh, int type, int count, const char *arg)
+{
+  headless_cmd_t *hc = calloc(1, sizeof(headless_cmd_t));
+  hc->hc_type = type;
+  hc->hc_count = count;
+  hc->hc_arg = arg ? strdup(arg) : NULL;
+  TAILQ_INSERT_TAIL(&gh->cmds, hc, hc_link);
+}
+
+
+/**
+ *
+ */
+static int
+headless_load_script(glw_headless_t *gh, const char *path)
+{
+  char line[1024];
+  int lineno = 0;
+  FILE *fp = fopen(path, "r");
+
+  if(fp == NULL) {
+    TRACE(TRACE_ERROR, "GLW", "Unable to open benchmark script %s -- %s",
+          path, strerror(errno));
+    return -1;
+  }
+
+  while(fgets(line, sizeof(line), fp) != NULL) {
+    char *argv[3];
+    char *s, *tmp = NULL;
+    int argc = 0;
+    lineno++;
+
+    if((s = strchr(line, '#')) != NULL)
+      *s = 0;
+
+    s = strtok_r(line, " \t\r\n", &tmp);
+    while(s != NULL && argc < 3) {
+      argv[argc++] = s;
+      s = strtok_r(NULL, " \t\r\n", &tmp);
+    }
+
+    if(argc < 1)
+      continue;
+
+    if(!strcmp(argv[0], "size") && argc == 3) {
+      gh->width  = atoi(argv[1]);
+      gh->height = atoi(argv[2]);
+    } else if(!strcmp(argv[0], "frames") && argc == 2) {
+      headless_cmd_add(gh, HEADLESS_CMD_FRAMES, atoi(argv[1]), NULL);
+    } else if(!strcmp(argv[0], "action") && argc == 2) {
+      headless_cmd_add(gh, HEADLESS_CMD_ACTION, 0, argv[1]);
+    } else if(!strcmp(argv[0], "open") && argc == 2) {
+      headless_cmd_add(gh, HEADLESS_CMD_OPEN, 0, argv[1]);
+    } else if(!strcmp(argv[0], "section") && argc == 2) {
+      headless_cmd_add(gh, HEADLESS_CMD_SECTION, 0, argv[1]);
+    } else {
+      TRACE(TRACE_ERROR, "GLW", "%s:%d: Invalid command '%s'",
+            path, lineno, argv[0]);
+      fclose(fp);
+      return -1;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static int
+int64_cmp(const void *A, const void *B)
+{
+  const int64_t *a = A;
+  const int64_t *b = B;
+  return *a < *b ? -1 : *a > *b;
+}
+
+
+/**
+ * Nearest-rank percentile in ms
+ */
+static double
+percentile(const int64_t *sorted, int num, int pct)
+{
+  int idx = (num * pct + 99) / 100 - 1;
+  if(idx < 0)
+    idx = 0;
+  return sorted[idx] / 1000.0;
+}
+
+
+/**
+ *
+ */
+static void
+headless_report(glw_headless_t *gh)
+{
+  const int n = gh->num_frames;
+  int64_t prepare = 0, layout = 0, render = 0, draw = 0;
+  int64_t jobs = 0, uploads = 0;
+  int jobs_max = 0, uploads_max = 0;
+  int i;
+
+  if(n == 0)
+    return;
+
+  int64_t *totals = malloc(sizeof(int64_t) * n);
+
+  for(i = 0; i < n; i++) {
+    const headless_frame_t *hf = &gh->frames[i];
+    totals[i] = hf->hf_total;
+    prepare  += hf->hf_prepare;
+    layout   += hf->hf_layout;
+    render   += hf->hf_render;
+    draw     += hf->hf_draw;
+    jobs     += hf->hf_render_jobs;
+    uploads  += hf->hf_tex_uploads;
+    jobs_max    = MAX(jobs_max,    hf->hf_render_jobs);
+    uploads_max = MAX(uploads_max, hf->hf_tex_uploads);
+  }
+
+  qsort(totals, n, sizeof(int64_t), int64_cmp);
+
+  printf("glw-bench: %s: %d frames\n"
+         "  frame time   p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  max %.2f ms\n"
+         "  phases avg   prepare %.2f ms  layout %.2f ms  render %.2f ms"
+         "  draw %.2f ms\n"
+         "  render jobs  avg %.1f  max %d\n"
+         "  tex uploads  total %"PRId64"  avg %.2f  max %d\n",
+         gh->section ?: "default", n,
+         percentile(totals, n, 50),
+         percentile(totals, n, 90),
+         percentile(totals, n, 99),
+         totals[n - 1] / 1000.0,
+         prepare / 1000.0 / n,
+         layout  / 1000.0 / n,
+         render  / 1000.0 / n,
+         draw    / 1000.0 / n,
+         (double)jobs / n, jobs_max,
+         uploads, (double)uploads / n, uploads_max);
+  fflush(stdout);
+
+  free(totals);
+  gh->num_frames = 0;
+}
+
+
+/**
+ *
+ */
+static int
+headless_egl_init(glw_headless_t *gh)
+{
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+  EGLint major, minor, num_configs;
+  EGLConfig config;
+
+  static const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE,        8,
+    EGL_GREEN_SIZE,      8,
+    EGL_BLUE_SIZE,       8,
+    EGL_ALPHA_SIZE,      8,
+    EGL_DEPTH_SIZE,      16,
+    EGL_NONE
+  };
+
+  const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH,  gh->width,
+    EGL_HEIGHT, gh->height,
+    EGL_NONE
+  };
+
+  // Prefer the surfaceless platform so we never try to talk to X
+  get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+  gh->display = EGL_NO_DISPLAY;
+  if(get_platform_display != NULL)
+    gh->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                       EGL_DEFAULT_DISPLAY, NULL);
+  if(gh->display == EGL_NO_DISPLAY)
+    gh->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  if(!eglInitialize(gh->display, &major, &minor)) {
+    TRACE(TRACE_ERROR, "GLW", "Unable to initialize EGL -- 0x%x",
+          eglGetError());
+    return -1;
+  }
+
+  TRACE(TRACE_DEBUG, "GLW", "EGL %d.%d by %s", major, minor,
+        eglQueryString(gh->display, EGL_VENDOR));
+
+  if(!eglChooseConfig(gh->display, config_attribs, &config, 1,
+                      &num_configs) || num_configs < 1) {
+    TRACE(TRACE_ERROR, "GLW", "No usable EGL pbuffer config");
+    return -1;
+  }
+
+  gh->surface = eglCreatePbufferSurface(gh->display, config, pbuffer_attribs);
+  if(gh->surface == EGL_NO_SURFACE) {
+    TRACE(TRACE_ERROR, "GLW", "Unable to create %d x %d pbuffer -- 0x%x",
+          gh->width, gh->height, eglGetError());
+    return -1;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+  gh->context = eglCreateContext(gh->display, config, EGL_NO_CONTEXT, NULL);
+  if(gh->context == EGL_NO_CONTEXT) {
+    TRACE(TRACE_ERROR, "GLW", "Unable to create OpenGL context -- 0x%x",
+          eglGetError());
+    return -1;
+  }
+
+  eglMakeCurrent(gh->display, gh->surface, gh->surface, gh->context);
+
+  gh->gr.gr_width  = gh->width;
+  gh->gr.gr_height = gh->height;
+
+  if(glw_opengl_init_context(&gh->gr))
+    return -1;
+
+  prop_t *gpu = prop_create(gh->gr.gr_prop_ui, "gpu");
+  prop_set_string(prop_create(gpu, "vendor"),
+                  (const char *)glGetString(GL_VENDOR));
+  prop_set_string(prop_create(gpu, "name"),
+                  (const char *)glGetString(GL_RENDERER));
+  prop_set_string(prop_create(gpu, "driver"),
+                  (const char *)glGetString(GL_VERSION));
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+headless_egl_fini(glw_headless_t *gh)
+{
+  glw_opengl_fini_context(&gh->gr);
+  eglMakeCurrent(gh->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(gh->display, gh->context);
+  eglDestroySurface(gh->display, gh->surface);
+  eglTerminate(gh->display);
+}
+
+
+/**
+ * Render one frame and record a sample if benchmarking
+ */
+static void
+headless_frame(glw_headless_t *gh)
+{
+  glw_root_t *gr = &gh->gr;
+  int64_t t0, t1, t2, t3, t4;
+
+  t0 = arch_get_ts();
+
+  glw_lock(gr);
+
+  gr->gr_screensaver_reset_at = gr->gr_frame_start;
+
+  glw_prepare_frame(gr, 0);
+
+  // When benchmarking, always do a full frame so numbers are
+  // comparable between runs regardless of what is animating
+  if(gh->bench)
+    gr->gr_need_refresh = GLW_REFRESH_FLAG_LAYOUT | GLW_REFRESH_FLAG_RENDER;
+
+  int refresh = gr->gr_need_refresh;
+  gr->gr_need_refresh = 0;
+
+  t1 = arch_get_ts();
+
+  if(refresh) {
+    glw_rctx_t rc;
+    int zmax = 0;
+    glw_rctx_init(&rc, gr->gr_width, gr->gr_height, 1, &zmax);
+
+    {
+      EVTRACE_SCOPE("glw", "layout");
+      glw_layout0(gr->gr_universe, &rc);
+    }
+
+    t2 = arch_get_ts();
+
+    if(refresh & GLW_REFRESH_FLAG_RENDER) {
+      EVTRACE_SCOPE("glw", "render0");
+      glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+      glw_render0(gr->gr_universe, &rc);
+    }
+  } else {
+    t2 = t1;
+  }
+  t3 = arch_get_ts();
+  glw_unlock(gr);
+
+  if(refresh & GLW_REFRESH_FLAG_RENDER) {
+    glw_post_scene(gr);
+    // Make sure the (software) rasterizer has actually finished
+    glFinish();
+  }
+
+  t4 = arch_get_ts();
+
+  if(!gh->bench)
+    return;
+
+  if(gh->num_frames == gh->frames_capacity) {
+    gh->frames_capacity = MAX(256, gh->frames_capacity * 2);
+    gh->frames = realloc(gh->frames,
+                         gh->frames_capacity * sizeof(headless_frame_t));
+  }
+
+  headless_frame_t *hf = &gh->frames[gh->num_frames++];
+  hf->hf_total       = t4 - t0;
+  hf->hf_prepare     = t1 - t0;
+  hf->hf_layout      = t2 - t1;
+  hf->hf_render      = t3 - t2;
+  hf->hf_draw        = t4 - t3;
+  hf->hf_render_jobs = gr->gr_num_render_jobs;
+  hf->hf_tex_uploads = gr->gr_tex_uploads;
+}
+
+
+/**
+ * Execute next script command, return 0 when the script is done
+ */
+static int
+headless_script_step(glw_headless_t *gh)
+{
+  headless_cmd_t *hc = TAILQ_FIRST(&gh->cmds);
+
+  if(hc == NULL)
+    return 0;
+
+  switch(hc->hc_type) {
+  case HEADLESS_CMD_FRAMES:
+    if(hc->hc_count-- > 0) {
+      headless_frame(gh);
+      return 1;
+    }
+    break;
+
+  case HEADLESS_CMD_ACTION:
+    glw_inject_event(&gh->gr, event_create_action_str(hc->hc_arg));
+    break;
+
+  case HEADLESS_CMD_OPEN:
+    glw_inject_event(&gh->gr, event_create_openurl(hc->hc_arg));
+    break;
+
+  case HEADLESS_CMD_SECTION:
+    headless_report(gh);
+    mystrset(&gh->section, hc->hc_arg);
+    break;
+  }
+
+  TAILQ_REMOVE(&gh->cmds, hc, hc_link);
+  free(hc->hc_arg);
+  free(hc);
+  return 1;
+}
+
+
+/**
+ *
+ */
+static void
+headless_mainloop(glw_headless_t *gh)
+{
+  int64_t start = arch_get_ts();
+  int64_t frame = 0;
+
+  while(gh->running) {
+
+    if(gh->bench) {
+      if(headless_script_step(gh))
+        continue;
+
+      headless_report(gh);
+      gh->bench = 0;
+      app_shutdown(0);
+    }
+
+    headless_frame(gh);
+
+    int64_t deadline = ++frame * 1000000LL / 60 + start;
+    int64_t now = arch_get_ts();
+    if(deadline > now)
+      usleep(deadline - now);
+  }
+}
+
+
+/**
+ *
+ */
+static void *
+glw_headless_thread(void *aux)
+{
+  glw_headless_t *gh = aux;
+  glw_root_t *gr = &gh->gr;
+
+  if(headless_egl_init(gh) || glw_init(gr)) {
+    app_shutdown(1);
+    return NULL;
+  }
+
+  glw_lock(gr);
+  glw_load_universe(gr);
+  glw_unlock(gr);
+
+  headless_mainloop(gh);
+
+  glw_video_reset(gr);
+  glFinish();
+  glw_lock(gr);
+  glw_flush(gr);
+  glw_unlock(gr);
+  headless_egl_fini(gh);
+
+  glw_lock(gr);
+  glw_unload_universe(gr);
+  glw_unlock(gr);
+  glw_reap(gr);
+  glw_reap(gr);
+
+  glw_fini(gr);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void *
+glw_headless_start(struct prop *nav)
+{
+  glw_headless_t *gh = calloc(1, sizeof(glw_headless_t));
+
+  TAILQ_INIT(&gh->cmds);
+  gh->width  = 1280;
+  gh->height = 720;
+
+  if(gconf.glw_bench_script != NULL) {
+    if(headless_load_script(gh, gconf.glw_bench_script)) {
+      app_shutdown(1);
+    } else {
+      gh->bench = 1;
+    }
+  }
+
+  gh->gr.gr_prop_ui = prop_create_root("ui");
+  gh->gr.gr_prop_nav = nav ?: nav_spawn();
+  gh->running = 1;
+
+  hts_thread_create_joinable("glw", &gh->thread,
+			     glw_headless_thread, gh, 0);
+
+  return gh;
+}
+
+
+/**
+ *
+ */
+static prop_t *
+glw_headless_stop(void *aux)
+{
+  glw_headless_t *gh = aux;
+  glw_root_t *gr = &gh->gr;
+  prop_t *nav = gr->gr_prop_nav;
+  headless_cmd_t *hc;
+
+  gh->running = 0;
+  hts_thread_join(&gh->thread);
+
+  while((hc = TAILQ_FIRST(&gh->cmds)) != NULL) {
+    TAILQ_REMOVE(&gh->cmds, hc, hc_link);
+    free(hc->hc_arg);
+    free(hc);
+  }
+  free(gh->frames);
+  free(gh->section);
+
+  prop_destroy(gr->gr_prop_ui);
+  glw_release_root(gr); // Frees gh
+  return nav;
+}
+
+
+
+const linux_ui_t ui_glw = {
+  .start = glw_headless_start,
+  .stop  = glw_headless_stop,
+};
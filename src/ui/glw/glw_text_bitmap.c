@@ -155,6 +155,7 @@ glw_text_bitmap_layout(glw_t *w, const glw_rctx_t *rc)
 
   image_component_t *ic = image_find_component(gtb->gtb_image, IMAGE_PIXMAP);
   if(ic != NULL) {
+    gr->gr_tex_uploads++;
     glw_tex_upload(gr, &gtb->gtb_texture, ic->pm, 0);
     gtb->gtb_margin = ic->pm->pm_margin;
     image_clear_component(ic);
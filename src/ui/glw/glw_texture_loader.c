@@ -28,6 +28,7 @@
 
 #include "backend/backend.h"
 #include "fileaccess/fileaccess.h"
+#include "misc/evtrace.h"
 
 #if 0
 /**
@@ -218,6 +219,7 @@ glt_enqueue(glw_root_t *gr, glw_loadable_texture_t *glt, int q)
 {
   glt->glt_refcnt++;
 
+  evtrace_flow_start("glw", "texload", glt);
   glt->glt_q = &gr->gr_tex_load_queue[q];
   TAILQ_INSERT_TAIL(&gr->gr_tex_load_queue[q], glt, glt_work_link);
   glt_set_state(glt, GLT_STATE_QUEUED);
@@ -248,7 +250,10 @@ glt_incremental_update(void *opaque, pixmap_t *pm)
   //  glt->glt_orientation   = img->im_orientation;
   glt->glt_intensity     = pm->pm_intensity;
 
-  glt->glt_size          = glw_tex_backend_load(gr, glt, pm);
+  {
+    EVTRACE_SCOPE("glw", "upload");
+    glt->glt_size          = glw_tex_backend_load(gr, glt, pm);
+  }
   glw_need_refresh(gr, 0);
 
   glw_unlock(gr);
@@ -278,6 +283,7 @@ loader_thread(void *aux)
 
     TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
     glt_set_state(glt, GLT_STATE_LOADING);
+    evtrace_flow_end("glw", "texload", glt);
 
     if(glt->glt_refcnt > 1) {
       rstr_t *url = rstr_dup(glt->glt_url);
@@ -318,10 +324,13 @@ loader_thread(void *aux)
       cancellable_reset(glt->glt_cancellable);
 
       glw_unlock(gr);
-      img = backend_imageloader(url, &im,
-                                errbuf, sizeof(errbuf),
-                                ccptr, glt->glt_cancellable,
-                                glt->glt_backend);
+      {
+        EVTRACE_SCOPE("glw", "imageload");
+        img = backend_imageloader(url, &im,
+                                  errbuf, sizeof(errbuf),
+                                  ccptr, glt->glt_cancellable,
+                                  glt->glt_backend);
+      }
 
       glw_lock(gr);
 
@@ -419,7 +428,10 @@ loader_thread(void *aux)
                     rstr_get(url), pm->pm_width, pm->pm_height);
 
 
-	    glt->glt_size          = glw_tex_backend_load(gr, glt, pm);
+	    {
+	      EVTRACE_SCOPE("glw", "upload");
+	      glt->glt_size          = glw_tex_backend_load(gr, glt, pm);
+	    }
 	    glw_need_refresh(gr, 0);
 	  }
 	}
@@ -685,8 +697,10 @@ gl_tex_req_load(glw_root_t *gr, glw_loadable_texture_t *glt)
 void
 glw_tex_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
 {
-  if(glt->glt_pixmap != NULL)
+  if(glt->glt_pixmap != NULL) {
+    gr->gr_tex_uploads++;
     glw_tex_backend_layout(gr, glt);
+  }
 
   switch(glt->glt_state) {
   case GLT_STATE_INACTIVE:
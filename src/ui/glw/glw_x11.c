@@ -42,6 +42,7 @@
 #include "navigator.h"
 
 #include "glw_settings.h"
+#include "misc/evtrace.h"
 #if ENABLE_VALGRIND
 #include <valgrind/callgrind.h>
 #endif
@@ -1190,9 +1191,13 @@ glw_x11_mainloop(glw_x11_t *gx11)
       int zmax = 0;
       glw_rctx_init(&rc, gr->gr_width, gx11->gr.gr_height, 1, &zmax);
 
-      glw_layout0(gr->gr_universe, &rc);
+      {
+        EVTRACE_SCOPE("glw", "layout");
+        glw_layout0(gr->gr_universe, &rc);
+      }
 
       if(refresh & GLW_REFRESH_FLAG_RENDER) {
+	EVTRACE_SCOPE("glw", "render0");
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 	glw_render0(gr->gr_universe, &rc);
       }
@@ -1210,7 +1215,10 @@ glw_x11_mainloop(glw_x11_t *gx11)
 
 	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &req, NULL);
       }
-      glXSwapBuffers(gx11->display, gx11->win);
+      {
+        EVTRACE_SCOPE("glw", "swap");
+        glXSwapBuffers(gx11->display, gx11->win);
+      }
     } else {
       usleep(16666);
     }
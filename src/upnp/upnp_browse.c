@@ -25,6 +25,7 @@
 #include "event.h"
 #include "playqueue.h"
 #include "misc/str.h"
+#include "misc/minmax.h"
 #include "api/lastfm.h"
 #include "api/soap.h"
 #include "prop/prop_nodefilter.h"
@@ -35,6 +36,52 @@
 #include "metadata/metadata.h"
 #include "navigator.h"
 #include "usage.h"
+#include "task.h"
+
+#define UPNP_PAGE_FIRST      100   // Size of first page
+#define UPNP_PAGE_MIN        100
+#define UPNP_PAGE_MAX        2000
+#define UPNP_PAGE_TARGET     500000 // Aim for this long requests (µs)
+#define UPNP_PAGE_WINDOW     4      // Max concurrent Browse requests
+#define UPNP_PREFETCH_ITEMS  2000   // Fetch this far beyond what's wanted
+
+TAILQ_HEAD(upnp_page_queue, upnp_page);
+
+static hts_mutex_t upnp_page_mutex;
+
+INITIALIZER(upnp_browse_init)
+{
+  hts_mutex_init(&upnp_page_mutex);
+}
+
+/**
+ * A page of Browse results fetched in the background. Pages are
+ * kept in StartingIndex order and delivered to the UI in that order
+ * regardless of when they complete
+ */
+typedef struct upnp_page {
+  TAILQ_ENTRY(upnp_page) up_link;
+
+  int up_start;
+  int up_count;
+
+  int up_done;        // Protected by upnp_page_mutex
+  int up_orphaned;    // Protected by upnp_page_mutex
+
+  char *up_control_url;
+  char *up_base_url;
+  char *up_id;
+  const char *up_sortcriteria;
+  prop_t *up_wakeup;
+
+  htsmsg_t *up_elements;
+  int up_total_matches;
+  int up_number_returned;
+  int64_t up_elapsed;
+  int up_error;
+  char up_errbuf[200];
+} upnp_page_t;
+
 
 /**
  * UPNP browse request
@@ -67,9 +114,18 @@ typedef struct upnp_browse {
 
   prop_sub_t *ub_itemsub;
 
-  int ub_loaded_entries;
+  int ub_loaded_entries;   // Delivered to UI
   int ub_total_entries;
 
+  struct upnp_page_queue ub_pages;
+  int ub_pages_inflight;
+  int ub_next_start;       // StartingIndex of next page to request
+  int ub_horizon;          // Prefetch pages up to this index
+  int ub_page_size;
+  int ub_page_max;         // Lowered if server returns short pages
+
+  prop_t *ub_wakeup;
+
   prop_sub_t *ub_sortsub;
   const char *ub_sortcriteria;
 
@@ -273,31 +329,116 @@ add_container(htsmsg_t *item, prop_t *root, const char *baseurl,
     prop_destroy(c);
 }
 
+/**
+ * Streaming parser for the DIDL-Lite document returned in the Result
+ * argument of a Browse request. Items become props as soon as their
+ * XML has been received
+ */
+typedef struct didl_parser {
+  htsmsg_xml_stream_t *dp_xml;
+  htsmsg_t *dp_collect;    // If set, collect elements here instead
+
+  prop_t *dp_root;
+  const char *dp_trackid;
+  prop_t **dp_trackptr;
+  const char *dp_baseurl;
+  prop_sub_t *dp_skip;
+
+  int dp_got_result;
+  int dp_error;
+  char dp_errbuf[200];
+
+  int dp_total_matches;    // -1 if not returned
+  int dp_number_returned;  // -1 if not returned
+  int dp_elements;         // Items and containers parsed so far
+
+  char dp_num[16];
+  int dp_numlen;
+} didl_parser_t;
+
+static const char *didl_elements[] = {"item", "container", NULL};
+
+
+/**
+ *
+ */
+static void
+didl_element(void *opaque, const char *name, htsmsg_t *element)
+{
+  didl_parser_t *dp = opaque;
+
+  dp->dp_elements++;
+
+  if(dp->dp_collect != NULL)
+    htsmsg_add_msg(dp->dp_collect, name, htsmsg_retain(element));
+  else if(!strcmp(name, "item"))
+    add_item(element, dp->dp_root, dp->dp_trackid, dp->dp_trackptr,
+             dp->dp_skip, dp->dp_baseurl);
+  else if(dp->dp_baseurl != NULL)
+    add_container(element, dp->dp_root, dp->dp_baseurl, dp->dp_skip);
+}
+
+
 /**
  *
  */
 static void
-nodes_from_meta(htsmsg_t *meta, prop_t *root, const char *trackid,
-		prop_t **trackptr, const char *baseurl, prop_sub_t *skip)
+didl_parser_init(didl_parser_t *dp, prop_t *root, const char *trackid,
+                 prop_t **trackptr, const char *baseurl, prop_sub_t *skip)
 {
-  htsmsg_t *items;
-  htsmsg_field_t *f;
+  memset(dp, 0, sizeof(didl_parser_t));
+  dp->dp_root = root;
+  dp->dp_trackid = trackid;
+  dp->dp_trackptr = trackptr;
+  dp->dp_baseurl = baseurl;
+  dp->dp_skip = skip;
+  dp->dp_total_matches = -1;
+  dp->dp_number_returned = -1;
+  dp->dp_xml = htsmsg_xml_stream_create(didl_elements, didl_element, dp);
+}
 
-  items = htsmsg_get_map(meta, "DIDL-Lite");
-  if(items == NULL)
-    return;
 
-  HTSMSG_FOREACH(f, items) {
-    if(!strcmp(f->hmf_name, "item")) {
-      htsmsg_t *item = htsmsg_get_map_by_field(f);
-      if(item != NULL)
-	add_item(item, root, trackid, trackptr, skip, baseurl);
-    } else if(baseurl != NULL && !strcmp(f->hmf_name, "container")) {
-      htsmsg_t *container = htsmsg_get_map_by_field(f);
-      if(container != NULL)
-	add_container(container, root, baseurl, skip);
+/**
+ * SOAP output argument callback
+ */
+static void
+didl_arg(void *opaque, const char *name, const char *data, size_t len)
+{
+  didl_parser_t *dp = opaque;
+
+  if(!strcmp(name, "Result")) {
+
+    if(dp->dp_error)
+      return;
+
+    if(data == NULL) {
+      dp->dp_got_result = 1;
+      if(htsmsg_xml_stream_finish(dp->dp_xml, dp->dp_errbuf,
+                                  sizeof(dp->dp_errbuf)))
+        dp->dp_error = 1;
+
+    } else if(htsmsg_xml_stream_feed(dp->dp_xml, data, len)) {
+      htsmsg_xml_stream_finish(dp->dp_xml, dp->dp_errbuf,
+                               sizeof(dp->dp_errbuf));
+      dp->dp_error = 1;
     }
+    return;
+  }
+
+  if(data != NULL) {
+    len = MIN(len, sizeof(dp->dp_num) - 1 - dp->dp_numlen);
+    memcpy(dp->dp_num + dp->dp_numlen, data, len);
+    dp->dp_numlen += len;
+    return;
   }
+
+  dp->dp_num[dp->dp_numlen] = 0;
+  dp->dp_numlen = 0;
+
+  if(!strcmp(name, "TotalMatches"))
+    dp->dp_total_matches = atoi(dp->dp_num);
+  else if(!strcmp(name, "NumberReturned"))
+    dp->dp_number_returned = atoi(dp->dp_num);
 }
 
 
@@ -309,10 +450,9 @@ upnp_browse_children(const char *uri, const char *id, prop_t *nodes,
 		     const char *trackid, prop_t **trackptr)
 {
   int r;
-  htsmsg_t *in = htsmsg_create_map(), *out;
+  htsmsg_t *in = htsmsg_create_map();
   char errbuf[200];
-  const char *result;
-  htsmsg_t *meta;
+  didl_parser_t dp;
 
   if(trackptr != NULL)
     *trackptr = NULL;
@@ -323,39 +463,31 @@ upnp_browse_children(const char *uri, const char *id, prop_t *nodes,
   htsmsg_add_u32(in, "StartingIndex", 0);
   htsmsg_add_u32(in, "RequestedCount", 0);
   htsmsg_add_str(in, "SortCriteria", "");
-  r = soap_exec(uri, "ContentDirectory", 1, "Browse", in, &out,
-		errbuf, sizeof(errbuf));
+
+  didl_parser_init(&dp, nodes, trackid, trackptr, NULL, NULL);
+
+  r = soap_exec_stream(uri, "ContentDirectory", 1, "Browse", in,
+                       didl_arg, &dp, errbuf, sizeof(errbuf));
   htsmsg_release(in);
+  htsmsg_xml_stream_destroy(dp.dp_xml);
+
   if(r) {
     TRACE(TRACE_ERROR, "UPNP", 
 	  "Browse %s via %s -- %s", id, uri, errbuf);
     return -1;
   }
 
-  if(out == NULL) {
-    TRACE(TRACE_ERROR, "UPNP", 
-	  "Browse %s via %s -- No returned varibles", uri, id);
-    return -1;
-  }
-  
-  if((result = htsmsg_get_str(out, "Result")) == NULL) {
+  if(!dp.dp_got_result) {
     TRACE(TRACE_ERROR, "UPNP", 
 	  "Browse %s via %s -- No returned result", uri, id);
-    htsmsg_release(out);
     return -1;
   }
 
-  meta = htsmsg_xml_deserialize_cstr(result, errbuf, sizeof(errbuf));
-  if(meta == NULL) {
+  if(dp.dp_error) {
     TRACE(TRACE_ERROR, "UPNP", 
-	  "Browse %s via %s -- XML error %s", uri, id, errbuf);
-    htsmsg_release(out);
+	  "Browse %s via %s -- XML error %s", uri, id, dp.dp_errbuf);
     return -1;
   }
-
-  nodes_from_meta(meta, nodes, trackid, trackptr, NULL, NULL);
-  htsmsg_release(meta);
-  htsmsg_release(out);
   return 0;
 }
 
@@ -383,63 +515,299 @@ browse_fail(upnp_browse_t *ub, const char *fmt, ...)
 /**
  *
  */
+static htsmsg_t *
+browse_args(const char *id, int start, int count, const char *sortcriteria)
+{
+  htsmsg_t *in = htsmsg_create_map();
+  htsmsg_add_str(in, "ObjectID", id);
+  htsmsg_add_str(in, "BrowseFlag", "BrowseDirectChildren");
+  htsmsg_add_str(in, "Filter", "*");
+  htsmsg_add_u32(in, "StartingIndex", start);
+  htsmsg_add_u32(in, "RequestedCount", count);
+  htsmsg_add_str(in, "SortCriteria", sortcriteria);
+  return in;
+}
+
+
+/**
+ * Size pages so each request takes roughly UPNP_PAGE_TARGET.
+ * Never let it reach 0, RequestedCount 0 means everything
+ */
+static void
+browse_update_page_size(upnp_browse_t *ub, int items, int64_t elapsed)
+{
+  if(items > 0 && elapsed > 0) {
+    int64_t size = items * UPNP_PAGE_TARGET / elapsed;
+    ub->ub_page_size = MAX(size, UPNP_PAGE_MIN);
+  }
+  ub->ub_page_size = MAX(MIN(ub->ub_page_size, ub->ub_page_max), 1);
+}
+
+
+/**
+ * Fetch first page. This is done synchronously and items are
+ * added while the response is received. It also tells us how many
+ * items there are in total so the rest can be fetched in parallel
+ */
 static void 
 browse_items(upnp_browse_t *ub)
 {
   int r;
-  htsmsg_t *in = htsmsg_create_map(), *out;
   char errbuf[200];
-  const char *result, *str;
-  htsmsg_t *meta;
+  didl_parser_t dp;
+  int64_t ts = arch_get_ts();
+  htsmsg_t *in = browse_args(ub->ub_id, ub->ub_loaded_entries,
+                             UPNP_PAGE_FIRST, ub->ub_sortcriteria);
 
-  htsmsg_add_str(in, "ObjectID", ub->ub_id);
-  htsmsg_add_str(in, "BrowseFlag", "BrowseDirectChildren");
-  htsmsg_add_str(in, "Filter", "*");
-  htsmsg_add_u32(in, "StartingIndex", ub->ub_loaded_entries);
-  htsmsg_add_u32(in, "RequestedCount", 500);
-  htsmsg_add_str(in, "SortCriteria", ub->ub_sortcriteria);
+  didl_parser_init(&dp, ub->ub_items, NULL, NULL,
+                   ub->ub_base_url, ub->ub_itemsub);
 
-  r = soap_exec(ub->ub_control_url, "ContentDirectory", 1, "Browse", in, &out,
-		errbuf, sizeof(errbuf));
+  r = soap_exec_stream(ub->ub_control_url, "ContentDirectory", 1, "Browse",
+                       in, didl_arg, &dp, errbuf, sizeof(errbuf));
   htsmsg_release(in);
+  htsmsg_xml_stream_destroy(dp.dp_xml);
+
+  if(r || !dp.dp_got_result || dp.dp_error) {
+    // Items received before the failure are already in the UI, a retry
+    // must continue after them
+    ub->ub_loaded_entries += dp.dp_elements;
+
+    if(r)
+      return browse_fail(ub, "%s", errbuf);
+    if(!dp.dp_got_result)
+      return browse_fail(ub, "No SOAP result");
+    return browse_fail(ub, "Malformed XML: %s", dp.dp_errbuf);
+  }
 
-  if(r)
-    return browse_fail(ub, "%s", errbuf);
-
-  if(out == NULL)
-    return browse_fail(ub, "Malformed SOAP response, no returned variabled");
-  
-  str = htsmsg_get_str(out, "TotalMatches");
-  if(str != NULL) {
-    ub->ub_total_entries = atoi(str);
+  if(dp.dp_total_matches != -1) {
+    ub->ub_total_entries = dp.dp_total_matches;
   } else {
     ub->ub_run = 0;
   }
 
-  str = htsmsg_get_str(out, "NumberReturned");
-  if(str != NULL) {
-    ub->ub_loaded_entries = atoi(str) + ub->ub_loaded_entries;
+  if(dp.dp_number_returned != -1) {
+    ub->ub_loaded_entries = dp.dp_number_returned + ub->ub_loaded_entries;
   } else {
     ub->ub_run = 0;
   }
 
-  if((result = htsmsg_get_str(out, "Result")) == NULL)
-    return browse_fail(ub, "No SOAP result");
-
-  meta = htsmsg_xml_deserialize_cstr(result, errbuf, sizeof(errbuf));
-  if(meta == NULL)
-    return browse_fail(ub, "Malformed XML: %s", errbuf);
+  if(dp.dp_number_returned > 0 && dp.dp_number_returned < UPNP_PAGE_FIRST &&
+     ub->ub_loaded_entries < ub->ub_total_entries)
+    ub->ub_page_max = dp.dp_number_returned;
 
-  nodes_from_meta(meta, ub->ub_items, NULL, NULL, 
-		  ub->ub_base_url, ub->ub_itemsub);
+  browse_update_page_size(ub, dp.dp_number_returned, arch_get_ts() - ts);
+  ub->ub_next_start = ub->ub_loaded_entries;
+  ub->ub_horizon = ub->ub_loaded_entries + UPNP_PREFETCH_ITEMS;
 
   UPNP_TRACE("Browsed %d of %d items",
 	ub->ub_loaded_entries, ub->ub_total_entries);
 
-  htsmsg_release(meta);
   prop_have_more_childs(ub->ub_items,
                         ub->ub_loaded_entries < ub->ub_total_entries);
-  htsmsg_release(out);
+}
+
+
+/**
+ *
+ */
+static void
+page_free(upnp_page_t *up)
+{
+  free(up->up_control_url);
+  free(up->up_base_url);
+  free(up->up_id);
+  prop_ref_dec(up->up_wakeup);
+  htsmsg_release(up->up_elements);
+  free(up);
+}
+
+
+/**
+ * Runs on a task thread
+ */
+static void
+browse_page_task(void *aux)
+{
+  upnp_page_t *up = aux;
+  didl_parser_t dp;
+  int64_t ts = arch_get_ts();
+  htsmsg_t *in = browse_args(up->up_id, up->up_start, up->up_count,
+                             up->up_sortcriteria);
+
+  didl_parser_init(&dp, NULL, NULL, NULL, up->up_base_url, NULL);
+  dp.dp_collect = up->up_elements = htsmsg_create_map();
+
+  if(soap_exec_stream(up->up_control_url, "ContentDirectory", 1, "Browse",
+                      in, didl_arg, &dp,
+                      up->up_errbuf, sizeof(up->up_errbuf))) {
+    up->up_error = 1;
+  } else if(!dp.dp_got_result) {
+    snprintf(up->up_errbuf, sizeof(up->up_errbuf), "No SOAP result");
+    up->up_error = 1;
+  } else if(dp.dp_error) {
+    snprintf(up->up_errbuf, sizeof(up->up_errbuf),
+             "Malformed XML: %s", dp.dp_errbuf);
+    up->up_error = 1;
+  }
+
+  htsmsg_release(in);
+  htsmsg_xml_stream_destroy(dp.dp_xml);
+
+  up->up_elapsed = arch_get_ts() - ts;
+  up->up_total_matches = dp.dp_total_matches;
+  up->up_number_returned = dp.dp_number_returned;
+
+  hts_mutex_lock(&upnp_page_mutex);
+  if(up->up_orphaned) {
+    hts_mutex_unlock(&upnp_page_mutex);
+    page_free(up);
+    return;
+  }
+  up->up_done = 1;
+  prop_add_int(up->up_wakeup, 1);
+  hts_mutex_unlock(&upnp_page_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+browse_page_issue(upnp_browse_t *ub, int start, int count, int first)
+{
+  upnp_page_t *up = calloc(1, sizeof(upnp_page_t));
+
+  up->up_start = start;
+  up->up_count = count;
+  up->up_control_url = strdup(ub->ub_control_url);
+  up->up_base_url = strdup(ub->ub_base_url);
+  up->up_id = strdup(ub->ub_id);
+  up->up_sortcriteria = ub->ub_sortcriteria;
+  up->up_wakeup = prop_ref_inc(ub->ub_wakeup);
+
+  if(first)
+    TAILQ_INSERT_HEAD(&ub->ub_pages, up, up_link);
+  else
+    TAILQ_INSERT_TAIL(&ub->ub_pages, up, up_link);
+  ub->ub_pages_inflight++;
+
+  UPNP_TRACE("Requesting items %d - %d", start, start + count - 1);
+  task_run(browse_page_task, up);
+}
+
+
+/**
+ * Abandon all outstanding pages
+ */
+static void
+browse_pages_cancel(upnp_browse_t *ub)
+{
+  upnp_page_t *up;
+
+  hts_mutex_lock(&upnp_page_mutex);
+  while((up = TAILQ_FIRST(&ub->ub_pages)) != NULL) {
+    TAILQ_REMOVE(&ub->ub_pages, up, up_link);
+    if(up->up_done)
+      page_free(up);
+    else
+      up->up_orphaned = 1; // Task will free it
+  }
+  hts_mutex_unlock(&upnp_page_mutex);
+  ub->ub_pages_inflight = 0;
+}
+
+
+/**
+ * Keep up to UPNP_PAGE_WINDOW requests in flight, nearest pages first
+ */
+static void
+browse_pages_fill(upnp_browse_t *ub)
+{
+  const int limit = MIN(ub->ub_total_entries, ub->ub_horizon);
+
+  while(ub->ub_pages_inflight < UPNP_PAGE_WINDOW &&
+        ub->ub_next_start < limit) {
+    int count = MIN(ub->ub_page_size,
+                    ub->ub_total_entries - ub->ub_next_start);
+    if(count <= 0)
+      break;
+    browse_page_issue(ub, ub->ub_next_start, count, 0);
+    ub->ub_next_start += count;
+  }
+}
+
+
+/**
+ * Add completed pages to the UI, in order
+ */
+static void
+browse_pages_deliver(upnp_browse_t *ub)
+{
+  upnp_page_t *up;
+  htsmsg_field_t *f;
+  int done, returned, delivered = 0;
+
+  while((up = TAILQ_FIRST(&ub->ub_pages)) != NULL) {
+
+    hts_mutex_lock(&upnp_page_mutex);
+    done = up->up_done;
+    hts_mutex_unlock(&upnp_page_mutex);
+
+    if(!done)
+      break;
+
+    TAILQ_REMOVE(&ub->ub_pages, up, up_link);
+    ub->ub_pages_inflight--;
+
+    if(up->up_error) {
+      browse_fail(ub, "%s", up->up_errbuf);
+      page_free(up);
+      browse_pages_cancel(ub);
+      ub->ub_next_start = ub->ub_total_entries;
+      return;
+    }
+
+    HTSMSG_FOREACH(f, up->up_elements) {
+      if(!strcmp(f->hmf_name, "item"))
+        add_item(f->hmf_childs, ub->ub_items, NULL, NULL,
+                 ub->ub_itemsub, ub->ub_base_url);
+      else
+        add_container(f->hmf_childs, ub->ub_items, ub->ub_base_url,
+                      ub->ub_itemsub);
+    }
+
+    returned = MAX(up->up_number_returned, 0);
+    ub->ub_loaded_entries += returned;
+    delivered = 1;
+
+    if(returned == 0) {
+      // Server has nothing more for us, folder probably shrunk
+      ub->ub_total_entries = ub->ub_loaded_entries;
+      page_free(up);
+      browse_pages_cancel(ub);
+      ub->ub_next_start = ub->ub_loaded_entries;
+      break;
+    }
+
+    if(returned < up->up_count) {
+      // Server caps RequestedCount, fetch the rest of this page first
+      ub->ub_page_max = returned;
+      browse_page_issue(ub, up->up_start + returned,
+                        up->up_count - returned, 1);
+    }
+
+    browse_update_page_size(ub, returned, up->up_elapsed);
+    page_free(up);
+  }
+
+  if(!delivered)
+    return;
+
+  UPNP_TRACE("Browsed %d of %d items, page size %d",
+	ub->ub_loaded_entries, ub->ub_total_entries, ub->ub_page_size);
+
+  prop_have_more_childs(ub->ub_items,
+                        ub->ub_loaded_entries < ub->ub_total_entries);
 }
 
 
@@ -603,7 +971,10 @@ set_sort_order(void *opaque, prop_event_t event, ...)
 		   KVSTORE_SET_STRING, val);
     rstr_release(r);
 
+    browse_pages_cancel(ub);
     ub->ub_loaded_entries = 0;
+    ub->ub_total_entries = 0;
+    ub->ub_next_start = 0;
     ub->ub_load_more = 1;
     prop_destroy_childs(ub->ub_items);
     break;
@@ -672,6 +1043,15 @@ add_sort_option_type(upnp_browse_t *ub, prop_t *model, prop_courier_t *pc)
 
 
 
+/**
+ *
+ */
+static void
+browse_wakeup(void *opaque, int v)
+{
+}
+
+
 /**
  *
  */
@@ -703,8 +1083,22 @@ browse_directory(upnp_browse_t *ub, const char *title)
 				  PROP_TAG_ROOT, ub->ub_items,
 				  PROP_TAG_COURIER, pc,
 				  NULL);
+
+  // Bumped by page tasks when they are done to wake us up
+  TAILQ_INIT(&ub->ub_pages);
+  ub->ub_page_max = UPNP_PAGE_MAX;
+  ub->ub_page_size = UPNP_PAGE_FIRST;
+  ub->ub_wakeup = prop_create_root(NULL);
+  prop_sub_t *wakeupsub =
+    prop_subscribe(PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK_INT, browse_wakeup, ub,
+                   PROP_TAG_ROOT, ub->ub_wakeup,
+                   PROP_TAG_COURIER, pc,
+                   NULL);
+
   // initial browse
   browse_items(ub);
+  browse_pages_fill(ub);
 
   prop_set_int(ub->ub_loading, 0);
   while(ub->ub_run) {
@@ -713,10 +1107,22 @@ browse_directory(upnp_browse_t *ub, const char *title)
     
     if(ub->ub_load_more) {
       ub->ub_load_more = 0;
-      browse_items(ub);
+      // Total is not known until the first page has been received
+      if(ub->ub_total_entries == 0 && TAILQ_FIRST(&ub->ub_pages) == NULL)
+        browse_items(ub);
+      else
+        ub->ub_horizon = MAX(ub->ub_horizon,
+                             ub->ub_loaded_entries + UPNP_PREFETCH_ITEMS);
     }
+
+    browse_pages_deliver(ub);
+    browse_pages_fill(ub);
   }
 
+  browse_pages_cancel(ub);
+
+  prop_unsubscribe(wakeupsub);
+  prop_destroy(ub->ub_wakeup);
   prop_unsubscribe(ub->ub_itemsub);
   prop_unsubscribe(ub->ub_sortsub);
 
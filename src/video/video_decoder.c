@@ -36,6 +36,7 @@
 #include "event.h"
 #include "media/media.h"
 #include "misc/sha.h"
+#include "misc/evtrace.h"
 #include "libav.h"
 
 #include "subtitles/ext_subtitles.h"
@@ -55,6 +56,9 @@ vd_init_timings(video_decoder_t *vd)
     vd->vd_fps_array[i] = PTS_UNSET;
 
   vd->vd_fps_delta = 0;
+
+  vd->vd_zap_armed = 1;
+  vd->vd_zap_start = 0;
 }
 
 
@@ -219,6 +223,8 @@ vd_thread(void *aux)
       continue;
     }
 
+    mq_ring_drain(mp, mq);
+
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *aux  = TAILQ_FIRST(&mq->mq_q_aux);
@@ -386,7 +392,10 @@ vd_thread(void *aux)
                                 mb->mb_skip,
                                 "VDEC");
 
-      mc->decode(mc, vd, mq, mb, reqsize);
+      {
+        EVTRACE_SCOPE("media", "video decode");
+        mc->decode(mc, vd, mq, mb, reqsize);
+      }
       update_vbitrate(mp, mq, mb, vd);
       reqsize = -1;
       break;
@@ -68,6 +68,12 @@ typedef struct video_decoder {
   avgtime_t vd_decode_time;
   avgtime_t vd_upload_time;
 
+  int vd_decoded_frames;
+  int64_t vd_decoded_frames_epoch;
+
+  int64_t vd_zap_start;   // Time of first packet after flush, 0 = idle
+  int vd_zap_armed;       // Set on flush, cleared when first frame is out
+
 
   /* Deinterlacing */
 
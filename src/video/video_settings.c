@@ -67,6 +67,15 @@ video_settings_init(void)
                  NULL);
 #endif
 
+  setting_create(SETTING_MULTIOPT, s, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE(_p("Video decoder threading")),
+                 SETTING_STORE("videoplayback", "decoder_threading"),
+                 SETTING_WRITE_INT(&video_settings.decoder_threading),
+                 SETTING_OPTION("0", _p("Automatic")),
+                 SETTING_OPTION("1", _p("Frame (highest throughput)")),
+                 SETTING_OPTION("2", _p("Slice (lowest latency)")),
+                 NULL);
+
 #if defined(__APPLE__) || defined(__ANDROID__)
   setting_create(SETTING_BOOL, s, SETTINGS_INITIAL_UPDATE,
                  SETTING_TITLE(_p("Hardware accelerated decoding")),
@@ -216,4 +225,21 @@ video_settings_init(void)
                  SETTING_STORE("videoplayback", "videobuffersize"),
                  SETTING_WRITE_INT(&video_settings.video_buffer_size),
                  NULL);
+
+  setting_create(SETTING_INT, s, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE(_p("HLS segments to download ahead")),
+                 SETTING_VALUE(3),
+                 SETTING_RANGE(0, 4),
+                 SETTING_STORE("videoplayback", "hlsprefetch"),
+                 SETTING_WRITE_INT(&video_settings.hls_prefetch_segments),
+                 NULL);
+
+  setting_create(SETTING_INT, s, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE(_p("HLS download ahead memory")),
+                 SETTING_VALUE(16),
+                 SETTING_RANGE(4, 64),
+                 SETTING_UNIT_CSTR("MB"),
+                 SETTING_STORE("videoplayback", "hlsprefetchmem"),
+                 SETTING_WRITE_INT(&video_settings.hls_prefetch_memory),
+                 NULL);
 }
@@ -43,6 +43,12 @@ struct video_settings {
     VIDEO_DPAD_PER_FILE_VOLUME = 1,
   } dpad_up_down_mode;
 
+  enum {
+    VIDEO_THREADING_AUTO  = 0,
+    VIDEO_THREADING_FRAME = 1,
+    VIDEO_THREADING_SLICE = 2,
+  } decoder_threading;
+
   int played_threshold;
   int vdpau_deinterlace;
   int vdpau_deinterlace_resolution_limit;
@@ -53,6 +59,9 @@ struct video_settings {
   int seek_fwd_step;
 
   int video_buffer_size;
+
+  int hls_prefetch_segments;
+  int hls_prefetch_memory;
 };
 
 extern struct video_settings video_settings;